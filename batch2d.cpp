@@ -0,0 +1,253 @@
+#include "game.hpp"
+
+#include <algorithm>
+
+
+bool Batch2D::m_initialized = false;
+GLuint Batch2D::m_vbo_id = empty_id;
+GLuint Batch2D::m_ebo_id = empty_id;
+#ifdef USE_VAO
+    std::optional<Meshes::VAO> Batch2D::m_vao{};
+#endif
+std::optional<Shaders::Program> Batch2D::m_default_shader{};
+std::optional<Textures::Texture2D> Batch2D::m_white_texture{};
+std::vector<Batch2D::Vertex> Batch2D::m_vertices{};
+const Shaders::Program *Batch2D::m_shader = NULL;
+GLuint Batch2D::m_texture_id = empty_id;
+glm::vec2 Batch2D::m_screen_res(0.f);
+
+bool Batch2D::init()
+{
+    assert(!m_initialized);
+    assert(!Utils::checkForGLError());
+
+    const char *batch2d_vs_path = SHADERS_DIR_PATH "batch2d.vs",
+               *tex_rect_fs_path = SHADERS_DIR_PATH "tex-rect.fs";
+
+    const Shaders::Program& shader = m_default_shader.emplace(batch2d_vs_path, tex_rect_fs_path);
+    if (shader.m_id == empty_id)
+    {
+        fprintf(stderr, "Failed to create 2D batch shader program!\n");
+        deinit();
+        return false;
+    }
+
+    // untextured quads (lines) sample this, so they can share the shader with textured ones
+    const Textures::Texture2D& white_texture = m_white_texture.emplace(1, 1, GL_RGBA);
+    if (white_texture.m_id == empty_id)
+    {
+        fprintf(stderr, "Failed to create white texture for 2D batching!\n");
+        deinit();
+        return false;
+    }
+    const GLubyte white_pixel[4] = { 255, 255, 255, 255 };
+    glBindTexture(GL_TEXTURE_2D, white_texture.m_id);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, white_pixel);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLuint buffer_obj[2];
+    glGenBuffers(2, buffer_obj);
+    if (Utils::checkForGLError())
+    {
+        fprintf(stderr, "Failed to generate GL buffers for 2D batching!\n");
+        deinit();
+        return false;
+    }
+    m_vbo_id = buffer_obj[0];
+    m_ebo_id = buffer_obj[1];
+
+    // every quad uses the same index pattern, so the element buffer never changes
+    std::vector<GLushort> indices(max_quads * 6);
+    for (unsigned int i = 0; i < max_quads; ++i)
+    {
+        const GLushort first = static_cast<GLushort>(i * 4);
+        const GLushort quad_indices[6] = { first, static_cast<GLushort>(first + 1), static_cast<GLushort>(first + 2),
+                                           first, static_cast<GLushort>(first + 2), static_cast<GLushort>(first + 3) };
+        std::copy(quad_indices, quad_indices + 6, indices.begin() + i * 6);
+    }
+
+    const size_t vertex_memory = max_quads * 4 * sizeof(Vertex);
+    const size_t element_memory = indices.size() * sizeof(GLushort);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_id);
+    glBufferData(GL_ARRAY_BUFFER, vertex_memory, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo_id);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, element_memory, indices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    Profiling::GpuMemory::track(Profiling::GpuMemory::Category::vertex_buffer, m_vbo_id, vertex_memory);
+    Profiling::GpuMemory::track(Profiling::GpuMemory::Category::vertex_buffer, m_ebo_id, element_memory);
+
+    #ifdef USE_VAO
+        Meshes::VAO& vao = m_vao.emplace();
+        vao.init();
+        if (vao.m_id == empty_id)
+        {
+            fprintf(stderr, "Failed to create VAO for 2D batching!\n");
+            deinit();
+            return false;
+        }
+
+        vao.bind();
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo_id);
+        setupVBOAttributes(); // VBO gets bound inside
+        vao.unbind();
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    #endif
+
+    m_vertices.reserve(max_quads * 4);
+    m_shader = NULL;
+    m_texture_id = empty_id;
+    m_initialized = true;
+    return true;
+}
+
+void Batch2D::deinit()
+{
+    #ifdef USE_VAO
+        m_vao.reset();
+    #endif
+    if (m_vbo_id != empty_id)
+    {
+        Profiling::GpuMemory::release(Profiling::GpuMemory::Category::vertex_buffer, m_vbo_id);
+        Profiling::GpuMemory::release(Profiling::GpuMemory::Category::vertex_buffer, m_ebo_id);
+        glDeleteBuffers(1, &m_vbo_id);
+        glDeleteBuffers(1, &m_ebo_id);
+        m_vbo_id = empty_id;
+        m_ebo_id = empty_id;
+    }
+    m_white_texture.reset();
+    m_default_shader.reset();
+
+    m_vertices.clear();
+    m_shader = NULL;
+    m_initialized = false;
+}
+
+bool Batch2D::isInitialized()
+{
+    return m_initialized;
+}
+
+const Shaders::Program& Batch2D::getDefaultShader()
+{
+    assert(m_initialized);
+    return m_default_shader.value();
+}
+
+void Batch2D::prepare(const Shaders::Program& shader, GLuint texture_id, glm::vec2 screen_res)
+{
+    assert(m_initialized);
+
+    const bool state_changed = m_shader != &shader || m_texture_id != texture_id || m_screen_res != screen_res;
+    if (m_vertices.empty() || state_changed || m_vertices.size() + 4 > m_vertices.capacity())
+    {
+        flush();
+        m_shader = &shader;
+        m_texture_id = texture_id;
+        m_screen_res = screen_res;
+    }
+}
+
+void Batch2D::quad(const glm::vec2 pos[4], const glm::vec2 uv[4], glm::vec2 uv_max, ColorF color)
+{
+    const GLubyte color_bytes[4] = { static_cast<GLubyte>(glm::clamp(color.r, 0.f, 1.f) * 255.f + 0.5f),
+                                     static_cast<GLubyte>(glm::clamp(color.g, 0.f, 1.f) * 255.f + 0.5f),
+                                     static_cast<GLubyte>(glm::clamp(color.b, 0.f, 1.f) * 255.f + 0.5f),
+                                     static_cast<GLubyte>(glm::clamp(color.a, 0.f, 1.f) * 255.f + 0.5f) };
+
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        m_vertices.push_back(Vertex{ { pos[i].x, pos[i].y }, { uv[i].x, uv[i].y }, { uv_max.x, uv_max.y },
+                                     { color_bytes[0], color_bytes[1], color_bytes[2], color_bytes[3] } });
+    }
+}
+
+void Batch2D::rect(const Shaders::Program& shader, const Textures::Texture2D& texture, glm::vec2 screen_res,
+                   glm::vec2 pos, glm::vec2 size, glm::vec2 uv_top_left, glm::vec2 uv_bottom_right,
+                   glm::vec2 uv_max, ColorF color)
+{
+    prepare(shader, texture.m_id, screen_res);
+
+    const glm::vec2 corners[4] = { pos, glm::vec2(pos.x + size.x, pos.y), pos + size, glm::vec2(pos.x, pos.y + size.y) };
+    const glm::vec2 uvs[4] = { uv_top_left, glm::vec2(uv_bottom_right.x, uv_top_left.y),
+                               uv_bottom_right, glm::vec2(uv_top_left.x, uv_bottom_right.y) };
+    quad(corners, uvs, uv_max, color);
+}
+
+void Batch2D::line(glm::vec2 screen_res, glm::vec2 v1, glm::vec2 v2, float thickness, ColorF color)
+{
+    assert(thickness > 0.f);
+
+    const glm::vec2 dir = v2 - v1;
+    const float length = glm::length(dir);
+    if (length <= 0.f) return;
+
+    prepare(m_default_shader.value(), m_white_texture->m_id, screen_res);
+
+    // expanded on the CPU, as core profiles are allowed to ignore glLineWidth above 1
+    const glm::vec2 offset = glm::vec2(-dir.y, dir.x) * (thickness / (2.f * length));
+    const glm::vec2 corners[4] = { v1 + offset, v2 + offset, v2 - offset, v1 - offset };
+    const glm::vec2 uvs[4] = { glm::vec2(0.5f), glm::vec2(0.5f), glm::vec2(0.5f), glm::vec2(0.5f) };
+    quad(corners, uvs, glm::vec2(1.f), color);
+}
+
+void Batch2D::flush()
+{
+    if (m_vertices.empty()) return;
+
+    PROFILE_SCOPE("Batch2D::flush");
+    assert(m_initialized && m_shader != NULL);
+
+    m_shader->use();
+    m_shader->set("screenRes", m_screen_res);
+    m_shader->set("inputTexture", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_texture_id);
+
+    // orphaning keeps earlier flushes of this frame untouched, the storage size never changes
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_id);
+    glBufferData(GL_ARRAY_BUFFER, max_quads * 4 * sizeof(Vertex), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, m_vertices.size() * sizeof(Vertex), m_vertices.data());
+
+    #ifdef USE_VAO
+        m_vao->bind();
+    #else
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo_id);
+        setupVBOAttributes();
+    #endif
+
+    const GLsizei element_count = static_cast<GLsizei>(m_vertices.size() / 4 * 6);
+    glDrawElements(GL_TRIANGLES, element_count, GL_UNSIGNED_SHORT, NULL);
+
+    #ifdef USE_VAO
+        m_vao->unbind();
+    #else
+        disableVBOAttributes();
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    #endif
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    m_vertices.clear();
+}
+
+void Batch2D::setupVBOAttributes()
+{
+    assert(m_vbo_id != empty_id);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_id); // just to make sure the vbo is really bound
+
+    const size_t stride = sizeof(Vertex);
+    Shaders::setupVertexAttribute_float(Shaders::attribute_position_pos, 2, offsetof(Vertex, pos), stride, true);
+    Shaders::setupVertexAttribute_float(Shaders::attribute_position_texcoords, 2, offsetof(Vertex, uv), stride, true);
+    Shaders::setupVertexAttribute_float(Shaders::attribute_position_texcoords_max, 2, offsetof(Vertex, uv_max), stride, true);
+    Shaders::setupVertexAttribute_ubyte(Shaders::attribute_position_color, 4, offsetof(Vertex, color), stride, true);
+}
+
+void Batch2D::disableVBOAttributes()
+{
+    Shaders::disableVertexAttribute(Shaders::attribute_position_pos);
+    Shaders::disableVertexAttribute(Shaders::attribute_position_texcoords);
+    Shaders::disableVertexAttribute(Shaders::attribute_position_texcoords_max);
+    Shaders::disableVertexAttribute(Shaders::attribute_position_color);
+}
@@ -0,0 +1,268 @@
+#include "game.hpp"
+
+#ifdef BUILD_BENCHMARK
+
+#include "glm/trigonometric.hpp" // glm::sin
+#include <algorithm>
+#include <chrono>
+#include <cstring> // strcmp
+
+namespace Bench
+{
+    // scene time is advanced by a fixed step, so every run renders exactly the same frames no matter how fast it is
+    static constexpr double sim_step = 1.0 / 60.0;
+    static constexpr unsigned int warmup_frames_max = 30;
+
+    enum Phase { phase_poll_events = 0, phase_loop_callback, phase_swap_buffers, phase_gpu_finish, phase_amount };
+    static const char *phase_names[phase_amount] = { "poll_events", "loop_callback", "swap_buffers", "gpu_finish" };
+
+    struct FrameSample
+    {
+        double frame_ms;
+        double phase_ms[phase_amount];
+        unsigned int draw_calls, gl_calls;
+        uint64_t triangles;
+    };
+
+    struct Summary { double mean, p50, p90, p95, p99, max; };
+
+    // slow horizontal sweep with a bit of vertical bobbing, relative to the initial camera direction
+    template <typename T>
+    static void applyCameraPath(T& loop, float base_yaw, float base_pitch, double scene_time)
+    {
+        const float t = static_cast<float>(scene_time);
+        loop.camera_yaw = base_yaw + 40.f * glm::sin(t * 2.f * glm::pi<float>() / 8.f);
+        loop.camera_pitch = base_pitch + 12.f * glm::sin(t * 2.f * glm::pi<float>() / 5.f);
+        loop.camera.setTargetFromPitchYaw(loop.camera_pitch, loop.camera_yaw);
+    }
+
+    static Summary summarize(std::vector<double>& values)
+    {
+        Summary result{};
+        if (values.empty()) return result;
+
+        std::sort(values.begin(), values.end());
+
+        double sum = 0.0;
+        for (double val : values) sum += val;
+
+        // nearest-rank percentiles
+        auto percentile = [&values](double p) -> double
+        {
+            size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * values.size()));
+            return values[std::min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+        };
+
+        result.mean = sum / values.size();
+        result.p50 = percentile(50.0);
+        result.p90 = percentile(90.0);
+        result.p95 = percentile(95.0);
+        result.p99 = percentile(99.0);
+        result.max = values.back();
+        return result;
+    }
+
+    static void writeSummary(FILE *file, const char *name, const Summary& summary, bool last)
+    {
+        fprintf(file, "    \"%s\": { \"mean\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }%s\n",
+                name, summary.mean, summary.p50, summary.p90, summary.p95, summary.p99, summary.max, last ? "" : ",");
+    }
+
+    static bool writeJSON(const Settings& settings, const std::vector<FrameSample>& samples, unsigned int warmup_frames,
+                          double total_time_s)
+    {
+        FILE *file = fopen(settings.output_path, "w");
+        if (file == NULL)
+        {
+            fprintf(stderr, "Failed to open benchmark output file '%s'!\n", settings.output_path);
+            return false;
+        }
+
+        std::vector<double> values;
+        values.reserve(samples.size());
+
+        const glm::ivec2 fbo_size = WindowManager::getFBOSize();
+
+        fprintf(file, "{\n");
+        fprintf(file, "  \"version\": \"%s\",\n", VERSION_STRING);
+        fprintf(file, "  \"scene\": \"%s\",\n", settings.scene_name);
+        fprintf(file, "  \"resolution\": [%d, %d],\n", fbo_size.x, fbo_size.y);
+        fprintf(file, "  \"frames\": %zu,\n", samples.size());
+        fprintf(file, "  \"warmup_frames\": %u,\n", warmup_frames);
+        fprintf(file, "  \"total_time_s\": %.4f,\n", total_time_s);
+
+        for (const FrameSample& sample : samples) values.push_back(sample.frame_ms);
+        const Summary frame_summary = summarize(values);
+        fprintf(file, "  \"fps_mean\": %.2f,\n", frame_summary.mean > 0.0 ? 1000.0 / frame_summary.mean : 0.0);
+        fprintf(file, "  \"frame_time_ms\":\n  {\n");
+        writeSummary(file, "all", frame_summary, true);
+        fprintf(file, "  },\n");
+
+        fprintf(file, "  \"cpu_phases_ms\":\n  {\n");
+        for (unsigned int phase = 0; phase < phase_amount; ++phase)
+        {
+            values.clear();
+            for (const FrameSample& sample : samples) values.push_back(sample.phase_ms[phase]);
+            writeSummary(file, phase_names[phase], summarize(values), phase + 1 == phase_amount);
+        }
+        fprintf(file, "  },\n");
+
+        values.clear();
+        for (const FrameSample& sample : samples) values.push_back(sample.draw_calls);
+        const Summary draw_calls_summary = summarize(values);
+        fprintf(file, "  \"draw_calls_per_frame\": { \"mean\": %.2f, \"max\": %.0f },\n", draw_calls_summary.mean, draw_calls_summary.max);
+
+        values.clear();
+        for (const FrameSample& sample : samples) values.push_back(sample.gl_calls);
+        const Summary gl_calls_summary = summarize(values);
+        fprintf(file, "  \"gl_calls_per_frame\": { \"mean\": %.2f, \"max\": %.0f },\n", gl_calls_summary.mean, gl_calls_summary.max);
+
+        values.clear();
+        for (const FrameSample& sample : samples) values.push_back(static_cast<double>(sample.triangles));
+        const Summary triangles_summary = summarize(values);
+        fprintf(file, "  \"triangles_per_frame\": { \"mean\": %.1f, \"max\": %.0f }\n", triangles_summary.mean, triangles_summary.max);
+        fprintf(file, "}\n");
+
+        fclose(file);
+        return true;
+    }
+
+    template <typename T>
+    static int runScene(const Settings& settings)
+    {
+        GLFWwindow *window = WindowManager::getWindow();
+        assert(window != NULL);
+
+        MainLoopStack& main_loop_stack = MainLoopStack::instance;
+        LoopData *loop_data = main_loop_stack.pushFromTemplate<T>();
+        if (loop_data == NULL)
+        {
+            fprintf(stderr, "Failed to create benchmark LoopData! Most likely out of memory.\n");
+            return -1;
+        }
+
+        int init_result = loop_data->init();
+        if (init_result)
+        {
+            fprintf(stderr, "Failed to initialize benchmark Main Loop! Error value: %d\n", init_result);
+            return -2;
+        }
+
+        T& loop = *reinterpret_cast<T*>(loop_data->getData());
+        const float base_yaw = loop.camera_yaw, base_pitch = loop.camera_pitch;
+
+        const unsigned int warmup_frames = std::min(warmup_frames_max, settings.frame_amount / 10);
+        std::vector<FrameSample> samples;
+        samples.reserve(settings.frame_amount);
+
+        // draw calls are counted by the GL call accounting layer, it stays installed if it was requested at launch
+        const bool installed_gl_call_stats = !Profiling::GLCallStats::isInstalled();
+        Profiling::GLCallStats::install();
+
+        using Clock = std::chrono::steady_clock;
+        auto toMs = [](Clock::duration duration) -> double
+        {
+            return std::chrono::duration<double, std::milli>(duration).count();
+        };
+
+        const Clock::time_point bench_start = Clock::now();
+        unsigned int global_ticks = 0;
+        for (unsigned int frame = 0; frame < warmup_frames + settings.frame_amount; ++frame)
+        {
+            // the loop might push other loops (e.g. pause menu), the benchmark only runs the scene loop itself
+            if (main_loop_stack.currentLoopData() != loop_data)
+            {
+                fprintf(stderr, "[WARNING] Benchmark scene left its main loop, stopping early.\n");
+                break;
+            }
+
+            PROFILE_FRAME_MARK();
+            PROFILE_SCOPE("frame");
+
+            FrameSample sample{};
+            RenderCommands::beginFrame();
+            main_loop_stack.beginFrame();
+
+            const Clock::time_point frame_start = Clock::now();
+            glfwPollEvents();
+            const Clock::time_point poll_end = Clock::now();
+
+            const double scene_time = frame * sim_step;
+            applyCameraPath(loop, base_yaw, base_pitch, scene_time);
+            const float frame_delta = main_loop_stack.getFrameDelta(scene_time);
+            main_loop_stack.simulate(*loop_data, scene_time);
+            const LoopRetVal loop_ret_val = loop_data->loopCallback(global_ticks, scene_time, frame_delta);
+            RenderCommands::submit(true); // executed in place, the benchmark never starts the render thread
+            const Clock::time_point loop_end = Clock::now();
+
+            glfwSwapBuffers(window);
+            const Clock::time_point swap_end = Clock::now();
+
+            glFinish(); // makes the frame time include the GPU work as well
+            const Clock::time_point frame_end = Clock::now();
+
+            sample.phase_ms[phase_poll_events] = toMs(poll_end - frame_start);
+            sample.phase_ms[phase_loop_callback] = toMs(loop_end - poll_end);
+            sample.phase_ms[phase_swap_buffers] = toMs(swap_end - loop_end);
+            sample.phase_ms[phase_gpu_finish] = toMs(frame_end - swap_end);
+            sample.frame_ms = toMs(frame_end - frame_start);
+            const Profiling::GLCallStats::FrameCounters& gl_counters = Profiling::GLCallStats::currentFrame();
+            sample.draw_calls = gl_counters.draw_calls;
+            sample.gl_calls = gl_counters.total_calls;
+            sample.triangles = gl_counters.triangles;
+
+            if (frame >= warmup_frames) samples.push_back(sample);
+            Profiling::FrameStats::instance.addFrame(static_cast<float>(sample.frame_ms),
+                                                     static_cast<float>(sample.phase_ms[phase_loop_callback]),
+                                                     Profiling::GpuProfiler::lastFrameMs());
+            main_loop_stack.endFrame(global_ticks);
+
+            ++global_ticks;
+            if (loop_ret_val != LoopRetVal::ok)
+            {
+                fprintf(stderr, "[WARNING] Benchmark scene returned from its main loop, stopping early.\n");
+                break;
+            }
+        }
+        const double total_time_s = std::chrono::duration<double>(Clock::now() - bench_start).count();
+
+        if (installed_gl_call_stats) Profiling::GLCallStats::uninstall();
+
+        printf("Benchmark of scene '%s' finished: %zu frames in %.2f s.\n", settings.scene_name, samples.size(), total_time_s);
+
+        const bool written = writeJSON(settings, samples, warmup_frames, total_time_s);
+        if (written) printf("Benchmark results written into '%s'.\n", settings.output_path);
+        #ifdef ENABLE_ALLOC_TRACKER
+            Profiling::AllocTracker::printReport(stdout);
+        #endif
+
+        while (main_loop_stack.currentLoopData() != NULL) main_loop_stack.pop();
+
+        return written ? 0 : -3;
+    }
+}
+
+int Bench::run(const Bench::Settings& settings)
+{
+    InputRecorder::startSynthetic(); // no input, deterministic target spawns
+
+    // fixed full resolution, otherwise runs on different machines (or the same one) would not render the same work
+    SharedGLContext::RenderSettings& render_settings = SharedGLContext::instance.value().render_settings;
+    const bool used_dynamic_resolution = render_settings.use_dynamic_resolution;
+    render_settings.use_dynamic_resolution = false;
+
+    int result = 0;
+    if (strcmp(settings.scene_name, "game") == 0) result = runScene<GameMainLoop>(settings);
+    else if (strcmp(settings.scene_name, "test") == 0) result = runScene<TestMainLoop>(settings);
+    else
+    {
+        fprintf(stderr, "Unknown benchmark scene '%s'! Available scenes: game, test\n", settings.scene_name);
+        result = -4;
+    }
+
+    render_settings.use_dynamic_resolution = used_dynamic_resolution;
+    InputRecorder::stop();
+    return result;
+}
+
+#endif /* BUILD_BENCHMARK */
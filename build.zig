@@ -7,9 +7,14 @@ const String = [:0]const u8;
 pub const project_name = "shooting_practice";
 pub const version_string = "v0.2";
 
-pub const cpp_files = [_]String{ "collision.cpp", "drawing.cpp", "game.cpp", "lighting.cpp", "loop_data.cpp", "main-game.cpp", "main-menu.cpp",
-                                 "main-test.cpp", "main.cpp", "meshes.cpp", "mouse_manager.cpp", "movement.cpp", "shaders.cpp",
-                                 "shared_gl_context.cpp", "textures.cpp", "ui.cpp", "utils.cpp", "window_manager.cpp" };
+pub const cpp_files = [_]String{ "batch2d.cpp", "bench.cpp", "clustered_lighting.cpp", "collision.cpp", "cpu_profiler.cpp",
+                                 "depth_prepass.cpp", "drawing.cpp", "dynamic_resolution.cpp", "frame_arena.cpp", "frame_pacing.cpp",
+                                 "frame_stats.cpp", "game.cpp", "gl_call_stats.cpp", "gpu_memory.cpp", "gpu_profiler.cpp",
+                                 "input_recorder.cpp", "lighting.cpp", "loop_data.cpp", "main-game.cpp", "main-menu.cpp",
+                                 "main-test.cpp", "main.cpp", "meshes.cpp", "mouse_manager.cpp", "movement.cpp",
+                                 "post_process_chain.cpp", "render_commands.cpp", "render_graph.cpp", "shaders.cpp",
+                                 "shared_gl_context.cpp", "textures.cpp", "transform_batch.cpp", "ui.cpp", "utils.cpp",
+                                 "window_manager.cpp" };
 pub const c_files = [_]String{ "cgltf.c", "glad.c", "nuklear.c", "stb_image.c", "tinyobj_loader_c.c" };
 
 pub const cpp_std_ver = "c++17";
@@ -88,64 +93,86 @@ pub fn build(b: *std.Build) !void {
         },
         else =>
         {
+            // CPU profiler scopes (PROFILE_SCOPE etc.) are compiled out unless enabled, benchmark build always has them
+            const enable_profiler = b.option(bool, "profiler", "compile in the CPU profiler") orelse false;
+            // replaces the global operator new and reports heap allocations made during steady state frames
+            const enable_alloc_tracker = b.option(bool, "alloc_tracker", "report heap allocations in steady state frames") orelse false;
+
             //game executable
-            const exe = b.addExecutable(.{ .name = project_name, .target = target, .optimize = optimize });
-
-            exe.defineCMacro("BUILD_OPENGL_330_CORE", null);
-            exe.defineCMacro("VERSION_STRING", "\"" ++ version_string ++ "\""); // adding quatation marks so that the macro value is a string literal
-
-            exe.addLibraryPath(.{ .src_path = .{ .owner = b, .sub_path = "lib" } });
-            exe.addIncludePath(.{ .src_path = .{ .owner = b, .sub_path = "include" } });
-            exe.linkLibCpp();
-
-            if (glfw_lib_dir_path) |lib_path|
-            {
-                exe.addLibraryPath(.{ .cwd_relative = lib_path });
-            }
-            if (glfw_include_dir_path) |include_path|
-            {
-                exe.addIncludePath(.{ .cwd_relative = include_path });
-            }
-
-            exe.addCSourceFiles(.{ .files = &cpp_files, .flags = &.{ "-std=" ++ cpp_std_ver } });
-            exe.addCSourceFiles(.{ .files = &c_files, .flags = &.{ "-std=" ++ c_std_ver } });
-
-            switch (target.result.os.tag)
-            {
-                .macos => {
-                    exe.linkSystemLibrary("glfw3");
-
-                    exe.linkFramework("Foundation");
-                    exe.linkFramework("Cocoa");
-                    exe.linkFramework("OpenGL");
-                    // exe.linkFramework("CoreAudio");
-                    // exe.linkFramework("CoreVideo");
-                    exe.linkFramework("IOKit");
-                },
-                //TODO correct linux libraries
-                .linux => {
-                    exe.linkSystemLibrary("glfw3"); //TODO check this
-
-                    exe.addLibraryPath(.{ .cwd_relative = "/usr/lib64/" });
-                    exe.linkSystemLibrary("GL");
-                    exe.linkSystemLibrary("rt");
-                    exe.linkSystemLibrary("dl");
-                    exe.linkSystemLibrary("m");
-                    exe.linkSystemLibrary("X11");
-                },
-                else => {
-                    exe.linkSystemLibrary("glfw3");
-
-                    exe.linkSystemLibrary("opengl32");
-                    exe.linkSystemLibrary("gdi32");
-                },
-            }
+            const exe = addDesktopExecutable(b, target, optimize, project_name, false, enable_profiler, enable_alloc_tracker);
 
             const run_cmd = std.Build.addRunArtifact(b, exe);
             var run_step = b.step("run", "run " ++ project_name);
             run_step.dependOn(&run_cmd.step);
 
             b.installArtifact(exe);
+
+            //headless benchmark runner (--bench <scene>), built only with `zig build bench`
+            const bench_exe = addDesktopExecutable(b, target, optimize, project_name ++ "_bench", true, true, enable_alloc_tracker);
+            const bench_install = b.addInstallArtifact(bench_exe, .{});
+            var bench_step = b.step("bench", "build headless benchmark runner " ++ project_name ++ "_bench");
+            bench_step.dependOn(&bench_install.step);
         },
     }
 }
+
+fn addDesktopExecutable(b: *std.Build, target: std.Build.ResolvedTarget, optimize: std.builtin.OptimizeMode,
+                        name: []const u8, benchmark: bool, profiler: bool, alloc_tracker: bool) *std.Build.Step.Compile {
+    const exe = b.addExecutable(.{ .name = name, .target = target, .optimize = optimize });
+
+    exe.defineCMacro("BUILD_OPENGL_330_CORE", null);
+    exe.defineCMacro("VERSION_STRING", "\"" ++ version_string ++ "\""); // adding quatation marks so that the macro value is a string literal
+    if (benchmark) exe.defineCMacro("BUILD_BENCHMARK", null);
+    if (profiler) exe.defineCMacro("ENABLE_PROFILER", null);
+    if (alloc_tracker) exe.defineCMacro("ENABLE_ALLOC_TRACKER", null);
+
+    exe.addLibraryPath(.{ .src_path = .{ .owner = b, .sub_path = "lib" } });
+    exe.addIncludePath(.{ .src_path = .{ .owner = b, .sub_path = "include" } });
+    exe.linkLibCpp();
+
+    if (glfw_lib_dir_path) |lib_path|
+    {
+        exe.addLibraryPath(.{ .cwd_relative = lib_path });
+    }
+    if (glfw_include_dir_path) |include_path|
+    {
+        exe.addIncludePath(.{ .cwd_relative = include_path });
+    }
+
+    exe.addCSourceFiles(.{ .files = &cpp_files, .flags = &.{ "-std=" ++ cpp_std_ver } });
+    exe.addCSourceFiles(.{ .files = &c_files, .flags = &.{ "-std=" ++ c_std_ver } });
+
+    switch (target.result.os.tag)
+    {
+        .macos => {
+            exe.linkSystemLibrary("glfw3");
+
+            exe.linkFramework("Foundation");
+            exe.linkFramework("Cocoa");
+            exe.linkFramework("OpenGL");
+            // exe.linkFramework("CoreAudio");
+            // exe.linkFramework("CoreVideo");
+            exe.linkFramework("IOKit");
+        },
+        //TODO correct linux libraries
+        .linux => {
+            exe.linkSystemLibrary("glfw3"); //TODO check this
+
+            exe.addLibraryPath(.{ .cwd_relative = "/usr/lib64/" });
+            exe.linkSystemLibrary("GL");
+            exe.linkSystemLibrary("rt");
+            exe.linkSystemLibrary("dl");
+            exe.linkSystemLibrary("m");
+            exe.linkSystemLibrary("pthread"); // render thread
+            exe.linkSystemLibrary("X11");
+        },
+        else => {
+            exe.linkSystemLibrary("glfw3");
+
+            exe.linkSystemLibrary("opengl32");
+            exe.linkSystemLibrary("gdi32");
+        },
+    }
+
+    return exe;
+}
@@ -0,0 +1,312 @@
+#include "game.hpp"
+
+#ifdef USE_CLUSTERED_LIGHTING
+
+#include <algorithm>
+#include <cstring> // memset
+
+
+bool ClusteredLighting::m_initialized = false;
+GLuint ClusteredLighting::m_buffer_ids[ClusteredLighting::buffer_amount]{};
+GLuint ClusteredLighting::m_texture_ids[ClusteredLighting::buffer_amount]{};
+float ClusteredLighting::m_bounds_min[3][ClusteredLighting::cluster_amount]{};
+float ClusteredLighting::m_bounds_max[3][ClusteredLighting::cluster_amount]{};
+uint64_t ClusteredLighting::m_light_masks[ClusteredLighting::mask_words][ClusteredLighting::cluster_amount]{};
+glm::mat4 ClusteredLighting::m_bounds_proj(0.f);
+float ClusteredLighting::m_near = 0.f;
+float ClusteredLighting::m_far = 0.f;
+std::vector<glm::vec4> ClusteredLighting::m_light_texels{};
+std::vector<GLuint> ClusteredLighting::m_grid{};
+std::vector<GLushort> ClusteredLighting::m_light_indices{};
+glm::mat4 ClusteredLighting::m_view_proj(1.f);
+unsigned int ClusteredLighting::m_global_amount = 0;
+unsigned int ClusteredLighting::m_light_amount = 0;
+unsigned int ClusteredLighting::m_accepted_amount = 0;
+bool ClusteredLighting::m_overflow_reported = false;
+
+static_assert(ClusteredLighting::max_lights % 64 == 0, "light masks are made of whole 64 bit words");
+static_assert(ClusteredLighting::max_lights <= 65536, "light indices are stored as unsigned shorts");
+
+// capacities of the texture buffers in bytes
+static constexpr size_t buffer_capacities[] = {
+    ClusteredLighting::max_lights * Lighting::Light::packed_texels * sizeof(glm::vec4),
+    ClusteredLighting::cluster_amount * 2 * sizeof(GLuint),
+    ClusteredLighting::max_light_indices * sizeof(GLushort)
+};
+static constexpr GLenum buffer_formats[] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+
+bool ClusteredLighting::init()
+{
+    assert(!m_initialized);
+    assert(!Utils::checkForGLError());
+
+    glGenBuffers(buffer_amount, m_buffer_ids);
+    glGenTextures(buffer_amount, m_texture_ids);
+    if (Utils::checkForGLError())
+    {
+        fprintf(stderr, "Failed to generate GL objects for clustered lighting!\n");
+        deinit();
+        return false;
+    }
+
+    for (unsigned int i = 0; i < buffer_amount; ++i)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, m_buffer_ids[i]);
+        glBufferData(GL_TEXTURE_BUFFER, buffer_capacities[i], NULL, GL_STREAM_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, m_texture_ids[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, buffer_formats[i], m_buffer_ids[i]);
+
+        Profiling::GpuMemory::track(Profiling::GpuMemory::Category::vertex_buffer, m_buffer_ids[i], buffer_capacities[i]);
+    }
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    if (Utils::checkForGLError())
+    {
+        fprintf(stderr, "Failed to create texture buffers for clustered lighting!\n");
+        deinit();
+        return false;
+    }
+
+    m_light_texels.reserve(max_lights * Lighting::Light::packed_texels);
+    m_grid.reserve(cluster_amount * 2);
+    m_light_indices.reserve(max_light_indices);
+
+    m_bounds_proj = glm::mat4(0.f); // forces computing the bounds on the first update
+    m_global_amount = 0;
+    m_light_amount = 0;
+    m_accepted_amount = 0;
+    m_overflow_reported = false;
+    m_initialized = true;
+    return true;
+}
+
+void ClusteredLighting::deinit()
+{
+    for (unsigned int i = 0; i < buffer_amount; ++i)
+    {
+        if (m_buffer_ids[i] != empty_id)
+        {
+            Profiling::GpuMemory::release(Profiling::GpuMemory::Category::vertex_buffer, m_buffer_ids[i]);
+        }
+    }
+    glDeleteTextures(buffer_amount, m_texture_ids);
+    glDeleteBuffers(buffer_amount, m_buffer_ids);
+    std::fill(m_texture_ids, m_texture_ids + buffer_amount, empty_id);
+    std::fill(m_buffer_ids, m_buffer_ids + buffer_amount, empty_id);
+
+    m_light_texels.clear();
+    m_grid.clear();
+    m_light_indices.clear();
+    m_initialized = false;
+}
+
+bool ClusteredLighting::isInitialized()
+{
+    return m_initialized;
+}
+
+void ClusteredLighting::computeBounds(const glm::mat4& proj)
+{
+    // symmetric perspective projection (glm::perspective) is expected, view space depth d maps to ndc x as
+    // proj[0][0] * x / d, the clip planes come out of the depth mapping coefficients
+    assert(proj[2][0] == 0.f && proj[2][1] == 0.f);
+    m_near = proj[3][2] / (proj[2][2] - 1.f);
+    m_far = proj[3][2] / (proj[2][2] + 1.f);
+    assert(m_near > 0.f && m_far > m_near);
+
+    const float inv_scale_x = 1.f / proj[0][0], inv_scale_y = 1.f / proj[1][1];
+    for (unsigned int z = 0; z < grid_z; ++z)
+    {
+        const float depth_near = m_near * std::pow(m_far / m_near, static_cast<float>(z) / grid_z);
+        const float depth_far = m_near * std::pow(m_far / m_near, static_cast<float>(z + 1) / grid_z);
+
+        for (unsigned int y = 0; y < grid_y; ++y)
+        {
+            const float ndc_y0 = -1.f + 2.f * y / grid_y, ndc_y1 = -1.f + 2.f * (y + 1) / grid_y;
+            for (unsigned int x = 0; x < grid_x; ++x)
+            {
+                const float ndc_x0 = -1.f + 2.f * x / grid_x, ndc_x1 = -1.f + 2.f * (x + 1) / grid_x;
+                const unsigned int idx = x + grid_x * (y + grid_y * z);
+
+                // the tile widens with depth, so the extremes lie on either of the slice depths
+                m_bounds_min[0][idx] = std::min(ndc_x0 * depth_near, ndc_x0 * depth_far) * inv_scale_x;
+                m_bounds_max[0][idx] = std::max(ndc_x1 * depth_near, ndc_x1 * depth_far) * inv_scale_x;
+                m_bounds_min[1][idx] = std::min(ndc_y0 * depth_near, ndc_y0 * depth_far) * inv_scale_y;
+                m_bounds_max[1][idx] = std::max(ndc_y1 * depth_near, ndc_y1 * depth_far) * inv_scale_y;
+                m_bounds_min[2][idx] = -depth_far; // view space looks down the negative z axis
+                m_bounds_max[2][idx] = -depth_near;
+            }
+        }
+    }
+
+    m_bounds_proj = proj;
+}
+
+void ClusteredLighting::update(const Drawing::Camera3D& camera, const Lighting::LightRefs& lights)
+{
+    PROFILE_SCOPE("ClusteredLighting::update");
+    assert(m_initialized);
+
+    const glm::mat4& view = camera.getViewMatrix();
+    const glm::mat4& proj = camera.getProjectionMatrix();
+    if (proj != m_bounds_proj) computeBounds(proj);
+    m_view_proj = proj * view;
+
+    // global lights go first in the light buffer, so that light.fs can loop over them without any indirection
+    m_light_texels.clear();
+    m_global_amount = 0;
+    unsigned int dropped_amount = 0;
+    for (const Lighting::Light& light : lights)
+    {
+        glm::vec3 center;
+        float radius = 0.f;
+        if (light.boundingSphere(center, radius)) continue;
+
+        if (m_global_amount >= max_global_lights)
+        {
+            ++dropped_amount;
+            continue;
+        }
+        m_light_texels.resize(m_light_texels.size() + Lighting::Light::packed_texels);
+        light.pack(m_light_texels.data() + m_light_texels.size() - Lighting::Light::packed_texels);
+        ++m_global_amount;
+    }
+
+    std::memset(m_light_masks, 0, sizeof(m_light_masks));
+    const float log_depth_scale = grid_z / std::log(m_far / m_near);
+
+    m_light_amount = m_global_amount;
+    for (const Lighting::Light& light : lights)
+    {
+        glm::vec3 center;
+        float radius = 0.f;
+        if (!light.boundingSphere(center, radius)) continue;
+        if (radius <= 0.f) continue; // never bright enough to be seen
+
+        if (m_light_amount >= max_lights)
+        {
+            ++dropped_amount;
+            continue;
+        }
+
+        const glm::vec3 view_center = glm::vec3(view * glm::vec4(center, 1.f));
+        const float depth_min = -view_center.z - radius, depth_max = -view_center.z + radius;
+        if (depth_max < m_near || depth_min > m_far) continue; // whole light in front of or behind the frustum
+
+        // only the depth slices the sphere spans get tested, their clusters are stored next to each other
+        auto depthSlice = [near_plane = m_near, log_depth_scale](float depth) -> unsigned int
+        {
+            const float slice = std::floor(std::log(std::max(depth, near_plane) / near_plane) * log_depth_scale);
+            return static_cast<unsigned int>(std::clamp(slice, 0.f, static_cast<float>(grid_z - 1)));
+        };
+        const unsigned int first = depthSlice(depth_min) * grid_x * grid_y;
+        const unsigned int last = (depthSlice(depth_max) + 1) * grid_x * grid_y;
+
+        const unsigned int light_idx = m_light_amount;
+        uint64_t *masks = m_light_masks[(light_idx - m_global_amount) / 64];
+        const unsigned int bit = (light_idx - m_global_amount) % 64;
+        const float radius_sq = radius * radius;
+        const float *min_x = m_bounds_min[0], *min_y = m_bounds_min[1], *min_z = m_bounds_min[2];
+        const float *max_x = m_bounds_max[0], *max_y = m_bounds_max[1], *max_z = m_bounds_max[2];
+
+        // sphere against cluster box, branchless so the compiler processes several clusters per instruction
+        for (unsigned int c = first; c < last; ++c)
+        {
+            const float dx = std::max(std::max(min_x[c] - view_center.x, view_center.x - max_x[c]), 0.f);
+            const float dy = std::max(std::max(min_y[c] - view_center.y, view_center.y - max_y[c]), 0.f);
+            const float dz = std::max(std::max(min_z[c] - view_center.z, view_center.z - max_z[c]), 0.f);
+            masks[c] |= static_cast<uint64_t>(dx * dx + dy * dy + dz * dz <= radius_sq) << bit;
+        }
+
+        m_light_texels.resize(m_light_texels.size() + Lighting::Light::packed_texels);
+        light.pack(m_light_texels.data() + m_light_texels.size() - Lighting::Light::packed_texels);
+        ++m_light_amount;
+    }
+
+    // masks into per cluster index lists, indices point into the light buffer (past the global lights)
+    m_grid.clear();
+    m_light_indices.clear();
+    const unsigned int used_words = (m_light_amount - m_global_amount + 63) / 64;
+    bool indices_overflow = false;
+    for (unsigned int c = 0; c < cluster_amount; ++c)
+    {
+        const size_t offset = m_light_indices.size();
+        for (unsigned int word = 0; word < used_words; ++word)
+        {
+            uint64_t mask = m_light_masks[word][c];
+            for (unsigned int bit = 0; mask != 0; ++bit, mask >>= 1)
+            {
+                if ((mask & 1) == 0) continue;
+                if (m_light_indices.size() >= max_light_indices)
+                {
+                    indices_overflow = true;
+                    break;
+                }
+                m_light_indices.push_back(static_cast<GLushort>(m_global_amount + word * 64 + bit));
+            }
+        }
+        m_grid.push_back(static_cast<GLuint>(offset));
+        m_grid.push_back(static_cast<GLuint>(m_light_indices.size() - offset));
+    }
+
+    m_accepted_amount = static_cast<unsigned int>(lights.size()) - dropped_amount;
+    if ((dropped_amount > 0 || indices_overflow) && !m_overflow_reported)
+    {
+        fprintf(stderr, "[WARNING] Clustered lighting is over its limits, %u lights were dropped%s!\n", dropped_amount,
+                indices_overflow ? " and some cluster light lists were cut short" : "");
+        m_overflow_reported = true; // once is enough, this would repeat every frame
+    }
+
+    upload(buffer_lights, m_light_texels.data(), m_light_texels.size() * sizeof(glm::vec4), buffer_capacities[buffer_lights]);
+    upload(buffer_grid, m_grid.data(), m_grid.size() * sizeof(GLuint), buffer_capacities[buffer_grid]);
+    upload(buffer_indices, m_light_indices.data(), m_light_indices.size() * sizeof(GLushort), buffer_capacities[buffer_indices]);
+}
+
+void ClusteredLighting::upload(BufferIdx idx, const void *data, size_t bytes, size_t capacity)
+{
+    assert(bytes <= capacity);
+
+    // orphaned just like the 2D batch, the draws of the previous frame might still read the old contents
+    glBindBuffer(GL_TEXTURE_BUFFER, m_buffer_ids[idx]);
+    glBufferData(GL_TEXTURE_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+    if (bytes > 0) glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+int ClusteredLighting::bind(const Shaders::Program& shader)
+{
+    assert(m_initialized);
+    assert(m_far > m_near); // update must come first
+
+    for (unsigned int i = 0; i < buffer_amount; ++i)
+    {
+        glActiveTexture(GL_TEXTURE0 + texture_unit_first + i);
+        glBindTexture(GL_TEXTURE_BUFFER, m_texture_ids[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+
+    shader.set("clusterLights", static_cast<GLint>(texture_unit_first + buffer_lights));
+    shader.set("clusterGrid", static_cast<GLint>(texture_unit_first + buffer_grid));
+    shader.set("clusterLightIndices", static_cast<GLint>(texture_unit_first + buffer_indices));
+    shader.set("clusterViewProj", m_view_proj);
+    shader.set("clusterGridSize", glm::vec3(grid_x, grid_y, grid_z));
+    // slice = log(depth) * x + y
+    const float log_depth_scale = grid_z / std::log(m_far / m_near);
+    shader.set("clusterDepthParams", glm::vec2(log_depth_scale, -std::log(m_near) * log_depth_scale));
+    shader.set("globalLightsCount", static_cast<GLint>(m_global_amount));
+
+    return static_cast<int>(m_accepted_amount);
+}
+
+unsigned int ClusteredLighting::getLightAmount()
+{
+    return m_light_amount;
+}
+
+unsigned int ClusteredLighting::getLightIndexAmount()
+{
+    return static_cast<unsigned int>(m_light_indices.size());
+}
+
+#endif /* USE_CLUSTERED_LIGHTING */
@@ -0,0 +1,225 @@
+#include "game.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring> // strcmp
+#include <mutex>
+
+
+static std::mutex registry_mutex;
+static const std::chrono::steady_clock::time_point profiler_epoch = std::chrono::steady_clock::now();
+
+std::vector<std::unique_ptr<Profiling::CpuProfiler::ThreadBuffer>> Profiling::CpuProfiler::m_thread_buffers{};
+std::atomic<uint32_t> Profiling::CpuProfiler::m_frame{0};
+Profiling::CpuProfiler::ScopeStats Profiling::CpuProfiler::m_scope_stats[Profiling::CpuProfiler::scope_stats_max]{};
+unsigned int Profiling::CpuProfiler::m_scope_stats_amount = 0;
+const char *Profiling::CpuProfiler::m_trace_path = NULL;
+uint32_t Profiling::CpuProfiler::m_trace_first_frame = 0;
+uint32_t Profiling::CpuProfiler::m_trace_frame_amount = 0;
+
+int64_t Profiling::CpuProfiler::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - profiler_epoch).count();
+}
+
+Profiling::CpuProfiler::ThreadBuffer& Profiling::CpuProfiler::threadBuffer()
+{
+    // buffers are owned by the registry so that they outlive their threads and can still be exported
+    thread_local ThreadBuffer *buffer = NULL;
+    if (buffer == NULL)
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        m_thread_buffers.push_back(std::make_unique<ThreadBuffer>());
+        buffer = m_thread_buffers.back().get();
+        buffer->m_thread_id = static_cast<uint32_t>(m_thread_buffers.size() - 1);
+    }
+
+    return *buffer;
+}
+
+void Profiling::CpuProfiler::beginScope(const char *name)
+{
+    ThreadBuffer& buffer = threadBuffer();
+
+    if (buffer.m_depth < depth_max)
+    {
+        buffer.m_open_names[buffer.m_depth] = name;
+        buffer.m_open_starts[buffer.m_depth] = now();
+    }
+    ++buffer.m_depth;
+}
+
+void Profiling::CpuProfiler::endScope()
+{
+    const int64_t end_ns = now();
+    ThreadBuffer& buffer = threadBuffer();
+
+    assert(buffer.m_depth > 0); // unpaired PROFILE_END
+    --buffer.m_depth;
+    if (buffer.m_depth >= depth_max) return;
+
+    const uint32_t write_idx = buffer.m_write_idx.load(std::memory_order_relaxed);
+    buffer.m_events[write_idx & (events_per_thread - 1)] = Event{ buffer.m_open_names[buffer.m_depth],
+                                                                  buffer.m_open_starts[buffer.m_depth], end_ns,
+                                                                  buffer.m_depth, m_frame.load(std::memory_order_relaxed) };
+    buffer.m_write_idx.store(write_idx + 1, std::memory_order_release);
+}
+
+uint32_t Profiling::CpuProfiler::currentFrame()
+{
+    return m_frame.load(std::memory_order_relaxed);
+}
+
+void Profiling::CpuProfiler::markFrame()
+{
+    const uint32_t finished_frame = m_frame.fetch_add(1, std::memory_order_relaxed);
+
+    updateScopeStats(finished_frame);
+
+    if (m_trace_path != NULL && finished_frame + 1 == m_trace_first_frame + m_trace_frame_amount)
+    {
+        if (writeTrace(m_trace_path, m_trace_first_frame, finished_frame))
+        {
+            printf("CPU profiler trace of frames %u-%u written into '%s'.\n", m_trace_first_frame, finished_frame, m_trace_path);
+        }
+        m_trace_path = NULL;
+    }
+}
+
+void Profiling::CpuProfiler::updateScopeStats(uint32_t finished_frame)
+{
+    const float smoothing = 0.1f; // weight of the newest frame
+
+    ThreadBuffer *main_buffer = NULL;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        if (!m_thread_buffers.empty()) main_buffer = m_thread_buffers.front().get();
+    }
+    if (main_buffer == NULL) return;
+
+    float frame_ms[scope_stats_max]{};
+    unsigned int frame_calls[scope_stats_max]{};
+
+    // walk back through the events of the finished frame
+    const uint32_t write_idx = main_buffer->m_write_idx.load(std::memory_order_acquire);
+    const uint32_t available = std::min(write_idx, events_per_thread);
+    for (uint32_t i = 1; i <= available; ++i)
+    {
+        const Event& event = main_buffer->m_events[(write_idx - i) & (events_per_thread - 1)];
+        if (event.frame != finished_frame) break;
+
+        unsigned int stats_idx = 0;
+        while (stats_idx < m_scope_stats_amount && m_scope_stats[stats_idx].name != event.name
+               && strcmp(m_scope_stats[stats_idx].name, event.name) != 0) ++stats_idx;
+
+        if (stats_idx == m_scope_stats_amount)
+        {
+            if (m_scope_stats_amount == scope_stats_max) continue; // table full, ignore the scope
+            m_scope_stats[m_scope_stats_amount++] = ScopeStats{ event.name, 0.f, 0.f };
+        }
+
+        frame_ms[stats_idx] += (event.end_ns - event.start_ns) / 1000000.f;
+        ++frame_calls[stats_idx];
+    }
+
+    for (unsigned int i = 0; i < m_scope_stats_amount; ++i)
+    {
+        m_scope_stats[i].avg_ms += smoothing * (frame_ms[i] - m_scope_stats[i].avg_ms);
+        m_scope_stats[i].calls += smoothing * (frame_calls[i] - m_scope_stats[i].calls);
+    }
+}
+
+void Profiling::CpuProfiler::requestTrace(const char *path, uint32_t first_frame, uint32_t frame_amount)
+{
+    assert(path != NULL);
+
+    if (frame_amount == 0)
+    {
+        fprintf(stderr, "[WARNING] CPU profiler trace requested for zero frames, ignoring.\n");
+        return;
+    }
+
+    m_trace_path = path;
+    m_trace_first_frame = first_frame;
+    m_trace_frame_amount = frame_amount;
+}
+
+bool Profiling::CpuProfiler::writeTrace(const char *path, uint32_t first_frame, uint32_t last_frame)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Failed to open CPU profiler trace file '%s' for writing!\n", path);
+        return false;
+    }
+
+    // Chrome trace-event format, complete events ("X") with microsecond timestamps
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    bool events_lost = false;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (const std::unique_ptr<ThreadBuffer>& buffer : m_thread_buffers)
+        {
+            const uint32_t write_idx = buffer->m_write_idx.load(std::memory_order_acquire);
+            const uint32_t available = std::min(write_idx, events_per_thread);
+
+            // oldest kept event already belongs to the range -> some of its events might have been overwritten
+            const Event& oldest_event = buffer->m_events[(write_idx - available) & (events_per_thread - 1)];
+            if (write_idx > events_per_thread && oldest_event.frame >= first_frame) events_lost = true;
+
+            for (uint32_t i = write_idx - available; i != write_idx; ++i)
+            {
+                const Event& event = buffer->m_events[i & (events_per_thread - 1)];
+                if (event.frame < first_frame || event.frame > last_frame) continue;
+
+                fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                              "\"args\":{\"frame\":%u,\"depth\":%u}}",
+                        first ? "" : ",\n", event.name, buffer->m_thread_id, event.start_ns / 1000.0,
+                        (event.end_ns - event.start_ns) / 1000.0, event.frame, event.depth);
+                first = false;
+            }
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    if (events_lost) fprintf(stderr, "[WARNING] CPU profiler ring buffer overflowed, trace is missing the oldest events.\n");
+    return true;
+}
+
+void Profiling::CpuProfiler::drawTopScopes(nk_context *ctx, struct nk_rect bounds, unsigned int top_amount)
+{
+    assert(ctx != NULL);
+
+    ScopeStats sorted[scope_stats_max];
+    const unsigned int amount = m_scope_stats_amount;
+    std::copy(m_scope_stats, m_scope_stats + amount, sorted);
+    std::sort(sorted, sorted + amount, [](const ScopeStats& a, const ScopeStats& b) { return a.avg_ms > b.avg_ms; });
+
+    if (nk_begin(ctx, "CPU scopes", bounds, NK_WINDOW_BORDER | NK_WINDOW_TITLE | NK_WINDOW_NO_SCROLLBAR))
+    {
+        char textbuff[32]{};
+        const float ratios[] = { 0.66f, 0.2f, 0.14f };
+
+        nk_layout_row(ctx, NK_DYNAMIC, 16, 3, ratios);
+        nk_label(ctx, "scope", NK_TEXT_LEFT);
+        nk_label(ctx, "ms", NK_TEXT_RIGHT);
+        nk_label(ctx, "calls", NK_TEXT_RIGHT);
+
+        unsigned int shown = 0;
+        for (unsigned int i = 0; i < amount && shown < top_amount; ++i)
+        {
+            if (sorted[i].calls < 0.5f) continue; // scopes that are no longer called (e.g. init) only fade out
+            ++shown;
+
+            nk_layout_row(ctx, NK_DYNAMIC, 16, 3, ratios);
+            nk_label(ctx, sorted[i].name, NK_TEXT_LEFT);
+            snprintf(textbuff, sizeof(textbuff), "%.2f", sorted[i].avg_ms);
+            nk_label(ctx, textbuff, NK_TEXT_RIGHT);
+            snprintf(textbuff, sizeof(textbuff), "%.0f", sorted[i].calls);
+            nk_label(ctx, textbuff, NK_TEXT_RIGHT);
+        }
+    }
+    nk_end(ctx);
+}
@@ -0,0 +1,149 @@
+#include "game.hpp"
+
+#include <algorithm>
+
+
+bool DepthPrepass::m_initialized = false;
+bool DepthPrepass::m_forced = false;
+bool DepthPrepass::m_enabled = false;
+bool DepthPrepass::m_active = false;
+bool DepthPrepass::m_measuring = false;
+GLuint DepthPrepass::m_queries[DepthPrepass::query_latency]{};
+GLuint DepthPrepass::m_viewport_samples[DepthPrepass::query_latency]{};
+unsigned int DepthPrepass::m_frame_idx = 0;
+unsigned int DepthPrepass::m_frames_since_change = 0;
+float DepthPrepass::m_overdraw = -1.f;
+
+bool DepthPrepass::init()
+{
+    assert(!m_initialized);
+
+    #ifdef BUILD_OPENGL_330_CORE
+        glGenQueries(query_latency, m_queries);
+
+        GLint counter_bits = 0;
+        glGetQueryiv(GL_SAMPLES_PASSED, GL_QUERY_COUNTER_BITS, &counter_bits);
+        if (counter_bits == 0)
+        {
+            fprintf(stderr, "[WARNING] Occlusion queries are not supported, automatic depth pre-pass disabled.\n");
+            glDeleteQueries(query_latency, m_queries);
+            return false;
+        }
+
+        for (GLuint& viewport_samples : m_viewport_samples) viewport_samples = 0;
+        m_initialized = true;
+        return true;
+    #else
+        // no occlusion queries on OpenGLES 2.0, the pre-pass runs only when forced
+        return false;
+    #endif
+}
+
+void DepthPrepass::deinit()
+{
+    if (!m_initialized) return;
+
+    assert(!m_measuring);
+    #ifdef BUILD_OPENGL_330_CORE
+        glDeleteQueries(query_latency, m_queries);
+    #endif
+    m_initialized = false;
+    m_enabled = false;
+    m_active = false;
+    m_overdraw = -1.f;
+}
+
+void DepthPrepass::setForced(bool forced)
+{
+    m_forced = forced;
+}
+
+void DepthPrepass::readBack(unsigned int slot)
+{
+    #ifdef BUILD_OPENGL_330_CORE
+        const GLuint viewport_samples = m_viewport_samples[slot];
+        m_viewport_samples[slot] = 0;
+        if (viewport_samples == 0) return; // nothing was measured in that frame
+
+        // never wait for the GPU, a result that is still not ready gets dropped
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(m_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available == GL_FALSE) return;
+
+        GLuint samples_passed = 0;
+        glGetQueryObjectuiv(m_queries[slot], GL_QUERY_RESULT, &samples_passed);
+
+        const float overdraw = samples_passed / (float)viewport_samples;
+        m_overdraw = m_overdraw < 0.f ? overdraw : m_overdraw + smoothing * (overdraw - m_overdraw);
+    #else
+        (void)slot;
+    #endif
+}
+
+bool DepthPrepass::update(bool forward)
+{
+    assert(!m_measuring);
+    const SharedGLContext::RenderSettings& settings = SharedGLContext::instance.value().render_settings;
+
+    m_enabled = forward && (m_forced || (m_initialized && settings.use_depth_prepass));
+    if (!m_enabled)
+    {
+        // results still in flight belong to a different setup, they are thrown away
+        for (GLuint& viewport_samples : m_viewport_samples) viewport_samples = 0;
+        m_active = false;
+        m_overdraw = -1.f;
+        m_frames_since_change = 0;
+        return false;
+    }
+
+    m_frame_idx = (m_frame_idx + 1) % query_latency;
+    readBack(m_frame_idx); // issued `query_latency` frames ago, reusing the query discards an unread result
+
+    if (m_forced)
+    {
+        m_active = true;
+        return true;
+    }
+
+    // both passes that get measured test with GL_LESS in the same order, so the estimate does not jump on a switch
+    if (++m_frames_since_change < settle_frames || m_overdraw < 0.f) return m_active;
+
+    const bool active = m_active ? m_overdraw > disable_overdraw : m_overdraw > enable_overdraw;
+    if (active != m_active)
+    {
+        m_active = active;
+        m_frames_since_change = 0;
+    }
+
+    return m_active;
+}
+
+void DepthPrepass::beginMeasure(glm::ivec2 viewport_size)
+{
+    if (!m_initialized || !m_enabled) return;
+
+    assert(!m_measuring);
+    assert(m_viewport_samples[m_frame_idx] == 0); // only once per frame
+
+    #ifdef BUILD_OPENGL_330_CORE
+        // every sample of a multisampled framebuffer passes on its own
+        GLint samples = 0;
+        glGetIntegerv(GL_SAMPLES, &samples);
+        m_viewport_samples[m_frame_idx] = viewport_size.x * viewport_size.y * std::max(samples, 1);
+
+        glBeginQuery(GL_SAMPLES_PASSED, m_queries[m_frame_idx]);
+        m_measuring = true;
+    #else
+        (void)viewport_size;
+    #endif
+}
+
+void DepthPrepass::endMeasure()
+{
+    if (!m_measuring) return;
+
+    #ifdef BUILD_OPENGL_330_CORE
+        glEndQuery(GL_SAMPLES_PASSED);
+    #endif
+    m_measuring = false;
+}
@@ -2,23 +2,22 @@
 
 #include "glm/ext/matrix_transform.hpp" //glm::lookAt
 #include "glm/gtc/matrix_transform.hpp" // IWYU pragma: keep //glm::perspective
-#include "glm/gtx/matrix_transform_2d.hpp" //glm::translate and glm::scale
 
 
 Drawing::Camera3D::Camera3D(float fov, float aspect_ratio, glm::vec3 pos, glm::vec3 target,
                             float near_plane, float far_plane)
-                    : m_pos(pos), m_target(target), m_view_mat(), m_proj_mat()
+                    : m_pos(pos), m_target(target), m_proj_mat(), m_view_mat(), m_view_proj_mat(), m_view_rot_inv(),
+                      m_view_dirty(true), m_derived_dirty(true)
 {
-    updateViewMatrix(); // properly sets m_view_mat
     setProjectionMatrix(fov, aspect_ratio, near_plane, far_plane);
 }
 
 Drawing::Camera3D::Camera3D(float fov, float aspect_ratio, glm::vec3 pos, float pitch, float yaw,
                             float near_plane, float far_plane)
-                    : m_pos(pos), m_target(), m_view_mat(), m_proj_mat()
+                    : m_pos(pos), m_target(), m_proj_mat(), m_view_mat(), m_view_proj_mat(), m_view_rot_inv(),
+                      m_view_dirty(true), m_derived_dirty(true)
 {
-    setTargetFromPitchYaw(pitch, yaw);  // properly sets m_target and m_view_mat
-    //updateViewMatrix();               // properly sets m_view_mat
+    setTargetFromPitchYaw(pitch, yaw);  // properly sets m_target
     setProjectionMatrix(fov, aspect_ratio, near_plane, far_plane);
 }
 
@@ -27,7 +26,7 @@ void Drawing::Camera3D::setPosition(glm::vec3 pos)
     if (pos != m_pos)
     {
         m_pos = pos;
-        updateViewMatrix();
+        m_view_dirty = true;
     }
 }
 
@@ -41,7 +40,7 @@ void Drawing::Camera3D::setTarget(glm::vec3 target)
     if (target != m_target)
     {
         m_target = target;
-        updateViewMatrix();
+        m_view_dirty = true;
     }
 }
 
@@ -51,14 +50,17 @@ void Drawing::Camera3D::moveTarget(glm::vec3 move_vec)
 }
 
 void Drawing::Camera3D::setTargetFromPitchYaw(float pitch, float yaw)
+{
+    setTarget(m_pos + dirFromPitchYaw(pitch, yaw));
+}
+
+glm::vec3 Drawing::Camera3D::dirFromPitchYaw(float pitch, float yaw)
 {
     const float sin_pitch = sin(glm::radians(pitch));
     const float cos_pitch = cos(glm::radians(pitch));
     const float sin_yaw = sin(glm::radians(yaw));
     const float cos_yaw = cos(glm::radians(yaw));
-    glm::vec3 dir = glm::normalize(glm::vec3(cos_yaw * cos_pitch, sin_pitch, sin_yaw * cos_pitch)); //TODO up_vec
-
-    setTarget(m_pos + dir);
+    return glm::normalize(glm::vec3(cos_yaw * cos_pitch, sin_pitch, sin_yaw * cos_pitch)); //TODO up_vec
 }
 
 void Drawing::Camera3D::move(glm::vec3 move_vec)
@@ -72,18 +74,32 @@ void Drawing::Camera3D::move(glm::vec3 move_vec)
 //     return getViewMatrix() * vec;
 // }
 
-void Drawing::Camera3D::updateViewMatrix()
+void Drawing::Camera3D::updateViewMatrix() const
 {
-    m_view_mat = glm::lookAt(m_pos, m_target, Drawing::up_dir);
+    if (m_view_dirty)
+    {
+        m_view_mat = glm::lookAt(m_pos, m_target, Drawing::up_dir);
+        m_view_dirty = false;
+        m_derived_dirty = true;
+    }
+
+    if (m_derived_dirty)
+    {
+        m_view_proj_mat = m_proj_mat * m_view_mat;
+        m_view_rot_inv = glm::inverse(glm::mat3(m_view_mat));
+        m_derived_dirty = false;
+    }
 }
 
 void Drawing::Camera3D::setProjectionMatrix(float fov, float aspect_ratio, float near_plane, float far_plane)
 {
     m_proj_mat = glm::perspective(glm::radians(fov), aspect_ratio, near_plane, far_plane);
+    m_derived_dirty = true;
 }
 
 const glm::mat4& Drawing::Camera3D::getViewMatrix() const
 {
+    updateViewMatrix();
     return m_view_mat;
 }
 
@@ -92,10 +108,16 @@ const glm::mat4& Drawing::Camera3D::getProjectionMatrix() const
     return m_proj_mat;
 }
 
+const glm::mat4& Drawing::Camera3D::getViewProjectionMatrix() const
+{
+    updateViewMatrix();
+    return m_view_proj_mat;
+}
+
 glm::vec3 Drawing::Camera3D::dirCoordsViewToWorld(glm::vec3 dir) const
 {
-    glm::mat3 m(getViewMatrix()); //IDEA cache this too
-    glm::vec3 dir_transformed = glm::inverse(m) * dir;
+    updateViewMatrix();
+    glm::vec3 dir_transformed = m_view_rot_inv * dir;
 
     return NORMALIZE_OR_0(dir_transformed);
 }
@@ -308,55 +330,26 @@ void Drawing::clear(Color color)
 }
 
 void Drawing::texturedRectangle(const Shaders::Program& tex_rect_shader, const Textures::Texture2D& textureRect,
-                                glm::vec2 screen_res, glm::vec2 dstPos, glm::vec2 dstSize)
+                                glm::vec2 screen_res, glm::vec2 dstPos, glm::vec2 dstSize, glm::vec2 src_region)
 {
-    const SharedGLContext& shared_gl_context = SharedGLContext::instance.value();
-    assert(shared_gl_context.isInitialized());
-    const Meshes::VBO& vbo = shared_gl_context.unit_quad_pos_only;
-    assert(vbo.m_id != empty_id);
-
-    glm::mat4 transform(1.f);
-    transform = glm::scale(transform, glm::vec3(2.f));
-
-    tex_rect_shader.use();
-    textureRect.bind();
-    {
-        //vs
-        tex_rect_shader.set("transform", transform);
-
-        //fs
-        tex_rect_shader.set("screenRes", screen_res);
-        tex_rect_shader.set("rectPosIn", dstPos);
-        tex_rect_shader.set("rectSize", dstSize);
-    }
-
-    vbo.bind();
-        glDrawArrays(GL_TRIANGLES, 0, vbo.vertexCount());
-    vbo.unbind();
+    // texture y axis points up, so the top of the rectangle gets the top of the region
+    // bilinear filtering must not reach outside the region, half a texel from its edge is the last safe texcoord
+    const glm::vec2 half_texel = 0.5f / glm::vec2(textureRect.m_width, textureRect.m_height);
+    Batch2D::rect(tex_rect_shader, textureRect, screen_res, dstPos, dstSize,
+                  glm::vec2(0.f, src_region.y), glm::vec2(src_region.x, 0.f), src_region - half_texel);
 }
 
 void Drawing::texturedRectangle2(const Shaders::Program& tex_rect_shader, const Textures::Texture2D& textureRect,
                                  const Textures::Texture2D& background, const Textures::Texture2D& foreground,
-                                 glm::vec2 dstPos, glm::vec2 dstSize)
+                                 glm::vec2 screen_res, glm::vec2 dstPos, glm::vec2 dstSize)
 {
-    const SharedGLContext& shared_gl_context = SharedGLContext::instance.value();
-    assert(shared_gl_context.isInitialized());
-    const Meshes::VBO& vbo = shared_gl_context.unit_quad_pos_only;
-    assert(vbo.m_id != empty_id);
-
-    glm::mat4 transform(1.f);
-    transform = glm::scale(transform, glm::vec3(2.f));
+    Batch2D::flush(); // pending quads might use the same shader with other uniforms
 
     tex_rect_shader.use();
-    textureRect.bind(0);
     background.bind(1);
     foreground.bind(2);
     {
-        //vs
-        tex_rect_shader.set("transform", transform);
-
         //fs
-        tex_rect_shader.set("inputTexture", 0);
         tex_rect_shader.set("inputTextureBG", 1);
         tex_rect_shader.set("inputTextureFG", 2);
         
@@ -364,54 +357,26 @@ void Drawing::texturedRectangle2(const Shaders::Program& tex_rect_shader, const
         tex_rect_shader.set("rectSize", dstSize);
     }
 
-    vbo.bind();
-        glDrawArrays(GL_TRIANGLES, 0, vbo.vertexCount());
-    vbo.unbind();
+    Batch2D::rect(tex_rect_shader, textureRect, screen_res, dstPos, dstSize, glm::vec2(0.f, 1.f), glm::vec2(1.f, 0.f), glm::vec2(1.f));
+    Batch2D::flush();
 }
 
-void Drawing::screenLine(const Shaders::Program& line_shader, const Meshes::VBO& line_vbo, glm::vec2 screen_res,
-                         glm::vec2 v1, glm::vec2 v2, float thickness, ColorF color)
+void Drawing::screenLine(glm::vec2 screen_res, glm::vec2 v1, glm::vec2 v2, float thickness, ColorF color)
 {
-    assert(line_vbo.m_id != empty_id);
     assert(thickness >= 1.f);
 
-    // v * scale + translation = u
-    // -> translation = v1
-    // -> scale = v2 - translation = v2 - v1
-    const glm::vec2 t = v1;
-    const glm::vec2 s = v2 - v1;
-
-    glm::mat3 transform(1.f);
-    transform = glm::translate(transform, t);
-    transform = glm::scale(transform, s);
-
-    glLineWidth(thickness);
-
-    line_shader.use();
-    {
-        //vs
-        line_shader.set("transform", transform);
-        line_shader.set("screenRes", screen_res);
-
-        //fs
-        line_shader.set("color", color);
-    }
-
-    line_vbo.bind();
-            glDrawArrays(GL_LINES, 0, line_vbo.vertexCount());
-    line_vbo.unbind();
+    Batch2D::line(screen_res, v1, v2, thickness, color);
 }
 
-void Drawing::crosshair(const Shaders::Program& line_shader, const Meshes::VBO& line_vbo, glm::vec2 screen_res,
-                        glm::vec2 size, glm::vec2 screen_pos, float thickness, ColorF color)
+void Drawing::crosshair(glm::vec2 screen_res, glm::vec2 size, glm::vec2 screen_pos, float thickness, ColorF color)
 {
     // horizontal (x) line
     glm::vec2 v1_x(screen_pos.x, screen_pos.y - (size.y / 2.f));
     glm::vec2 v2_x(screen_pos.x, screen_pos.y + (size.y / 2.f));
-    Drawing::screenLine(line_shader, line_vbo, screen_res, v1_x, v2_x, thickness, color);
+    Drawing::screenLine(screen_res, v1_x, v2_x, thickness, color);
 
     // vertical (y) line
     glm::vec2 v1_y(screen_pos.x - (size.x / 2.f), screen_pos.y);
     glm::vec2 v2_y(screen_pos.x + (size.x / 2.f), screen_pos.y);
-    Drawing::screenLine(line_shader, line_vbo, screen_res, v1_y, v2_y, thickness, color);
+    Drawing::screenLine(screen_res, v1_y, v2_y, thickness, color);
 }
@@ -0,0 +1,61 @@
+#include "game.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+
+float DynamicResolution::m_budget_ms = DynamicResolution::default_budget_ms;
+float DynamicResolution::m_smoothed_gpu_ms = -1.f;
+unsigned int DynamicResolution::m_frames_since_change = 0;
+
+void DynamicResolution::setBudget(float budget_ms)
+{
+    assert(budget_ms > 0.f);
+    m_budget_ms = budget_ms;
+}
+
+float DynamicResolution::getBudget()
+{
+    return m_budget_ms;
+}
+
+void DynamicResolution::update(float gpu_frame_ms)
+{
+    SharedGLContext& shared_gl_context = SharedGLContext::instance.value();
+    const SharedGLContext::RenderSettings& settings = shared_gl_context.render_settings;
+    const float scale = shared_gl_context.getFbo3DRenderScale();
+
+    if (!settings.use_fbo3d || !settings.use_dynamic_resolution || gpu_frame_ms < 0.f)
+    {
+        if (scale != max_scale) shared_gl_context.setFbo3DRenderScale(max_scale);
+        m_smoothed_gpu_ms = -1.f;
+        m_frames_since_change = 0;
+        return;
+    }
+
+    m_smoothed_gpu_ms = m_smoothed_gpu_ms < 0.f ? gpu_frame_ms
+                                                : m_smoothed_gpu_ms + smoothing * (gpu_frame_ms - m_smoothed_gpu_ms);
+    if (++m_frames_since_change < settle_frames) return;
+
+    // the GPU time is modeled as proportional to the rendered pixel count, which goes with the square of the scale
+    float new_scale = scale;
+    if (m_smoothed_gpu_ms > m_budget_ms)
+    {
+        const float fitting_scale = scale * std::sqrt(m_budget_ms / m_smoothed_gpu_ms);
+        new_scale = std::min(scale - scale_step, std::floor(fitting_scale / scale_step + 0.001f) * scale_step);
+    }
+    else
+    {
+        const float upscaled = scale + scale_step;
+        const float predicted_ms = m_smoothed_gpu_ms * (upscaled * upscaled) / (scale * scale);
+        if (predicted_ms < m_budget_ms * upscale_threshold) new_scale = upscaled;
+    }
+
+    new_scale = std::max(min_scale, std::min(max_scale, new_scale));
+    if (std::fabs(new_scale - scale) < scale_step * 0.5f) return;
+
+    shared_gl_context.setFbo3DRenderScale(new_scale);
+    // keeps the prediction going until timings of the new scale arrive
+    m_smoothed_gpu_ms *= (new_scale * new_scale) / (scale * scale);
+    m_frames_since_change = 0;
+}
@@ -0,0 +1,197 @@
+#include "game.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+
+alignas(std::max_align_t) thread_local unsigned char FrameArena::m_memory[FrameArena::capacity];
+thread_local size_t FrameArena::m_offset = 0;
+thread_local size_t FrameArena::m_last_offset = 0;
+thread_local size_t FrameArena::m_peak_bytes = 0;
+thread_local unsigned int FrameArena::m_overflow_count = 0;
+
+void FrameArena::reset()
+{
+    m_offset = 0;
+    m_last_offset = 0;
+}
+
+void* FrameArena::allocate(size_t bytes, size_t alignment)
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0); // power of two
+    assert(alignment <= alignof(std::max_align_t));
+
+    const size_t start = (m_offset + alignment - 1) & ~(alignment - 1);
+    if (bytes > capacity || start > capacity - bytes)
+    {
+        // better slow than broken, the overflow shows up in the stats (and in the AllocTracker reports)
+        ++m_overflow_count;
+        return ::operator new(bytes);
+    }
+
+    m_last_offset = start;
+    m_offset = start + bytes;
+    m_peak_bytes = std::max(m_peak_bytes, m_offset);
+    return m_memory + start;
+}
+
+void FrameArena::deallocate(void *ptr, size_t bytes)
+{
+    if (ptr == NULL) return;
+
+    if (!owns(ptr))
+    {
+        ::operator delete(ptr);
+        return;
+    }
+
+    // only the most recent allocation can be given back, the rest waits for the reset
+    unsigned char *byte_ptr = static_cast<unsigned char*>(ptr);
+    if (byte_ptr == m_memory + m_last_offset && m_last_offset + bytes == m_offset)
+    {
+        m_offset = m_last_offset;
+    }
+}
+
+bool FrameArena::owns(const void *ptr)
+{
+    const unsigned char *byte_ptr = static_cast<const unsigned char*>(ptr);
+    return byte_ptr >= m_memory && byte_ptr < m_memory + capacity;
+}
+
+size_t FrameArena::getUsedBytes()
+{
+    return m_offset;
+}
+
+size_t FrameArena::getPeakBytes()
+{
+    return m_peak_bytes;
+}
+
+unsigned int FrameArena::getOverflowCount()
+{
+    return m_overflow_count;
+}
+
+uint64_t Profiling::AllocTracker::m_frame_allocs = 0;
+uint64_t Profiling::AllocTracker::m_frame_bytes = 0;
+uint64_t Profiling::AllocTracker::m_frame_largest = 0;
+uint64_t Profiling::AllocTracker::m_steady_frames = 0;
+uint64_t Profiling::AllocTracker::m_offending_frames = 0;
+uint64_t Profiling::AllocTracker::m_steady_allocs = 0;
+uint64_t Profiling::AllocTracker::m_steady_bytes = 0;
+
+// only the main thread is tracked, other threads (profiler export, drivers) allocate as they wish
+static thread_local bool alloc_tracking = false;
+
+void Profiling::AllocTracker::beginFrame()
+{
+    m_frame_allocs = 0;
+    m_frame_bytes = 0;
+    m_frame_largest = 0;
+    alloc_tracking = true;
+}
+
+void Profiling::AllocTracker::endFrame(bool steady_state, unsigned int global_tick)
+{
+    alloc_tracking = false;
+    if (!steady_state) return;
+
+    ++m_steady_frames;
+    if (m_frame_allocs == 0) return;
+
+    ++m_offending_frames;
+    m_steady_allocs += m_frame_allocs;
+    m_steady_bytes += m_frame_bytes;
+
+    if (m_offending_frames <= reported_frames_max)
+    {
+        fprintf(stderr, "[WARNING] %llu heap allocations (%llu bytes, largest %llu) during steady state frame %u!\n",
+                static_cast<unsigned long long>(m_frame_allocs), static_cast<unsigned long long>(m_frame_bytes),
+                static_cast<unsigned long long>(m_frame_largest), global_tick);
+        if (m_offending_frames == reported_frames_max)
+        {
+            fprintf(stderr, "[WARNING] Further frames with heap allocations are only counted.\n");
+        }
+    }
+}
+
+void Profiling::AllocTracker::noteAllocation(size_t bytes)
+{
+    ++m_frame_allocs;
+    m_frame_bytes += bytes;
+    m_frame_largest = std::max<uint64_t>(m_frame_largest, bytes);
+}
+
+void Profiling::AllocTracker::printReport(FILE *out)
+{
+    assert(out != NULL);
+
+    fprintf(out, "Heap allocations in steady state frames: %llu of %llu frames allocated, %llu allocations, %llu bytes\n",
+            static_cast<unsigned long long>(m_offending_frames), static_cast<unsigned long long>(m_steady_frames),
+            static_cast<unsigned long long>(m_steady_allocs), static_cast<unsigned long long>(m_steady_bytes));
+    fprintf(out, "Frame arena: peak %zu of %zu bytes, %u overflows\n", FrameArena::getPeakBytes(), FrameArena::capacity,
+            FrameArena::getOverflowCount());
+}
+
+#ifdef ENABLE_ALLOC_TRACKER
+    // Replacements of the global allocation functions, the aligned (std::align_val_t) variants are left alone.
+    // All of them must be replaced together, memory from malloc is not guaranteed to work with the default delete.
+    void* operator new(std::size_t size)
+    {
+        if (alloc_tracking) Profiling::AllocTracker::noteAllocation(size);
+
+        void *ptr = std::malloc(size > 0 ? size : 1);
+        if (ptr == NULL) throw std::bad_alloc();
+        return ptr;
+    }
+
+    void* operator new[](std::size_t size)
+    {
+        return operator new(size);
+    }
+
+    void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+    {
+        if (alloc_tracking) Profiling::AllocTracker::noteAllocation(size);
+
+        return std::malloc(size > 0 ? size : 1);
+    }
+
+    void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept
+    {
+        return operator new(size, tag);
+    }
+
+    void operator delete(void *ptr) noexcept
+    {
+        std::free(ptr);
+    }
+
+    void operator delete[](void *ptr) noexcept
+    {
+        std::free(ptr);
+    }
+
+    void operator delete(void *ptr, std::size_t) noexcept
+    {
+        std::free(ptr);
+    }
+
+    void operator delete[](void *ptr, std::size_t) noexcept
+    {
+        std::free(ptr);
+    }
+
+    void operator delete(void *ptr, const std::nothrow_t&) noexcept
+    {
+        std::free(ptr);
+    }
+
+    void operator delete[](void *ptr, const std::nothrow_t&) noexcept
+    {
+        std::free(ptr);
+    }
+#endif /* ENABLE_ALLOC_TRACKER */
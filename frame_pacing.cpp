@@ -0,0 +1,227 @@
+#include "game.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <thread>
+
+
+bool FramePacing::m_enabled = false;
+#ifdef BUILD_OPENGL_330_CORE
+    GLsync FramePacing::m_fence = NULL;
+#endif
+double FramePacing::m_refresh_interval = 1.0 / 60.0;
+double FramePacing::m_last_vblank_time = -1.0;
+double FramePacing::m_input_time = -1.0;
+float FramePacing::m_predicted_work_ms = 0.f;
+float FramePacing::m_last_sleep_ms = 0.f;
+
+float FramePacing::m_latency_history[FramePacing::history_size]{};
+uint32_t FramePacing::m_latency_write_idx = 0;
+double FramePacing::m_latency_sum_ms = 0.0;
+float FramePacing::m_latency_max_ms = 0.f;
+
+void FramePacing::setEnabled(bool enabled)
+{
+    #ifndef BUILD_OPENGL_330_CORE
+        if (enabled) fprintf(stderr, "[WARNING] Low latency mode needs fences of OpenGL 3.3, latency is only measured.\n");
+        m_enabled = false;
+    #else
+        m_enabled = enabled;
+        m_last_vblank_time = -1.0;
+        m_last_sleep_ms = 0.f;
+        if (!enabled) return;
+
+        GLFWmonitor *monitor = glfwGetPrimaryMonitor();
+        const GLFWvidmode *mode = monitor != NULL ? glfwGetVideoMode(monitor) : NULL;
+        if (mode != NULL && mode->refreshRate > 0) m_refresh_interval = 1.0 / mode->refreshRate;
+        else
+        {
+            fprintf(stderr, "[WARNING] Failed to get the monitor refresh rate, low latency mode expects 60 Hz.\n");
+            m_refresh_interval = 1.0 / 60.0;
+        }
+    #endif
+}
+
+bool FramePacing::isEnabled()
+{
+    return m_enabled;
+}
+
+void FramePacing::waitForInput(bool v_sync)
+{
+    #ifdef BUILD_OPENGL_330_CORE
+        if (!m_enabled) return;
+
+        if (m_fence != NULL)
+        {
+            PROFILE_SCOPE("FramePacing::waitFence");
+            const GLenum status = glClientWaitSync(m_fence, GL_SYNC_FLUSH_COMMANDS_BIT, fence_timeout_ns);
+            glDeleteSync(m_fence);
+            m_fence = NULL;
+
+            // a blocked wait ends with the flip of the previous frame, that is the vblank
+            if (status == GL_CONDITION_SATISFIED) m_last_vblank_time = glfwGetTime();
+            else if (status == GL_TIMEOUT_EXPIRED)
+            {
+                fprintf(stderr, "[WARNING] Previous frame is not done after %u ms, frame pacing gets reset.\n",
+                        static_cast<unsigned int>(fence_timeout_ns / 1000000));
+                m_last_vblank_time = -1.0;
+            }
+            else if (status == GL_WAIT_FAILED)
+            {
+                fprintf(stderr, "[WARNING] Waiting for the previous frame fence failed!\n");
+                m_last_vblank_time = -1.0;
+            }
+        }
+
+        // without V-Sync there is no vblank to be late for, the fence alone keeps a single frame in flight
+        m_last_sleep_ms = 0.f;
+        if (!v_sync || m_last_vblank_time < 0.0) return;
+
+        // the earliest vblank the frame can still make, input gets sampled right before the work has to start
+        // a frame taking most of the interval would wake up at a random point of it and could miss vblanks
+        const double lead_time = (m_predicted_work_ms + safety_margin_ms) / 1000.0;
+        if (lead_time >= m_refresh_interval * max_lead_ratio) return;
+
+        const double now = glfwGetTime();
+        const double intervals = std::ceil((now + lead_time - m_last_vblank_time) / m_refresh_interval);
+        const double wake_time = m_last_vblank_time + std::max(1.0, intervals) * m_refresh_interval - lead_time;
+
+        // never sleep through a whole refresh, a prediction that far off is better thrown away
+        const double sleep_time = std::min(wake_time - now, m_refresh_interval);
+        if (sleep_time <= 0.0) return;
+
+        {
+            PROFILE_SCOPE("FramePacing::sleep");
+            std::this_thread::sleep_for(std::chrono::duration<double>(sleep_time));
+        }
+        m_last_sleep_ms = static_cast<float>(sleep_time * 1000.0);
+    #else
+        (void)v_sync;
+    #endif
+}
+
+void FramePacing::inputSampled(double time)
+{
+    m_input_time = time;
+}
+
+void FramePacing::frameSubmitted(double time, bool loop_changed)
+{
+    if (m_input_time < 0.0) return;
+
+    const float latency_ms = static_cast<float>(time - m_input_time) * 1000.f;
+    m_input_time = -1.0;
+
+    m_latency_history[m_latency_write_idx & (history_size - 1)] = latency_ms;
+    ++m_latency_write_idx;
+    m_latency_sum_ms += latency_ms;
+    m_latency_max_ms = std::max(m_latency_max_ms, latency_ms);
+
+    // pushing or popping a loop (init, first frame of a menu) says nothing about the frames to come
+    if (loop_changed) return;
+
+    // the GPU part lags a few frames behind, a longer frame is taken right away so the next one is not late,
+    // one stalled frame (e.g. after a resize) must not keep the prediction high for long, hence the clamp
+    const float refresh_ms = static_cast<float>(m_refresh_interval * 1000.0);
+    const float work_ms = std::min(latency_ms + std::max(0.f, Profiling::GpuProfiler::lastFrameMs()), refresh_ms);
+    if (work_ms > m_predicted_work_ms) m_predicted_work_ms = work_ms;
+    else m_predicted_work_ms += (work_ms - m_predicted_work_ms) * work_smoothing;
+}
+
+void FramePacing::framePresented()
+{
+    #ifdef BUILD_OPENGL_330_CORE
+        if (!m_enabled) return;
+
+        if (m_fence != NULL) glDeleteSync(m_fence); // the frame before was not waited for (e.g. idle menu)
+        m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    #endif
+}
+
+void FramePacing::reset()
+{
+    #ifdef BUILD_OPENGL_330_CORE
+        if (m_fence != NULL) glDeleteSync(m_fence);
+        m_fence = NULL;
+    #endif
+    m_last_vblank_time = -1.0;
+    m_input_time = -1.0;
+}
+
+float FramePacing::lastLatencyMs()
+{
+    if (m_latency_write_idx == 0) return 0.f;
+    return m_latency_history[(m_latency_write_idx - 1) & (history_size - 1)];
+}
+
+float FramePacing::recentPercentile(float p)
+{
+    const uint32_t amount = std::min(m_latency_write_idx, history_size);
+    if (amount == 0) return 0.f;
+
+    float sorted[history_size];
+    std::copy(m_latency_history, m_latency_history + amount, sorted);
+
+    // nearest-rank, rank is 1-based
+    const uint32_t rank = std::max<uint32_t>(1, static_cast<uint32_t>(std::ceil(p / 100.f * amount)));
+    std::nth_element(sorted, sorted + rank - 1, sorted + amount);
+    return sorted[rank - 1];
+}
+
+void FramePacing::drawOverlay(nk_context *ctx, struct nk_rect bounds)
+{
+    assert(ctx != NULL);
+
+    if (nk_begin(ctx, "Input latency", bounds, NK_WINDOW_BORDER | NK_WINDOW_TITLE | NK_WINDOW_NO_SCROLLBAR))
+    {
+        char textbuff[64]{};
+        const float avg_ms = m_latency_write_idx ? static_cast<float>(m_latency_sum_ms / m_latency_write_idx) : 0.f;
+
+        nk_layout_row_dynamic(ctx, 16, 1);
+        snprintf(textbuff, sizeof(textbuff), "last %.2f  avg %.2f ms", lastLatencyMs(), avg_ms);
+        nk_label(ctx, textbuff, NK_TEXT_LEFT);
+        snprintf(textbuff, sizeof(textbuff), "p50 %.2f  p95 %.2f ms", recentPercentile(50.f), recentPercentile(95.f));
+        nk_label(ctx, textbuff, NK_TEXT_LEFT);
+        snprintf(textbuff, sizeof(textbuff), "max %.2f ms", m_latency_max_ms);
+        nk_label(ctx, textbuff, NK_TEXT_LEFT);
+        if (isEnabled()) snprintf(textbuff, sizeof(textbuff), "low latency: sleep %.2f ms", m_last_sleep_ms);
+        else snprintf(textbuff, sizeof(textbuff), "low latency: off");
+        nk_label(ctx, textbuff, NK_TEXT_LEFT);
+    }
+    nk_end(ctx);
+}
+
+bool FramePacing::exportJSON(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Failed to open latency stats file '%s' for writing!\n", path);
+        return false;
+    }
+
+    const uint32_t amount = std::min(m_latency_write_idx, history_size);
+    fprintf(file, "{\n");
+    fprintf(file, "  \"low_latency\": %s,\n", isEnabled() ? "true" : "false");
+    fprintf(file, "  \"refresh_interval_ms\": %.4f,\n", m_refresh_interval * 1000.0);
+    fprintf(file, "  \"predicted_work_ms\": %.4f,\n", m_predicted_work_ms);
+    fprintf(file, "  \"frames\": %u,\n", m_latency_write_idx);
+    fprintf(file, "  \"input_to_submit_ms\": { \"avg\": %.4f, \"max\": %.4f, \"recent_p50\": %.4f, \"recent_p95\": %.4f },\n",
+            m_latency_write_idx ? m_latency_sum_ms / m_latency_write_idx : 0.0, m_latency_max_ms,
+            recentPercentile(50.f), recentPercentile(95.f));
+
+    // oldest first
+    fprintf(file, "  \"recent_ms\": [");
+    for (uint32_t i = 0; i < amount; ++i)
+    {
+        const uint32_t idx = (m_latency_write_idx - amount + i) & (history_size - 1);
+        fprintf(file, "%s%.4f", i ? ", " : "", m_latency_history[idx]);
+    }
+    fprintf(file, "]\n");
+    fprintf(file, "}\n");
+
+    fclose(file);
+    return true;
+}
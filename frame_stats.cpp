@@ -0,0 +1,228 @@
+#include "game.hpp"
+
+#include <algorithm>
+#include <cstring> // memset
+
+
+Profiling::FrameStats Profiling::FrameStats::instance{};
+
+Profiling::FrameStats::FrameStats(float hitch_threshold_ms) : m_hitch_threshold_ms(hitch_threshold_ms)
+{
+    reset();
+}
+
+void Profiling::FrameStats::reset()
+{
+    memset(m_history, 0, sizeof(m_history));
+    m_write_idx.store(0, std::memory_order_relaxed);
+    memset(m_histogram, 0, sizeof(m_histogram));
+    m_frame_ms_sum = 0.0;
+    m_max_ms = 0.f;
+    m_frame_count = 0;
+    m_hitch_count = 0;
+}
+
+uint32_t Profiling::FrameStats::bucketIndex(uint32_t value_us)
+{
+    value_us = std::min(value_us, histogram_max_us - 1);
+    if (value_us < sub_bucket_count) return value_us;
+
+    // position of the most significant bit, the value then falls into range [2^msb; 2^(msb + 1))
+    uint32_t msb = 0;
+    for (uint32_t val = value_us; val > 1; val >>= 1) ++msb;
+
+    const uint32_t shift = msb - (sub_bucket_bits - 1);
+    const uint32_t sub_bucket = (value_us >> shift) - (sub_bucket_count / 2);
+    return sub_bucket_count + (msb - sub_bucket_bits) * (sub_bucket_count / 2) + sub_bucket;
+}
+
+uint32_t Profiling::FrameStats::bucketUpperValue(uint32_t idx)
+{
+    if (idx < sub_bucket_count) return idx;
+
+    const uint32_t range_idx = (idx - sub_bucket_count) / (sub_bucket_count / 2);
+    const uint32_t sub_bucket = (idx - sub_bucket_count) % (sub_bucket_count / 2);
+    const uint32_t shift = range_idx + 1;
+    const uint32_t lower = (sub_bucket + sub_bucket_count / 2) << shift;
+
+    return lower + (1u << shift) - 1;
+}
+
+void Profiling::FrameStats::addFrame(float frame_ms, float cpu_ms, float gpu_ms)
+{
+    const uint32_t write_idx = m_write_idx.load(std::memory_order_relaxed);
+    m_history[write_idx & (history_size - 1)] = Sample{ frame_ms, cpu_ms, gpu_ms };
+    m_write_idx.store(write_idx + 1, std::memory_order_release); // publish the sample
+
+    const uint32_t value_us = static_cast<uint32_t>(std::max(0.f, frame_ms) * 1000.f);
+    ++m_histogram[bucketIndex(value_us)];
+
+    m_frame_ms_sum += frame_ms;
+    m_max_ms = std::max(m_max_ms, frame_ms);
+    ++m_frame_count;
+    if (frame_ms > m_hitch_threshold_ms) ++m_hitch_count;
+}
+
+float Profiling::FrameStats::percentile(float p) const
+{
+    if (m_frame_count == 0) return 0.f;
+
+    // nearest-rank, rank is 1-based
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p / 100.f * m_frame_count)));
+
+    uint64_t cumulative = 0;
+    for (uint32_t idx = 0; idx < histogram_size; ++idx)
+    {
+        cumulative += m_histogram[idx];
+        if (cumulative >= rank)
+        {
+            // bucket upper bound can overshoot the real maximum
+            return std::min(m_max_ms, bucketUpperValue(idx) / 1000.f);
+        }
+    }
+
+    return m_max_ms;
+}
+
+Profiling::FrameStats::Report Profiling::FrameStats::getReport() const
+{
+    Report report{};
+    report.frame_count = m_frame_count;
+    report.hitch_count = m_hitch_count;
+    report.avg_ms = m_frame_count ? static_cast<float>(m_frame_ms_sum / m_frame_count) : 0.f;
+    report.p50_ms = percentile(50.f);
+    report.p95_ms = percentile(95.f);
+    report.p99_ms = percentile(99.f);
+    report.max_ms = m_max_ms;
+    return report;
+}
+
+unsigned int Profiling::FrameStats::copyRecent(Sample *out, unsigned int max_amount) const
+{
+    const uint32_t write_idx = m_write_idx.load(std::memory_order_acquire);
+    const uint32_t amount = std::min<uint32_t>({ max_amount, write_idx, history_size });
+
+    for (uint32_t i = 0; i < amount; ++i)
+    {
+        out[i] = m_history[(write_idx - amount + i) & (history_size - 1)];
+    }
+
+    return amount;
+}
+
+float Profiling::FrameStats::getRecentFPS(unsigned int frame_amount) const
+{
+    const uint32_t write_idx = m_write_idx.load(std::memory_order_acquire);
+    const uint32_t amount = std::min<uint32_t>({ frame_amount, write_idx, history_size });
+
+    double sum_ms = 0.0;
+    for (uint32_t i = 1; i <= amount; ++i) sum_ms += m_history[(write_idx - i) & (history_size - 1)].frame_ms;
+
+    return sum_ms > 0.0 ? static_cast<float>(1000.0 * amount / sum_ms) : 0.f;
+}
+
+void Profiling::FrameStats::drawOverlay(nk_context *ctx, struct nk_rect bounds) const
+{
+    assert(ctx != NULL);
+
+    if (nk_begin(ctx, "Frame time", bounds, NK_WINDOW_BORDER | NK_WINDOW_TITLE | NK_WINDOW_NO_SCROLLBAR))
+    {
+        char textbuff[128]{};
+        const Report report = getReport();
+
+        nk_layout_row_dynamic(ctx, 16, 1);
+        snprintf(textbuff, sizeof(textbuff), "avg %.2f  p50 %.2f ms", report.avg_ms, report.p50_ms);
+        nk_label(ctx, textbuff, NK_TEXT_LEFT);
+        snprintf(textbuff, sizeof(textbuff), "p95 %.2f  p99 %.2f ms", report.p95_ms, report.p99_ms);
+        nk_label(ctx, textbuff, NK_TEXT_LEFT);
+        snprintf(textbuff, sizeof(textbuff), "max %.2f ms  hitches %u", report.max_ms, report.hitch_count);
+        nk_label(ctx, textbuff, NK_TEXT_LEFT);
+
+        //sparkline of recent frames, frame time and GPU time (if measured) in separate slots
+        Sample samples[sparkline_samples];
+        const unsigned int amount = copyRecent(samples, sparkline_samples);
+
+        float graph_max_ms = 1.f;
+        bool has_gpu_times = false;
+        for (unsigned int i = 0; i < amount; ++i)
+        {
+            graph_max_ms = std::max(graph_max_ms, samples[i].frame_ms);
+            has_gpu_times = has_gpu_times || samples[i].gpu_ms >= 0.f;
+        }
+
+        nk_layout_row_dynamic(ctx, 50, 1);
+        if (nk_chart_begin_colored(ctx, NK_CHART_LINES, nk_rgb(40, 40, 40), nk_rgb(200, 0, 0), amount, 0.f, graph_max_ms))
+        {
+            if (has_gpu_times)
+            {
+                nk_chart_add_slot_colored(ctx, NK_CHART_LINES, nk_rgb(0, 90, 200), nk_rgb(200, 0, 0), amount, 0.f, graph_max_ms);
+            }
+
+            for (unsigned int i = 0; i < amount; ++i)
+            {
+                nk_chart_push_slot(ctx, samples[i].frame_ms, 0);
+                if (has_gpu_times) nk_chart_push_slot(ctx, std::max(0.f, samples[i].gpu_ms), 1);
+            }
+            nk_chart_end(ctx);
+        }
+    }
+    nk_end(ctx);
+}
+
+bool Profiling::FrameStats::exportCSV(const char *path) const
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Failed to open frame stats file '%s' for writing!\n", path);
+        return false;
+    }
+
+    // only the recent history is stored per frame
+    Sample samples[history_size];
+    const unsigned int amount = copyRecent(samples, history_size);
+    const unsigned int first_frame = m_frame_count - amount;
+
+    fprintf(file, "frame,frame_ms,cpu_ms,gpu_ms\n");
+    for (unsigned int i = 0; i < amount; ++i)
+    {
+        fprintf(file, "%u,%.4f,%.4f,%.4f\n", first_frame + i, samples[i].frame_ms, samples[i].cpu_ms, samples[i].gpu_ms);
+    }
+
+    fclose(file);
+    return true;
+}
+
+bool Profiling::FrameStats::exportJSON(const char *path) const
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Failed to open frame stats file '%s' for writing!\n", path);
+        return false;
+    }
+
+    const Report report = getReport();
+    fprintf(file, "{\n");
+    fprintf(file, "  \"frames\": %u,\n", report.frame_count);
+    fprintf(file, "  \"hitch_threshold_ms\": %.2f,\n", m_hitch_threshold_ms);
+    fprintf(file, "  \"hitches\": %u,\n", report.hitch_count);
+    fprintf(file, "  \"frame_time_ms\": { \"avg\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f },\n",
+            report.avg_ms, report.p50_ms, report.p95_ms, report.p99_ms, report.max_ms);
+
+    // non-empty histogram buckets as [upper bound in ms, count]
+    fprintf(file, "  \"histogram\": [");
+    bool first = true;
+    for (uint32_t idx = 0; idx < histogram_size; ++idx)
+    {
+        if (m_histogram[idx] == 0) continue;
+
+        fprintf(file, "%s[%.3f, %u]", first ? "" : ", ", bucketUpperValue(idx) / 1000.f, m_histogram[idx]);
+        first = false;
+    }
+    fprintf(file, "]\n");
+    fprintf(file, "}\n");
+
+    fclose(file);
+    return true;
+}
@@ -1,6 +1,7 @@
 #include "game.hpp"
 
 #include <algorithm>
+#include <cmath>
 
 
 glm::vec3 Game::targetRandomWallPosition(Utils::RNG& width, Utils::RNG& height, glm::vec2 wall_size)
@@ -26,35 +27,41 @@ glm::vec3 Game::targetMiddleWallPosition(Utils::RNG& width, Utils::RNG& height,
 Game::PosChanger_float::PosChanger_float(glm::vec3 init_pos, glm::vec3 dir, glm::vec3 spawn_area_pos,
                                          glm::vec2 spawn_area_size, Game::PosChanger_float::Params params)
                             : PosChanger(init_pos), m_dir(dir), m_area_pos(spawn_area_pos + params.area_pos_offset),
-                              m_area_size(spawn_area_size * params.area_size), m_prev_alive_time(0.f), m_speed(params.speed)
+                              m_area_size(spawn_area_size * params.area_size), m_speed(params.speed)
 {
     //nothing
 }
 
-void Game::PosChanger_float::updatePos(glm::vec3 size, double alive_time)
+float Game::PosChanger_float::bounceAxis(float init_pos, float velocity, float low, float high, double alive_time)
 {
-    float delta_time = static_cast<float>(alive_time) - m_prev_alive_time;
-    m_prev_alive_time = alive_time;
+    const double range = static_cast<double>(high) - static_cast<double>(low);
+    if (range <= 0.0) return low; // degenerate area -> stuck in place
+
+    // unfold the bounces into one straight line and fold it back with a triangle wave of period 2 * range
+    const double start = std::clamp(static_cast<double>(init_pos), static_cast<double>(low), static_cast<double>(high));
+    const double unfolded = (start - low) + static_cast<double>(velocity) * alive_time;
+
+    double phase = std::fmod(unfolded, 2.0 * range);
+    if (phase < 0.0) phase += 2.0 * range;
+    if (phase > range) phase = 2.0 * range - phase;
+
+    return static_cast<float>(low + phase);
+}
+
+glm::vec3 Game::PosChanger_float::getPos(double alive_time) const
+{
+    if (alive_time <= 0.0) alive_time = 0.0;
 
     const float right = m_area_pos.x + (m_area_size.x / 2.f);
     const float left  = m_area_pos.x - (m_area_size.x / 2.f);
     const float up    = m_area_pos.y + (m_area_size.y / 2.f);
     const float down  = m_area_pos.y - (m_area_size.y / 2.f);
 
-    glm::vec3 move = (delta_time * m_speed) * m_dir;
-    glm::vec3 new_pos = m_pos + move;
+    const glm::vec3 velocity = m_speed * m_dir;
 
-    //check if hit and correct the position
-    if (new_pos.x > right) new_pos.x = right;
-    if (new_pos.x < left) new_pos.x = left;
-    if (new_pos.y > up) new_pos.y = up;
-    if (new_pos.y < down) new_pos.y = down;
-
-    //update the direction if hit
-    if (FLOAT_EQUALS(new_pos.x, right) || FLOAT_EQUALS(new_pos.x, left)) m_dir.x *= -1; 
-    if (FLOAT_EQUALS(new_pos.y, up)    || FLOAT_EQUALS(new_pos.y, down)) m_dir.y *= -1; 
-
-    m_pos = new_pos;
+    return glm::vec3(bounceAxis(m_pos.x, velocity.x, left, right, alive_time),
+                     bounceAxis(m_pos.y, velocity.y, down, up, alive_time),
+                     m_pos.z);
 }
 
 float Game::Target::getScale_default(double alive_time) //TODO probably unite with targetGetScale_linearFactor
@@ -125,38 +132,32 @@ float Game::Target::getScale(double time) const
     return m_scale_fn(alive_time);
 }
 
-void Game::Target::updatePos(double current_frame_time)
+glm::vec3 Game::Target::getPos(double current_frame_time) const
 {
-    const float scale = getScale(current_frame_time);
     const double alive_time = current_frame_time - m_spawn_time;
 
-    PosChanger& pos_changer = getCurrentPosChanger();
-    pos_changer.updatePos(glm::vec3(scale), alive_time);
-}
-
-glm::vec3 Game::Target::getPos() const
-{
     const PosChanger& pos_changer = getCurrentPosChanger();
-    return pos_changer.m_pos;
+    return pos_changer.getPos(alive_time);
 }
 
-void Game::Target::draw(Game::TargetType type, const Drawing::Camera3D& camera,
-                        const std::vector<std::reference_wrapper<const Lighting::Light>>& lights,
-                        float gamma, double current_frame_time, glm::vec3 pos_offset) const
+void Game::Target::setTransform(Game::TargetType type, TransformBatch& transforms, TransformBatch::Id id,
+                                double current_frame_time, glm::vec3 pos_offset) const
 {
-    const float scale = getScale(current_frame_time);
-    const glm::vec3 pos = getPos();
+    // frames interpolate the simulation one tick back, targets spawned in the last tick are not alive yet at that time
+    const double time = std::max(current_frame_time, m_spawn_time);
+    const float scale = getScale(time);
+    const glm::vec3 pos = getPos(time);
 
     switch (type)
     {
     case Game::TargetType::target:
         {
-            m_model.drawWithColorTint(camera, lights, gamma, pos + pos_offset, m_color_tint, glm::vec3(scale, scale, 1.f));
+            m_model.setTransform(transforms, id, pos + pos_offset, glm::vec3(scale, scale, 1.f));
             return;
         }
     case Game::TargetType::ball:
         {
-            m_model.drawWithColorTint(camera, lights, gamma, pos + pos_offset, m_color_tint, glm::vec3(scale));
+            m_model.setTransform(transforms, id, pos + pos_offset, glm::vec3(scale));
             return;
         }
     }
@@ -20,15 +20,20 @@
 #include "nuklear.h"
 
 #include <cstdio>
+#include <cstddef>
+#include <cstdint>
 #include <cassert>
 #include <cmath> // IWYU pragma: keep
 #include <array> // IWYU pragma: keep
 #include <vector>
+#include <string>
 #include <memory>
 #include <functional>
 #include <random>
 #include <optional>
 #include <variant>
+#include <atomic>
+#include <type_traits>
 
 #define FLOAT_TOLERANCE 0.001f
 
@@ -39,6 +44,7 @@
 #define ATTRIBUTE_DEFAULT_NAME_TEXCOORDS "aTexCoord"
 #define ATTRIBUTE_DEFAULT_NAME_NORMALS "aNormal"
 #define ATTRIBUTE_DEFAULT_NAME_COLOR "aColor"
+#define ATTRIBUTE_DEFAULT_NAME_TEXCOORDS_MAX "aTexCoordMax"
 
 // maximal length of a uniform name/location
 //TODO WebGL imposes limit of 256, maybe change to that?
@@ -73,12 +79,17 @@
 #define UNIFORM_LIGHT_COSOUTERCUTOFF "cosOuterCutoff"
 
 #define UNIFORM_LIGHT_COUNT_NAME "lightsCount"
+// size of the uniform light array in light.fs, the clustered path has no such limit
+#define LIGHTS_MAX_AMOUNT 10
 
 //Macro functions
 // returns normalized vector or zero vector if the given vector is zero
 //TODO find a better solution than macros
 //TODO there is no normalization?
 #define NORMALIZE_OR_0(v) (Utils::isZero((v)) ? glm::vec3(0.f) : (glm::normalize((v))))
+// turns the value of a macro into a string literal
+#define STRINGIFY_INNER(x) #x
+#define STRINGIFY(x) STRINGIFY_INNER(x)
 // returns size_t length of string (must be string literal or char array with term. char.),
 // -1 as we dont count the term. char.
 #define STR_LEN(S) ((sizeof((S)) / sizeof((S)[0])) - 1)
@@ -184,6 +195,148 @@ namespace Collision
     struct Ray;
 };
 
+//frame_arena.cpp
+// Bump allocator for data that lives only during one frame, MainLoopStack::beginFrame resets it at the top of every
+// main loop iteration, so nothing allocated from it may be kept across frames. Deallocation only rolls back the most
+// recent allocation (a growing vector gets its old block back), anything else is freed all at once by the reset.
+// Allocations that do not fit into the arena fall back to the heap and are counted as overflows.
+// Every thread has an arena of its own, the render thread resets its one before executing each command stream.
+class FrameArena
+{
+public:
+    static constexpr size_t capacity = 64 * 1024;
+
+private:
+    alignas(std::max_align_t) static thread_local unsigned char m_memory[capacity];
+    static thread_local size_t m_offset, m_last_offset; // end of the used memory, start of the most recent allocation
+    static thread_local size_t m_peak_bytes;
+    static thread_local unsigned int m_overflow_count;
+
+public:
+    static void reset();
+
+    static void* allocate(size_t bytes, size_t alignment);
+    static void deallocate(void *ptr, size_t bytes);
+    static bool owns(const void *ptr);
+
+    static size_t getUsedBytes();
+    static size_t getPeakBytes();
+    static unsigned int getOverflowCount();
+};
+
+// STL allocator adapter, containers using it must not outlive the frame they were created in
+template <typename T>
+struct FrameAllocator
+{
+    using value_type = T;
+
+    FrameAllocator() noexcept = default;
+    template <typename U>
+    FrameAllocator(const FrameAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(FrameArena::allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *ptr, size_t n) noexcept
+    {
+        FrameArena::deallocate(ptr, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const FrameAllocator<U>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const FrameAllocator<U>&) const noexcept { return false; }
+};
+
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+//render_commands.cpp
+// Stream of render commands. Loops declaring `records_render_commands` make no GL calls during their frames, they
+// record commands instead (one per pass or state change, with copies of whatever the simulation may change meanwhile)
+// and `submit` hands the stream over. With the render thread running (desktop only, started on request) the thread
+// owns the GL context, executes the stream and swaps the buffers, while the main thread already polls the events and
+// simulates the next frame. Without it (web, benchmark) `submit` executes the same stream right away.
+// The stream is recorded into one of two arenas while the other one is executed, their memory is reused every frame.
+class RenderCommands
+{
+public:
+    typedef void (ExecuteFnPtr) (const void *command);
+
+    static constexpr size_t block_size = 64 * 1024; // arenas grow by blocks, bigger entries get a block of their own
+
+private:
+    static void* allocateEntry(size_t bytes, ExecuteFnPtr *execute); // NULL `execute` for the data of commands
+
+    template <typename Cmd>
+    static void executeTemplate(const void *command)
+    {
+        Cmd::execute(*static_cast<const Cmd*>(command));
+    }
+
+public:
+    // commands are trivially copyable structs with `static void execute(const Cmd&)`, executed in the recording order
+    template <typename Cmd>
+    static void record(const Cmd& command)
+    {
+        static_assert(std::is_trivially_copyable<Cmd>::value, "render commands are copied around as raw bytes");
+        static_assert(alignof(Cmd) <= alignof(std::max_align_t), "render command is over-aligned");
+        new (allocateEntry(sizeof(Cmd), executeTemplate<Cmd>)) Cmd(command);
+    }
+
+    // for state changes whose place in the stream does not matter (swap interval, resizes),
+    // executed right away when the main thread has the GL context
+    template <typename Cmd>
+    static void recordOrExecute(const Cmd& command)
+    {
+        if (isThreaded()) record(command);
+        else Cmd::execute(command);
+    }
+
+    // data referenced by the recorded commands, stays valid until the stream gets executed
+    template <typename T>
+    static T* allocate(size_t amount)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "render command data is copied around as raw bytes");
+        static_assert(alignof(T) <= alignof(std::max_align_t), "render command data is over-aligned");
+        return static_cast<T*>(allocateEntry(amount * sizeof(T), NULL));
+    }
+
+    // frames of the main thread, GPU profiler frames and GL call stats follow the thread that executes the stream
+    static void beginFrame();
+    static void submit(bool present); // the render thread swaps the buffers afterwards, otherwise the caller does
+    static void finish(); // waits until the submitted stream gets executed, loop callbacks never run alongside it
+
+    static bool startThread(GLFWwindow *window); // desktop only, the context must be current on the calling thread
+    static void stopThread(); // the context gets current on the calling thread again
+    static void handOverContext(); // to the render thread, between the frames only
+    static void acquireContext(); // back to the main thread, after the submitted stream got executed
+    static bool isThreaded(); // the render thread has the context, the main thread must not call GL
+};
+
+namespace Profiling
+{
+    // Debug aid compiled in only with ENABLE_ALLOC_TRACKER, it replaces the global operator new/delete and counts
+    // heap allocations the main thread makes during a frame. Steady state frames (see MainLoopStack) are expected
+    // to allocate nothing, per frame data belongs into the FrameArena, every offending frame gets reported.
+    class AllocTracker
+    {
+        static constexpr unsigned int reported_frames_max = 16; // later offenders are only counted
+
+        static uint64_t m_frame_allocs, m_frame_bytes, m_frame_largest;
+        static uint64_t m_steady_frames, m_offending_frames, m_steady_allocs, m_steady_bytes;
+
+    public:
+        static void beginFrame();
+        static void endFrame(bool steady_state, unsigned int global_tick);
+        static void noteAllocation(size_t bytes); // called by the replaced operator new
+
+        static void printReport(FILE *out);
+    };
+}
+
 //window_manager.cpp
 class WindowManager
 {
@@ -206,11 +359,36 @@ public:
 };
 
 //mouse_manager.cpp
+// Besides the latest state, every raw cursor move and button change gets queued with its timestamp (glfwGetTime),
+// so that the loops can replay the input in between their frames, e.g. aim at the moment of a click.
+// The timestamps are taken when GLFW dispatches the callbacks inside glfwPollEvents, not when the input happened,
+// so all events arriving in between two polls get nearly the same time and the precision is that of the polling.
 class MouseManager
 {
+public:
+    struct Event
+    {
+        enum class Type : uint8_t { move, button };
+
+        Type type;
+        uint8_t button; // GLFW_MOUSE_BUTTON_*, button events only
+        bool pressed;   // button events only
+        double time;
+        glm::vec2 pos;  // cursor position after the event
+    };
+
+    static constexpr unsigned int event_capacity = 256; // per frame, the oldest events get dropped when more arrive
+
+private:
     //TODO save if mouse_pos was set atleast from within the callback
     static glm::vec2 mouse_pos;
 
+    // ring filled by the callbacks, beginFrame moves it into the events of the frame
+    static Event m_pending_events[event_capacity];
+    static unsigned int m_pending_first, m_pending_count, m_dropped_events;
+    static Event m_frame_events[event_capacity];
+    static unsigned int m_frame_event_count, m_frame_event_read;
+
 public:
     static bool left_button, right_button;
 
@@ -222,11 +400,74 @@ public:
     static void setCursorLocked();
     static void setCursorVisible();
 
+    // called by InputRecorder::beginFrame, events the loops did not read in the last frame are dropped
+    static void beginFrame();
+    // next unread event of the frame in the order of arrival, only when it happened at `up_to_time` or sooner
+    static bool nextEvent(double up_to_time, Event& out_event);
+    static void skipEvents(); // marks all events of the frame as read
+
 private:
+    friend class InputRecorder; // injects recorded mouse state
+
+    static void queueEvent(const Event& event);
+    static void clearPendingEvents();
+
     static void mousePositionCallback(GLFWwindow* window, double xpos, double ypos);
     static void mouseButtonsCallback(GLFWwindow *window, int button, int action, int mods);
 };
 
+//input_recorder.cpp
+// Records per-frame input (frame times, mouse deltas, mouse buttons, mouse events, key changes, window focus) and RNG seeds
+// into a compact binary file and replays them back, so that a whole session can be reproduced exactly.
+// Loops must query keys through InputRecorder::getKey and RNGs are seeded through InputRecorder::nextSeed.
+class InputRecorder
+{
+public:
+    enum class Mode { live, record, replay, synthetic }; // synthetic - no input at all, focused window, fixed seeds
+
+private:
+    static constexpr char file_magic[4] = { 'S', 'P', 'I', 'R' };
+    static constexpr uint32_t file_version = 2;
+    static constexpr uint8_t record_tag_seed = 'S', record_tag_frame = 'F';
+    static constexpr uint8_t flag_left_button = 1 << 0, flag_right_button = 1 << 1, flag_focused = 1 << 2;
+
+    static Mode m_mode;
+    static FILE *m_file;
+    static bool m_key_states[GLFW_KEY_LAST + 1];
+    static glm::vec2 m_mouse_pos; // reconstructed from the deltas, the same in both record and replay
+    static bool m_focused;
+    static double m_fixed_step, m_first_frame_time; // fixed step <= 0.0 means recorded frame times are used
+    static unsigned int m_frame_count, m_seed_count;
+
+    static bool writeBytes(const void *data, size_t size);
+    static bool readBytes(void *data, size_t size);
+    static bool expectTag(uint8_t tag);
+    static void fail(const char *message);
+
+    static void recordFrame(GLFWwindow *window, double frame_time);
+    static bool recordMouseEvents(double frame_time);
+    static bool replayFrame(double& frame_time);
+    static bool replayMouseEvents(double frame_time);
+    static void applyMouseState(uint8_t flags);
+
+public:
+    static bool startRecording(const char *path);
+    static bool startReplay(const char *path, double fixed_step = 0.0);
+    static void startSynthetic();
+    static void stop();
+
+    static Mode getMode();
+
+    // called once per frame right after polling the events, in replay mode overrides the frame time,
+    // returns false when the replay has run out of recorded frames, starts the frame of MouseManager events too
+    static bool beginFrame(GLFWwindow *window, double& frame_time);
+
+    static unsigned int nextSeed();
+
+    static int getKey(GLFWwindow *window, int key); // drop-in replacement for glfwGetKey
+    static bool isWindowFocused(GLFWwindow *window);
+};
+
 //drawing.cpp
 namespace Drawing
 {
@@ -237,23 +478,29 @@ namespace Drawing
     struct Camera3D
     {
         glm::vec3 m_pos, m_target;
-        glm::mat4 m_view_mat, m_proj_mat;
+        glm::mat4 m_proj_mat;
+
+        // derived matrices are cached, the getters recompute them only after the camera changed
+        mutable glm::mat4 m_view_mat, m_view_proj_mat;
+        mutable glm::mat3 m_view_rot_inv; // inverse of the rotation part of the view matrix
+        mutable bool m_view_dirty, m_derived_dirty;
 
         Camera3D(float fov, float aspect_ratio, glm::vec3 pos, glm::vec3 target,
                  float near_plane = default_near_plane, float far_plane = default_far_plane);
         Camera3D(float fov, float aspect_ratio, glm::vec3 pos, float pitch, float yaw,
                  float near_plane = default_near_plane, float far_plane = default_far_plane);
 
-        void setPosition(glm::vec3 pos);        // setter for camera position, in the future we might want to cache view matrix
+        void setPosition(glm::vec3 pos);        // setter for camera position, marks the view matrix dirty
         void movePosition(glm::vec3 move_vec);  // move camera position by given vector
 
-        void setTarget(glm::vec3 target);       // setter for camera target, in the future we might want to cache view matrix
+        void setTarget(glm::vec3 target);       // setter for camera target, marks the view matrix dirty
         void moveTarget(glm::vec3 move_vec);    // move camera target by given vector
         void setTargetFromPitchYaw(float pitch, float yaw);
+        static glm::vec3 dirFromPitchYaw(float pitch, float yaw); // in degrees
 
         void move(glm::vec3 move_vec);          // combines movePosition and moveTarget
         
-        void updateViewMatrix();
+        void updateViewMatrix() const;          // recomputes whatever cached matrix is dirty
 
         void setProjectionMatrix(float fov, float aspect_ratio,
                                  float near_plane = default_near_plane, float far_plane = default_far_plane);
@@ -262,6 +509,8 @@ namespace Drawing
 
         const glm::mat4& getProjectionMatrix() const;
 
+        const glm::mat4& getViewProjectionMatrix() const; // projection * view
+
         glm::vec3 dirCoordsViewToWorld(glm::vec3 dir) const;
 
         glm::vec3 getDirection() const;
@@ -318,18 +567,20 @@ namespace Drawing
 
     void clear(Color color);
 
+    // 2D helpers below only queue into Batch2D, call `Batch2D::flush` before drawing anything over them
+
+    // `src_region` is the lower left part of the texture that gets stretched over the rectangle (bilinear upscale)
     void texturedRectangle(const Shaders::Program& tex_rect_shader, const Textures::Texture2D& textureRect,
-                           glm::vec2 screen_res, glm::vec2 dstPos, glm::vec2 dstSize);
+                           glm::vec2 screen_res, glm::vec2 dstPos, glm::vec2 dstSize, glm::vec2 src_region = glm::vec2(1.f));
 
+    // flushes right away, as the extra texture units are bound only for this one rectangle
     void texturedRectangle2(const Shaders::Program& tex_rect_shader, const Textures::Texture2D& textureRect,
                             const Textures::Texture2D& background, const Textures::Texture2D& foreground,
-                            glm::vec2 dstPos, glm::vec2 dstSize);
+                            glm::vec2 screen_res, glm::vec2 dstPos, glm::vec2 dstSize);
 
-    void screenLine(const Shaders::Program& line_shader, const Meshes::VBO& line_vbo, glm::vec2 screen_res,
-                    glm::vec2 v1, glm::vec2 v2, float thickness, ColorF color);
+    void screenLine(glm::vec2 screen_res, glm::vec2 v1, glm::vec2 v2, float thickness, ColorF color);
 
-    void crosshair(const Shaders::Program& line_shader, const Meshes::VBO& line_vbo, glm::vec2 screen_res,
-                   glm::vec2 size, glm::vec2 screen_pos, float thickness, ColorF color);
+    void crosshair(glm::vec2 screen_res, glm::vec2 size, glm::vec2 screen_pos, float thickness, ColorF color);
 }
 
 //lighting.cpp
@@ -371,15 +622,29 @@ namespace Lighting
         }
     };
 
+    #ifndef USE_CLUSTERED_LIGHTING
+        #ifdef BUILD_OPENGL_330_CORE
+            // needs texture buffers, on OpenGLES 2.0 all lights go through the uniform array
+            #define USE_CLUSTERED_LIGHTING
+        #endif
+    #endif
+
     // Lights - directional (dir vec), point (pos vec), spot (dir vec, pos vec, inner/outer cone cutoff angle)
-    constexpr size_t lights_max_amount = 10; //TODO make this synchronized with light shader includes!
+    constexpr size_t lights_max_amount = LIGHTS_MAX_AMOUNT; // uniform array path, clustered lighting has its own limit
     constexpr float light_src_size = 0.2f;
+    constexpr float light_range_cutoff = 1.f / 256.f; // attenuated intensity under which a light counts as out of range
+
+    // distance at which the strongest channel of `props` attenuates under `cutoff`, infinity without any falloff
+    float attenuationRange(const LightProps& props, float constant, float linear, float quadratic,
+                           float cutoff = light_range_cutoff);
 
     class Light //abstract class representing singular light source (directional/point/spot light)
     {
     public:
         enum class Type { directional = 0, point = 1, spot = 2 };
 
+        static constexpr unsigned int packed_texels = 6; // vec4s per light in the clustered lighting buffer
+
         LightProps m_props;
 
         Light(const LightProps& props);
@@ -388,8 +653,20 @@ namespace Lighting
         bool bindPropsToShader(const char *uniform_name, const Shaders::Program& shader, int idx = -1) const;
 
         virtual bool bindToShader(const char *uniform_name, const Shaders::Program& shader, int idx = -1) const = 0;
+
+        // sphere enclosing everything the light reaches (in world space),
+        // returns false for lights that reach everywhere (directional ones or without attenuation)
+        virtual bool boundingSphere(glm::vec3& out_center, float& out_radius) const = 0;
+        // layout is described in light.fs (clusterLights), `range` 0 means unlimited
+        virtual void pack(glm::vec4 out_texels[packed_texels]) const = 0;
+
+    protected:
+        void packProps(glm::vec4 out_texels[packed_texels]) const;
     };
 
+    // lights used for drawing one frame, built every frame, so it lives in the FrameArena
+    using LightRefs = FrameVector<std::reference_wrapper<const Light>>;
+
     class DirLight : public Light
     {
     public:
@@ -399,6 +676,8 @@ namespace Lighting
         ~DirLight() = default;
 
         bool bindToShader(const char *uniform_name, const Shaders::Program& shader, int idx = -1) const override;
+        bool boundingSphere(glm::vec3& out_center, float& out_radius) const override;
+        void pack(glm::vec4 out_texels[packed_texels]) const override;
     };
 
     class PointLight : public Light
@@ -415,6 +694,10 @@ namespace Lighting
         ~PointLight() = default;
 
         bool bindToShader(const char *uniform_name, const Shaders::Program& shader, int idx = -1) const override;
+        bool boundingSphere(glm::vec3& out_center, float& out_radius) const override;
+        void pack(glm::vec4 out_texels[packed_texels]) const override;
+
+        float range() const; // see attenuationRange
 
         void setAttenuation(GLfloat constant, GLfloat linear, GLfloat quadratic);
     };
@@ -437,6 +720,10 @@ namespace Lighting
         ~SpotLight() = default;
 
         bool bindToShader(const char *uniform_name, const Shaders::Program& shader, int idx = -1) const override;
+        bool boundingSphere(glm::vec3& out_center, float& out_radius) const override;
+        void pack(glm::vec4 out_texels[packed_texels]) const override;
+
+        float range() const; // see attenuationRange
 
         void setAttenuation(GLfloat constant, GLfloat linear, GLfloat quadratic);
     };
@@ -533,6 +820,7 @@ namespace Shaders
     constexpr GLuint attribute_position_texcoords = 1;
     constexpr GLuint attribute_position_normals = 2;
     constexpr GLuint attribute_position_color = 3;
+    constexpr GLuint attribute_position_texcoords_max = 4;
 
     struct IncludeDefine
     {
@@ -588,7 +876,7 @@ namespace Shaders
         void setMaterial(const Lighting::Material& material, int map_bind_offset = 0) const;
         bool setLight(const char *uniform_name, const Lighting::Light& light, int idx = -1) const;
         int setLights(const char *uniform_array_name, const char *uniform_arrray_size_name,
-                      const std::vector<std::reference_wrapper<const Lighting::Light>>& lights) const;
+                      const Lighting::LightRefs& lights) const;
     };
 
     GLuint fromString(GLenum type, const char *src);
@@ -663,6 +951,69 @@ namespace Textures
     };
 }
 
+//transform_batch.cpp
+// World (model), normal and MVP matrices of many objects, their transforms are kept in a structure of arrays.
+// The world matrix is translate(position) * rotation * scale(scale) * translate(origin offset). World and normal
+// matrices of an object get recomputed only after it moved, MVP matrices only after it moved or the camera did.
+// Objects are processed `lanes` at a time by plain float loops over the arrays, which compilers turn into SIMD
+// code without any intrinsics. Blocks of uniformly scaled objects take a fast path, their normal matrix is
+// the upper 3x3 of the world matrix (shaders normalize the normals anyway), no reciprocals nor inverses needed.
+class TransformBatch
+{
+public:
+    using Id = unsigned int;
+    static constexpr unsigned int lanes = 4;
+
+    TransformBatch();
+
+    // new objects have the identity transform
+    Id add();
+    void resize(unsigned int amount);
+    void reserve(unsigned int amount);
+    unsigned int size() const;
+
+    // setters mark the object moved only when the value changes
+    void setPosition(Id id, glm::vec3 pos);
+    void setRotation(Id id, float angle, glm::vec3 axis); // angle in radians
+    void setScale(Id id, glm::vec3 scale);
+    void setOriginOffset(Id id, glm::vec3 offset);
+
+    // recomputes matrices of the moved objects and the MVP matrices, call once per frame before drawing
+    void update(const glm::mat4& view_proj);
+
+    const glm::mat4& worldMatrix(Id id) const;
+    const glm::mat3& normalMatrix(Id id) const;
+    const glm::mat4& mvpMatrix(Id id) const;
+
+    // sets `model`, `normalMat` and `mvp` uniforms (texture.vs) of a program that is already in use,
+    // `model` only feeds the world position, which the G-buffer pass never reads, so its uniform is optimized out there,
+    // programs with default.vs take only the `mvp` one
+    void setUniforms(const Shaders::Program& program, Id id, bool world_pos = true) const;
+
+private:
+    enum Component : unsigned int
+    {
+        pos_x, pos_y, pos_z,
+        scale_x, scale_y, scale_z,
+        offset_x, offset_y, offset_z,
+        rot_00, rot_01, rot_02, rot_10, rot_11, rot_12, rot_20, rot_21, rot_22, // rot_CR - column C, row R
+        component_amount
+    };
+
+    unsigned int m_amount;
+    std::vector<float> m_components[component_amount]; // padded to a multiple of `lanes` with identity transforms
+    std::vector<float> m_world_soa[16]; // world matrices again as arrays, the MVP computation reads these
+    std::vector<uint8_t> m_moved;
+    glm::mat4 m_view_proj;
+
+    std::vector<glm::mat4> m_world, m_mvp;
+    std::vector<glm::mat3> m_normal;
+
+    void setComponent(Id id, unsigned int component, float value);
+    void updateWorldBlock(unsigned int first);
+    void updateMvpBlock(unsigned int first);
+};
+
 //meshes.cpp
 namespace Meshes
 {
@@ -727,6 +1078,7 @@ namespace Meshes
         // Ideally we would want VAO to be outside of VBO and optionally bound by Mesh instead of VBO through VBO::bind
         #ifdef USE_VAO
             VAO m_vao;
+            VAO m_pos_only_vao; // only the position attribute, stays empty when the VBO has no other attributes
         #endif
         //IDEA if we use vao then we probably dont need the following attributes
 
@@ -748,6 +1100,10 @@ namespace Meshes
         void bind() const;
         void unbind() const; //TODO refactor? unbinds are an OpenGL anti-pattern, this unbind is however correct when not using VAO!
 
+        // binds the same buffer with only the vertex position attribute enabled, for position-only shaders (depth pre-pass)
+        void bindPositionOnly() const;
+        void unbindPositionOnly() const;
+
         static constexpr AttributeConfig default3DConfig = AttributeConfig{Meshes::attribute3d_pos_amount,
                                                                            Meshes::attribute3d_texcoord_amount,
                                                                            Meshes::attribute3d_normal_amount};
@@ -816,13 +1172,23 @@ namespace Meshes
 
         Model(const Shaders::Program& shader, const Meshes::Mesh& mesh, Lighting::Material material);
 
+        // places the model into a transform batch, its own translate, scale and origin offset are applied too
         //TODO add rotation as a parameter too
-        void draw(const Drawing::Camera3D& camera, const std::vector<std::reference_wrapper<const Lighting::Light>>& lights,
-                  float gamma, glm::vec3 pos, glm::vec3 scale = glm::vec3(1.f)) const;
+        void setTransform(TransformBatch& transforms, TransformBatch::Id id,
+                          glm::vec3 pos, glm::vec3 scale = glm::vec3(1.f)) const;
+
+        // draw methods take the matrices from a transform batch that was already updated this frame
+        void draw(const Drawing::Camera3D& camera, const Lighting::LightRefs& lights,
+                  float gamma, const TransformBatch& transforms, TransformBatch::Id id) const;
         
         void drawWithColorTint(const Drawing::Camera3D& camera,
-                               const std::vector<std::reference_wrapper<const Lighting::Light>>& lights,
-                               float gamma, glm::vec3 pos, const Color3F color_tint, glm::vec3 scale = glm::vec3(1.f)) const;
+                               const Lighting::LightRefs& lights,
+                               float gamma, const TransformBatch& transforms, TransformBatch::Id id,
+                               const Color3F color_tint) const;
+
+        // geometry pass of deferred shading, the G-buffer shader is used instead of the model one and no lights are set
+        void drawToGBuffer(const Shaders::Program& gbuffer_shader,
+                           float gamma, const TransformBatch& transforms, TransformBatch::Id id) const;
     };
 
     int loadObj(const char *obj_file_path, unsigned int *out_vert_count, unsigned int *out_triangle_count,
@@ -901,9 +1267,20 @@ namespace UI
 
     struct Context
     {
-        // static const size_t max_vertex_memory = 512 * 1024;
-        // static const size_t max_element_memory = 128 * 1024;
+        // fixed memory sizes, about twice the peaks measured with all F3 overlays open
+        static const size_t ctx_memory_size = 128 * 1024; // commands at the front, windows at the back
+        static const size_t cmd_memory_size = 32 * 1024;
+        static const size_t max_vertices = 16 * 1024;
+        static const size_t max_elements = 48 * 1024;
+        static const size_t max_vertex_memory = max_vertices * sizeof(UI::Vertex);
+        static const size_t max_element_memory = max_elements * sizeof(nk_draw_index);
+        #ifdef BUILD_OPENGL_330_CORE
+            static const unsigned int ring_regions = 3; // frames the GPU can lag behind before writes have to wait
+        #else
+            static const unsigned int ring_regions = 1; // GLES2 orphans the buffers instead
+        #endif
 
+        std::unique_ptr<unsigned char[]> m_arena; // backs m_ctx and all of the Nuklear buffers
         nk_context m_ctx;
         bool m_ctx_initialized;
         nk_convert_config m_cfg;
@@ -913,7 +1290,25 @@ namespace UI
         #ifdef USE_VAO
             Meshes::VAO m_vao;
         #endif
-        GLuint m_vbo_id, m_ebo_id;
+        GLuint m_vbo_id, m_ebo_id; // ring_regions regions of max_vertex_memory/max_element_memory each
+        unsigned int m_ring_region; // region holding the geometry of m_batches
+        #ifdef BUILD_OPENGL_330_CORE
+            GLsync m_ring_fences[ring_regions]; // signaled once the GPU stops reading the region
+        #endif
+
+        // draw commands of the geometry currently in m_vbo_id/m_ebo_id, replayed while the UI does not change
+        struct DrawBatch
+        {
+            struct nk_rect clip_rect;
+            GLuint texture_id;
+            unsigned int elem_count;
+        };
+        std::vector<DrawBatch> m_batches;
+        bool m_retained_valid;
+        uint64_t m_retained_hash;
+        glm::vec2 m_retained_screen_res;
+
+        unsigned int m_reused_frames, m_converted_frames; // drawn frames with and without nk_convert
 
         Context(const Shaders::Program& shader, const UI::Font& font);
         ~Context();
@@ -923,6 +1318,10 @@ namespace UI
 
         bool convert();
 
+        // hash of the Nuklear commands built since the last clear, the same hash means the same looking UI
+        uint64_t commandHash() const;
+
+        // converts and uploads the UI only when its commands changed since the last draw
         bool draw(glm::vec2 screen_res, unsigned int texture_unit = 0);
 
         void clear();
@@ -931,6 +1330,9 @@ namespace UI
         void verticalGap(float gap_height);
     
     private:
+        // writes the converted geometry into the next ring region
+        bool upload();
+
         void setupVBOAttributes() const;
         
         void disableVBOAttributes() const;
@@ -946,22 +1348,24 @@ namespace Game
     //TODO this to take double as a template parameter
     template <unsigned int factor> float targetGetScale_linearFactor(double alive_time);
 
+    // Position changers describe the target motion in closed form, position is evaluated directly
+    // from the time since spawn, so it doesn't depend on the frame rate and can be computed lazily.
     struct PosChanger
     {
-        glm::vec3 m_pos;
+        glm::vec3 m_pos; // spawn position
 
         PosChanger(glm::vec3 init_pos) : m_pos(init_pos) {}
         virtual ~PosChanger() = default;
 
-        virtual void updatePos(glm::vec3 size, double alive_time) {}
+        virtual glm::vec3 getPos(double alive_time) const { return m_pos; }
     };
 
+    // linear motion bouncing inside the axis-aligned area, a triangle wave per axis
     struct PosChanger_float : PosChanger
     {
         glm::vec3 m_dir;
         glm::vec3 m_area_pos;
         glm::vec2 m_area_size;
-        float m_prev_alive_time;
         float m_speed;
 
         struct Params { glm::vec2 area_size; glm::vec3 area_pos_offset; float speed; };
@@ -969,7 +1373,9 @@ namespace Game
         PosChanger_float(glm::vec3 init_pos, glm::vec3 dir, glm::vec3 spawn_area_pos, glm::vec2 spawn_area_size, Params params);
         ~PosChanger_float() = default;
 
-        virtual void updatePos(glm::vec3 size, double alive_time) override;
+        static float bounceAxis(float init_pos, float velocity, float low, float high, double alive_time);
+
+        virtual glm::vec3 getPos(double alive_time) const override;
     };
 
     enum class TargetType { target, ball };
@@ -1005,13 +1411,11 @@ namespace Game
 
         float getScale(double time) const;
 
-        void updatePos(double current_frame_time);
-
-        glm::vec3 getPos() const;
+        glm::vec3 getPos(double current_frame_time) const;
 
-        void draw(Game::TargetType type, const Drawing::Camera3D& camera,
-                  const std::vector<std::reference_wrapper<const Lighting::Light>>& lights,
-                  float gamma, double current_frame_time, glm::vec3 pos_offset = glm::vec3(0.f)) const;
+        // flat targets scale only in the wall plane, balls in all directions
+        void setTransform(Game::TargetType type, TransformBatch& transforms, TransformBatch::Id id,
+                          double current_frame_time, glm::vec3 pos_offset = glm::vec3(0.f)) const;
     };
 
     struct LevelPart
@@ -1084,21 +1488,28 @@ namespace Game
 }
 
 //loop_data.cpp
-enum class LoopRetVal { exit, ok, popTop };
+enum class LoopRetVal { exit, ok, popTop, unchanged }; // unchanged - ok, but nothing was drawn, nothing to present
 
 struct LoopData // vtable + pointer to data itself
 {
     typedef int         (InitFnPtr)         (void *data);
     typedef void        (DeinitFnPtr)       (void *data);
     typedef LoopRetVal  (LoopCallbackFnPtr) (void *data, unsigned int global_tick, double frame_time, float frame_delta);
+    typedef void        (SimTickFnPtr)      (void *data, unsigned int sim_tick, double sim_time, float sim_delta);
 
     std::unique_ptr<unsigned char[]> m_raw_data;
 
     InitFnPtr *m_init_fn;
     DeinitFnPtr *m_deinit_fn;
     LoopCallbackFnPtr *m_loop_callback_fn;
-
-    LoopData(size_t data_size, InitFnPtr *init_fn, DeinitFnPtr *deinit_fn, LoopCallbackFnPtr *loop_callback_fn);
+    SimTickFnPtr *m_sim_tick_fn; // NULL for loops without fixed rate simulation
+    bool m_idle_capable; // loop returns LoopRetVal::unchanged for frames that would look the same, see MainLoopStack
+    double m_sim_rate; // Hz, fixed rate simulation ticks, see MainLoopStack
+    bool m_records_render_commands; // loop draws only through RenderCommands, so the render thread may execute it
+
+    LoopData(size_t data_size, InitFnPtr *init_fn, DeinitFnPtr *deinit_fn, LoopCallbackFnPtr *loop_callback_fn,
+             bool idle_capable, SimTickFnPtr *sim_tick_fn = NULL, double sim_rate = 0.0,
+             bool records_render_commands = false);
     LoopData(LoopData&& other);
     ~LoopData();
 
@@ -1109,6 +1520,7 @@ struct LoopData // vtable + pointer to data itself
     void deinit() const;
     void deinitAndFree();
     LoopRetVal loopCallback(unsigned int global_tick, double frame_time, float frame_delta) const;
+    void simTick(unsigned int sim_tick, double sim_time, float sim_delta) const;
 
     template <typename T>
     static int init_template(void *data)
@@ -1130,10 +1542,18 @@ struct LoopData // vtable + pointer to data itself
         return reinterpret_cast<T*>(data)->loop(global_tick, frame_time, frame_delta);
     }
 
+    template <typename T>
+    static void sim_tick_template(void *data, unsigned int sim_tick, double sim_time, float sim_delta)
+    {
+        // loops without simulation do not even have the method
+        if constexpr (T::sim_rate > 0.0) reinterpret_cast<T*>(data)->simTick(sim_tick, sim_time, sim_delta);
+    }
+
     template <typename T>
     static LoopData createFromType()
     {
-        return LoopData(sizeof(T), init_template<T>, deinit_template<T>, loop_template<T>);
+        return LoopData(sizeof(T), init_template<T>, deinit_template<T>, loop_template<T>, T::idle_capable,
+                        T::sim_rate > 0.0 ? sim_tick_template<T> : NULL, T::sim_rate, T::records_render_commands);
     }
 };
 
@@ -1142,8 +1562,21 @@ class MainLoopStack
     std::vector<LoopData> m_stack;
 
     double m_last_frame_time = -1.f;
+    double m_last_present_time = -1.0;
+    double m_idle_min_refresh_rate;
+    unsigned int m_frames_since_change = 0; // frames since the last push/pop
+
+    double m_sim_start_time = -1.0; // time of the first simulation tick, < 0.0 until the first simulate
+    unsigned int m_sim_ticks = 0; // ticks done since the start
+    float m_sim_alpha = 1.f;
 
 public:
+    static constexpr double default_idle_min_refresh_rate = 4.0; // Hz
+    // frames after a push/pop still create resources lazily and grow their containers, later ones are steady state
+    static constexpr unsigned int steady_state_warmup_frames = 120;
+
+    MainLoopStack();
+
     const LoopData* currentLoopData() const;
 
     LoopData* push(LoopData&& new_data);
@@ -1158,10 +1591,202 @@ public:
 
     void pop();
 
+    // wrap every main loop iteration, beginFrame resets the FrameArena
+    void beginFrame();
+    void endFrame(unsigned int global_tick);
+    bool steadyState() const;
+
+    // Idle rendering - while an idle capable loop is on top, the main loop waits for events instead of spinning
+    // and frames the loop did not draw (LoopRetVal::unchanged) are not presented. A redraw is still forced
+    // at least at the minimal refresh rate, rate <= 0 disables idle rendering.
+    void setIdleMinRefreshRate(double rate);
+    bool idleWaitAllowed() const; // current loop is idle capable
+    double idleWaitTimeout(double time) const; // seconds left until the next forced redraw
+    bool redrawForced(double frame_time) const; // idle capable loops must draw the frame even when unchanged
+    void framePresented(double frame_time);
+
+    // Fixed rate simulation - loops with a non-zero `sim_rate` get their simTick called at that rate, regardless
+    // of the frame rate. simulate runs the ticks that are due by the frame time before the loop callback, at most
+    // max_sim_ticks_per_frame of them, the rest of the time is dropped so slow frames do not spiral into slower ones.
+    // The loop then renders its state interpolated by simAlpha between the last two ticks. Push/pop restarts the ticks.
+    static constexpr unsigned int max_sim_ticks_per_frame = 8;
+    void simulate(const LoopData& loop_data, double frame_time);
+    float simAlpha() const; // 0.0 - state of the previous tick, 1.0 - state of the last tick
+
     static MainLoopStack instance;
 };
 
+//render_graph.cpp
+// Render targets of a frame are declared in a render graph instead of being allocated by hand. Passes declare
+// the targets they draw into (color attachments, depth) and the ones they sample. Compilation computes the lifetime
+// of every transient target and maps targets of the same format with disjoint lifetimes onto the same GL texture
+// or renderbuffer, builds one framebuffer per pass and schedules the resolves. Multisampled targets get resolved
+// into hidden single sample textures before a pass samples them, explicit resolves copy into imported textures.
+// All graphs share one pool of targets of the common target size, setTargetSize reallocates the whole pool at once.
+// Transient targets hold their contents only while their graph runs, so graphs must never run interleaved.
+class RenderGraph
+{
+public:
+    using TargetId = int;
+    using PassId = int;
+    static constexpr int none = -1;
+    static constexpr unsigned int color_attachments_max = 4, reads_max = 4;
+
+    struct TargetDesc
+    {
+        GLenum internalformat;
+        unsigned int samples; // 1 - single sample, only single sample targets can be sampled by passes
+    };
+
+private:
+    enum class TargetKind { transient, imported, backbuffer };
+    struct Target
+    {
+        const char *name;
+        TargetKind kind;
+        TargetDesc desc;
+        GLuint imported_id;
+        // filled by compile
+        bool sampled; // stored in a texture, otherwise in a renderbuffer
+        int first_step, last_step;
+        int pool_idx;
+        TargetId resolved; // single sample copy of a sampled multisampled target
+    };
+
+    enum class StepType { pass, resolve };
+    struct Step
+    {
+        StepType type;
+        const char *name;
+        TargetId colors[color_attachments_max];
+        unsigned int color_amount;
+        TargetId depth;
+        TargetId reads[reads_max];
+        unsigned int read_amount;
+        TargetId src, dst; // resolve only
+        GLuint fbo_id, src_fbo_id; // framebuffer of the pass or of the resolve destination, resolve source framebuffer
+    };
+
+    struct PoolEntry
+    {
+        TargetDesc desc;
+        bool texture;
+        GLuint id; // empty_id - free slot
+        unsigned int users; // compiled graphs mapping some target onto this entry
+        int busy_until; // last step of the latest target mapped onto it, only during compile
+    };
+
+    static std::vector<PoolEntry> m_pool;
+    static glm::ivec2 m_target_size;
+
+    std::vector<Target> m_targets;
+    unsigned int m_declared_target_amount; // the rest got added by compile
+    std::vector<Step> m_declared; // passes and resolves as declared, PassId indexes them
+    std::vector<Step> m_steps; // compiled schedule
+    std::vector<int> m_pass_steps; // schedule step of every declared step
+    std::vector<int> m_used_pool_entries;
+    bool m_compiled;
+    size_t m_next_step;
+    glm::ivec2 m_region;
+
+    static bool allocateEntry(PoolEntry& entry);
+    static void releaseEntry(PoolEntry& entry);
+    static void releaseUnusedEntries();
+
+    GLuint targetId(TargetId target) const;
+    bool attachTarget(GLenum attachment, TargetId target) const;
+    bool buildFramebuffers();
+    void releaseCompiled();
+    void runResolve(const Step& step) const;
+
+public:
+    RenderGraph();
+    RenderGraph(const RenderGraph& other) = delete;
+    RenderGraph& operator=(const RenderGraph& other) = delete;
+    ~RenderGraph();
+
+    // declaration, any change drops the compiled schedule (its pooled targets stay until the next compile)
+    void clear();
+    TargetId addTarget(const char *name, TargetDesc desc);
+    TargetId importTexture(const char *name, const Textures::Texture2D& texture); // persistent, keeps its own size
+    TargetId importBackbuffer(); // OS framebuffer, usable as the only color attachment of a pass or as a resolve source
+    PassId addPass(const char *name, std::initializer_list<TargetId> colors, TargetId depth = none,
+                   std::initializer_list<TargetId> reads = {});
+    void addResolve(const char *name, TargetId src, TargetId dst); // after the previously declared pass
+
+    // (re)allocates the transient targets and framebuffers, unused pool entries are released afterwards
+    bool compile();
+    bool isCompiled() const;
+
+    // Frame - passes run in the declaration order, a skipped pass leaves its targets undefined.
+    // Only the lower left `region` of the targets gets resolved, viewports are left to the caller.
+    void beginFrame(glm::ivec2 region);
+    void beginPass(PassId pass); // runs the resolves scheduled before the pass and binds its framebuffer
+    void finish(); // runs the rest of the schedule, OS framebuffer is bound afterwards
+    void cancel(); // same, but the rest of the schedule is skipped
+    GLuint getTexture(TargetId target) const; // sampled target of the compiled graph (its resolved copy if multisampled)
+
+    static void setTargetSize(glm::ivec2 size);
+    static glm::ivec2 getTargetSize();
+};
+
+//post_process_chain.cpp
+// Chain of post-process effects, each a small GLSL snippet over the functions of postprocess.fspart. Color effects
+// work point-wise on the result of the previous effect, so consecutive ones are fused into one generated fragment
+// shader (postprocess.fs with the POSTPROCESS macro) and cost a single fullscreen pass together. Texture effects
+// sample neighbours of their input, they can only start a pass, the previous pass result is then read from a target.
+// Compiled programs are cached by the signature of their pass (defines and effect names) and shared by all chains.
+class PostProcessChain
+{
+public:
+    enum class Input { color, texture };
+    struct Effect
+    {
+        const char *name; // identifies the snippet in the cache signature
+        Input input;
+        // body of `vec4 f(vec4 color, vec2 tpos)` for color effects, `vec4 f(sampler2D tex, vec2 tpos)` for texture ones
+        const char *snippet;
+    };
+
+    static const Effect grayscale, dither, dither_gray_mix;
+
+private:
+    struct CachedProgram
+    {
+        std::string signature;
+        std::unique_ptr<Shaders::Program> program;
+    };
+    static std::vector<CachedProgram> m_cache;
+
+    std::vector<Shaders::IncludeDefine> m_defines;
+    std::vector<Effect> m_effects;
+    std::vector<const Shaders::Program*> m_pass_programs;
+
+    static const Shaders::Program* findProgram(const std::string& signature);
+
+public:
+    // macros for the snippets and postprocess.fspart (e.g. DITHER_ON_COLOR), same for all passes
+    void define(const char *name, const char *value = NULL);
+    void add(const Effect& effect);
+
+    // splits the chain into passes and fetches their programs, false when some program fails to compile
+    bool compile();
+    bool isCompiled() const;
+    unsigned int passAmount() const;
+    // pass program of postprocess.fs, drawn with fullscreen.vs, takes `inputTexture` and `rectSize` uniforms
+    const Shaders::Program& passProgram(unsigned int pass) const;
+
+    static void clearCache(); // before the OpenGL context goes away
+};
+
 //shared_gl_context.cpp
+#ifndef USE_DEFERRED_SHADING
+    #ifdef BUILD_OPENGL_330_CORE
+        // needs multiple render targets and float textures, on OpenGLES 2.0 the scene is always shaded forward
+        #define USE_DEFERRED_SHADING
+    #endif
+#endif
+
 struct SharedGLContext
 {
     //VBOs and Meshes
@@ -1173,50 +1798,710 @@ struct SharedGLContext
     //3D Framebuffer
 private:
     static constexpr GLenum fbo3d_rbo_color_internalformat = GL_RGB565;
-    Textures::Texture2D fbo3d_conv_tex;
-    GLuint fbo3d_rbo_color;
     #ifdef USE_COMBINED_FBO_BUFFERS
-        GLuint fbo3d_rbo_depth_stencil;
+        static constexpr GLenum fbo3d_rbo_depth_internalformat = GL_DEPTH_STENCIL;
     #else
-        GLuint fbo3d_rbo_depth; 
-        GLuint fbo3d_rbo_stencil;
+        // no stencil, separate stencil renderbuffer does not work on nvidia
+        static constexpr GLenum fbo3d_rbo_depth_internalformat = GL_DEPTH_COMPONENT16;
     #endif
-    Drawing::FrameBuffer fbo3d_unconv, fbo3d_conv;
+    Textures::Texture2D fbo3d_conv_tex; // the only persistent target, everything else is transient in the render graphs
     unsigned int fbo3d_samples;
-    glm::ivec2 fbo3d_unconv_size;
+    float fbo3d_render_scale; // part of the targets actually rendered into, they are always allocated at full size
+    unsigned int fbo3d_freeze_count;
+    glm::vec2 fbo3d_frozen_region; // texture region of the frozen frame, render settings might change meanwhile
+    std::optional<glm::ivec2> fbo3d_pending_size; // resize requested while frozen
+
+    // scene graph - optional G-buffer pass, then the scene pass into fbo3d (or the OS framebuffer) resolved into fbo3d_conv
+    RenderGraph scene_graph;
+    RenderGraph::PassId scene_pass;
+    bool scene_graph_fbo3d, scene_graph_deferred; // render settings the scene graph is built for
+    // frozen frame postprocessing - one pass per PostProcessChain pass, each reading the result of the previous one,
+    // the last target aliases the scene color target of the same format and the intermediate ones alias each other
+    RenderGraph postprocess_graph;
+    std::vector<RenderGraph::PassId> postprocess_passes;
+    std::vector<RenderGraph::TargetId> postprocess_inputs;
+
+    bool buildSceneGraph(bool use_fbo3d, bool deferred);
+    bool buildPostprocessGraph(unsigned int pass_amount);
+
+    //G-buffer for deferred shading, transient targets of the scene graph
+    #ifdef USE_DEFERRED_SHADING
+        enum GBufferTarget { gbuffer_diffuse = 0, gbuffer_specular, gbuffer_normal, gbuffer_depth, gbuffer_target_amount };
+        static constexpr GLenum gbuffer_internalformats[gbuffer_target_amount] = { GL_RGBA8, GL_RGBA8, GL_RGBA16F,
+                                                                                   GL_DEPTH_COMPONENT24 };
+        RenderGraph::TargetId gbuffer_targets[gbuffer_target_amount];
+        RenderGraph::PassId gbuffer_pass;
+    #endif
 public:
     struct RenderSettings
     {
         bool use_fbo3d, use_msaa, enable_gamma_correction, use_v_sync; //FIXME v-sync in pause menu
+        bool use_dynamic_resolution; // has effect only with use_fbo3d
+        bool use_deferred_shading; // has effect only with OpenGL 3.3, MSAA then applies only to the forward drawn objects
+        bool use_depth_prepass; // automatic, DepthPrepass runs it only while the overdraw is high, ignored with deferred shading
         static constexpr float default_gamma_coef = 2.2f;
         float gamma_coef;
 
-        RenderSettings(bool use_fbo3d, bool use_msaa, bool enable_gamma_correction, bool use_v_sync)
+        RenderSettings(bool use_fbo3d, bool use_msaa, bool enable_gamma_correction, bool use_v_sync, bool use_dynamic_resolution,
+                       bool use_deferred_shading, bool use_depth_prepass)
             : use_fbo3d(use_fbo3d), use_msaa(use_msaa), enable_gamma_correction(enable_gamma_correction),
-              use_v_sync(use_v_sync), gamma_coef(default_gamma_coef) {}
+              use_v_sync(use_v_sync), use_dynamic_resolution(use_dynamic_resolution),
+              use_deferred_shading(use_deferred_shading), use_depth_prepass(use_depth_prepass),
+              gamma_coef(default_gamma_coef) {}
+
+        // compared member by member, the struct has padding bytes
+        bool operator==(const RenderSettings& other) const
+        {
+            return use_fbo3d == other.use_fbo3d && use_msaa == other.use_msaa &&
+                   enable_gamma_correction == other.enable_gamma_correction && use_v_sync == other.use_v_sync &&
+                   use_dynamic_resolution == other.use_dynamic_resolution &&
+                   use_deferred_shading == other.use_deferred_shading && use_depth_prepass == other.use_depth_prepass &&
+                   gamma_coef == other.gamma_coef;
+        }
     };
     RenderSettings render_settings, render_settings_default;
 
     SharedGLContext(unsigned int init_width, unsigned int init_height, unsigned int fbo3d_samples, const RenderSettings render_settings);
-    ~SharedGLContext();
 
     bool isInitialized() const;
 
-    glm::ivec2 getFbo3DSize(bool converted) const;
+    glm::ivec2 getFbo3DSize() const;
 
+    // 3D scene is rendered into the lower left `getFbo3DRenderSize` sub-rect of fbo3d and stays there after conversion,
+    // scale is clamped into <DynamicResolution::min_scale, 1> and changing it never reallocates anything
+    void setFbo3DRenderScale(float scale);
+    float getFbo3DRenderScale() const;
+    glm::ivec2 getFbo3DRenderSize() const; // always the full size when rendering into OS framebuffer (!use_fbo3d)
+    glm::vec2 getFbo3DTextureRegion() const; // render size relative to fbo3d_conv texture, for sampling it
+
+    // resizes fbo3d_conv and all render graph targets
     void changeFbo3DSize(unsigned int new_width, unsigned int new_height);
 
-    bool convertFbo3D() const; // resolves fbo3d_conv from unconverted internal fbo3d
-    void saveToFbo3DFromExternal(GLuint external_fbo_id); // saves data into fbo3d_conv from external fbo
-    // this calls either `convertFbo3D` or `saveToFbo3DFromExternal` based on given parameters
-    bool stageFbo3D(std::optional<GLuint> external_fbo_id_used);
+    // Freezing keeps the last staged 3D frame in fbo3d_conv, so menus can borrow its texture instead of copying it.
+    // Staging is skipped and resizes are postponed until the last unfreeze (freezes can nest).
+    void freezeFbo3D();
+    void unfreezeFbo3D();
+    bool isFbo3DFrozen() const;
+    // runs a compiled post-process chain over the frozen frame once and stores the result back into fbo3d_conv,
+    // its last render target is aliased with the idle scene color target, so a single pass chain allocates nothing
+    bool postprocessFrozenFbo3D(const PostProcessChain& chain);
+
+    // Scene frame - beginScene rebuilds the scene graph when use_fbo3d or use_deferred_shading changed, falling back
+    // to forward shading and then to the OS framebuffer (updating the render settings) when targets can't be allocated.
+    void beginScene();
+    // binds fbo3d or the OS framebuffer for the forward drawn scene (viewport is left to the caller)
+    void beginScenePass();
+    // resolves the rendered sub-rect into fbo3d_conv and ends the scene frame, the resolve is skipped while frozen
+    bool stageFbo3D();
 
     const Textures::Texture2D& getFbo3DTexture() const;
-    const Drawing::FrameBuffer& getFbo3D(bool converted) const;
+
+    // state changes and passes that can be recorded into RenderCommands
+    struct ResizeFbo3DCommand
+    {
+        unsigned int width, height;
+        static void execute(const ResizeFbo3DCommand& command);
+    };
+    struct SwapIntervalCommand
+    {
+        int interval;
+        static void execute(const SwapIntervalCommand& command);
+    };
+    struct StageFbo3DCommand
+    {
+        static void execute(const StageFbo3DCommand& command);
+    };
+
+    // Deferred shading: opaque objects are drawn with a GBUFFER_PASS variant of light.fs into the G-buffer, then one
+    // fullscreen DEFERRED_LIGHTING pass shades every pixel once, so the lighting cost does not grow with the overdraw.
+    // The lighting pass also writes the scene depth, objects drawn forward afterwards (targets, skybox) test against it.
+    #ifdef USE_DEFERRED_SHADING
+        static constexpr unsigned int gbuffer_texture_unit_first = 5; // after the material maps and ClusteredLighting buffers
+
+        // binds the G-buffer for the geometry pass and clears its depth (viewport is left to the caller),
+        // only with use_deferred_shading still set after beginScene, the pass goes before beginScenePass
+        void beginGBufferPass();
+        // fullscreen pass of a DEFERRED_LIGHTING shader into the currently bound framebuffer and viewport,
+        // camera and light uniforms are set by the caller, pixels without any geometry are left untouched
+        void drawDeferredLighting(const Shaders::Program& shader, glm::ivec2 viewport_size) const;
+    #endif
 
     static std::optional<SharedGLContext> instance;
 };
 
+//dynamic_resolution.cpp
+// Keeps the GPU frame time under a budget by scaling the 3D scene render size of SharedGLContext in fixed steps.
+// Cost of the 3D pass is roughly proportional to the pixel count, so big overshoots jump several steps down at once,
+// while going back up is always done one step at a time and only with a clear headroom (hysteresis).
+// Needs GPU timer queries, on OpenGLES 2.0 the scene is always rendered at full resolution.
+class DynamicResolution
+{
+public:
+    static constexpr float min_scale = 0.5f, max_scale = 1.f, scale_step = 0.05f;
+    static constexpr float default_budget_ms = 14.f; // 60 Hz with some headroom for the rest of the frame
+
+private:
+    static constexpr float smoothing = 0.2f; // weight of the newest GPU frame time
+    static constexpr float upscale_threshold = 0.8f; // part of the budget the predicted time must fit in to scale up
+    static constexpr unsigned int settle_frames = 8; // GPU timings lag a few frames behind, wait for the new scale to show
+
+    static float m_budget_ms;
+    static float m_smoothed_gpu_ms;
+    static unsigned int m_frames_since_change;
+
+public:
+    static void setBudget(float budget_ms);
+    static float getBudget();
+
+    // feeds the latest GPU frame time (negative when unknown) and applies the new scale to SharedGLContext,
+    // restores full resolution when disabled in its render settings
+    static void update(float gpu_frame_ms);
+};
+
+//frame_pacing.cpp
+// Low latency frame pacing of the desktop main loop. Drivers queue several swapped frames ahead, each of them delays
+// what the player sees of the input. In the latency mode the main thread waits for a fence placed after the previous
+// swap before it polls the input, so at most one frame is in flight. With V-Sync it then also sleeps until the
+// predicted vblank minus the predicted frame work, so the input gets sampled as late as possible.
+// The fence wait that blocks ends at the flip, that gives the vblank phase, the interval is the monitor refresh rate.
+// Input-to-submit latency (input polled -> GL commands of the frame submitted) is measured in any mode.
+// Fences need OpenGL 3.3, on OpenGLES 2.0 (web) the latency is only measured.
+class FramePacing
+{
+public:
+    static constexpr float safety_margin_ms = 1.5f; // sleeping ends this much sooner than the prediction says
+    static constexpr uint32_t history_size = 512; // latencies for the percentiles, must be power of 2
+
+private:
+    static constexpr float work_smoothing = 0.1f; // weight of a shorter frame, longer ones are taken right away
+    static constexpr float max_lead_ratio = 0.8f; // of the refresh interval, sleeping is pointless with longer frames
+    static constexpr uint64_t fence_timeout_ns = 100000000; // 100 ms
+
+    static bool m_enabled;
+    #ifdef BUILD_OPENGL_330_CORE
+        static GLsync m_fence;
+    #endif
+    static double m_refresh_interval; // in seconds
+    static double m_last_vblank_time; // negative until a fence wait blocked
+    static double m_input_time; // of the current frame, negative when not sampled
+    static float m_predicted_work_ms, m_last_sleep_ms;
+
+    static float m_latency_history[history_size];
+    static uint32_t m_latency_write_idx;
+    static double m_latency_sum_ms;
+    static float m_latency_max_ms;
+
+    static float recentPercentile(float p);
+
+public:
+    static void setEnabled(bool enabled); // takes the refresh rate of the primary monitor
+    static bool isEnabled();
+
+    static void waitForInput(bool v_sync); // right before polling the input, does nothing unless enabled
+    static void inputSampled(double time);
+    static void frameSubmitted(double time, bool loop_changed); // right before the swap, loop_changed skips the prediction
+    static void framePresented(); // right after the swap, places the fence
+    static void reset(); // drops the fence, before the context changes hands or goes away
+
+    static float lastLatencyMs();
+
+    static void drawOverlay(nk_context *ctx, struct nk_rect bounds);
+    static bool exportJSON(const char *path);
+};
+
+//depth_prepass.cpp
+// Depth-only pre-pass of the opaque objects drawn with the light shader. The lit pass then tests with GL_EQUAL and
+// does not write depth, so light.fs runs once per visible sample instead of once per rasterized one. The geometry
+// is drawn twice though, so in the automatic mode the pre-pass runs only while the overdraw is high.
+// Overdraw is estimated with GL_SAMPLES_PASSED queries of the opaque pass that tests with GL_LESS (the pre-pass when
+// it runs, otherwise the lit pass), read back `query_latency` frames later without waiting for the GPU.
+// There are no occlusion queries on OpenGLES 2.0, so there the pre-pass runs only when forced.
+class DepthPrepass
+{
+public:
+    static constexpr unsigned int query_latency = 4;
+    // shaded samples per viewport sample, the gap between the two keeps it from toggling every few frames
+    static constexpr float enable_overdraw = 1.6f, disable_overdraw = 1.3f;
+
+private:
+    static constexpr float smoothing = 0.2f; // weight of the newest estimate
+    static constexpr unsigned int settle_frames = 8; // estimates lag a few frames behind, wait after every change
+
+    static bool m_initialized, m_forced, m_enabled, m_active, m_measuring; // enabled - considered this frame, measured
+    static GLuint m_queries[query_latency];
+    static GLuint m_viewport_samples[query_latency]; // what the query of that frame gets divided by, 0 when not issued
+    static unsigned int m_frame_idx, m_frames_since_change;
+    static float m_overdraw; // smoothed, negative when unknown
+
+    static void readBack(unsigned int slot);
+
+public:
+    // needs current OpenGL context, returns false when occlusion queries are not supported (OpenGLES 2.0)
+    static bool init();
+    static void deinit();
+
+    // runs the pre-pass every frame regardless of the render settings and the overdraw (benchmarking)
+    static void setForced(bool forced);
+
+    // once per frame before the 3D pass, `forward` is false when the opaque objects are not drawn by the light shader
+    // this frame (deferred shading), returns whether they get the pre-pass
+    static bool update(bool forward);
+
+    // wraps the opaque pass that tests with GL_LESS, at most once per frame, the framebuffer must be already bound
+    static void beginMeasure(glm::ivec2 viewport_size);
+    static void endMeasure();
+};
+
+//batch2d.cpp
+// Collects 2D quads (textured rectangles, lines expanded into thick quads) in one streaming buffer and draws them
+// with a single draw call per shader/texture/screen resolution change, the Drawing 2D helpers only queue into it.
+// Coordinates are in pixels with the origin at the top left. Quads stay pending until `flush`, which the callers
+// must do before drawing anything else on top of them (e.g. the UI).
+class Batch2D
+{
+public:
+    struct Vertex
+    {
+        GLfloat pos[2];
+        GLfloat uv[2];
+        GLfloat uv_max[2]; // texcoords get clamped to this, keeps bilinear filtering inside of a texture sub-region
+        GLubyte color[4];
+    };
+
+    static constexpr unsigned int max_quads = 1024; // flushed earlier when full
+
+private:
+    static bool m_initialized;
+    static GLuint m_vbo_id, m_ebo_id;
+    #ifdef USE_VAO
+        static std::optional<Meshes::VAO> m_vao;
+    #endif
+    static std::optional<Shaders::Program> m_default_shader;
+    static std::optional<Textures::Texture2D> m_white_texture;
+    static std::vector<Vertex> m_vertices; // pending quads, 4 vertices each
+
+    // state shared by all pending quads
+    static const Shaders::Program *m_shader;
+    static GLuint m_texture_id;
+    static glm::vec2 m_screen_res;
+
+    static void prepare(const Shaders::Program& shader, GLuint texture_id, glm::vec2 screen_res);
+    static void quad(const glm::vec2 pos[4], const glm::vec2 uv[4], glm::vec2 uv_max, ColorF color);
+
+    static void setupVBOAttributes();
+    static void disableVBOAttributes();
+
+public:
+    static bool init();
+    static void deinit();
+    static bool isInitialized();
+
+    // batch2d.vs + tex-rect.fs, sampled texture multiplied by the vertex color
+    static const Shaders::Program& getDefaultShader();
+
+    // `uv_top_left`/`uv_bottom_right` are the texcoords of the rectangle corners
+    static void rect(const Shaders::Program& shader, const Textures::Texture2D& texture, glm::vec2 screen_res,
+                     glm::vec2 pos, glm::vec2 size, glm::vec2 uv_top_left, glm::vec2 uv_bottom_right,
+                     glm::vec2 uv_max, ColorF color = ColorF(1.f, 1.f, 1.f));
+    static void line(glm::vec2 screen_res, glm::vec2 v1, glm::vec2 v2, float thickness, ColorF color);
+
+    static void flush();
+};
+
+//clustered_lighting.cpp
+#ifdef USE_CLUSTERED_LIGHTING
+    // Clustered forward lighting. The view frustum is split into clusters (screen tiles times exponentially growing
+    // depth slices) and every frame each light with a limited range is assigned to the clusters its bounding sphere
+    // touches. light.fs built with CLUSTERED_LIGHTING then shades only the lights of its fragment's cluster, plus
+    // the global lights (directional ones and those without attenuation) that reach every fragment.
+    // Light data, per cluster light lists and their indices are uploaded in texture buffers.
+    class ClusteredLighting
+    {
+    public:
+        static constexpr unsigned int grid_x = 16, grid_y = 9, grid_z = 24;
+        static constexpr unsigned int cluster_amount = grid_x * grid_y * grid_z;
+        static constexpr unsigned int max_lights = 128; // global and clustered together, must be a multiple of 64
+        static constexpr unsigned int max_global_lights = 8;
+        static constexpr unsigned int max_light_indices = 32 * 1024; // sum of all per cluster list lengths
+        static constexpr unsigned int texture_unit_first = 2; // units 0 and 1 are taken by the material maps
+
+    private:
+        enum BufferIdx { buffer_lights = 0, buffer_grid, buffer_indices, buffer_amount };
+        static constexpr unsigned int mask_words = max_lights / 64;
+
+        static bool m_initialized;
+        static GLuint m_buffer_ids[buffer_amount], m_texture_ids[buffer_amount];
+
+        // view space bounds of the clusters and bitmasks of their lights, kept as structures of arrays,
+        // so that the assignment loops get vectorized
+        static float m_bounds_min[3][cluster_amount], m_bounds_max[3][cluster_amount];
+        static uint64_t m_light_masks[mask_words][cluster_amount];
+        static glm::mat4 m_bounds_proj; // projection the bounds were computed for
+        static float m_near, m_far;
+
+        static std::vector<glm::vec4> m_light_texels;
+        static std::vector<GLuint> m_grid; // offset and length of the light list of every cluster
+        static std::vector<GLushort> m_light_indices;
+
+        static glm::mat4 m_view_proj;
+        static unsigned int m_global_amount, m_light_amount; // in the light buffer
+        static unsigned int m_accepted_amount; // lights of the last update that were not dropped because of the limits
+        static bool m_overflow_reported;
+
+        static void computeBounds(const glm::mat4& proj);
+        static void upload(BufferIdx idx, const void *data, size_t bytes, size_t capacity);
+
+    public:
+        static bool init();
+        static void deinit();
+        static bool isInitialized();
+
+        // assigns the lights to the clusters of this camera and uploads everything, once per frame before drawing
+        static void update(const Drawing::Camera3D& camera, const Lighting::LightRefs& lights);
+        // binds the lights of the last update to a shader built with CLUSTERED_LIGHTING,
+        // returns amount of the lights that fit into the limits (culled ones included, those are just not visible)
+        static int bind(const Shaders::Program& shader);
+
+        static unsigned int getLightAmount();
+        static unsigned int getLightIndexAmount();
+    };
+#endif /* USE_CLUSTERED_LIGHTING */
+
+//frame_stats.cpp
+namespace Profiling
+{
+    // Per-frame timing statistics for the whole session. Keeps a ring buffer of recent frames (for graphs)
+    // and a log-bucket histogram of all frames (HDR histogram style, ~3% precision), which gives percentiles
+    // without storing every sample. Written only from the main loop thread, readers only copy the ring.
+    class FrameStats
+    {
+    public:
+        struct Sample
+        {
+            float frame_ms; // time between frame starts, this is what the player sees
+            float cpu_ms;   // CPU time spent producing the frame
+            float gpu_ms;   // GPU time of the frame, negative when not measured
+        };
+
+        struct Report
+        {
+            float avg_ms, p50_ms, p95_ms, p99_ms, max_ms;
+            unsigned int frame_count, hitch_count;
+        };
+
+        static constexpr uint32_t history_size = 512; // must be power of 2
+        static constexpr unsigned int sparkline_samples = 128;
+        static constexpr float default_hitch_threshold_ms = 50.f;
+
+    private:
+        // histogram values are in microseconds, first `sub_bucket_count` buckets are linear (1us wide),
+        // every following power of 2 range is split into `sub_bucket_count / 2` equally wide buckets
+        static constexpr uint32_t sub_bucket_bits = 6, sub_bucket_count = 1 << sub_bucket_bits;
+        static constexpr uint32_t histogram_max_us = 1u << 24; // ~16.7s, longer frames get clamped
+        static constexpr uint32_t histogram_size = sub_bucket_count + (24 - sub_bucket_bits) * (sub_bucket_count / 2);
+
+        Sample m_history[history_size];
+        std::atomic<uint32_t> m_write_idx;
+        uint32_t m_histogram[histogram_size];
+        double m_frame_ms_sum;
+        float m_max_ms, m_hitch_threshold_ms;
+        unsigned int m_frame_count, m_hitch_count;
+
+        static uint32_t bucketIndex(uint32_t value_us);
+        static uint32_t bucketUpperValue(uint32_t idx);
+
+        float percentile(float p) const;
+
+    public:
+        FrameStats(float hitch_threshold_ms = default_hitch_threshold_ms);
+        ~FrameStats() = default;
+
+        void reset();
+        void addFrame(float frame_ms, float cpu_ms, float gpu_ms = -1.f);
+
+        Report getReport() const;
+        float getRecentFPS(unsigned int frame_amount = 30) const;
+        // copies up to `max_amount` most recent samples (oldest first) and returns their amount
+        unsigned int copyRecent(Sample *out, unsigned int max_amount) const;
+
+        void drawOverlay(nk_context *ctx, struct nk_rect bounds) const;
+
+        bool exportCSV(const char *path) const;
+        bool exportJSON(const char *path) const;
+
+        static FrameStats instance;
+    };
+}
+
+//cpu_profiler.cpp
+// CPU timing macros, they compile to nothing unless the build defines ENABLE_PROFILER.
+// PROFILE_SCOPE times until the end of the enclosing block, PROFILE_BEGIN/PROFILE_END are for flat sections
+// of long functions and must be paired within the same function. Names must be string literals (only the pointer is kept).
+#ifdef ENABLE_PROFILER
+    #define PROFILE_CONCAT_INNER(a, b) a##b
+    #define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+    #define PROFILE_SCOPE(name) Profiling::CpuScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+    #define PROFILE_BEGIN(name) Profiling::CpuProfiler::beginScope(name)
+    #define PROFILE_END() Profiling::CpuProfiler::endScope()
+    #define PROFILE_FRAME_MARK() Profiling::CpuProfiler::markFrame()
+#else
+    #define PROFILE_SCOPE(name) ((void)0)
+    #define PROFILE_BEGIN(name) ((void)0)
+    #define PROFILE_END() ((void)0)
+    #define PROFILE_FRAME_MARK() ((void)0)
+#endif /* ENABLE_PROFILER */
+
+namespace Profiling
+{
+    // Hierarchical CPU profiler, every thread writes finished scopes into its own ring buffer (no locking
+    // on the hot path), the buffers are only read for the UI table and for Chrome trace export.
+    class CpuProfiler
+    {
+    public:
+        struct Event
+        {
+            const char *name;
+            int64_t start_ns, end_ns; // relative to profiler start
+            uint32_t depth, frame;
+        };
+
+        struct ScopeStats
+        {
+            const char *name;
+            float avg_ms; // smoothed inclusive time per frame
+            float calls;  // smoothed amount of calls per frame
+        };
+
+        static constexpr uint32_t events_per_thread = 1 << 16; // must be power of 2
+        static constexpr uint32_t depth_max = 64; // deeper scopes are not recorded
+        static constexpr unsigned int scope_stats_max = 64;
+
+    private:
+        struct ThreadBuffer
+        {
+            Event m_events[events_per_thread];
+            std::atomic<uint32_t> m_write_idx{0};
+            uint32_t m_depth = 0, m_thread_id = 0;
+            // currently open scopes
+            const char *m_open_names[depth_max];
+            int64_t m_open_starts[depth_max];
+        };
+
+        static std::vector<std::unique_ptr<ThreadBuffer>> m_thread_buffers; // guarded by registry mutex
+        static std::atomic<uint32_t> m_frame;
+        static ScopeStats m_scope_stats[scope_stats_max];
+        static unsigned int m_scope_stats_amount;
+
+        // trace capture request, written once the last requested frame finishes
+        static const char *m_trace_path;
+        static uint32_t m_trace_first_frame, m_trace_frame_amount;
+
+        static ThreadBuffer& threadBuffer();
+        static void updateScopeStats(uint32_t finished_frame);
+
+    public:
+        static int64_t now();
+
+        static void beginScope(const char *name);
+        static void endScope();
+
+        static void markFrame(); // called once at the start of every main loop iteration
+        static uint32_t currentFrame();
+
+        static void requestTrace(const char *path, uint32_t first_frame, uint32_t frame_amount);
+        static bool writeTrace(const char *path, uint32_t first_frame, uint32_t last_frame);
+
+        // top `top_amount` scopes by smoothed inclusive time (main thread only)
+        static void drawTopScopes(nk_context *ctx, struct nk_rect bounds, unsigned int top_amount);
+    };
+
+    struct CpuScope
+    {
+        CpuScope(const char *name) { CpuProfiler::beginScope(name); }
+        ~CpuScope() { CpuProfiler::endScope(); }
+
+        CpuScope(const CpuScope&) = delete;
+        CpuScope& operator=(const CpuScope&) = delete;
+    };
+}
+
+//gpu_profiler.cpp
+// GPU pass timing macros, compiled in together with the CPU profiler. OpenGLES 2.0 has no timer queries,
+// so there they compile to nothing as well. GPU scopes can nest, names must be string literals.
+// GPU_PROFILE_BEGIN/GPU_PROFILE_END are the flat variant, paired the same way as PROFILE_BEGIN/PROFILE_END.
+// Whole frame GPU time is measured in every OpenGL 3.3 build, as DynamicResolution is driven by it.
+#if defined(ENABLE_PROFILER) && defined(BUILD_OPENGL_330_CORE)
+    #define GPU_PROFILE_SCOPE(name) Profiling::GpuScope PROFILE_CONCAT(gpu_profile_scope_, __LINE__)(name)
+    #define GPU_PROFILE_BEGIN(name) Profiling::GpuProfiler::beginScope(name)
+    #define GPU_PROFILE_END() Profiling::GpuProfiler::endScope()
+#else
+    #define GPU_PROFILE_SCOPE(name) ((void)0)
+    #define GPU_PROFILE_BEGIN(name) ((void)0)
+    #define GPU_PROFILE_END() ((void)0)
+#endif
+#ifdef BUILD_OPENGL_330_CORE
+    #define GPU_PROFILE_FRAME_BEGIN() Profiling::GpuProfiler::beginFrame()
+    #define GPU_PROFILE_FRAME_END() Profiling::GpuProfiler::endFrame()
+#else
+    #define GPU_PROFILE_FRAME_BEGIN() ((void)0)
+    #define GPU_PROFILE_FRAME_END() ((void)0)
+#endif
+
+namespace Profiling
+{
+    // Times render passes on the GPU using GL_TIMESTAMP queries. Every frame in flight has its own set of query
+    // objects, results are read back `frame_latency` frames later without waiting (frames that are still not
+    // finished by then get dropped), so the profiler never stalls the pipeline.
+    class GpuProfiler
+    {
+    public:
+        struct PassStats
+        {
+            const char *name;
+            uint32_t depth;
+            float last_ms, avg_ms, max_ms; // avg_ms is smoothed over recent frames
+            double total_ms;
+            unsigned int frame_count, last_seen; // last_seen is the measured frame the pass was last part of
+        };
+
+        static constexpr unsigned int frame_latency = 4;
+        static constexpr unsigned int scopes_per_frame_max = 32; // including the whole frame scope
+        static constexpr unsigned int depth_max = 16;
+        static constexpr unsigned int pass_stats_max = 32;
+
+    private:
+        struct FrameQueries
+        {
+            GLuint m_queries[scopes_per_frame_max * 2]; // start and end timestamp of every scope
+            const char *m_names[scopes_per_frame_max];
+            uint32_t m_depths[scopes_per_frame_max];
+            unsigned int m_scope_amount;
+            bool m_pending; // queries were issued, but not read back yet
+        };
+
+        static bool m_initialized;
+        static FrameQueries m_frames[frame_latency];
+        static unsigned int m_frame_idx;
+        // currently open scopes (indices into current frame's scopes), `scopes_per_frame_max` marks unrecorded ones
+        static unsigned int m_open_scopes[depth_max];
+        static unsigned int m_depth;
+
+        static PassStats m_pass_stats[pass_stats_max];
+        static unsigned int m_pass_stats_amount;
+        static std::atomic<float> m_last_frame_ms; // read by the main thread while the render thread profiles
+        static unsigned int m_measured_frames, m_dropped_frames;
+
+        static bool readBack(const FrameQueries& frame);
+
+    public:
+        // needs current OpenGL context, returns false when timer queries are not supported (OpenGLES 2.0)
+        static bool init();
+        static void deinit();
+
+        static void beginFrame();
+        static void endFrame();
+        static void beginScope(const char *name);
+        static void endScope();
+
+        // GPU time of the whole frame, it lags `frame_latency` frames behind, negative when not measured
+        static float lastFrameMs();
+
+        static void drawPasses(nk_context *ctx, struct nk_rect bounds);
+        static bool exportJSON(const char *path);
+    };
+
+    struct GpuScope
+    {
+        GpuScope(const char *name) { GpuProfiler::beginScope(name); }
+        ~GpuScope() { GpuProfiler::endScope(); }
+
+        GpuScope(const GpuScope&) = delete;
+        GpuScope& operator=(const GpuScope&) = delete;
+    };
+}
+
+//gl_call_stats.cpp
+namespace Profiling
+{
+    // Optional accounting of OpenGL calls. install() swaps the glad function pointers for counting wrappers,
+    // until then (and after uninstall()) the original pointers stay in place, so there is no overhead at all.
+    // Counters are kept per frame, beginFrame() finishes the current frame and starts counting a new one.
+    class GLCallStats
+    {
+    public:
+        static constexpr unsigned int entries_max = 96; // amount of wrapped entry points
+
+        struct FrameCounters
+        {
+            uint32_t calls[entries_max]; // per entry point
+            uint32_t total_calls, draw_calls;
+            uint64_t triangles, upload_bytes; // upload_bytes: buffer/texture uploads, write mapped ranges, texture copies
+        };
+
+        static void install(); // needs loaded glad
+        static void uninstall();
+        static bool isInstalled();
+
+        static void beginFrame();
+        static const FrameCounters& currentFrame();
+        static const FrameCounters& lastFrame();
+
+        static unsigned int entryAmount();
+        static const char *entryName(unsigned int idx);
+
+        static void drawOverlay(nk_context *ctx, struct nk_rect bounds, unsigned int top_amount);
+        static bool exportJSON(const char *path);
+    };
+}
+
+//gpu_memory.cpp
+namespace Profiling
+{
+    // Estimated GPU memory of every live allocation (textures, buffers, renderbuffers), keyed by category
+    // and OpenGL object id. Sizes are only estimates (format * dimensions * samples * mip levels), drivers
+    // are free to pad and compress. Only called from the thread owning the OpenGL context.
+    class GpuMemory
+    {
+    public:
+        enum class Category : unsigned int { texture2d = 0, cubemap, vertex_buffer, ui_buffer, render_target_rbo, render_target_texture,
+                                             amount };
+
+        struct CategoryStats
+        {
+            uint64_t live_bytes, peak_bytes;
+            unsigned int live_allocations;
+        };
+
+    private:
+        struct Allocation
+        {
+            Category category;
+            GLuint id;
+            uint64_t bytes;
+        };
+
+        static std::vector<Allocation> m_allocations;
+        static CategoryStats m_stats[static_cast<unsigned int>(Category::amount)];
+        static uint64_t m_total_live_bytes, m_total_peak_bytes;
+
+    public:
+        // sets the size of given object, replacing its previous allocation (e.g. after resize)
+        static void track(Category category, GLuint id, uint64_t bytes);
+        static void release(Category category, GLuint id);
+
+        static uint64_t estimateBytes(GLenum internal_format, unsigned int width, unsigned int height,
+                                      unsigned int samples = 1, bool mipmaps = false);
+
+        static const char *categoryName(Category category);
+        static CategoryStats getStats(Category category);
+        static uint64_t getTotalLiveBytes();
+        static uint64_t getTotalPeakBytes();
+
+        static void drawOverlay(nk_context *ctx, struct nk_rect bounds);
+        static void printReport(FILE *out);
+    };
+}
+
 //Game loops:
 //main-test.cpp
 struct TestMainLoop //TODO proper deinit of objects
@@ -1264,6 +2549,10 @@ struct TestMainLoop //TODO proper deinit of objects
     unsigned int tick;
     double last_mouse_x, last_mouse_y;
 
+    static constexpr bool idle_capable = false;
+    static constexpr double sim_rate = 0.0; // no fixed rate simulation, everything happens per frame
+    static constexpr bool records_render_commands = false;
+
     int init();
     ~TestMainLoop();
 
@@ -1278,7 +2567,7 @@ struct GameMainLoop
     Drawing::Camera3D camera;
 
     //VBOs and Meshes
-    Meshes::VBO cube_vbo, line_vbo;
+    Meshes::VBO cube_vbo;
     Meshes::Mesh turret_mesh, ball_mesh, rock_mesh, floor_mesh;
     glm::vec2 floor_size;
 
@@ -1295,7 +2584,11 @@ struct GameMainLoop
     // GLuint fbo3d_rbo_depth, fbo3d_rbo_stencil;
 
     //Shaders
-    Shaders::Program screen_line_shader, ui_shader, tex_rect_shader, light_src_shader, light_shader, skybox_shader;
+    Shaders::Program ui_shader, tex_rect_shader, light_src_shader, light_shader, skybox_shader;
+    Shaders::Program depth_shader; // position only, for the depth pre-pass
+    #ifdef USE_DEFERRED_SHADING
+        Shaders::Program gbuffer_shader, deferred_light_shader; // variants of the light shader
+    #endif
 
     //Lighting
     Lighting::DirLight sun;
@@ -1335,18 +2628,74 @@ struct GameMainLoop
     double practice_time_start, practice_time_end;
     std::vector<float> pracice_times;
 
+    //Transforms - matrices of the static scene objects get computed just once, the targets ones when they move
+    enum SceneObject : TransformBatch::Id
+    {
+        scene_cube, scene_turret, scene_ball, scene_default_ball, scene_rock, scene_floor, scene_wall,
+        scene_outlined_ball, scene_ball_outline,
+        scene_object_amount
+    };
+    TransformBatch scene_transforms;
+    TransformBatch target_transforms; // flat targets first, ball targets after them
+
+    //Simulation - shooting, spawning and movement run in simTick, frames draw the state interpolated between the last two ticks
+    glm::vec3 player_pos, last_player_pos;
+    double sim_state_time; // time of the last tick, `player_pos` is the state at that time
+    unsigned int sim_ticks; // all ticks since init, unlike the `sim_tick` that restarts after the pause menu
+    // clicks get aimed by replaying the mouse events in between the frames, the next tick shoots them
+    struct QueuedShot
+    {
+        double time;
+        glm::vec3 dir;
+    };
+    static constexpr unsigned int max_queued_shots = 16; // more clicks than this in one tick are not humanly possible
+    QueuedShot queued_shots[max_queued_shots];
+    unsigned int queued_shot_amount;
+
+    //Drawing - `loop` records the passes, they get executed at submit or by the render thread alongside the next simTicks,
+    // so the commands carry copies of whatever the simulation changes
+    struct TargetDraw
+    {
+        const Meshes::Model *model;
+        Color3F color_tint;
+    };
+    struct DrawSceneCommand
+    {
+        GameMainLoop *loop;
+        Drawing::Camera3D camera; // copy, simTick reads the camera and its getters update the cached matrices
+        const Lighting::Light * const *lights;
+        unsigned int light_amount;
+        const TargetDraw *targets; // same order as in `target_transforms`
+        unsigned int flat_target_amount, ball_target_amount;
+        glm::ivec2 fbo_size;
+
+        static void execute(const DrawSceneCommand& command);
+    };
+    struct DrawOverlayCommand
+    {
+        GameMainLoop *loop;
+        glm::ivec2 fbo_size;
+        ColorF crosshair_color;
+
+        static void execute(const DrawOverlayCommand& command);
+    };
+
     //Misc.
     Color clear_color_3d, clear_color_2d;
     unsigned int tick, last_global_tick;
-    double fps_calculation_interval, last_fps_calculation_time;
-    unsigned int fps_calculation_counter, fps_calculated;
+    bool show_frame_stats;
     glm::vec2 last_mouse_posF;
     bool last_left_mbutton, last_right_mbutton;
-    int last_esc_state, last_c_state, last_v_state;
+    int last_esc_state, last_c_state, last_v_state, last_f3_state, last_f4_state;
+
+    static constexpr bool idle_capable = false;
+    static constexpr double sim_rate = 120.0; // Hz
+    static constexpr bool records_render_commands = true; // see the Drawing commands above
 
     int init();
     ~GameMainLoop();
 
+    void simTick(unsigned int sim_tick, double sim_time, float sim_delta);
     LoopRetVal loop(unsigned int global_tick, double frame_time, float frame_delta);
 
 private:
@@ -1377,16 +2726,19 @@ private:
     unsigned int getTargetsAlive() const;
     void handleTargetHit(double current_frame_time);
     bool updateMuzzleFlashLightProps(double current_frame_time);
+    void consumeMouseEvents(double up_to_time);
+    void drawScene(const DrawSceneCommand& command);
+    void drawOverlay(const DrawOverlayCommand& command);
 };
 
 //main-menu.cpp
 struct GamePauseMainLoop
 {
-    //Textures
-    Textures::Texture2D background_tex;
+    //Background - frozen fbo3d_conv of SharedGLContext, grayed out once in init
+    bool background_frozen;
 
     //Shaders
-    Shaders::Program screen_line_shader, ui_shader, gray_tex_rect_shader;
+    Shaders::Program ui_shader, tex_rect_shader;
 
     //UI
     unsigned int textbuffer[UNICODE_TEXTBUFFER_LEN];
@@ -1398,6 +2750,11 @@ struct GamePauseMainLoop
     Color clear_color;
     unsigned int tick, last_global_tick;
     int last_esc_state;
+    uint64_t last_ui_hash;
+
+    static constexpr bool idle_capable = true; // redraws only when the UI changes
+    static constexpr double sim_rate = 0.0;
+    static constexpr bool records_render_commands = false;
 
     int init();
     ~GamePauseMainLoop();
@@ -1405,10 +2762,10 @@ struct GamePauseMainLoop
     LoopRetVal loop(unsigned int global_tick, double frame_time, float frame_delta);
 
 private:
-    bool initTextures();
-    void deinitTextures();
     bool initShaders();
     void deinitShaders();
+    void initBackground(); // can't fail, the menu copes without the gray background
+    void deinitBackground();
     bool initUI();
     void deinitUI();
 };
@@ -1416,9 +2773,8 @@ private:
 struct GameOptionsMainLoop // also in main-menu.cpp
 {
     //Parameters
-    Textures::Texture2D *ref_background_tex;
     Shaders::Program *ref_ui_shader;
-    Shaders::Program *ref_gray_tex_rect_shader;
+    Shaders::Program *ref_tex_rect_shader;
     UI::Context *ref_ui;
 
     //Shaders
@@ -1431,10 +2787,15 @@ struct GameOptionsMainLoop // also in main-menu.cpp
     Color clear_color;
     unsigned int tick, last_global_tick;
     int last_esc_state, last_enter_state;
+    uint64_t last_ui_hash;
     SharedGLContext::RenderSettings settings, initial_settings;
 
-    void setParameters(Textures::Texture2D& background_tex, Shaders::Program& ui_shader,
-                       Shaders::Program& tex_rect_shader, UI::Context& ui);
+    static constexpr bool idle_capable = true; // redraws only when the UI changes
+    static constexpr double sim_rate = 0.0;
+    static constexpr bool records_render_commands = false;
+
+    // background is the frozen fbo3d_conv of SharedGLContext, as left by the pause menu
+    void setParameters(Shaders::Program& ui_shader, Shaders::Program& tex_rect_shader, UI::Context& ui);
 
     int init();
     ~GameOptionsMainLoop();
@@ -1445,3 +2806,20 @@ private:
     bool initUI();
     void deinitUI();
 };
+
+//bench.cpp
+#ifdef BUILD_BENCHMARK
+namespace Bench
+{
+    struct Settings
+    {
+        const char *scene_name = "game"; // "game" (GameMainLoop) or "test" (TestMainLoop)
+        unsigned int frame_amount = 1000;
+        const char *output_path = "bench.json";
+    };
+
+    // runs the scene for given amount of frames along scripted camera path and writes statistics as JSON,
+    // expects already initialized (preferably headless) window and shared gl context
+    int run(const Settings& settings);
+}
+#endif /* BUILD_BENCHMARK */
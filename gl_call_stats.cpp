@@ -0,0 +1,398 @@
+#include "game.hpp"
+
+#include <algorithm>
+
+
+// every entry point the game uses, entry points missing in the loaded context (NULL pointers) are not wrapped
+#define GL_CALL_STATS_ENTRIES(X) \
+    X(glActiveTexture) X(glAttachShader) X(glBeginQuery) X(glBindAttribLocation) X(glBindBuffer) \
+    X(glBindFragDataLocation) X(glBindFramebuffer) X(glBindRenderbuffer) X(glBindTexture) X(glBindVertexArray) \
+    X(glBlendEquation) X(glBlendFunc) X(glBlitFramebuffer) X(glBufferData) X(glBufferSubData) \
+    X(glCheckFramebufferStatus) X(glClear) X(glClearColor) X(glClientWaitSync) X(glColorMask) \
+    X(glCompileShader) X(glCopyTexImage2D) X(glCopyTexSubImage2D) X(glCreateProgram) X(glCreateShader) \
+    X(glCullFace) X(glDeleteBuffers) X(glDeleteFramebuffers) X(glDeleteProgram) X(glDeleteQueries) \
+    X(glDeleteRenderbuffers) X(glDeleteShader) X(glDeleteSync) X(glDeleteTextures) X(glDeleteVertexArrays) \
+    X(glDepthFunc) X(glDepthMask) X(glDisable) X(glDisableVertexAttribArray) X(glDrawArrays) \
+    X(glDrawBuffer) X(glDrawBuffers) X(glDrawElements) X(glDrawElementsBaseVertex) X(glEnable) \
+    X(glEnableVertexAttribArray) X(glEndQuery) X(glFenceSync) X(glFinish) X(glFramebufferRenderbuffer) \
+    X(glFramebufferTexture2D) X(glGenBuffers) X(glGenFramebuffers) X(glGenQueries) X(glGenRenderbuffers) \
+    X(glGenTextures) X(glGenVertexArrays) X(glGenerateMipmap) X(glGetError) X(glGetIntegerv) \
+    X(glGetProgramInfoLog) X(glGetProgramiv) X(glGetQueryObjectui64v) X(glGetQueryObjectuiv) X(glGetQueryiv) \
+    X(glGetShaderInfoLog) X(glGetShaderiv) X(glGetUniformLocation) X(glLineWidth) X(glLinkProgram) \
+    X(glMapBufferRange) X(glQueryCounter) X(glReadBuffer) X(glRenderbufferStorage) X(glRenderbufferStorageMultisample) \
+    X(glScissor) X(glShaderSource) X(glStencilFunc) X(glStencilMask) X(glStencilOp) \
+    X(glTexBuffer) X(glTexImage2D) X(glTexImage2DMultisample) X(glTexParameteri) X(glTexSubImage2D) \
+    X(glUniform1f) X(glUniform1i) X(glUniform2f) X(glUniform3f) X(glUniform4f) \
+    X(glUniformMatrix3fv) X(glUniformMatrix4fv) X(glUnmapBuffer) X(glUseProgram) X(glVertexAttribPointer) \
+    X(glViewport)
+
+enum GLCallEntry : unsigned int
+{
+    #define GL_CALL_STATS_ENUM(name) entry_##name,
+    GL_CALL_STATS_ENTRIES(GL_CALL_STATS_ENUM)
+    #undef GL_CALL_STATS_ENUM
+    entry_amount
+};
+static_assert(entry_amount <= Profiling::GLCallStats::entries_max, "Too many GL entry points, raise entries_max!");
+
+static const char *entry_names[entry_amount] = {
+    #define GL_CALL_STATS_NAME(name) #name,
+    GL_CALL_STATS_ENTRIES(GL_CALL_STATS_NAME)
+    #undef GL_CALL_STATS_NAME
+};
+
+static bool installed = false;
+static bool frame_started = false; // calls made before the first beginFrame() are not counted
+static Profiling::GLCallStats::FrameCounters current_frame{}, last_frame{};
+// sums over all finished frames
+static uint64_t session_calls[entry_amount]{};
+static uint64_t session_total_calls = 0, session_draw_calls = 0, session_triangles = 0, session_upload_bytes = 0;
+static unsigned int session_frames = 0;
+
+static uint64_t trianglesOf(GLenum mode, GLsizei count)
+{
+    switch (mode)
+    {
+    case GL_TRIANGLES:
+        return count / 3;
+    case GL_TRIANGLE_STRIP:
+    case GL_TRIANGLE_FAN:
+        return count > 2 ? count - 2 : 0;
+    default:
+        return 0; // lines and points
+    }
+}
+
+// rough size of client pixel data, only the formats and types used by the game are exact
+static uint64_t pixelDataBytes(GLsizei width, GLsizei height, GLenum format, GLenum type)
+{
+    unsigned int components = 4;
+    switch (format)
+    {
+    case GL_RED:
+    case GL_ALPHA:
+    case GL_LUMINANCE:
+    case GL_DEPTH_COMPONENT:
+    case GL_DEPTH_STENCIL:
+        components = 1;
+        break;
+    case GL_RG:
+    case GL_LUMINANCE_ALPHA:
+        components = 2;
+        break;
+    case GL_RGB:
+        components = 3;
+        break;
+    default:
+        break;
+    }
+
+    unsigned int pixel_bytes = components;
+    switch (type)
+    {
+    case GL_UNSIGNED_SHORT:
+    case GL_HALF_FLOAT:
+        pixel_bytes = components * 2;
+        break;
+    case GL_UNSIGNED_INT:
+    case GL_FLOAT:
+        pixel_bytes = components * 4;
+        break;
+    case GL_UNSIGNED_SHORT_5_6_5:
+    case GL_UNSIGNED_SHORT_4_4_4_4:
+    case GL_UNSIGNED_SHORT_5_5_5_1:
+        pixel_bytes = 2; // packed
+        break;
+    case GL_UNSIGNED_INT_24_8:
+        pixel_bytes = 4; // packed
+        break;
+    default:
+        break;
+    }
+
+    return static_cast<uint64_t>(std::max(width, 0)) * std::max(height, 0) * pixel_bytes;
+}
+
+// per entry point extra accounting, most entry points only get their calls counted
+template <unsigned int entry_idx>
+struct CallObserver
+{
+    template <typename... Args>
+    static void observe(Args...) {}
+};
+
+template <>
+struct CallObserver<entry_glDrawArrays>
+{
+    static void observe(GLenum mode, GLint, GLsizei count)
+    {
+        ++current_frame.draw_calls;
+        current_frame.triangles += trianglesOf(mode, count);
+    }
+};
+
+template <>
+struct CallObserver<entry_glDrawElements>
+{
+    static void observe(GLenum mode, GLsizei count, GLenum, const void *)
+    {
+        ++current_frame.draw_calls;
+        current_frame.triangles += trianglesOf(mode, count);
+    }
+};
+
+template <>
+struct CallObserver<entry_glDrawElementsBaseVertex>
+{
+    static void observe(GLenum mode, GLsizei count, GLenum, const void *, GLint)
+    {
+        ++current_frame.draw_calls;
+        current_frame.triangles += trianglesOf(mode, count);
+    }
+};
+
+template <>
+struct CallObserver<entry_glBufferData>
+{
+    static void observe(GLenum, GLsizeiptr size, const void *data, GLenum)
+    {
+        if (data != NULL) current_frame.upload_bytes += size; // allocation only otherwise
+    }
+};
+
+template <>
+struct CallObserver<entry_glBufferSubData>
+{
+    static void observe(GLenum, GLintptr, GLsizeiptr size, const void *)
+    {
+        current_frame.upload_bytes += size;
+    }
+};
+
+template <>
+struct CallObserver<entry_glMapBufferRange>
+{
+    static void observe(GLenum, GLintptr, GLsizeiptr length, GLbitfield access)
+    {
+        if (access & GL_MAP_WRITE_BIT) current_frame.upload_bytes += length; // the whole range counts as written
+    }
+};
+
+template <>
+struct CallObserver<entry_glTexImage2D>
+{
+    static void observe(GLenum, GLint, GLint, GLsizei width, GLsizei height, GLint, GLenum format, GLenum type,
+                        const void *pixels)
+    {
+        if (pixels != NULL) current_frame.upload_bytes += pixelDataBytes(width, height, format, type);
+    }
+};
+
+template <>
+struct CallObserver<entry_glTexSubImage2D>
+{
+    static void observe(GLenum, GLint, GLint, GLint, GLsizei width, GLsizei height, GLenum format, GLenum type,
+                        const void *)
+    {
+        current_frame.upload_bytes += pixelDataBytes(width, height, format, type);
+    }
+};
+
+// copies stay on the GPU, they are counted as uploads since they move the same amount of texture data
+template <>
+struct CallObserver<entry_glCopyTexImage2D>
+{
+    static void observe(GLenum, GLint, GLenum internalformat, GLint, GLint, GLsizei width, GLsizei height, GLint)
+    {
+        current_frame.upload_bytes += pixelDataBytes(width, height, internalformat, GL_UNSIGNED_BYTE);
+    }
+};
+
+template <>
+struct CallObserver<entry_glCopyTexSubImage2D>
+{
+    static void observe(GLenum, GLint, GLint, GLint, GLint, GLint, GLsizei width, GLsizei height)
+    {
+        // format of the texture is not known here, estimated as RGBA8
+        current_frame.upload_bytes += pixelDataBytes(width, height, GL_RGBA, GL_UNSIGNED_BYTE);
+    }
+};
+
+// wrapper of a single glad function pointer, `glad_ptr` points to the glad global holding it
+template <typename FnPtr, FnPtr *glad_ptr, unsigned int entry_idx>
+struct CallHook;
+
+template <typename Ret, typename... Args, Ret (APIENTRY **glad_ptr)(Args...), unsigned int entry_idx>
+struct CallHook<Ret (APIENTRY *)(Args...), glad_ptr, entry_idx>
+{
+    static Ret (APIENTRY *original)(Args...);
+
+    static Ret APIENTRY hook(Args... args)
+    {
+        ++current_frame.calls[entry_idx];
+        ++current_frame.total_calls;
+        CallObserver<entry_idx>::observe(args...);
+        return original(args...);
+    }
+
+    static void install()
+    {
+        original = *glad_ptr;
+        if (original != NULL) *glad_ptr = hook;
+    }
+
+    static void uninstall()
+    {
+        if (original != NULL) *glad_ptr = original;
+        original = NULL;
+    }
+};
+
+template <typename Ret, typename... Args, Ret (APIENTRY **glad_ptr)(Args...), unsigned int entry_idx>
+Ret (APIENTRY *CallHook<Ret (APIENTRY *)(Args...), glad_ptr, entry_idx>::original)(Args...) = NULL;
+
+#define GL_CALL_STATS_HOOK(name) using Hook_##name = CallHook<decltype(glad_##name), &glad_##name, entry_##name>;
+GL_CALL_STATS_ENTRIES(GL_CALL_STATS_HOOK)
+#undef GL_CALL_STATS_HOOK
+
+
+void Profiling::GLCallStats::install()
+{
+    if (installed) return;
+
+    #define GL_CALL_STATS_INSTALL(name) Hook_##name::install();
+    GL_CALL_STATS_ENTRIES(GL_CALL_STATS_INSTALL)
+    #undef GL_CALL_STATS_INSTALL
+
+    installed = true;
+    frame_started = false;
+}
+
+void Profiling::GLCallStats::uninstall()
+{
+    if (!installed) return;
+
+    #define GL_CALL_STATS_UNINSTALL(name) Hook_##name::uninstall();
+    GL_CALL_STATS_ENTRIES(GL_CALL_STATS_UNINSTALL)
+    #undef GL_CALL_STATS_UNINSTALL
+
+    installed = false;
+}
+
+bool Profiling::GLCallStats::isInstalled()
+{
+    return installed;
+}
+
+void Profiling::GLCallStats::beginFrame()
+{
+    if (!installed) return;
+
+    if (frame_started)
+    {
+        last_frame = current_frame;
+
+        for (unsigned int i = 0; i < entry_amount; ++i) session_calls[i] += last_frame.calls[i];
+        session_total_calls += last_frame.total_calls;
+        session_draw_calls += last_frame.draw_calls;
+        session_triangles += last_frame.triangles;
+        session_upload_bytes += last_frame.upload_bytes;
+        ++session_frames;
+    }
+
+    current_frame = FrameCounters{};
+    frame_started = true;
+}
+
+const Profiling::GLCallStats::FrameCounters& Profiling::GLCallStats::currentFrame()
+{
+    return current_frame;
+}
+
+const Profiling::GLCallStats::FrameCounters& Profiling::GLCallStats::lastFrame()
+{
+    return last_frame;
+}
+
+unsigned int Profiling::GLCallStats::entryAmount()
+{
+    return entry_amount;
+}
+
+const char *Profiling::GLCallStats::entryName(unsigned int idx)
+{
+    assert(idx < entry_amount);
+    return entry_names[idx];
+}
+
+void Profiling::GLCallStats::drawOverlay(nk_context *ctx, struct nk_rect bounds, unsigned int top_amount)
+{
+    assert(ctx != NULL);
+
+    if (nk_begin(ctx, "GL calls", bounds, NK_WINDOW_BORDER | NK_WINDOW_TITLE | NK_WINDOW_NO_SCROLLBAR))
+    {
+        char textbuff[64]{};
+
+        nk_layout_row_dynamic(ctx, 16, 1);
+        snprintf(textbuff, sizeof(textbuff), "calls %u  draws %u", last_frame.total_calls, last_frame.draw_calls);
+        nk_label(ctx, textbuff, NK_TEXT_LEFT);
+        snprintf(textbuff, sizeof(textbuff), "triangles %llu  upload %.1f kB",
+                 static_cast<unsigned long long>(last_frame.triangles), last_frame.upload_bytes / 1024.0);
+        nk_label(ctx, textbuff, NK_TEXT_LEFT);
+
+        unsigned int sorted[entry_amount];
+        for (unsigned int i = 0; i < entry_amount; ++i) sorted[i] = i;
+        std::sort(sorted, sorted + entry_amount,
+                  [](unsigned int a, unsigned int b) { return last_frame.calls[a] > last_frame.calls[b]; });
+
+        const float ratios[] = { 0.75f, 0.25f };
+        for (unsigned int i = 0; i < std::min<unsigned int>(top_amount, entry_amount); ++i)
+        {
+            if (last_frame.calls[sorted[i]] == 0) break;
+
+            nk_layout_row(ctx, NK_DYNAMIC, 16, 2, ratios);
+            nk_label(ctx, entry_names[sorted[i]], NK_TEXT_LEFT);
+            snprintf(textbuff, sizeof(textbuff), "%u", last_frame.calls[sorted[i]]);
+            nk_label(ctx, textbuff, NK_TEXT_RIGHT);
+        }
+    }
+    nk_end(ctx);
+}
+
+bool Profiling::GLCallStats::exportJSON(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Failed to open GL call stats file '%s' for writing!\n", path);
+        return false;
+    }
+
+    const double frames = session_frames > 0 ? session_frames : 1.0;
+
+    fprintf(file, "{\n  \"frames\": %u,\n", session_frames);
+    fprintf(file, "  \"per_frame_avg\": { \"calls\": %.2f, \"draw_calls\": %.2f, \"triangles\": %.1f, \"upload_bytes\": %.1f },\n",
+            session_total_calls / frames, session_draw_calls / frames, session_triangles / frames, session_upload_bytes / frames);
+    fprintf(file, "  \"last_frame\": { \"calls\": %u, \"draw_calls\": %u, \"triangles\": %llu, \"upload_bytes\": %llu },\n",
+            last_frame.total_calls, last_frame.draw_calls, static_cast<unsigned long long>(last_frame.triangles),
+            static_cast<unsigned long long>(last_frame.upload_bytes));
+
+    // most called entry points first, never called ones are left out
+    unsigned int sorted[entry_amount];
+    for (unsigned int i = 0; i < entry_amount; ++i) sorted[i] = i;
+    std::sort(sorted, sorted + entry_amount, [](unsigned int a, unsigned int b) { return session_calls[a] > session_calls[b]; });
+
+    fprintf(file, "  \"entry_points\":\n  [\n");
+    bool first = true;
+    for (unsigned int i = 0; i < entry_amount && session_calls[sorted[i]] > 0; ++i)
+    {
+        fprintf(file, "%s    { \"name\": \"%s\", \"per_frame_avg\": %.2f, \"last_frame\": %u, \"total\": %llu }",
+                first ? "" : ",\n", entry_names[sorted[i]], session_calls[sorted[i]] / frames, last_frame.calls[sorted[i]],
+                static_cast<unsigned long long>(session_calls[sorted[i]]));
+        first = false;
+    }
+    fprintf(file, "\n  ]\n}\n");
+
+    fclose(file);
+    return true;
+}
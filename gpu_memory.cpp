@@ -0,0 +1,183 @@
+#include "game.hpp"
+
+#include <algorithm>
+
+
+std::vector<Profiling::GpuMemory::Allocation> Profiling::GpuMemory::m_allocations{};
+Profiling::GpuMemory::CategoryStats Profiling::GpuMemory::m_stats[static_cast<unsigned int>(Profiling::GpuMemory::Category::amount)]{};
+uint64_t Profiling::GpuMemory::m_total_live_bytes = 0;
+uint64_t Profiling::GpuMemory::m_total_peak_bytes = 0;
+
+static const char *category_names[static_cast<unsigned int>(Profiling::GpuMemory::Category::amount)] = {
+    "Texture2D", "Cubemap", "VBO", "UI buffers", "RT renderbuffers", "RT textures"
+};
+
+void Profiling::GpuMemory::track(Category category, GLuint id, uint64_t bytes)
+{
+    if (id == empty_id) return;
+
+    CategoryStats& stats = m_stats[static_cast<unsigned int>(category)];
+
+    auto it = std::find_if(m_allocations.begin(), m_allocations.end(),
+                           [category, id](const Allocation& alloc) { return alloc.category == category && alloc.id == id; });
+    if (it == m_allocations.end())
+    {
+        m_allocations.push_back(Allocation{ category, id, 0 });
+        it = m_allocations.end() - 1;
+        ++stats.live_allocations;
+    }
+
+    stats.live_bytes = stats.live_bytes - it->bytes + bytes;
+    m_total_live_bytes = m_total_live_bytes - it->bytes + bytes;
+    it->bytes = bytes;
+
+    stats.peak_bytes = std::max(stats.peak_bytes, stats.live_bytes);
+    m_total_peak_bytes = std::max(m_total_peak_bytes, m_total_live_bytes);
+}
+
+void Profiling::GpuMemory::release(Category category, GLuint id)
+{
+    auto it = std::find_if(m_allocations.begin(), m_allocations.end(),
+                           [category, id](const Allocation& alloc) { return alloc.category == category && alloc.id == id; });
+    if (it == m_allocations.end()) return; // never allocated any storage
+
+    CategoryStats& stats = m_stats[static_cast<unsigned int>(category)];
+    stats.live_bytes -= it->bytes;
+    --stats.live_allocations;
+    m_total_live_bytes -= it->bytes;
+
+    *it = m_allocations.back();
+    m_allocations.pop_back();
+}
+
+uint64_t Profiling::GpuMemory::estimateBytes(GLenum internal_format, unsigned int width, unsigned int height,
+                                             unsigned int samples, bool mipmaps)
+{
+    // 3 component formats are counted as 4 bytes, as drivers usually pad them
+    uint64_t pixel_bytes = 4;
+    switch (internal_format)
+    {
+    case GL_ALPHA:
+    case GL_LUMINANCE:
+    case GL_R8:
+    case GL_STENCIL_INDEX8:
+        pixel_bytes = 1;
+        break;
+    case GL_LUMINANCE_ALPHA:
+    case GL_RG8:
+    case GL_RGB565:
+    case GL_RGBA4:
+    case GL_RGB5_A1:
+    case GL_DEPTH_COMPONENT16:
+        pixel_bytes = 2;
+        break;
+    case GL_RGBA16F:
+    case GL_RGB16F:
+        pixel_bytes = 8;
+        break;
+    case GL_RGBA32F:
+    case GL_RGB32F:
+        pixel_bytes = 16;
+        break;
+    default: // GL_RGB(A)(8), GL_DEPTH_COMPONENT24, GL_DEPTH_STENCIL, GL_DEPTH24_STENCIL8...
+        break;
+    }
+
+    uint64_t texels = static_cast<uint64_t>(width) * height;
+    if (mipmaps)
+    {
+        // whole chain down to 1x1
+        for (unsigned int w = width, h = height; w > 1 || h > 1; )
+        {
+            w = std::max(1u, w / 2);
+            h = std::max(1u, h / 2);
+            texels += static_cast<uint64_t>(w) * h;
+        }
+    }
+
+    return texels * pixel_bytes * std::max(1u, samples);
+}
+
+const char *Profiling::GpuMemory::categoryName(Category category)
+{
+    assert(category < Category::amount);
+    return category_names[static_cast<unsigned int>(category)];
+}
+
+Profiling::GpuMemory::CategoryStats Profiling::GpuMemory::getStats(Category category)
+{
+    assert(category < Category::amount);
+    return m_stats[static_cast<unsigned int>(category)];
+}
+
+uint64_t Profiling::GpuMemory::getTotalLiveBytes()
+{
+    return m_total_live_bytes;
+}
+
+uint64_t Profiling::GpuMemory::getTotalPeakBytes()
+{
+    return m_total_peak_bytes;
+}
+
+void Profiling::GpuMemory::drawOverlay(nk_context *ctx, struct nk_rect bounds)
+{
+    assert(ctx != NULL);
+
+    if (nk_begin(ctx, "GPU memory", bounds, NK_WINDOW_BORDER | NK_WINDOW_TITLE | NK_WINDOW_NO_SCROLLBAR))
+    {
+        char textbuff[32]{};
+        const float ratios[] = { 0.5f, 0.25f, 0.25f };
+        const double mb = 1024.0 * 1024.0;
+
+        nk_layout_row(ctx, NK_DYNAMIC, 16, 3, ratios);
+        nk_label(ctx, "MB", NK_TEXT_LEFT);
+        nk_label(ctx, "live", NK_TEXT_RIGHT);
+        nk_label(ctx, "peak", NK_TEXT_RIGHT);
+
+        for (unsigned int i = 0; i < static_cast<unsigned int>(Category::amount); ++i)
+        {
+            nk_layout_row(ctx, NK_DYNAMIC, 16, 3, ratios);
+            nk_label(ctx, category_names[i], NK_TEXT_LEFT);
+            snprintf(textbuff, sizeof(textbuff), "%.2f", m_stats[i].live_bytes / mb);
+            nk_label(ctx, textbuff, NK_TEXT_RIGHT);
+            snprintf(textbuff, sizeof(textbuff), "%.2f", m_stats[i].peak_bytes / mb);
+            nk_label(ctx, textbuff, NK_TEXT_RIGHT);
+        }
+
+        nk_layout_row(ctx, NK_DYNAMIC, 16, 3, ratios);
+        nk_label(ctx, "total", NK_TEXT_LEFT);
+        snprintf(textbuff, sizeof(textbuff), "%.2f", m_total_live_bytes / mb);
+        nk_label(ctx, textbuff, NK_TEXT_RIGHT);
+        snprintf(textbuff, sizeof(textbuff), "%.2f", m_total_peak_bytes / mb);
+        nk_label(ctx, textbuff, NK_TEXT_RIGHT);
+    }
+    nk_end(ctx);
+}
+
+void Profiling::GpuMemory::printReport(FILE *out)
+{
+    assert(out != NULL);
+
+    const double mb = 1024.0 * 1024.0;
+
+    fprintf(out, "GPU memory (estimated):\n");
+    for (unsigned int i = 0; i < static_cast<unsigned int>(Category::amount); ++i)
+    {
+        fprintf(out, "  %-22s %4u allocations, live %8.2f MB, peak %8.2f MB\n", category_names[i],
+                m_stats[i].live_allocations, m_stats[i].live_bytes / mb, m_stats[i].peak_bytes / mb);
+    }
+    fprintf(out, "  %-22s %4zu allocations, live %8.2f MB, peak %8.2f MB\n", "total", m_allocations.size(),
+            m_total_live_bytes / mb, m_total_peak_bytes / mb);
+
+    // the biggest allocations are the ones worth budgeting
+    std::vector<Allocation> sorted(m_allocations);
+    std::sort(sorted.begin(), sorted.end(), [](const Allocation& a, const Allocation& b) { return a.bytes > b.bytes; });
+
+    const size_t top_amount = std::min<size_t>(10, sorted.size());
+    if (top_amount > 0) fprintf(out, "Largest allocations:\n");
+    for (size_t i = 0; i < top_amount; ++i)
+    {
+        fprintf(out, "  %-22s id %4u %8.2f MB\n", categoryName(sorted[i].category), sorted[i].id, sorted[i].bytes / mb);
+    }
+}
@@ -0,0 +1,255 @@
+#include "game.hpp"
+
+#include <algorithm>
+#include <cstring> // strcmp
+
+
+bool Profiling::GpuProfiler::m_initialized = false;
+Profiling::GpuProfiler::FrameQueries Profiling::GpuProfiler::m_frames[Profiling::GpuProfiler::frame_latency]{};
+unsigned int Profiling::GpuProfiler::m_frame_idx = 0;
+unsigned int Profiling::GpuProfiler::m_open_scopes[Profiling::GpuProfiler::depth_max]{};
+unsigned int Profiling::GpuProfiler::m_depth = 0;
+Profiling::GpuProfiler::PassStats Profiling::GpuProfiler::m_pass_stats[Profiling::GpuProfiler::pass_stats_max]{};
+unsigned int Profiling::GpuProfiler::m_pass_stats_amount = 0;
+std::atomic<float> Profiling::GpuProfiler::m_last_frame_ms{-1.f};
+unsigned int Profiling::GpuProfiler::m_measured_frames = 0;
+unsigned int Profiling::GpuProfiler::m_dropped_frames = 0;
+
+bool Profiling::GpuProfiler::init()
+{
+    assert(!m_initialized);
+
+    #ifdef BUILD_OPENGL_330_CORE
+        // timer queries are core since OpenGL 3.3
+        for (FrameQueries& frame : m_frames)
+        {
+            glGenQueries(scopes_per_frame_max * 2, frame.m_queries);
+            frame.m_scope_amount = 0;
+            frame.m_pending = false;
+        }
+
+        GLint counter_bits = 0;
+        glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &counter_bits);
+        if (counter_bits == 0)
+        {
+            fprintf(stderr, "[WARNING] GPU timestamp queries are not supported, GPU profiler disabled.\n");
+            for (FrameQueries& frame : m_frames) glDeleteQueries(scopes_per_frame_max * 2, frame.m_queries);
+            return false;
+        }
+
+        m_initialized = true;
+        return true;
+    #else
+        // no timer queries on OpenGLES 2.0, the profiler stays disabled
+        return false;
+    #endif
+}
+
+void Profiling::GpuProfiler::deinit()
+{
+    if (!m_initialized) return;
+
+    #ifdef BUILD_OPENGL_330_CORE
+        for (FrameQueries& frame : m_frames) glDeleteQueries(scopes_per_frame_max * 2, frame.m_queries);
+    #endif
+    m_initialized = false;
+}
+
+bool Profiling::GpuProfiler::readBack(const FrameQueries& frame)
+{
+    #ifdef BUILD_OPENGL_330_CORE
+        // never wait for the GPU, if any of the results is not ready yet the whole frame is dropped
+        for (unsigned int i = 0; i < frame.m_scope_amount * 2; ++i)
+        {
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(frame.m_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available == GL_FALSE) return false;
+        }
+
+        const float smoothing = 0.1f; // weight of the newest frame
+        float frame_ms[pass_stats_max]{};
+        bool frame_seen[pass_stats_max]{};
+
+        for (unsigned int scope = 0; scope < frame.m_scope_amount; ++scope)
+        {
+            GLuint64 start_ns = 0, end_ns = 0;
+            glGetQueryObjectui64v(frame.m_queries[scope * 2], GL_QUERY_RESULT, &start_ns);
+            glGetQueryObjectui64v(frame.m_queries[scope * 2 + 1], GL_QUERY_RESULT, &end_ns);
+            const float scope_ms = end_ns > start_ns ? (end_ns - start_ns) / 1000000.f : 0.f;
+
+            if (scope == 0) m_last_frame_ms = scope_ms; // first scope is always the whole frame
+
+            const char *name = frame.m_names[scope];
+            unsigned int stats_idx = 0;
+            while (stats_idx < m_pass_stats_amount && m_pass_stats[stats_idx].name != name
+                   && strcmp(m_pass_stats[stats_idx].name, name) != 0) ++stats_idx;
+
+            if (stats_idx == m_pass_stats_amount)
+            {
+                if (m_pass_stats_amount == pass_stats_max) continue; // table full, ignore the pass
+                m_pass_stats[m_pass_stats_amount++] = PassStats{ name, frame.m_depths[scope], 0.f, 0.f, 0.f, 0.0, 0, 0 };
+            }
+
+            // passes that run multiple times per frame are summed up
+            frame_ms[stats_idx] += scope_ms;
+            frame_seen[stats_idx] = true;
+        }
+
+        for (unsigned int i = 0; i < m_pass_stats_amount; ++i)
+        {
+            if (!frame_seen[i]) continue;
+
+            PassStats& stats = m_pass_stats[i];
+            stats.avg_ms = stats.frame_count ? stats.avg_ms + smoothing * (frame_ms[i] - stats.avg_ms) : frame_ms[i];
+            stats.last_ms = frame_ms[i];
+            stats.max_ms = std::max(stats.max_ms, frame_ms[i]);
+            stats.total_ms += frame_ms[i];
+            ++stats.frame_count;
+            stats.last_seen = m_measured_frames;
+        }
+
+        ++m_measured_frames;
+        return true;
+    #else
+        (void)frame;
+        return false;
+    #endif
+}
+
+void Profiling::GpuProfiler::beginFrame()
+{
+    if (!m_initialized) return;
+
+    FrameQueries& frame = m_frames[m_frame_idx % frame_latency];
+    if (frame.m_pending)
+    {
+        // queries of this slot were issued `frame_latency` frames ago, reusing them discards unread results
+        if (!readBack(frame)) ++m_dropped_frames;
+        frame.m_pending = false;
+    }
+
+    frame.m_scope_amount = 0;
+    m_depth = 0;
+    beginScope("GPU frame");
+}
+
+void Profiling::GpuProfiler::endFrame()
+{
+    if (!m_initialized) return;
+
+    endScope(); // whole frame scope
+    assert(m_depth == 0); // unpaired GPU scope
+
+    m_frames[m_frame_idx % frame_latency].m_pending = true;
+    ++m_frame_idx;
+}
+
+void Profiling::GpuProfiler::beginScope(const char *name)
+{
+    if (!m_initialized) return;
+
+    #ifdef BUILD_OPENGL_330_CORE
+        FrameQueries& frame = m_frames[m_frame_idx % frame_latency];
+
+        unsigned int scope_idx = scopes_per_frame_max; // not recorded
+        if (frame.m_scope_amount < scopes_per_frame_max && m_depth < depth_max)
+        {
+            scope_idx = frame.m_scope_amount++;
+            frame.m_names[scope_idx] = name;
+            frame.m_depths[scope_idx] = m_depth;
+            glQueryCounter(frame.m_queries[scope_idx * 2], GL_TIMESTAMP);
+        }
+
+        if (m_depth < depth_max) m_open_scopes[m_depth] = scope_idx;
+        ++m_depth;
+    #else
+        (void)name;
+    #endif
+}
+
+void Profiling::GpuProfiler::endScope()
+{
+    if (!m_initialized) return;
+
+    #ifdef BUILD_OPENGL_330_CORE
+        assert(m_depth > 0); // unpaired GPU scope end
+        --m_depth;
+        if (m_depth >= depth_max) return;
+
+        const unsigned int scope_idx = m_open_scopes[m_depth];
+        if (scope_idx == scopes_per_frame_max) return;
+
+        FrameQueries& frame = m_frames[m_frame_idx % frame_latency];
+        glQueryCounter(frame.m_queries[scope_idx * 2 + 1], GL_TIMESTAMP);
+    #endif
+}
+
+float Profiling::GpuProfiler::lastFrameMs()
+{
+    return m_initialized ? m_last_frame_ms.load() : -1.f;
+}
+
+void Profiling::GpuProfiler::drawPasses(nk_context *ctx, struct nk_rect bounds)
+{
+    assert(ctx != NULL);
+
+    if (nk_begin(ctx, "GPU passes", bounds, NK_WINDOW_BORDER | NK_WINDOW_TITLE | NK_WINDOW_NO_SCROLLBAR))
+    {
+        if (!m_initialized)
+        {
+            nk_layout_row_dynamic(ctx, 16, 1);
+            nk_label(ctx, "GPU timing not supported", NK_TEXT_LEFT);
+        }
+        else
+        {
+            char textbuff[64]{};
+            const float ratios[] = { 0.6f, 0.2f, 0.2f };
+
+            nk_layout_row(ctx, NK_DYNAMIC, 16, 3, ratios);
+            nk_label(ctx, "pass", NK_TEXT_LEFT);
+            nk_label(ctx, "ms", NK_TEXT_RIGHT);
+            nk_label(ctx, "max", NK_TEXT_RIGHT);
+
+            // passes are kept in the order they first ran, which also keeps children under their parents
+            for (unsigned int i = 0; i < m_pass_stats_amount; ++i)
+            {
+                const PassStats& stats = m_pass_stats[i];
+                if (stats.last_seen + 60 < m_measured_frames) continue; // passes that stopped running
+
+                nk_layout_row(ctx, NK_DYNAMIC, 16, 3, ratios);
+                snprintf(textbuff, sizeof(textbuff), "%*s%s", static_cast<int>(stats.depth * 2), "", stats.name);
+                nk_label(ctx, textbuff, NK_TEXT_LEFT);
+                snprintf(textbuff, sizeof(textbuff), "%.2f", stats.avg_ms);
+                nk_label(ctx, textbuff, NK_TEXT_RIGHT);
+                snprintf(textbuff, sizeof(textbuff), "%.2f", stats.max_ms);
+                nk_label(ctx, textbuff, NK_TEXT_RIGHT);
+            }
+        }
+    }
+    nk_end(ctx);
+}
+
+bool Profiling::GpuProfiler::exportJSON(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Failed to open GPU profile file '%s' for writing!\n", path);
+        return false;
+    }
+
+    fprintf(file, "{\n  \"supported\": %s,\n  \"frame_latency\": %u,\n  \"measured_frames\": %u,\n  \"dropped_frames\": %u,\n",
+            m_initialized ? "true" : "false", frame_latency, m_measured_frames, m_dropped_frames);
+    fprintf(file, "  \"passes\":\n  [\n");
+    for (unsigned int i = 0; i < m_pass_stats_amount; ++i)
+    {
+        const PassStats& stats = m_pass_stats[i];
+        fprintf(file, "    { \"name\": \"%s\", \"depth\": %u, \"frames\": %u, \"avg_ms\": %.4f, \"recent_ms\": %.4f, \"max_ms\": %.4f }%s\n",
+                stats.name, stats.depth, stats.frame_count, stats.frame_count ? stats.total_ms / stats.frame_count : 0.0,
+                stats.avg_ms, stats.max_ms, i + 1 == m_pass_stats_amount ? "" : ",");
+    }
+    fprintf(file, "  ]\n}\n");
+
+    fclose(file);
+    return true;
+}
@@ -0,0 +1,361 @@
+#include "game.hpp"
+
+#include <cstring> // memcmp, memset
+
+// File layout (native endianness):
+//  header: char magic[4], uint32_t version
+//  records in the order they were produced, each starting with uint8_t tag:
+//   'S' seed:  uint32_t seed
+//   'F' frame: double frame_time, float mouse_dx, float mouse_dy, uint8_t flags,
+//              uint16_t changed_keys_count, uint16_t changed_keys[changed_keys_count],
+//              uint16_t mouse_events_count, mouse_event[mouse_events_count]
+//   mouse_event: float time_offset (against frame_time), uint8_t type, uint8_t button, uint8_t pressed, float x, float y
+// Keys are stored only as state changes against the previous frame, which keeps idle frames at 22 bytes.
+
+InputRecorder::Mode InputRecorder::m_mode = InputRecorder::Mode::live;
+FILE *InputRecorder::m_file = NULL;
+bool InputRecorder::m_key_states[GLFW_KEY_LAST + 1] = {};
+glm::vec2 InputRecorder::m_mouse_pos(0.f);
+bool InputRecorder::m_focused = true;
+double InputRecorder::m_fixed_step = 0.0;
+double InputRecorder::m_first_frame_time = 0.0;
+unsigned int InputRecorder::m_frame_count = 0;
+unsigned int InputRecorder::m_seed_count = 0;
+
+bool InputRecorder::startRecording(const char *path)
+{
+    assert(m_mode == Mode::live);
+
+    m_file = fopen(path, "wb");
+    if (m_file == NULL)
+    {
+        fprintf(stderr, "Failed to open input recording file '%s' for writing!\n", path);
+        return false;
+    }
+
+    m_mode = Mode::record;
+    if (!writeBytes(file_magic, sizeof(file_magic)) || !writeBytes(&file_version, sizeof(file_version)))
+    {
+        fail("Failed to write input recording header!");
+        return false;
+    }
+
+    memset(m_key_states, 0, sizeof(m_key_states));
+    m_mouse_pos = MouseManager::mouse_pos;
+    m_frame_count = 0;
+
+    printf("Recording input into '%s'.\n", path);
+    return true;
+}
+
+bool InputRecorder::startReplay(const char *path, double fixed_step)
+{
+    assert(m_mode == Mode::live);
+
+    m_file = fopen(path, "rb");
+    if (m_file == NULL)
+    {
+        fprintf(stderr, "Failed to open input recording file '%s' for reading!\n", path);
+        return false;
+    }
+
+    m_mode = Mode::replay;
+
+    char magic[sizeof(file_magic)];
+    uint32_t version = 0;
+    if (!readBytes(magic, sizeof(magic)) || !readBytes(&version, sizeof(version))
+        || memcmp(magic, file_magic, sizeof(magic)) != 0 || version != file_version)
+    {
+        fail("Input recording file has invalid header or unsupported version!");
+        return false;
+    }
+
+    memset(m_key_states, 0, sizeof(m_key_states));
+    m_mouse_pos = glm::vec2(0.f);
+    m_focused = true;
+    m_fixed_step = fixed_step;
+    m_frame_count = 0;
+
+    printf("Replaying input from '%s'", path);
+    if (fixed_step > 0.0) printf(" with fixed timestep %.6f s", fixed_step);
+    puts(".");
+    return true;
+}
+
+void InputRecorder::startSynthetic()
+{
+    assert(m_mode == Mode::live);
+
+    memset(m_key_states, 0, sizeof(m_key_states));
+    m_focused = true;
+    m_frame_count = 0;
+    m_seed_count = 0;
+
+    m_mode = Mode::synthetic;
+}
+
+void InputRecorder::stop()
+{
+    if (m_file != NULL)
+    {
+        if (m_mode == Mode::record) printf("Input recording finished after %u frames.\n", m_frame_count);
+        else if (m_mode == Mode::replay) printf("Input replay finished after %u frames.\n", m_frame_count);
+
+        fclose(m_file);
+        m_file = NULL;
+    }
+
+    m_mode = Mode::live;
+}
+
+InputRecorder::Mode InputRecorder::getMode()
+{
+    return m_mode;
+}
+
+bool InputRecorder::writeBytes(const void *data, size_t size)
+{
+    assert(m_file != NULL);
+    return fwrite(data, 1, size, m_file) == size;
+}
+
+bool InputRecorder::readBytes(void *data, size_t size)
+{
+    assert(m_file != NULL);
+    return fread(data, 1, size, m_file) == size;
+}
+
+bool InputRecorder::expectTag(uint8_t tag)
+{
+    uint8_t read_tag = 0;
+    return readBytes(&read_tag, sizeof(read_tag)) && read_tag == tag;
+}
+
+void InputRecorder::fail(const char *message)
+{
+    fprintf(stderr, "[WARNING] %s Falling back to live input.\n", message);
+    stop();
+}
+
+bool InputRecorder::beginFrame(GLFWwindow *window, double& frame_time)
+{
+    switch (m_mode)
+    {
+    case Mode::synthetic:
+        MouseManager::clearPendingEvents(); // no input at all
+        MouseManager::beginFrame();
+        return true;
+    case Mode::live:
+        MouseManager::beginFrame();
+        return true;
+    case Mode::record:
+        recordFrame(window, frame_time);
+        return true;
+    case Mode::replay:
+        return replayFrame(frame_time);
+    default:
+        assert(false); // unimplemented case!
+        return true;
+    }
+}
+
+void InputRecorder::recordFrame(GLFWwindow *window, double frame_time)
+{
+    MouseManager::beginFrame(); // its events are recorded along the rest of the frame
+
+    // deltas are taken against the reconstructed position and the reconstructed one is then fed to the game,
+    // this way the recorded session sees exactly the same (float rounded) values as its replay
+    const glm::vec2 mouse_delta = MouseManager::mouse_pos - m_mouse_pos;
+    m_mouse_pos += mouse_delta;
+
+    m_focused = glfwGetWindowAttrib(window, GLFW_FOCUSED) > 0;
+
+    uint8_t flags = 0;
+    if (MouseManager::left_button) flags |= flag_left_button;
+    if (MouseManager::right_button) flags |= flag_right_button;
+    if (m_focused) flags |= flag_focused;
+
+    // the key state does not change until next glfwPollEvents, so a snapshot is what the loop would see
+    uint16_t changed_keys[GLFW_KEY_LAST + 1];
+    uint16_t changed_keys_count = 0;
+    for (int key = GLFW_KEY_SPACE; key <= GLFW_KEY_LAST; ++key)
+    {
+        const bool is_down = glfwGetKey(window, key) == GLFW_PRESS;
+        if (is_down != m_key_states[key])
+        {
+            m_key_states[key] = is_down;
+            changed_keys[changed_keys_count++] = static_cast<uint16_t>(key);
+        }
+    }
+
+    const bool ok = writeBytes(&record_tag_frame, sizeof(record_tag_frame))
+                    && writeBytes(&frame_time, sizeof(frame_time))
+                    && writeBytes(&mouse_delta.x, sizeof(mouse_delta.x))
+                    && writeBytes(&mouse_delta.y, sizeof(mouse_delta.y))
+                    && writeBytes(&flags, sizeof(flags))
+                    && writeBytes(&changed_keys_count, sizeof(changed_keys_count))
+                    && writeBytes(changed_keys, changed_keys_count * sizeof(changed_keys[0]))
+                    && recordMouseEvents(frame_time);
+    if (!ok)
+    {
+        fail("Failed to write input recording frame!");
+        return;
+    }
+
+    applyMouseState(flags);
+    ++m_frame_count;
+}
+
+bool InputRecorder::recordMouseEvents(double frame_time)
+{
+    const uint16_t events_count = static_cast<uint16_t>(MouseManager::m_frame_event_count);
+    if (!writeBytes(&events_count, sizeof(events_count))) return false;
+
+    for (unsigned int i = 0; i < events_count; ++i)
+    {
+        MouseManager::Event& event = MouseManager::m_frame_events[i];
+        const float time_offset = static_cast<float>(event.time - frame_time);
+        const uint8_t type = static_cast<uint8_t>(event.type), pressed = event.pressed ? 1 : 0;
+
+        const bool ok = writeBytes(&time_offset, sizeof(time_offset))
+                        && writeBytes(&type, sizeof(type))
+                        && writeBytes(&event.button, sizeof(event.button))
+                        && writeBytes(&pressed, sizeof(pressed))
+                        && writeBytes(&event.pos.x, sizeof(event.pos.x))
+                        && writeBytes(&event.pos.y, sizeof(event.pos.y));
+        if (!ok) return false;
+
+        event.time = frame_time + time_offset; // same rounding as in the replay
+    }
+
+    return true;
+}
+
+bool InputRecorder::replayFrame(double& frame_time)
+{
+    double recorded_frame_time = 0.0;
+    glm::vec2 mouse_delta(0.f);
+    uint8_t flags = 0;
+    uint16_t changed_keys_count = 0;
+
+    if (!expectTag(record_tag_frame)
+        || !readBytes(&recorded_frame_time, sizeof(recorded_frame_time))
+        || !readBytes(&mouse_delta.x, sizeof(mouse_delta.x))
+        || !readBytes(&mouse_delta.y, sizeof(mouse_delta.y))
+        || !readBytes(&flags, sizeof(flags))
+        || !readBytes(&changed_keys_count, sizeof(changed_keys_count)))
+    {
+        stop(); // end of the recording
+        return false;
+    }
+
+    for (uint16_t i = 0; i < changed_keys_count; ++i)
+    {
+        uint16_t key = 0;
+        if (!readBytes(&key, sizeof(key)) || key > GLFW_KEY_LAST)
+        {
+            fail("Corrupted input recording frame!");
+            return false;
+        }
+
+        m_key_states[key] = !m_key_states[key];
+    }
+
+    if (m_frame_count == 0) m_first_frame_time = recorded_frame_time;
+    frame_time = m_fixed_step > 0.0 ? m_first_frame_time + m_frame_count * m_fixed_step : recorded_frame_time;
+
+    if (!replayMouseEvents(frame_time))
+    {
+        fail("Corrupted input recording frame!");
+        return false;
+    }
+
+    m_mouse_pos += mouse_delta;
+    m_focused = (flags & flag_focused) != 0;
+    applyMouseState(flags);
+
+    ++m_frame_count;
+    return true;
+}
+
+bool InputRecorder::replayMouseEvents(double frame_time)
+{
+    MouseManager::clearPendingEvents(); // live input has no place in the replay
+
+    uint16_t events_count = 0;
+    if (!readBytes(&events_count, sizeof(events_count)) || events_count > MouseManager::event_capacity) return false;
+
+    for (uint16_t i = 0; i < events_count; ++i)
+    {
+        float time_offset = 0.f;
+        uint8_t type = 0, button = 0, pressed = 0;
+        glm::vec2 pos(0.f);
+
+        const bool ok = readBytes(&time_offset, sizeof(time_offset))
+                        && readBytes(&type, sizeof(type))
+                        && readBytes(&button, sizeof(button))
+                        && readBytes(&pressed, sizeof(pressed))
+                        && readBytes(&pos.x, sizeof(pos.x))
+                        && readBytes(&pos.y, sizeof(pos.y));
+        if (!ok || type > static_cast<uint8_t>(MouseManager::Event::Type::button)) return false;
+
+        MouseManager::queueEvent(MouseManager::Event{ static_cast<MouseManager::Event::Type>(type), button, pressed != 0,
+                                                      frame_time + time_offset, pos });
+    }
+
+    MouseManager::beginFrame();
+    return true;
+}
+
+void InputRecorder::applyMouseState(uint8_t flags)
+{
+    MouseManager::mouse_pos = m_mouse_pos;
+    MouseManager::left_button = (flags & flag_left_button) != 0;
+    MouseManager::right_button = (flags & flag_right_button) != 0;
+}
+
+unsigned int InputRecorder::nextSeed()
+{
+    switch (m_mode)
+    {
+    case Mode::record:
+        {
+            std::random_device rd;
+            const uint32_t seed = rd();
+            if (!writeBytes(&record_tag_seed, sizeof(record_tag_seed)) || !writeBytes(&seed, sizeof(seed)))
+            {
+                fail("Failed to write RNG seed into input recording!");
+            }
+            return seed;
+        }
+    case Mode::replay:
+        {
+            uint32_t seed = 0;
+            if (expectTag(record_tag_seed) && readBytes(&seed, sizeof(seed))) return seed;
+
+            fail("Input recording is out of sync, expected RNG seed!");
+            break;
+        }
+    case Mode::synthetic:
+        return 5489u + m_seed_count++; // 5489 is the default std::mt19937 seed
+    default:
+        break;
+    }
+
+    std::random_device rd;
+    return rd();
+}
+
+int InputRecorder::getKey(GLFWwindow *window, int key)
+{
+    if (m_mode == Mode::live || key < 0 || key > GLFW_KEY_LAST) return glfwGetKey(window, key);
+
+    return m_key_states[key] ? GLFW_PRESS : GLFW_RELEASE;
+}
+
+bool InputRecorder::isWindowFocused(GLFWwindow *window)
+{
+    if (m_mode == Mode::live) return glfwGetWindowAttrib(window, GLFW_FOCUSED) > 0;
+
+    return m_focused;
+}
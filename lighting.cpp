@@ -2,10 +2,40 @@
 
 #include "glm/trigonometric.hpp" //glm::radians
 
+#include <algorithm>
+#include <limits>
+
+
+float Lighting::attenuationRange(const LightProps& props, float constant, float linear, float quadratic, float cutoff)
+{
+    assert(cutoff > 0.f);
+
+    const float intensity = std::max({ props.m_ambient.r, props.m_ambient.g, props.m_ambient.b,
+                                       props.m_diffuse.r, props.m_diffuse.g, props.m_diffuse.b,
+                                       props.m_specular.r, props.m_specular.g, props.m_specular.b });
+    // intensity / (constant + linear * d + quadratic * d^2) = cutoff, solved for d
+    const float denominator = intensity / cutoff - constant;
+    if (denominator <= 0.f) return 0.f; // too weak to be ever noticed
+
+    if (quadratic > 0.f)
+    {
+        return (-linear + std::sqrt(linear * linear + 4.f * quadratic * denominator)) / (2.f * quadratic);
+    }
+    if (linear > 0.f) return denominator / linear;
+
+    return std::numeric_limits<float>::infinity();
+}
 
 Lighting::Light::Light::Light(const LightProps& props)
                         : m_props(props) {}
 
+void Lighting::Light::packProps(glm::vec4 out_texels[packed_texels]) const
+{
+    out_texels[3] = glm::vec4(m_props.m_ambient.r, m_props.m_ambient.g, m_props.m_ambient.b, out_texels[3].w);
+    out_texels[4] = glm::vec4(m_props.m_diffuse.r, m_props.m_diffuse.g, m_props.m_diffuse.b, 0.f);
+    out_texels[5] = glm::vec4(m_props.m_specular.r, m_props.m_specular.g, m_props.m_specular.b, 0.f);
+}
+
 bool Lighting::Light::bindPropsToShader(const char *uniform_name, const Shaders::Program& shader, int idx) const
 {
     // bind the light props (ambient, diffuse, specular) to given shader under given uniform_name,
@@ -82,6 +112,22 @@ bool Lighting::DirLight::bindToShader(const char *uniform_name, const Shaders::P
     return true;
 }
 
+bool Lighting::DirLight::boundingSphere(glm::vec3& out_center, float& out_radius) const
+{
+    (void)out_center;
+    (void)out_radius;
+    return false;
+}
+
+void Lighting::DirLight::pack(glm::vec4 out_texels[packed_texels]) const
+{
+    out_texels[0] = glm::vec4(0.f, 0.f, 0.f, static_cast<float>(Type::directional));
+    out_texels[1] = glm::vec4(m_dir, 0.f);
+    out_texels[2] = glm::vec4(1.f, 0.f, 0.f, 0.f);
+    out_texels[3].w = 0.f;
+    packProps(out_texels);
+}
+
 Lighting::PointLight::PointLight(const LightProps& props, glm::vec3 pos)
                                 : Light(props), m_pos(pos) {}
 
@@ -135,6 +181,32 @@ void Lighting::PointLight::setAttenuation(GLfloat constant, GLfloat linear, GLfl
     m_attenuation_coefs_quad = quadratic;
 }
 
+float Lighting::PointLight::range() const
+{
+    return attenuationRange(m_props, m_attenuation_coefs_const, m_attenuation_coefs_lin, m_attenuation_coefs_quad);
+}
+
+bool Lighting::PointLight::boundingSphere(glm::vec3& out_center, float& out_radius) const
+{
+    const float light_range = range();
+    if (std::isinf(light_range)) return false;
+
+    out_center = m_pos;
+    out_radius = light_range;
+    return true;
+}
+
+void Lighting::PointLight::pack(glm::vec4 out_texels[packed_texels]) const
+{
+    const float light_range = range();
+
+    out_texels[0] = glm::vec4(m_pos, static_cast<float>(Type::point));
+    out_texels[1] = glm::vec4(0.f, 0.f, 0.f, std::isinf(light_range) ? 0.f : light_range);
+    out_texels[2] = glm::vec4(m_attenuation_coefs_const, m_attenuation_coefs_lin, m_attenuation_coefs_quad, 0.f);
+    out_texels[3].w = 0.f;
+    packProps(out_texels);
+}
+
 Lighting::SpotLight::SpotLight(const LightProps& props, glm::vec3 dir, glm::vec3 pos,
                               float inner_cutoff_angle, float outer_cutoff_angle) // cutoff angles are expected in degrees
                                 : Light(props), m_dir(glm::normalize(dir)), m_pos(pos),
@@ -226,3 +298,39 @@ void Lighting::SpotLight::setAttenuation(GLfloat constant, GLfloat linear, GLflo
     m_attenuation_coefs_lin = linear;
     m_attenuation_coefs_quad = quadratic;
 }
+
+float Lighting::SpotLight::range() const
+{
+    return attenuationRange(m_props, m_attenuation_coefs_const, m_attenuation_coefs_lin, m_attenuation_coefs_quad);
+}
+
+bool Lighting::SpotLight::boundingSphere(glm::vec3& out_center, float& out_radius) const
+{
+    const float light_range = range();
+    if (std::isinf(light_range)) return false;
+
+    // smallest sphere around the cone, wide cones are bounded by their base, narrow ones by the apex and the base rim
+    const float cos_45_degrees = 0.70710678f;
+    if (m_cos_out_cutoff < cos_45_degrees)
+    {
+        out_center = m_pos + m_dir * (light_range * std::max(m_cos_out_cutoff, 0.f));
+        out_radius = m_cos_out_cutoff < 0.f ? light_range : light_range * std::sqrt(1.f - m_cos_out_cutoff * m_cos_out_cutoff);
+    }
+    else
+    {
+        out_radius = light_range / (2.f * m_cos_out_cutoff);
+        out_center = m_pos + m_dir * out_radius;
+    }
+    return true;
+}
+
+void Lighting::SpotLight::pack(glm::vec4 out_texels[packed_texels]) const
+{
+    const float light_range = range();
+
+    out_texels[0] = glm::vec4(m_pos, static_cast<float>(Type::spot));
+    out_texels[1] = glm::vec4(m_dir, std::isinf(light_range) ? 0.f : light_range);
+    out_texels[2] = glm::vec4(m_attenuation_coefs_const, m_attenuation_coefs_lin, m_attenuation_coefs_quad, m_cos_in_cutoff);
+    out_texels[3].w = m_cos_out_cutoff;
+    packProps(out_texels);
+}
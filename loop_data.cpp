@@ -1,12 +1,17 @@
 #include "game.hpp"
 
+#include <algorithm>
+#include <cmath> // std::floor
 #include <cstring> // memcpy, memset
 
 
 MainLoopStack MainLoopStack::instance{};
 
-LoopData::LoopData(size_t data_size, InitFnPtr *init_fn, DeinitFnPtr *deinit_fn, LoopCallbackFnPtr *loop_callback_fn)
-            : m_raw_data(std::make_unique<unsigned char[]>(data_size)), m_init_fn(init_fn), m_deinit_fn(deinit_fn), m_loop_callback_fn(loop_callback_fn)
+LoopData::LoopData(size_t data_size, InitFnPtr *init_fn, DeinitFnPtr *deinit_fn, LoopCallbackFnPtr *loop_callback_fn,
+                   bool idle_capable, SimTickFnPtr *sim_tick_fn, double sim_rate, bool records_render_commands)
+            : m_raw_data(std::make_unique<unsigned char[]>(data_size)), m_init_fn(init_fn), m_deinit_fn(deinit_fn), m_loop_callback_fn(loop_callback_fn),
+              m_sim_tick_fn(sim_tick_fn), m_idle_capable(idle_capable), m_sim_rate(sim_rate),
+              m_records_render_commands(records_render_commands)
 {
     //TODO maybe print error when m_raw_data pointer is NULL
     // printf("LoopData constructor called! m_raw_data: %p, init_fn: %p, deinit_fn: %p, loop_callback_fn: %p\n",
@@ -38,6 +43,7 @@ bool LoopData::dataInitialized() const
 
 int LoopData::init() const
 {
+    PROFILE_SCOPE("LoopData::init");
     assert(dataInitialized());
 
     if (m_init_fn != NULL)
@@ -70,6 +76,7 @@ void LoopData::deinitAndFree()
 
 LoopRetVal LoopData::loopCallback(unsigned int global_tick, double frame_time, float frame_delta) const
 {
+    PROFILE_SCOPE("LoopData::loopCallback");
     assert(dataInitialized());
 
     if (m_loop_callback_fn != NULL)
@@ -80,6 +87,20 @@ LoopRetVal LoopData::loopCallback(unsigned int global_tick, double frame_time, f
     return LoopRetVal::exit; //TODO other value instead?
 }
 
+void LoopData::simTick(unsigned int sim_tick, double sim_time, float sim_delta) const
+{
+    assert(dataInitialized());
+
+    if (m_sim_tick_fn != NULL)
+    {
+        m_sim_tick_fn(getData(), sim_tick, sim_time, sim_delta);
+    }
+}
+
+MainLoopStack::MainLoopStack() : m_idle_min_refresh_rate(default_idle_min_refresh_rate)
+{
+}
+
 const LoopData* MainLoopStack::currentLoopData() const
 {
     return m_stack.empty() ? NULL : &m_stack.back();
@@ -88,6 +109,7 @@ const LoopData* MainLoopStack::currentLoopData() const
 LoopData* MainLoopStack::push(LoopData&& new_data)
 {
     if (!new_data.dataInitialized()) return NULL;
+    RenderCommands::acquireContext(); // the new loop gets initialized right away
 
     try
     {
@@ -99,17 +121,49 @@ LoopData* MainLoopStack::push(LoopData&& new_data)
     }
 
     assert(!m_stack.empty());
+    m_last_present_time = -1.0; // new loop on top is drawn right away, without idle waiting
+    m_frames_since_change = 0;
+    m_sim_start_time = -1.0; // loop on top starts simulating from its first frame
     return &m_stack.back();
 }
 
 void MainLoopStack::pop()
 {
+    PROFILE_SCOPE("MainLoopStack::pop");
     if (!m_stack.empty())
     {
+        RenderCommands::acquireContext(); // deinitialization frees GL objects
         m_stack.pop_back();
+        m_last_present_time = -1.0; // same as in push
+        m_frames_since_change = 0;
+        m_sim_start_time = -1.0; // time spent in the popped loop is not caught up
     }
 }
 
+void MainLoopStack::beginFrame()
+{
+    FrameArena::reset();
+    #ifdef ENABLE_ALLOC_TRACKER
+        Profiling::AllocTracker::beginFrame();
+    #endif
+}
+
+void MainLoopStack::endFrame(unsigned int global_tick)
+{
+    #ifdef ENABLE_ALLOC_TRACKER
+        // a push/pop during this frame has already reset the counter, such frame is not judged
+        Profiling::AllocTracker::endFrame(steadyState(), global_tick);
+    #else
+        (void)global_tick;
+    #endif
+    ++m_frames_since_change;
+}
+
+bool MainLoopStack::steadyState() const
+{
+    return m_frames_since_change >= steady_state_warmup_frames;
+}
+
 float MainLoopStack::getFrameDelta(double frame_time)
 {
     float frame_delta = 0.f;
@@ -122,3 +176,72 @@ float MainLoopStack::getFrameDelta(double frame_time)
 
     return frame_delta;
 }
+
+void MainLoopStack::setIdleMinRefreshRate(double rate)
+{
+    m_idle_min_refresh_rate = rate;
+}
+
+bool MainLoopStack::idleWaitAllowed() const
+{
+    const LoopData *loop_data = currentLoopData();
+    return m_idle_min_refresh_rate > 0.0 && loop_data != NULL && loop_data->m_idle_capable;
+}
+
+double MainLoopStack::idleWaitTimeout(double time) const
+{
+    if (m_idle_min_refresh_rate <= 0.0 || m_last_present_time < 0.0) return 0.0;
+
+    return std::max(0.0, m_last_present_time + 1.0 / m_idle_min_refresh_rate - time);
+}
+
+bool MainLoopStack::redrawForced(double frame_time) const
+{
+    if (m_idle_min_refresh_rate <= 0.0 || m_last_present_time < 0.0) return true;
+
+    return frame_time - m_last_present_time >= 1.0 / m_idle_min_refresh_rate;
+}
+
+void MainLoopStack::framePresented(double frame_time)
+{
+    m_last_present_time = frame_time;
+}
+
+void MainLoopStack::simulate(const LoopData& loop_data, double frame_time)
+{
+    PROFILE_SCOPE("MainLoopStack::simulate");
+    if (loop_data.m_sim_tick_fn == NULL || loop_data.m_sim_rate <= 0.0) return;
+
+    const double sim_step = 1.0 / loop_data.m_sim_rate;
+    if (m_sim_start_time < 0.0)
+    {
+        m_sim_start_time = frame_time;
+        m_sim_ticks = 0;
+    }
+
+    // tick times are computed from the start, so they do not drift by summing the steps,
+    // the epsilon keeps frame times that are exact multiples of the step (replays, benchmark) from losing a tick
+    const double ticks_elapsed = (frame_time - m_sim_start_time) * loop_data.m_sim_rate;
+    unsigned int ticks_due = static_cast<unsigned int>(std::floor(ticks_elapsed + 1e-6)) + 1; // first tick at the start
+    if (ticks_due > m_sim_ticks + max_sim_ticks_per_frame)
+    {
+        // the simulation falls behind, it continues from the time it can still reach
+        const unsigned int ticks_dropped = ticks_due - m_sim_ticks - max_sim_ticks_per_frame;
+        m_sim_start_time += ticks_dropped * sim_step;
+        ticks_due -= ticks_dropped;
+    }
+
+    const float sim_delta = static_cast<float>(sim_step);
+    for (; m_sim_ticks < ticks_due; ++m_sim_ticks)
+    {
+        loop_data.simTick(m_sim_ticks, m_sim_start_time + m_sim_ticks * sim_step, sim_delta);
+    }
+
+    const double alpha = (frame_time - m_sim_start_time) * loop_data.m_sim_rate - (m_sim_ticks - 1);
+    m_sim_alpha = static_cast<float>(std::min(1.0, std::max(0.0, alpha)));
+}
+
+float MainLoopStack::simAlpha() const
+{
+    return m_sim_alpha;
+}
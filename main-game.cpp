@@ -9,6 +9,7 @@
 //!IMPORTANT: we need to call destructor on objects even if their constructor "failed" (aka id == empty_id)
 void GameMainLoop::initCamera()
 {
+    PROFILE_SCOPE("GameMainLoop::initCamera");
     const glm::vec2 win_size = WindowManager::getSizeF();
 
     mouse_sens = 0.08f;
@@ -20,6 +21,8 @@ void GameMainLoop::initCamera()
     camera_pitch = 0.f;
     camera_yaw = -90.f;
     new (&camera) Drawing::Camera3D(fov, camera_aspect_ratio, camera_init_pos, camera_pitch, camera_yaw);
+    player_pos = camera_init_pos;
+    last_player_pos = camera_init_pos;
 }
 
 void GameMainLoop::deinitCamera()
@@ -29,6 +32,7 @@ void GameMainLoop::deinitCamera()
 
 bool GameMainLoop::initVBOsAndMeshes()
 {
+    PROFILE_SCOPE("GameMainLoop::initVBOsAndMeshes");
     //Cube and it's vbo
     float cube_vertices[] = // counter-clockwise vertex winding order
     {
@@ -87,26 +91,6 @@ bool GameMainLoop::initVBOsAndMeshes()
         return false;
     }
 
-    //Unit line and it's vbo
-    float line_vertices[] =
-    {
-        //position
-        0.f, 0.f,
-        1.f, 1.f,
-    };
-    size_t line_vert_attrib = 2; //amount of line attributes - 2x pos
-    size_t line_vert_count = (sizeof(line_vertices) / sizeof(line_vertices[0]))
-                                / line_vert_attrib; //amount of vertices - elements in array divided by attribute size
-    
-    new (&line_vbo) Meshes::VBO(line_vertices, line_vert_count, Meshes::VBO::default2DConfig);
-    if (line_vbo.m_id == empty_id)
-    {
-        fprintf(stderr, "Failed to create unit line VBO!\n");
-        cube_vbo.~VBO();
-        line_vbo.~VBO();
-        return false;
-    }
-
     //Turret mesh
     const char *turret_mesh_path = "assets/turret/turret.obj";
 
@@ -116,7 +100,6 @@ bool GameMainLoop::initVBOsAndMeshes()
     {
         fprintf(stderr, "Failed to create Turret mesh! Returned error value: %d\n", turret_mesh_ret);
         cube_vbo.~VBO();
-        line_vbo.~VBO();
         turret_mesh.~Mesh();
         return false;
     }
@@ -130,7 +113,6 @@ bool GameMainLoop::initVBOsAndMeshes()
     {
         fprintf(stderr, "Failed to create Ball mesh! Returned error value: %d\n", ball_mesh_ret);
         cube_vbo.~VBO();
-        line_vbo.~VBO();
         turret_mesh.~Mesh();
         ball_mesh.~Mesh();
         return false;
@@ -145,7 +127,6 @@ bool GameMainLoop::initVBOsAndMeshes()
     {
         fprintf(stderr, "Failed to create Rock mesh! Returned error value: %d\n", rock_mesh_ret);
         cube_vbo.~VBO();
-        line_vbo.~VBO();
         turret_mesh.~Mesh();
         ball_mesh.~Mesh();
         rock_mesh.~Mesh();
@@ -161,7 +142,6 @@ bool GameMainLoop::initVBOsAndMeshes()
     {
         fprintf(stderr, "Failed to create Floor mesh!\n");
         cube_vbo.~VBO();
-        line_vbo.~VBO();
         turret_mesh.~Mesh();
         ball_mesh.~Mesh();
         rock_mesh.~Mesh();
@@ -175,7 +155,6 @@ bool GameMainLoop::initVBOsAndMeshes()
 void GameMainLoop::deinitVBOsAndMeshes()
 {
     cube_vbo.~VBO();
-    line_vbo.~VBO();
     turret_mesh.~Mesh();
     ball_mesh.~Mesh();
     rock_mesh.~Mesh();
@@ -184,6 +163,7 @@ void GameMainLoop::deinitVBOsAndMeshes()
 
 bool GameMainLoop::initTextures()
 {
+    PROFILE_SCOPE("GameMainLoop::initTextures");
     using Texture = Textures::Texture2D;
     using Cubemap = Textures::Cubemap;
 
@@ -417,6 +397,7 @@ void GameMainLoop::deinitRenderBuffers()
 
 bool GameMainLoop::initShaders()
 {
+    PROFILE_SCOPE("GameMainLoop::initShaders");
     //shader partials
     // used only during this init method, thus loaded as local unique_ptr, so we dont have to call delete/destructor
     const char *postprocess_fs_partial_path = SHADERS_PARTIALS_DIR_PATH "postprocess.fspart";
@@ -433,19 +414,7 @@ bool GameMainLoop::initShaders()
             //    *default_fs_path = SHADERS_DIR_PATH "default.fs",
             //    *passthrough_pos_vs_path = SHADERS_DIR_PATH "passthrough-pos.vs",
             //    *passthrough_pos_uv_vs_path = SHADERS_DIR_PATH "passthrough-pos-uv.vs",
-               *transform_vs_path = SHADERS_DIR_PATH "transform.vs",
-               *static_color_fs_path = SHADERS_DIR_PATH "static-color.fs";
-
-    //line shader
-    const char *screen_line_vs_path = SHADERS_DIR_PATH "screen2d-line.vs";
-
-    new (&screen_line_shader) ShaderP(screen_line_vs_path, static_color_fs_path);
-    if (screen_line_shader.m_id == empty_id)
-    {
-        fprintf(stderr, "Failed to create screen line shader program!\n");
-        screen_line_shader.~Program();
-        return false;
-    }
+               *batch2d_vs_path = SHADERS_DIR_PATH "batch2d.vs";
 
     //ui shader
     const char *ui_vs_path = SHADERS_DIR_PATH "ui.vs",
@@ -457,7 +426,6 @@ bool GameMainLoop::initShaders()
     if (ui_shader.m_id == empty_id)
     {
         fprintf(stderr, "Failed to create UI shader program!\n");
-        screen_line_shader.~Program();
         ui_shader.~Program();
         return false;
     }
@@ -469,11 +437,10 @@ bool GameMainLoop::initShaders()
                                                                 // Shaders::ShaderInclude(postprocess_fs_partial.get()),
                                                                };
 
-    new (&tex_rect_shader) ShaderP(transform_vs_path, tex_rect_fs_path, tex_rect_vs_includes, tex_rect_fs_includes);
+    new (&tex_rect_shader) ShaderP(batch2d_vs_path, tex_rect_fs_path, tex_rect_vs_includes, tex_rect_fs_includes);
     if (tex_rect_shader.m_id == empty_id)
     {
         fprintf(stderr, "Failed to create textured rectangle shader program!\n");
-        screen_line_shader.~Program();
         ui_shader.~Program();
         tex_rect_shader.~Program();
         return false;
@@ -486,7 +453,6 @@ bool GameMainLoop::initShaders()
     if (light_src_shader.m_id == empty_id)
     {
         fprintf(stderr, "Failed to create light source shader program!\n");
-        screen_line_shader.~Program();
         ui_shader.~Program();
         tex_rect_shader.~Program();
         light_src_shader.~Program();
@@ -499,16 +465,17 @@ bool GameMainLoop::initShaders()
     std::vector<Shaders::ShaderInclude> light_vs_includes = {},
                                         light_fs_includes =
                                             {
-                                                // TODO synchronize this value with `lights_max_amount` constexpr
-                                                Shaders::ShaderInclude(Shaders::IncludeDefine("LIGHTS_MAX_AMOUNT", "10")),
+                                                Shaders::ShaderInclude(Shaders::IncludeDefine("LIGHTS_MAX_AMOUNT", STRINGIFY(LIGHTS_MAX_AMOUNT))),
                                                 Shaders::ShaderInclude(Shaders::IncludeDefine("ALPHA_MIN_THRESHOLD", "0.35")),
                                             };
+    #ifdef USE_CLUSTERED_LIGHTING
+        light_fs_includes.emplace_back(Shaders::IncludeDefine("CLUSTERED_LIGHTING"));
+    #endif
 
     new (&light_shader) ShaderP(light_vs_path, light_fs_path, light_vs_includes, light_fs_includes);
     if (light_shader.m_id == empty_id)
     {
         fprintf(stderr, "Failed to create shader program for lighting!\n");
-        screen_line_shader.~Program();
         ui_shader.~Program();
         tex_rect_shader.~Program();
         light_src_shader.~Program();
@@ -526,7 +493,6 @@ bool GameMainLoop::initShaders()
     if (skybox_shader.m_id == empty_id)
     {
         fprintf(stderr, "Failed to create skybox shader program!\n");
-        screen_line_shader.~Program();
         ui_shader.~Program();
         tex_rect_shader.~Program();
         light_src_shader.~Program();
@@ -535,21 +501,67 @@ bool GameMainLoop::initShaders()
         return false;
     }
 
+    //depth pre-pass shader
+    const char *depth_fs_path = SHADERS_DIR_PATH "depth.fs";
+
+    new (&depth_shader) ShaderP(default_vs_path, depth_fs_path); // using the default vertex shader, positions only
+    if (depth_shader.m_id == empty_id)
+    {
+        fprintf(stderr, "Failed to create depth pre-pass shader program!\n");
+        ui_shader.~Program();
+        tex_rect_shader.~Program();
+        light_src_shader.~Program();
+        light_shader.~Program();
+        skybox_shader.~Program();
+        depth_shader.~Program();
+        return false;
+    }
+
+    #ifdef USE_DEFERRED_SHADING
+        //deferred shading shaders, both are built from the light shader
+        const char *fullscreen_vs_path = SHADERS_DIR_PATH "fullscreen.vs";
+        std::vector<Shaders::ShaderInclude> gbuffer_fs_includes = light_fs_includes,
+                                            deferred_light_fs_includes = light_fs_includes;
+        gbuffer_fs_includes.emplace_back(Shaders::IncludeDefine("GBUFFER_PASS"));
+        deferred_light_fs_includes.emplace_back(Shaders::IncludeDefine("DEFERRED_LIGHTING"));
+
+        new (&gbuffer_shader) ShaderP(light_vs_path, light_fs_path, light_vs_includes, gbuffer_fs_includes);
+        new (&deferred_light_shader) ShaderP(fullscreen_vs_path, light_fs_path, {}, deferred_light_fs_includes);
+        if (gbuffer_shader.m_id == empty_id || deferred_light_shader.m_id == empty_id)
+        {
+            fprintf(stderr, "Failed to create shader programs for deferred shading!\n");
+            ui_shader.~Program();
+            tex_rect_shader.~Program();
+            light_src_shader.~Program();
+            light_shader.~Program();
+            skybox_shader.~Program();
+            depth_shader.~Program();
+            gbuffer_shader.~Program();
+            deferred_light_shader.~Program();
+            return false;
+        }
+    #endif
+
     return true;
 }
 
 void GameMainLoop::deinitShaders()
 {
-    screen_line_shader.~Program();
     ui_shader.~Program();
     tex_rect_shader.~Program();
     light_src_shader.~Program();
     light_shader.~Program();
     skybox_shader.~Program();
+    depth_shader.~Program();
+    #ifdef USE_DEFERRED_SHADING
+        gbuffer_shader.~Program();
+        deferred_light_shader.~Program();
+    #endif
 }
 
 void GameMainLoop::initLighting()
 {
+    PROFILE_SCOPE("GameMainLoop::initLighting");
     using LightProps = Lighting::LightProps;
     using DirLight = Lighting::DirLight;
     using PointLight = Lighting::PointLight;
@@ -593,6 +605,7 @@ void GameMainLoop::deinitLighting()
 
 void GameMainLoop::initMaterials()
 {
+    PROFILE_SCOPE("GameMainLoop::initMaterials");
     const SharedGLContext& shared_gl_context = SharedGLContext::instance.value();
     assert(shared_gl_context.isInitialized());
     const Textures::Texture2D& white_pixel = shared_gl_context.white_pixel_tex;
@@ -682,6 +695,7 @@ void GameMainLoop::deinitMaterials()
 
 bool GameMainLoop::initUI()
 {
+    PROFILE_SCOPE("GameMainLoop::initUI");
     const char *font_path = "assets/DINEngschrift-Regular.ttf";
     const float font_size = 22;
 
@@ -751,6 +765,7 @@ void GameMainLoop::deinitFrameBuffers()
 
 bool GameMainLoop::initGameStuff()
 {
+    PROFILE_SCOPE("GameMainLoop::initGameStuff");
     //Wall and it's vbo
     wall_size = glm::vec3(5.f, 2.5f, 0.2f);
     wall_pos = glm::vec3(0.f, wall_size.y / 2.f, 0.f);
@@ -851,6 +866,39 @@ bool GameMainLoop::initGameStuff()
     
     level_manager.addLevel(Level{ std::vector<LevelPart>{ LevelPart{ TargetType::target, 30, 1.3f } }, true });
 
+    // never more targets alive than the whole game has, spawning then never reallocates mid-game
+    targets.reserve(level_manager.getWholeTargetAmount());
+    ball_targets.reserve(level_manager.getWholeTargetAmount());
+
+    //Transforms
+    new (&scene_transforms) TransformBatch();
+    scene_transforms.resize(scene_object_amount);
+    scene_transforms.setPosition(scene_cube, glm::vec3(-4.f, 0.35f, -0.5f));
+    scene_transforms.setScale(scene_cube, glm::vec3(0.7f));
+    scene_transforms.setPosition(scene_turret, glm::vec3(4.3f, 0.f, -1.5f));
+    scene_transforms.setScale(scene_turret, glm::vec3(0.3f));
+    scene_transforms.setRotation(scene_turret, glm::pi<float>(), Drawing::up_dir); // rotate towards the player spawn point
+    scene_transforms.setPosition(scene_ball, glm::vec3(2.2f, 0.f, 2.2f));
+    scene_transforms.setScale(scene_ball, glm::vec3(3.f));
+    scene_transforms.setPosition(scene_default_ball, glm::vec3(-2.2f, -0.5f, 2.2f));
+    scene_transforms.setScale(scene_default_ball, glm::vec3(3.f));
+    rock_model.setTransform(scene_transforms, scene_rock, glm::vec3(-5.5f, 0.35f, 0.f));
+    scene_transforms.setRotation(scene_floor, glm::radians(-90.f), glm::vec3{ 1.f, 0.f, 0.f });
+    scene_transforms.setPosition(scene_wall, wall_pos);
+
+    const glm::vec3 outlined_ball_pos = glm::vec3(3.6f, 0.33f, 2.2f);
+    const glm::vec3 outlined_ball_scale = glm::vec3(2.5f);
+    const float outline_scale_factor = 1.1f;
+    scene_transforms.setPosition(scene_outlined_ball, outlined_ball_pos);
+    scene_transforms.setScale(scene_outlined_ball, outlined_ball_scale);
+    scene_transforms.setOriginOffset(scene_outlined_ball, ball_origin_offset);
+    scene_transforms.setPosition(scene_ball_outline, outlined_ball_pos);
+    scene_transforms.setScale(scene_ball_outline, outlined_ball_scale * outline_scale_factor);
+    scene_transforms.setOriginOffset(scene_ball_outline, ball_origin_offset);
+
+    new (&target_transforms) TransformBatch();
+    target_transforms.reserve(level_manager.getWholeTargetAmount());
+
     //Target practice stuff
     practice_time_start = -1.f;
     practice_time_end = -1.f;
@@ -872,6 +920,8 @@ void GameMainLoop::deinitGameStuff()
     target_rng_height.~RNG();
     target_rng_dir.~RNG();
     level_manager.~LevelManager();
+    scene_transforms.~TransformBatch();
+    target_transforms.~TransformBatch();
     pracice_times.~vector();
 }
 
@@ -935,6 +985,7 @@ bool GameMainLoop::updateMuzzleFlashLightProps(double current_frame_time)
 
 int GameMainLoop::init()
 {
+    PROFILE_SCOPE("GameMainLoop::init");
     puts("GameMainLoop init begin");
 
     //Camera
@@ -1033,18 +1084,20 @@ int GameMainLoop::init()
     clear_color_3d = Color(50, 220, 80);
     // clear_color_3d = Color(10, 10, 10); //DEBUG
     clear_color_2d = Color(0, 0, 0);
+    sim_state_time = 0.0;
+    sim_ticks = 0;
+    queued_shot_amount = 0;
     tick = 0;
     last_global_tick = 0;
-    fps_calculation_interval = 0.5f; // in seconds
-    last_fps_calculation_time = glfwGetTime();
-    fps_calculation_counter = 0;
-    fps_calculated = 0;
+    show_frame_stats = false;
     last_mouse_posF = glm::vec2(0.f);
     last_left_mbutton = false;
     last_right_mbutton = false;
     last_esc_state = GLFW_PRESS;
     last_c_state = GLFW_PRESS;
     last_v_state = GLFW_PRESS;
+    last_f3_state = GLFW_PRESS;
+    last_f4_state = GLFW_PRESS;
 
     puts("GameMainLoop init end");
     return 0;
@@ -1056,157 +1109,70 @@ GameMainLoop::~GameMainLoop()
     // glDeleteRenderbuffers(1, &fbo3d_rbo_stencil);
 }
 
-LoopRetVal GameMainLoop::loop(unsigned int global_tick, double frame_time, float frame_delta)
+void GameMainLoop::simTick(unsigned int sim_tick, double sim_time, float sim_delta)
 {
-    GLFWwindow * const window = WindowManager::getWindow();
-    const glm::vec2 win_size = WindowManager::getSizeF();
-    SharedGLContext& shared_gl_context = SharedGLContext::instance.value();
-    assert(shared_gl_context.isInitialized());
-
-    const bool consecutive_tick = (last_global_tick + 1) == global_tick;
-
-    // ---Mouse input---
-    if (!consecutive_tick) MouseManager::setCursorLocked();
-
-    const glm::vec2 mouse_posF = MouseManager::mousePosF();
-
-    if (!consecutive_tick)
-    {
-        last_mouse_posF = mouse_posF;
-    }
-
-    const float mouse_delta_x = mouse_posF.x - last_mouse_posF.x, mouse_delta_y = mouse_posF.y - last_mouse_posF.y;
-    //printf("mouse_delta_x: %f, mouse_delta_y: %f\n", mouse_delta_x, mouse_delta_y);
-
-    if (!CLOSE_TO_0(mouse_delta_x) || !CLOSE_TO_0(mouse_delta_y))
-    {
-        camera_yaw += mouse_sens * mouse_delta_x;
-        camera_pitch = std::min(89.f, std::max(-89.f, camera_pitch - mouse_sens * mouse_delta_y)); // set camera_pitch with limits -89°/89°
-        camera.setTargetFromPitchYaw(camera_pitch, camera_yaw); //TODO make this better
-    }
-
-    //updating camera's aspect ratio if the window aspect ration changed
-    if (!CLOSE_TO_0(win_size.x) && !CLOSE_TO_0(win_size.y)) // ...but only when having meaningful window size
-    {
-        const float win_aspect_ratio = win_size.x / win_size.y;
-        if (!FLOAT_EQUALS(camera_aspect_ratio, win_aspect_ratio))
-        {
-            camera_aspect_ratio = win_aspect_ratio;
-            camera.setProjectionMatrix(fov, camera_aspect_ratio);
-        }
-    }
-
-    const Collision::Ray mouse_ray = camera.getRay();
-
-    const bool left_mbutton = MouseManager::left_button, right_mbutton = MouseManager::right_button;
-    const bool left_mbutton_is_clicked = consecutive_tick && left_mbutton && !last_left_mbutton,
-               right_mbutton_is_clicked = consecutive_tick && right_mbutton && !last_right_mbutton;
-
-    // ---Keyboard input---
-    int esc_state = glfwGetKey(window, GLFW_KEY_ESCAPE);
-    int c_state = glfwGetKey(window, GLFW_KEY_C);
-    int v_state = glfwGetKey(window, GLFW_KEY_V);
-    const bool esc_clicked = consecutive_tick && (esc_state == GLFW_PRESS) && (last_esc_state == GLFW_RELEASE);
-    const bool c_clicked = consecutive_tick && (c_state == GLFW_PRESS) && (last_c_state == GLFW_RELEASE);
-    const bool v_clicked = consecutive_tick && (v_state == GLFW_PRESS) && (last_v_state == GLFW_RELEASE);
-    const bool pause_pressed = consecutive_tick && (glfwGetKey(window, GLFW_KEY_PAUSE) == GLFW_PRESS); // not using last_pause_state currently
-    
-    #ifdef PLATFORM_WEB
-        // const bool cursor_not_captured = glfwGetInputMode(window, GLFW_CURSOR) != GLFW_CURSOR_CAPTURED;
-        const bool pause_the_game = esc_clicked || pause_pressed;
-    #else
-        const bool window_is_focused = glfwGetWindowAttrib(window, GLFW_FOCUSED) > 0;
-        const bool pause_the_game = esc_clicked || pause_pressed || !window_is_focused;
-    #endif /* PLATFORM_WEB */
-
-    if (pause_the_game)
-    {
-        MainLoopStack& main_loop_stack = MainLoopStack::instance;
-
-        LoopData* pause_loop = main_loop_stack.pushFromTemplate<GamePauseMainLoop>();
-        if (pause_loop == NULL)
-        {
-            fprintf(stderr, "Failed to pause the game! Can't push pause main loop on the stack.\n");
-        }
-        else
-        {
-            int init_result = pause_loop->init();
-            if (init_result)
-            {
-                fprintf(stderr, "Failed to pause the game! Initialization failed with return value: %d.\n", init_result);
-            }
-        }
-    }
-
-    if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS) show_flashlight = true;
-    if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS) show_flashlight = false;
-
-    // Gamma coef. setting
-    {
-        float new_gamma_coef = shared_gl_context.render_settings.gamma_coef;
-        if (glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS) new_gamma_coef -= 0.01f;
-        if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS) new_gamma_coef += 0.01f;
-        if (new_gamma_coef != shared_gl_context.render_settings.gamma_coef)
-        {
-            // printf("Gamma coeficient changed to: %f\n", new_gamma_coef);
-            shared_gl_context.render_settings.gamma_coef = new_gamma_coef;
-        }
-    }
+    PROFILE_SCOPE("GameMainLoop::simTick");
 
-    if (c_clicked)
-    {
-        shared_gl_context.render_settings.enable_gamma_correction = !shared_gl_context.render_settings.enable_gamma_correction;
-    }
+    GLFWwindow * const window = WindowManager::getWindow();
 
-    if (v_clicked)
+    // ---Input---
+    // mouse events up to the tick time, keys are sampled per tick
+    if (sim_tick == 0)
     {
-        const bool new_use_v_sync = !shared_gl_context.render_settings.use_v_sync;
-
-        const int interval = new_use_v_sync ? 1 : 0;
-        glfwSwapInterval(interval);
-
-        shared_gl_context.render_settings.use_v_sync = new_use_v_sync;
+        // no clicks right after the pause, the aim continues from where the cursor is now
+        MouseManager::skipEvents();
+        last_mouse_posF = MouseManager::mousePosF();
+        queued_shot_amount = 0;
     }
-
-    glm::vec3 move_dir_rel = Movement::getSimplePlayerDir(window);
+    consumeMouseEvents(sim_time);
+    const glm::vec3 move_dir_rel = Movement::getSimplePlayerDir(window);
 
     // ---Shooting---
-    if (tick == 0)
+    PROFILE_BEGIN("shooting");
+    if (sim_ticks == 0)
     {
-        level_manager.prepareFirstLevel(frame_time);
+        level_manager.prepareFirstLevel(sim_time);
     }
 
     //TODO this system does not work properly when shooting from an angle - ball gets hit even when aiming at the flat target
     // possible fix could be to also check for a hit of the wall, if target hit is further from the player than the wall hit count it as a miss
-    if (left_mbutton_is_clicked)
+    for (unsigned int i = 0; i < queued_shot_amount; ++i)
     {
+        // targets are hit where they were when the click got polled, those spawned by the last tick existed since its time
+        const double shot_time = std::clamp(queued_shots[i].time, sim_time - 1.0 / sim_rate, sim_time);
+        const Collision::Ray mouse_ray(player_pos, queued_shots[i].dir); // aim at the click from the simulated position
+
         size_t hit_idx = 0;
 
         //ball targets - they go first as they get hit before flat targets
-        Collision::RayCollision rcoll = Collision::rayBallTargets(mouse_ray, ball_targets, frame_time, &hit_idx);
+        Collision::RayCollision rcoll = Collision::rayBallTargets(mouse_ray, ball_targets, shot_time, &hit_idx);
         if (rcoll.m_hit)
         {
             assert(hit_idx < ball_targets.size());
             ball_targets.erase(ball_targets.begin() + hit_idx); // delete the target at `out_idx`
-            handleTargetHit(frame_time);
+            handleTargetHit(shot_time);
         }
         else
         {
             //flat targets - only if no ball target hit
-            rcoll = Collision::rayFlatTargets(mouse_ray, targets, frame_time, &hit_idx);
+            rcoll = Collision::rayFlatTargets(mouse_ray, targets, shot_time, &hit_idx);
             if (rcoll.m_hit)
             {
                 assert(hit_idx < targets.size());
                 targets.erase(targets.begin() + hit_idx); // delete the target at `out_idx`
-                handleTargetHit(frame_time);
+                handleTargetHit(shot_time);
             }
         }
 
-        muzzle_flash_begin = frame_time; // start the muzzle flash effect
+        muzzle_flash_begin = shot_time; // start the muzzle flash effect
     }
+    queued_shot_amount = 0;
+    PROFILE_END();
 
     // ---Target spawning---
     {
+        PROFILE_SCOPE("target spawning");
+
         // not using radius as we would *2 for both borders
         glm::vec2 flat_target_spawn_area = glm::vec2(wall_size.x, wall_size.y)
                                             - glm::vec2(Game::Target::flat_target_size);
@@ -1214,7 +1180,7 @@ LoopRetVal GameMainLoop::loop(unsigned int global_tick, double frame_time, float
                                             - glm::vec2(Game::Target::ball_target_size);
         
         unsigned int targets_alive = getTargetsAlive();
-        unsigned int target_spawn_amount = level_manager.targetSpawnAmount(frame_time, targets_alive);
+        unsigned int target_spawn_amount = level_manager.targetSpawnAmount(sim_time, targets_alive);
 
         for (unsigned int i = 0; i < target_spawn_amount; ++i)
         {
@@ -1229,7 +1195,7 @@ LoopRetVal GameMainLoop::loop(unsigned int global_tick, double frame_time, float
                 {
                 case Game::TargetType::target:
                     {
-                        targets.emplace_back(target_model, frame_time,
+                        targets.emplace_back(target_model, sim_time,
                                              current_level_part->spawnNext(target_rng_width, target_rng_height, target_rng_dir,
                                                                            wall_center, flat_target_spawn_area),
                                              color, scale_fn);
@@ -1237,7 +1203,7 @@ LoopRetVal GameMainLoop::loop(unsigned int global_tick, double frame_time, float
                     }
                 case Game::TargetType::ball:
                     {
-                        ball_targets.emplace_back(ball_model, frame_time,
+                        ball_targets.emplace_back(ball_model, sim_time,
                                                   current_level_part->spawnNext(target_rng_width, target_rng_height, target_rng_dir,
                                                                                 wall_center, ball_target_spawn_area),
                                                   color, scale_fn);
@@ -1249,647 +1215,885 @@ LoopRetVal GameMainLoop::loop(unsigned int global_tick, double frame_time, float
         }
     }
 
-    // ---Target position updating---
-    for (size_t i = 0; i < targets.size(); ++i)
-    {
-        targets[i].updatePos(frame_time);
-    }
-    for (size_t i = 0; i < ball_targets.size(); ++i)
-    {
-        ball_targets[i].updatePos(frame_time);
-    }
-
     // ---Player movement---
+    PROFILE_BEGIN("movement");
     const float move_per_sec = 4.f;
-    const float move_magnitude = move_per_sec * frame_delta;
+    const float move_magnitude = move_per_sec * sim_delta;
     glm::vec3 move_dir_abs = camera.dirCoordsViewToWorld(move_dir_rel); // absolute move dir vector (world coords)
     glm::vec3 move_abs = move_magnitude * NORMALIZE_OR_0(glm::vec3(move_dir_abs.x, 0.f, move_dir_abs.z)); // we remove the vertical movement
     // glm::vec3 move_abs = move_magnitude * move_dir_abs;
-    
+
+    last_player_pos = player_pos;
     if (!Utils::isZero(move_abs))
     {
-        // printf("move_rel: %f|%f|%f\n", move_rel.x, move_rel.y, move_rel.z);
         // printf("move_abs: %f|%f|%f\n", move_abs.x, move_abs.y, move_abs.z);
-        camera.move(move_abs);
+        player_pos += move_abs;
     }
+    PROFILE_END();
 
-    // ---Lights---
-    //lights array
-    std::vector<std::reference_wrapper<const Lighting::Light>> lights = { sun };
+    sim_state_time = sim_time;
+    ++sim_ticks;
+}
 
-    //flashlight
-    if (show_flashlight)
+void GameMainLoop::consumeMouseEvents(double up_to_time)
+{
+    MouseManager::Event event;
+    while (MouseManager::nextEvent(up_to_time, event))
     {
-        // updating the flashlight position and directiom
-        flashlight.m_pos = camera.m_pos;
-        flashlight.m_dir = camera.getDirection();
+        const float mouse_delta_x = event.pos.x - last_mouse_posF.x, mouse_delta_y = event.pos.y - last_mouse_posF.y;
+        last_mouse_posF = event.pos;
+        //printf("mouse_delta_x: %f, mouse_delta_y: %f\n", mouse_delta_x, mouse_delta_y);
 
-        lights.push_back(flashlight);
+        if (!CLOSE_TO_0(mouse_delta_x) || !CLOSE_TO_0(mouse_delta_y))
+        {
+            camera_yaw += mouse_sens * mouse_delta_x;
+            camera_pitch = std::min(89.f, std::max(-89.f, camera_pitch - mouse_sens * mouse_delta_y)); // set camera_pitch with limits -89°/89°
+        }
+
+        const bool left_click = event.type == MouseManager::Event::Type::button && event.button == GLFW_MOUSE_BUTTON_LEFT
+                                && event.pressed;
+        if (left_click && queued_shot_amount < max_queued_shots)
+        {
+            queued_shots[queued_shot_amount++] = QueuedShot{ event.time, Drawing::Camera3D::dirFromPitchYaw(camera_pitch, camera_yaw) };
+        }
     }
+}
 
-    //muzzle flash
-    if (updateMuzzleFlashLightProps(frame_time))
-    {
-        //additionally update the muzzle flash position
-        muzzle_flash.m_pos = camera.m_pos;
+void GameMainLoop::DrawSceneCommand::execute(const DrawSceneCommand& command)
+{
+    command.loop->drawScene(command);
+}
 
-        lights.push_back(muzzle_flash);
-    }
+void GameMainLoop::drawScene(const DrawSceneCommand& command)
+{
+    PROFILE_SCOPE("GameMainLoop::drawScene");
+    SharedGLContext& shared_gl_context = SharedGLContext::instance.value();
+    const Drawing::Camera3D& camera = command.camera; // the one of the recorded frame
 
-    // ---UI---
-    //pump the input into UI
-    if (!ui.getInput(window, mouse_posF, left_mbutton, textbuffer, textbuffer_len))
-    {
-        fprintf(stderr, "[WARNING] Failed to update the input for UI!\n");
-    }
+    Lighting::LightRefs lights;
+    lights.reserve(command.light_amount);
+    for (unsigned int i = 0; i < command.light_amount; ++i) lights.push_back(*command.lights[i]);
 
-    //GUI styling    
-    {
-        nk_color ui_background_color = nk_rgba(200, 200, 80, 200);
-        ui.m_ctx.style.window.background = ui_background_color;
-        ui.m_ctx.style.window.fixed_background = nk_style_item_color(ui_background_color);
-        ui.m_ctx.style.window.border_color = nk_rgb(100, 100, 80);
-        ui.m_ctx.style.window.border = 3;
-        ui.m_ctx.style.window.padding = nk_vec2(8, 4);
-        ui.m_ctx.style.text.color = nk_rgb(0, 0, 0);
-    }
-    //GUI definition+logic
+    // picks the 3D render size for this frame, GPU timings arrive a few frames late
+    DynamicResolution::update(Profiling::GpuProfiler::lastFrameMs());
+    // scene render graph follows the render settings, they may fall back when its targets can't be allocated
+    shared_gl_context.beginScene();
+
+    bool use_fbo = shared_gl_context.render_settings.use_fbo3d;
+    bool enable_gamma_correction = shared_gl_context.render_settings.enable_gamma_correction;
+    float gamma = enable_gamma_correction ? shared_gl_context.render_settings.gamma_coef : 0.f;
+
+    //3D block
     {
-        //TODO change this probably
-        char ui_textbuff[256]{};
-        size_t ui_textbuff_capacity = sizeof(ui_textbuff) / sizeof(ui_textbuff[0]); // including term. char.
-        
-        //General info
-        if (nk_begin(&ui.m_ctx, "Target Practice", nk_rect(30, 30, 150, 240),
-            NK_WINDOW_BORDER | NK_WINDOW_TITLE | NK_WINDOW_NO_SCROLLBAR))
+        PROFILE_SCOPE("3D pass");
+        GPU_PROFILE_SCOPE("3D pass");
+        #ifdef USE_CLUSTERED_LIGHTING
+            ClusteredLighting::update(camera, lights);
+        #endif
+        //set the viewport according to wanted framebuffer
+        // only a sub-rect of fbo3d is used when the dynamic resolution scales the scene down
+        const glm::ivec2 viewport_size = use_fbo ? shared_gl_context.getFbo3DRenderSize() : command.fbo_size;
+        glViewport(0, 0, viewport_size.x, viewport_size.y);
+
+        // opaque objects without stencil tricks go into the G-buffer with deferred shading and get lit later at once
+        #ifdef USE_DEFERRED_SHADING
+            const bool deferred = shared_gl_context.render_settings.use_deferred_shading;
+            if (deferred) shared_gl_context.beginGBufferPass();
+            const Shaders::Program& opaque_shader = deferred ? gbuffer_shader : light_shader;
+        #else
+            const bool deferred = false;
+            const Shaders::Program& opaque_shader = light_shader;
+        #endif
+
+        //bind the correct framebuffer, with deferred shading only after the G-buffer got filled
+        auto bind_scene_framebuffer = [&]()
         {
-            const bool use_v_sync = shared_gl_context.render_settings.use_v_sync;
-            unsigned int level = level_manager.m_level_idx,
-                         level_targets_hit = level_manager.m_level_targets_hit,
-                         level_amount = level_manager.getLevelAmount(),
-                         level_target_amount = level_manager.getCurrentLevelTargetAmount(),
-                         whole_target_amount = level_manager.getWholeTargetAmount();
+            shared_gl_context.beginScenePass();
 
-            nk_layout_row_dynamic(&ui.m_ctx, 0, 1);
+            Drawing::clear(clear_color_3d);
+            glDepthMask(GL_TRUE); // must enable depth buffer, so the clear will work properly
+            glStencilMask(0xFF);  // must enable stencil buffer, so the clear will work properly
+            glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT); //TODO make this nicer - probably move into Drawing
+        };
+        if (!deferred) bind_scene_framebuffer();
 
-            //fps calculating and rendering
-            ++fps_calculation_counter;
-            if (!consecutive_tick)
-            {
-                fps_calculation_counter = 0;
-                last_fps_calculation_time = frame_time;
-            }
-            else if (frame_time >= last_fps_calculation_time + fps_calculation_interval)
-            {
-                const double time_passed = frame_time - last_fps_calculation_time;
-                fps_calculated = static_cast<unsigned int>(static_cast<double>(fps_calculation_counter) / time_passed);
-                
-                fps_calculation_counter = 0;
-                last_fps_calculation_time = frame_time;
-            }
-            const char* maybe_v_sync_str = use_v_sync ? " (V-Sync)" : "";
-            snprintf(ui_textbuff, ui_textbuff_capacity, "FPS%s: %3d", maybe_v_sync_str, fps_calculated);
-            nk_label(&ui.m_ctx, ui_textbuff, NK_TEXT_LEFT);
+        const glm::mat4& view_mat = camera.getViewMatrix();
+        const glm::mat4& proj_mat = camera.getProjectionMatrix();
 
-            //level counter
-            nk_layout_row_begin(&ui.m_ctx, NK_DYNAMIC, 20, 2);
-            {
-                nk_layout_row_push(&ui.m_ctx, 0.5f);
-                nk_label(&ui.m_ctx, "Level:", NK_TEXT_LEFT);
+        // the G-buffer pass has no use for the camera position and lights
+        auto set_opaque_lighting = [&]()
+        {
+            if (deferred) return;
 
-                nk_layout_row_push(&ui.m_ctx, 0.5f);
-                snprintf(ui_textbuff, ui_textbuff_capacity, "%d/%d",
-                         level, level_amount ? level_amount - 1 : 0); // -1 as we dont count the intro level
-                nk_label(&ui.m_ctx, ui_textbuff, NK_TEXT_RIGHT);
-            }
-            nk_layout_row_end(&ui.m_ctx);
+            light_shader.set("cameraPos", camera.m_pos);
+            light_shader.setLights(UNIFORM_LIGHT_NAME, UNIFORM_LIGHT_COUNT_NAME, lights); // return value ignored here
+        };
 
-            //target counter
-            nk_layout_row_begin(&ui.m_ctx, NK_DYNAMIC, 20, 2);
-            {
-                nk_layout_row_push(&ui.m_ctx, 0.5f);
-                nk_label(&ui.m_ctx, "Progress:", NK_TEXT_LEFT);
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
 
-                nk_layout_row_push(&ui.m_ctx, 0.5f);
-                snprintf(ui_textbuff, ui_textbuff_capacity, "%d/%d", level_targets_hit, level_target_amount);
-                nk_label(&ui.m_ctx, ui_textbuff, NK_TEXT_RIGHT);
-            }
-            nk_layout_row_end(&ui.m_ctx);
+        glDisable(GL_STENCIL_TEST);
+        glStencilMask(0x00);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        
+        // enable multisampling (only for OpenGL 3.3, as OpenGL ES 2.0 and WebGL1 does not support it)
+        #ifdef BUILD_OPENGL_330_CORE
+            if (shared_gl_context.render_settings.use_msaa) glEnable(GL_MULTISAMPLE);
+            else                                            glDisable(GL_MULTISAMPLE);
+        #endif
 
-            ui.verticalGap(8);
+        //Enable backface culling
+        glCullFace(GL_BACK);
+        glEnable(GL_CULL_FACE);
 
-            //level progress bar
+        //depth pre-pass of the opaque objects, the lit pass then shades only the samples that stay visible
+        // it is decided from the overdraw of the previous frames, the G-buffer pass of deferred shading never gets it
+        if (DepthPrepass::update(!deferred))
+        {
+            GPU_PROFILE_SCOPE("depth pre-pass");
+            // alpha tested materials would need a pre-pass shader with the discard, none of the opaque objects has one
+            // it uses the very same MVP matrices as the lit pass
+            struct DepthDraw
             {
-                ui.m_ctx.style.progress.cursor_normal = nk_style_item_color(nk_rgb(100, 100, 100));
-            }
-            nk_layout_row_dynamic(&ui.m_ctx, 30, 1);
+                const Meshes::VBO& vbo;
+                SceneObject object;
+            };
+            const DepthDraw opaque_draws[] = {
+                { cube_vbo, scene_cube },
+                { turret_mesh.m_vbo, scene_turret },
+                { ball_mesh.m_vbo, scene_ball },
+                { ball_mesh.m_vbo, scene_default_ball },
+                { rock_model.m_mesh.m_vbo, scene_rock },
+                { floor_mesh.m_vbo, scene_floor },
+                { wall_vbo, scene_wall },
+            };
+
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            DepthPrepass::beginMeasure(viewport_size);
+
+            depth_shader.use();
+            for (const DepthDraw& draw : opaque_draws)
             {
-                nk_size level_targets_hit_copy = level_targets_hit;
-                nk_progress(&ui.m_ctx, &level_targets_hit_copy, level_target_amount, NK_FIXED); // ignoring the return value as we use NK_FIXED
+                depth_shader.set("mvp", scene_transforms.mvpMatrix(draw.object));
+                draw.vbo.bindPositionOnly();
+                    glDrawArrays(GL_TRIANGLES, 0, draw.vbo.vertexCount());
+                draw.vbo.unbindPositionOnly();
             }
 
-            //complete progress bar
-            {
-                ui.m_ctx.style.progress.cursor_normal = nk_style_item_color(nk_rgb(180, 180, 180));
-            }
-            nk_layout_row_dynamic(&ui.m_ctx, 30, 1);
-            {
-                nk_size whole_targets_hit_copy = level_manager.getPartialTargetAmount(0, level_manager.m_level_idx) + level_targets_hit;
-                nk_progress(&ui.m_ctx, &whole_targets_hit_copy, whole_target_amount, NK_FIXED); // ignoring the return value as we use NK_FIXED
-            }
+            DepthPrepass::endMeasure();
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 
-            //practice time
-            nk_layout_row_begin(&ui.m_ctx, NK_DYNAMIC, 20, 2);
-            {
-                double time;
-                if (practice_time_start < 0.f) time = 0.f;
-                else if (practice_time_end < 0.f) time = frame_time - practice_time_start;
-                else time = practice_time_end - practice_time_start;
+            // the depth is final already
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+        }
+        else if (!deferred)
+        {
+            DepthPrepass::beginMeasure(viewport_size); // estimating the overdraw from the lit pass itself
+        }
 
-                nk_layout_row_push(&ui.m_ctx, 0.5f);
-                nk_label(&ui.m_ctx, "Time:", NK_TEXT_LEFT);
+        GPU_PROFILE_BEGIN(deferred ? "G-buffer pass" : "opaque lit pass");
 
-                nk_layout_row_push(&ui.m_ctx, 0.5f);
-                snprintf(ui_textbuff, ui_textbuff_capacity, "%.3fs", time);
-                nk_label(&ui.m_ctx, ui_textbuff, NK_TEXT_RIGHT);
-            }
-            nk_layout_row_end(&ui.m_ctx);
+        //cube
+        opaque_shader.use();
+        {
+            //vs
+            scene_transforms.setUniforms(opaque_shader, scene_cube, !deferred);
+
+            //fs
+            opaque_shader.setMaterialProps(default_material_props);
+            opaque_shader.bindDiffuseMap(brick_texture);
+            opaque_shader.bindSpecularMap(shared_gl_context.white_pixel_tex);
+            set_opaque_lighting();
+            opaque_shader.set("gammaCoef", gamma);
         }
-        nk_end(&ui.m_ctx);
 
-        //Time window
-        const int time_window_header_height = 50, time_window_height_min = time_window_header_height + 40;
-        int time_window_height = std::max<int>(time_window_height_min,
-                                               time_window_header_height + 25 * pracice_times.size());
-        if (nk_begin(&ui.m_ctx, "Previous times:", nk_rect(30, 280, 150, time_window_height),
-            NK_WINDOW_BORDER | NK_WINDOW_TITLE | NK_WINDOW_NO_SCROLLBAR))
+        cube_vbo.bind();
+            glDrawArrays(GL_TRIANGLES, 0, cube_vbo.vertexCount());
+        cube_vbo.unbind();
+
+        //turret
+        opaque_shader.use();
         {
-            nk_layout_row_dynamic(&ui.m_ctx, 20, 1);
+            //vs
+            scene_transforms.setUniforms(opaque_shader, scene_turret, !deferred);
 
-            for (size_t i = 0; i < pracice_times.size(); ++i)
-            {
-                snprintf(ui_textbuff, ui_textbuff_capacity, "%.3fs", pracice_times[i]);
-                nk_label(&ui.m_ctx, ui_textbuff, NK_TEXT_RIGHT);
-            }
+            //fs
+            opaque_shader.setMaterial(turret_material);
+            set_opaque_lighting();
+            opaque_shader.set("gammaCoef", gamma);
         }
-        nk_end(&ui.m_ctx);
-    }
-
-    // Credits 
-    {
-        ui.m_ctx.style.window.background = nk_rgba(0, 0, 0, 0);
-        ui.m_ctx.style.window.fixed_background = nk_style_item_color(nk_rgba(0, 0, 0, 0));
-        ui.m_ctx.style.text.color = nk_rgba(0, 0, 0, 100);
-        ui.m_ctx.style.window.padding = nk_vec2(3, 3);
-    }
-    const glm::vec2 credits_size(156, 56);
-    if (nk_begin(&ui.m_ctx, "Credits", nk_rect(win_size.x - credits_size.x, win_size.y - credits_size.y,
-                                               credits_size.x, credits_size.y),
-        NK_WINDOW_NO_SCROLLBAR))
-    {
-        nk_layout_row_dynamic(&ui.m_ctx, 25, 1);
-        #ifdef VERSION_STRING
-            nk_label(&ui.m_ctx, VERSION_STRING, NK_TEXT_RIGHT);
-        #else
-            ui.verticalGap(25.f);
-        #endif
-        nk_label(&ui.m_ctx, "Ondrej Richtr, 2025", NK_TEXT_RIGHT);
-    }
-    nk_end(&ui.m_ctx);
-
-    // ---Drawing---
-    {
-        bool use_fbo = shared_gl_context.render_settings.use_fbo3d;
-        bool use_msaa = shared_gl_context.render_settings.use_msaa;
-        bool enable_gamma_correction = shared_gl_context.render_settings.enable_gamma_correction;
-        bool post_process = enable_gamma_correction || use_fbo;
-        float gamma = enable_gamma_correction ? shared_gl_context.render_settings.gamma_coef : 0.f;
+        
+        turret_mesh.draw();
 
-        //3D block
+        //ball
+        opaque_shader.use();
         {
-            const Drawing::FrameBuffer& fbo3d = shared_gl_context.getFbo3D(false);
+            //vs
+            scene_transforms.setUniforms(opaque_shader, scene_ball, !deferred);
 
-            //set the viewport according to wanted framebuffer
-            if (use_fbo)
-            {
-                const glm::ivec2 fbo3d_unconv_size = shared_gl_context.getFbo3DSize(false);
-                glViewport(0, 0, fbo3d_unconv_size.x, fbo3d_unconv_size.y);
-            }
-            else
-            {
-                const glm::ivec2 fbo3d_win_size = WindowManager::getFBOSize();
-                glViewport(0, 0, fbo3d_win_size.x, fbo3d_win_size.y);
-            }
-            
-            //bind the correct framebuffer
-            if (use_fbo) fbo3d.bind();
-            else glBindFramebuffer(GL_FRAMEBUFFER, empty_id);
+            //fs
+            opaque_shader.setMaterial(ball_material);
+            set_opaque_lighting();
+            opaque_shader.set("gammaCoef", gamma);
+        }
+        
+        ball_mesh.draw();
 
-            Drawing::clear(clear_color_3d);
-            glDepthMask(GL_TRUE); // must enable depth buffer, so the clear will work properly
-            glStencilMask(0xFF);  // must enable stencil buffer, so the clear will work properly
-            glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT); //TODO make this nicer - probably move into Drawing
+        //ball with default material
+        opaque_shader.use();
+        {
+            //vs
+            scene_transforms.setUniforms(opaque_shader, scene_default_ball, !deferred);
+
+            //fs
+            opaque_shader.setMaterialProps(default_material_props);
+            opaque_shader.bindDiffuseMap(ball_texture);
+            opaque_shader.bindSpecularMap(shared_gl_context.white_pixel_tex);
+            set_opaque_lighting();
+            opaque_shader.set("gammaCoef", gamma);
+        }
 
-            const glm::mat4& view_mat = camera.getViewMatrix();
-            const glm::mat4& proj_mat = camera.getProjectionMatrix();
+        ball_mesh.draw();
 
-            glEnable(GL_DEPTH_TEST);
-            glDepthFunc(GL_LESS);
+        //rock
+        if (deferred) rock_model.drawToGBuffer(opaque_shader, gamma, scene_transforms, scene_rock);
+        else          rock_model.draw(camera, lights, gamma, scene_transforms, scene_rock);
 
-            glDisable(GL_STENCIL_TEST);
-            glStencilMask(0x00);
-            glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-            
-            // enable multisampling (only for OpenGL 3.3, as OpenGL ES 2.0 and WebGL1 does not support it)
-            #ifdef BUILD_OPENGL_330_CORE
-                if (use_msaa) glEnable(GL_MULTISAMPLE);
-                else          glDisable(GL_MULTISAMPLE);
-            #endif
+        //floor
+        opaque_shader.use();
+        {
+            //vs
+            scene_transforms.setUniforms(opaque_shader, scene_floor, !deferred);
 
-            //Enable backface culling
-            glCullFace(GL_BACK);
-            glEnable(GL_CULL_FACE);
+            //fs
+            opaque_shader.setMaterial(floor_material);
+            set_opaque_lighting();
+            opaque_shader.set("gammaCoef", gamma);
+        }
 
-            //cube
-            light_shader.use();
-            {
-                glm::vec3 pos = glm::vec3(-4.f, 0.35f, -0.5f);
+        floor_mesh.draw();
 
-                //vs
-                glm::mat4 model_mat(1.f);
-                model_mat = glm::translate(model_mat, pos);
-                model_mat = glm::scale(model_mat, glm::vec3(0.7f, 0.7f, 0.7f));
+        //wall
+        opaque_shader.use();
+        {
+            //vs
+            scene_transforms.setUniforms(opaque_shader, scene_wall, !deferred);
+
+            //fs
+            opaque_shader.setMaterialProps(default_material_props);
+            opaque_shader.bindDiffuseMap(brick_alt_texture);
+            opaque_shader.bindSpecularMap(shared_gl_context.white_pixel_tex);
+            set_opaque_lighting();
+            opaque_shader.set("gammaCoef", gamma);
+        }
 
-                glm::mat3 normal_mat = Utils::modelMatrixToNormalMatrix(model_mat);
+        wall_vbo.bind();
+            glDrawArrays(GL_TRIANGLES, 0, wall_vbo.vertexCount());
+        wall_vbo.unbind();
 
-                light_shader.set("model", model_mat);
-                light_shader.set("normalMat", normal_mat);
-                light_shader.set("view", view_mat);
-                light_shader.set("projection", proj_mat);
+        GPU_PROFILE_END();
+        DepthPrepass::endMeasure(); // when the lit pass was measured
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
 
-                //fs
-                light_shader.set("cameraPos", camera.m_pos);
-                light_shader.setMaterialProps(default_material_props);
-                light_shader.bindDiffuseMap(brick_texture);
-                light_shader.bindSpecularMap(shared_gl_context.white_pixel_tex);
-                light_shader.setLights(UNIFORM_LIGHT_NAME, UNIFORM_LIGHT_COUNT_NAME, lights); // return value ignored here
-                light_shader.set("gammaCoef", gamma);
+        //deferred lighting of everything in the G-buffer, the rest gets drawn forward over it
+        #ifdef USE_DEFERRED_SHADING
+            if (deferred)
+            {
+                GPU_PROFILE_SCOPE("deferred lighting");
+                bind_scene_framebuffer();
+
+                const glm::mat4& view_proj_mat = camera.getViewProjectionMatrix();
+                deferred_light_shader.use();
+                deferred_light_shader.set("invViewProj", glm::inverse(view_proj_mat));
+                deferred_light_shader.set("cameraPos", camera.m_pos);
+                deferred_light_shader.setLights(UNIFORM_LIGHT_NAME, UNIFORM_LIGHT_COUNT_NAME, lights); // return value ignored here
+                deferred_light_shader.set("gammaCoef", gamma);
+                shared_gl_context.drawDeferredLighting(deferred_light_shader, viewport_size);
+
+                glDisable(GL_STENCIL_TEST);
+                glStencilMask(0x00);
+                glEnable(GL_CULL_FACE);
             }
+        #endif
 
-            cube_vbo.bind();
-                glDrawArrays(GL_TRIANGLES, 0, cube_vbo.vertexCount());
-            cube_vbo.unbind();
+        //ball with an outline - always shaded forward, the outline needs the stencil buffer of the scene framebuffer
+        glEnable(GL_STENCIL_TEST);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);  
+        glStencilFunc(GL_ALWAYS, 1, 0xFF); // all fragments should pass the stencil test
+        glStencilMask(0xFF); // enable writing to the stencil buffer if it wasn't already
+        {
+            GPU_PROFILE_SCOPE("stencil outline");
+            const Color3F outline_color(0.f, 1.f, 1.f);
 
-            //turret
+            //drawing the object itself
             light_shader.use();
             {
-                glm::vec3 pos = glm::vec3(4.3f, 0.f, -1.5f);
-                glm::vec3 scale = glm::vec3(0.3f);
-
                 //vs
-                glm::mat4 model_mat(1.f);
-                model_mat = glm::translate(model_mat, pos);
-                model_mat = glm::scale(model_mat, scale);
-                model_mat = glm::rotate(model_mat, glm::pi<float>(), Drawing::up_dir); // rotate towards the player spawn point
-
-                glm::mat3 normal_mat = Utils::modelMatrixToNormalMatrix(model_mat);
-
-                light_shader.set("model", model_mat);
-                light_shader.set("normalMat", normal_mat);
-                light_shader.set("view", view_mat);
-                light_shader.set("projection", proj_mat);
+                scene_transforms.setUniforms(light_shader, scene_outlined_ball);
 
                 //fs
                 light_shader.set("cameraPos", camera.m_pos);
-                light_shader.setMaterial(turret_material);
+                light_shader.setMaterial(ball_material);
                 light_shader.setLights(UNIFORM_LIGHT_NAME, UNIFORM_LIGHT_COUNT_NAME, lights); // return value ignored here
                 light_shader.set("gammaCoef", gamma);
             }
-            
-            turret_mesh.draw();
+            ball_mesh.draw();
 
-            //ball
-            light_shader.use();
+            //drawing the outline
+            #if defined(BUILD_OPENGL_330_CORE) || defined(PLATFORM_WEB)
+                // always safe with OpenGL 3.3 or WebGL
+                const bool render_ball_outline = true;
+            #else
+                // on OpenGLES 2.0 we have no way to use stencil buffer in custom FBO
+                const bool render_ball_outline = !use_fbo;
+            #endif
+            if (render_ball_outline)
             {
-                glm::vec3 pos = glm::vec3(2.2f, 0.f, 2.2f);
-                glm::vec3 scale = glm::vec3(3.f);
+                light_src_shader.use();
+                {
+                    //vs
+                    light_src_shader.set("mvp", scene_transforms.mvpMatrix(scene_ball_outline));
 
-                //vs
-                glm::mat4 model_mat(1.f);
-                model_mat = glm::translate(model_mat, pos);
-                model_mat = glm::scale(model_mat, scale);
+                    //fs
+                    light_src_shader.set("lightSrcColor", outline_color);
+                }
 
-                glm::mat3 normal_mat = Utils::modelMatrixToNormalMatrix(model_mat);
+                glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
+                glStencilMask(0x00); // disable writing to the stencil buffer
+                ball_mesh.draw();
+            }
+        }
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+        glDisable(GL_STENCIL_TEST);
+        glStencilMask(0x00);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+
+        //targets - must be rendered after the wall they are attachedd to!
+        // we also disable culling and depth buffer writing (so the z-fighting does not happen)
+        glDisable(GL_CULL_FACE);
+        glDepthMask(GL_FALSE);
+        glDepthFunc(GL_LEQUAL);
+
+        for (TransformBatch::Id i = 0; i < command.flat_target_amount; ++i)
+        {
+            const TargetDraw& target = command.targets[i];
+            target.model->drawWithColorTint(camera, lights, gamma, target_transforms, i, target.color_tint);
+        }
 
-                light_shader.set("model", model_mat);
-                light_shader.set("normalMat", normal_mat);
-                light_shader.set("view", view_mat);
-                light_shader.set("projection", proj_mat);
+        //ball targets
+        // we change the GL settings back
+        glEnable(GL_CULL_FACE);
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
 
-                //fs
-                light_shader.set("cameraPos", camera.m_pos);
-                light_shader.setMaterial(ball_material);
-                light_shader.setLights(UNIFORM_LIGHT_NAME, UNIFORM_LIGHT_COUNT_NAME, lights); // return value ignored here
-                light_shader.set("gammaCoef", gamma);
-            }
-            
-            ball_mesh.draw();
+        for (TransformBatch::Id i = command.flat_target_amount; i < command.flat_target_amount + command.ball_target_amount; ++i)
+        {
+            const TargetDraw& target = command.targets[i];
+            target.model->drawWithColorTint(camera, lights, gamma, target_transforms, i, target.color_tint);
+        }
 
-            //ball with an outline
-            glEnable(GL_STENCIL_TEST);
-            glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);  
-            glStencilFunc(GL_ALWAYS, 1, 0xFF); // all fragments should pass the stencil test
-            glStencilMask(0xFF); // enable writing to the stencil buffer if it wasn't already
-            {
-                glm::vec3 pos = glm::vec3(3.6f, 0.33f, 2.2f);
-                glm::vec3 scale = glm::vec3(2.5f);
-                const float outline_scale_factor = 1.1f;
-                const Color3F outline_color(0.f, 1.f, 1.f);
+        //skybox
+        glDepthMask(GL_FALSE); // I guess this is not strictly necessary
+        glDepthFunc(GL_LEQUAL);
 
-                //drawing the object itself
-                light_shader.use();
-                {
-                    //vs
-                    glm::mat4 model_mat(1.f);
-                    model_mat = glm::translate(model_mat, pos);
-                    model_mat = glm::scale(model_mat, scale);
-                    model_mat = glm::translate(model_mat, ball_origin_offset);
+        skybox_shader.use();
+        {
+            glm::mat3 view_mat_stripped = Utils::stripTranslationFromMatrix(view_mat);
+
+            //vs
+            skybox_shader.set("view_stripped", view_mat_stripped);
+            skybox_shader.set("projection", proj_mat);
 
-                    glm::mat3 normal_mat = Utils::modelMatrixToNormalMatrix(model_mat);
+            //fs
+            skybox_shader.bindCubemap("skybox", skybox_cubemap);
+        }
 
-                    light_shader.set("model", model_mat);
-                    light_shader.set("normalMat", normal_mat);
-                    light_shader.set("view", view_mat);
-                    light_shader.set("projection", proj_mat);
+        cube_vbo.bind();
+            glDrawArrays(GL_TRIANGLES, 0, cube_vbo.vertexCount());
+        cube_vbo.unbind();
 
-                    //fs
-                    light_shader.set("cameraPos", camera.m_pos);
-                    light_shader.setMaterial(ball_material);
-                    light_shader.setLights(UNIFORM_LIGHT_NAME, UNIFORM_LIGHT_COUNT_NAME, lights); // return value ignored here
-                    light_shader.set("gammaCoef", gamma);
-                }
-                ball_mesh.draw();
+        assert(!Utils::checkForGLErrorsAndPrintThem()); //DEBUG
+    }
+}
 
-                //drawing the outline
-                #if defined(BUILD_OPENGL_330_CORE) || defined(PLATFORM_WEB)
-                    // always safe with OpenGL 3.3 or WebGL
-                    const bool render_ball_outline = true;
-                #else
-                    // on OpenGLES 2.0 we have no way to use stencil buffer in custom FBO
-                    const bool render_ball_outline = !use_fbo;
-                #endif
-                if (render_ball_outline)
-                {
-                    light_src_shader.use();
-                    {
-                        //vs
-                        glm::mat4 model_mat(1.f);
-                        model_mat = glm::translate(model_mat, pos);
-                        model_mat = glm::scale(model_mat, scale * outline_scale_factor);
-                        model_mat = glm::translate(model_mat, ball_origin_offset);
-
-                        light_src_shader.set("model", model_mat);
-                        light_src_shader.set("view", view_mat);
-                        light_src_shader.set("projection", proj_mat);
-
-                        //fs
-                        light_src_shader.set("lightSrcColor", outline_color);
-                    }
+void GameMainLoop::DrawOverlayCommand::execute(const DrawOverlayCommand& command)
+{
+    command.loop->drawOverlay(command);
+}
 
-                    glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
-                    glStencilMask(0x00); // disable writing to the stencil buffer
-                    ball_mesh.draw();
-                }
-            }
-            glEnable(GL_DEPTH_TEST);
-            glDepthMask(GL_TRUE);
-            glDepthFunc(GL_LESS);
-            glDisable(GL_STENCIL_TEST);
-            glStencilMask(0x00);
-            glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-
-            //ball with default material
-            light_shader.use();
-            {
-                glm::vec3 pos = glm::vec3(-2.2f, -0.5f, 2.2f);
-                glm::vec3 scale = glm::vec3(3.f);
+void GameMainLoop::drawOverlay(const DrawOverlayCommand& command)
+{
+    PROFILE_SCOPE("GameMainLoop::drawOverlay");
+    const SharedGLContext& shared_gl_context = SharedGLContext::instance.value();
 
-                //vs
-                glm::mat4 model_mat(1.f);
-                model_mat = glm::translate(model_mat, pos);
-                model_mat = glm::scale(model_mat, scale);
+    bool use_fbo = shared_gl_context.render_settings.use_fbo3d;
+    bool post_process = shared_gl_context.render_settings.enable_gamma_correction || use_fbo;
 
-                glm::mat3 normal_mat = Utils::modelMatrixToNormalMatrix(model_mat);
+    //2D block
+    {
+        PROFILE_SCOPE("2D pass");
+        GPU_PROFILE_SCOPE("2D pass");
+        //TODO use correct win size + check whether some functions need it as parameter
+        const glm::vec2 win_fbo_size = command.fbo_size;
+        const glm::ivec2 win_fbo_size_i = command.fbo_size;
+        glm::vec2 window_middle = win_fbo_size / 2.f;
 
-                light_shader.set("model", model_mat);
-                light_shader.set("normalMat", normal_mat);
-                light_shader.set("view", view_mat);
-                light_shader.set("projection", proj_mat);
+        //TODO this might be wrong on some displays?
+        //set the viewport according to window size
+        glViewport(0, 0, win_fbo_size_i.x, win_fbo_size_i.y);
 
-                //fs
-                light_shader.set("cameraPos", camera.m_pos);
-                light_shader.setMaterialProps(default_material_props);
-                light_shader.bindDiffuseMap(ball_texture);
-                light_shader.bindSpecularMap(shared_gl_context.white_pixel_tex);
-                light_shader.setLights(UNIFORM_LIGHT_NAME, UNIFORM_LIGHT_COUNT_NAME, lights); // return value ignored here
-                light_shader.set("gammaCoef", gamma);
-            }
+        //bind the default framebuffer
+        glBindFramebuffer(GL_FRAMEBUFFER, empty_id);
+        if (post_process)
+        {
+            Drawing::clear(clear_color_2d);
+            glClear(GL_DEPTH_BUFFER_BIT); //TODO make this nicer - probably move into Drawing
+        }
 
-            ball_mesh.draw();
+        glDepthMask(GL_FALSE);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
+        glEnable(GL_BLEND); //TODO check this
+        glBlendEquation(GL_FUNC_ADD); //TODO check this
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); //TODO check this
+
+        // enable multisampling (only for OpenGL 3.3, as OpenGL ES 2.0 and WebGL1 does not support it)
+        #ifdef BUILD_OPENGL_330_CORE
+            if (shared_gl_context.render_settings.use_msaa) glEnable(GL_MULTISAMPLE);
+            else                                            glDisable(GL_MULTISAMPLE);
+        #endif
+        
+        //render the 3D scene as a background from it's framebuffer
+        if (post_process)
+        {
+            const Textures::Texture2D& fbo3d_conv_tex = shared_gl_context.getFbo3DTexture();
+            // Drawing::texturedRectangle2(tex_rect_shader, fbo3d_conv_tex, orb_texture, brick_texture, win_fbo_size, glm::vec2(0.f), win_fbo_size);
+            Drawing::texturedRectangle(tex_rect_shader, fbo3d_conv_tex, win_fbo_size, glm::vec2(0.f), win_fbo_size,
+                                       shared_gl_context.getFbo3DTextureRegion());
+        }
+        
+        //line test
+        // Drawing::screenLine(win_size,
+        //                     screen_middle, glm::vec2(50.f),
+        //                     50.f, ColorF(1.0f, 0.0f, 0.0f));
+
+        //crosshair
+        Drawing::crosshair(win_fbo_size, glm::vec2(50.f, 30.f), window_middle, 1.f, command.crosshair_color);
+        Batch2D::flush();
+
+        //UI drawing
+        glEnable(GL_SCISSOR_TEST); // enable scissor for UI drawing only
+        if (!ui.draw(win_fbo_size))
+        {
+            fprintf(stderr, "[WARNING] Failed to draw the UI!\n");
+        }
+        glDisable(GL_SCISSOR_TEST);
+
+        glDisable(GL_BLEND);
+
+        assert(!Utils::checkForGLErrorsAndPrintThem()); //DEBUG
+    }
+}
+
+LoopRetVal GameMainLoop::loop(unsigned int global_tick, double frame_time, float frame_delta)
+{
+    PROFILE_SCOPE("GameMainLoop::loop");
+
+    GLFWwindow * const window = WindowManager::getWindow();
+    const glm::vec2 win_size = WindowManager::getSizeF();
+    SharedGLContext& shared_gl_context = SharedGLContext::instance.value();
+    assert(shared_gl_context.isInitialized());
+
+    const bool consecutive_tick = (last_global_tick + 1) == global_tick;
+
+    // ---Mouse input---
+    PROFILE_BEGIN("input");
+    if (!consecutive_tick) MouseManager::setCursorLocked();
 
-            //rock
+    const glm::vec2 mouse_posF = MouseManager::mousePosF();
+
+    if (!consecutive_tick)
+    {
+        last_mouse_posF = mouse_posF;
+        MouseManager::skipEvents();
+    }
+
+    // the events after the last sim tick, clicks among them get shot by the next one
+    consumeMouseEvents(frame_time);
+
+    // aiming stays per frame for the lowest latency, the position comes from the last two sim ticks,
+    // so the frame shows the simulation one tick back, at the alpha between these ticks
+    const float sim_alpha = MainLoopStack::instance.simAlpha();
+    const double render_time = sim_state_time - (1.0 - sim_alpha) / sim_rate;
+    camera.setPosition(glm::mix(last_player_pos, player_pos, sim_alpha));
+    camera.setTargetFromPitchYaw(camera_pitch, camera_yaw); //TODO make this better
+
+    //updating camera's aspect ratio if the window aspect ration changed
+    if (!CLOSE_TO_0(win_size.x) && !CLOSE_TO_0(win_size.y)) // ...but only when having meaningful window size
+    {
+        const float win_aspect_ratio = win_size.x / win_size.y;
+        if (!FLOAT_EQUALS(camera_aspect_ratio, win_aspect_ratio))
+        {
+            camera_aspect_ratio = win_aspect_ratio;
+            camera.setProjectionMatrix(fov, camera_aspect_ratio);
+        }
+    }
+
+    const bool left_mbutton = MouseManager::left_button, right_mbutton = MouseManager::right_button;
+    const bool right_mbutton_is_clicked = consecutive_tick && right_mbutton && !last_right_mbutton;
+
+    // ---Keyboard input---
+    int esc_state = InputRecorder::getKey(window, GLFW_KEY_ESCAPE);
+    int c_state = InputRecorder::getKey(window, GLFW_KEY_C);
+    int v_state = InputRecorder::getKey(window, GLFW_KEY_V);
+    int f3_state = InputRecorder::getKey(window, GLFW_KEY_F3);
+    int f4_state = InputRecorder::getKey(window, GLFW_KEY_F4);
+    const bool esc_clicked = consecutive_tick && (esc_state == GLFW_PRESS) && (last_esc_state == GLFW_RELEASE);
+    const bool c_clicked = consecutive_tick && (c_state == GLFW_PRESS) && (last_c_state == GLFW_RELEASE);
+    const bool v_clicked = consecutive_tick && (v_state == GLFW_PRESS) && (last_v_state == GLFW_RELEASE);
+    const bool f3_clicked = consecutive_tick && (f3_state == GLFW_PRESS) && (last_f3_state == GLFW_RELEASE);
+    const bool f4_clicked = consecutive_tick && (f4_state == GLFW_PRESS) && (last_f4_state == GLFW_RELEASE);
+    const bool pause_pressed = consecutive_tick && (InputRecorder::getKey(window, GLFW_KEY_PAUSE) == GLFW_PRESS); // not using last_pause_state currently
+    
+    #ifdef PLATFORM_WEB
+        // const bool cursor_not_captured = glfwGetInputMode(window, GLFW_CURSOR) != GLFW_CURSOR_CAPTURED;
+        const bool pause_the_game = esc_clicked || pause_pressed;
+    #else
+        const bool window_is_focused = InputRecorder::isWindowFocused(window);
+        const bool pause_the_game = esc_clicked || pause_pressed || !window_is_focused;
+    #endif /* PLATFORM_WEB */
+
+    if (pause_the_game)
+    {
+        MainLoopStack& main_loop_stack = MainLoopStack::instance;
+
+        LoopData* pause_loop = main_loop_stack.pushFromTemplate<GamePauseMainLoop>();
+        if (pause_loop == NULL)
+        {
+            fprintf(stderr, "Failed to pause the game! Can't push pause main loop on the stack.\n");
+        }
+        else
+        {
+            int init_result = pause_loop->init();
+            if (init_result)
             {
-                glm::vec3 pos = glm::vec3(-5.5f, 0.35f, 0.f);
-                rock_model.draw(camera, lights, gamma, pos);
+                fprintf(stderr, "Failed to pause the game! Initialization failed with return value: %d.\n", init_result);
             }
+        }
+    }
 
-            //floor
-            light_shader.use();
-            {
-                glm::vec3 pos{ 0.f };
+    if (InputRecorder::getKey(window, GLFW_KEY_F) == GLFW_PRESS) show_flashlight = true;
+    if (InputRecorder::getKey(window, GLFW_KEY_G) == GLFW_PRESS) show_flashlight = false;
 
-                //vs
-                glm::mat4 model_mat(1.f);
-                model_mat = glm::translate(model_mat, pos);
-                model_mat = glm::rotate(model_mat, glm::radians(-90.f), glm::vec3{ 1.f, 0.f, 0.f });
+    // Gamma coef. setting
+    {
+        float new_gamma_coef = shared_gl_context.render_settings.gamma_coef;
+        if (InputRecorder::getKey(window, GLFW_KEY_N) == GLFW_PRESS) new_gamma_coef -= 0.01f;
+        if (InputRecorder::getKey(window, GLFW_KEY_M) == GLFW_PRESS) new_gamma_coef += 0.01f;
+        if (new_gamma_coef != shared_gl_context.render_settings.gamma_coef)
+        {
+            // printf("Gamma coeficient changed to: %f\n", new_gamma_coef);
+            shared_gl_context.render_settings.gamma_coef = new_gamma_coef;
+        }
+    }
 
-                glm::mat3 normal_mat = Utils::modelMatrixToNormalMatrix(model_mat);
+    if (c_clicked)
+    {
+        shared_gl_context.render_settings.enable_gamma_correction = !shared_gl_context.render_settings.enable_gamma_correction;
+    }
 
-                light_shader.set("model", model_mat);
-                light_shader.set("normalMat", normal_mat);
-                light_shader.set("view", view_mat);
-                light_shader.set("projection", proj_mat);
+    if (v_clicked)
+    {
+        const bool new_use_v_sync = !shared_gl_context.render_settings.use_v_sync;
 
-                //fs
-                light_shader.set("cameraPos", camera.m_pos);
-                light_shader.setMaterial(floor_material);
-                light_shader.setLights(UNIFORM_LIGHT_NAME, UNIFORM_LIGHT_COUNT_NAME, lights); // return value ignored here
-                light_shader.set("gammaCoef", gamma);
-            }
+        const int interval = new_use_v_sync ? 1 : 0;
+        RenderCommands::recordOrExecute(SharedGLContext::SwapIntervalCommand{ interval }); // swap interval belongs to the context
 
-            floor_mesh.draw();
+        shared_gl_context.render_settings.use_v_sync = new_use_v_sync;
+    }
 
-            //wall
-            light_shader.use();
-            {
-                //vs
-                glm::mat4 model_mat(1.f);
-                model_mat = glm::translate(model_mat, wall_pos);
+    if (f3_clicked) show_frame_stats = !show_frame_stats;
+    if (f4_clicked) Profiling::GpuMemory::printReport(stdout);
 
-                glm::mat3 normal_mat = Utils::modelMatrixToNormalMatrix(model_mat);
+    PROFILE_END();
 
-                light_shader.set("model", model_mat);
-                light_shader.set("normalMat", normal_mat);
-                light_shader.set("view", view_mat);
-                light_shader.set("projection", proj_mat);
+    // ---Lights---
+    PROFILE_BEGIN("lights");
+    //lights array
+    Lighting::LightRefs lights = { sun };
 
-                //fs
-                light_shader.set("cameraPos", camera.m_pos);
-                light_shader.setMaterialProps(default_material_props);
-                light_shader.bindDiffuseMap(brick_alt_texture);
-                light_shader.bindSpecularMap(shared_gl_context.white_pixel_tex);
-                light_shader.setLights(UNIFORM_LIGHT_NAME, UNIFORM_LIGHT_COUNT_NAME, lights); // return value ignored here
-                light_shader.set("gammaCoef", gamma);
-            }
+    //flashlight
+    if (show_flashlight)
+    {
+        // updating the flashlight position and directiom
+        flashlight.m_pos = camera.m_pos;
+        flashlight.m_dir = camera.getDirection();
 
-            wall_vbo.bind();
-                glDrawArrays(GL_TRIANGLES, 0, wall_vbo.vertexCount());
-            wall_vbo.unbind();
+        lights.push_back(flashlight);
+    }
 
-            //targets - must be rendered after the wall they are attachedd to!
-            // we also disable culling and depth buffer writing (so the z-fighting does not happen)
-            glDisable(GL_CULL_FACE);
-            glDepthMask(GL_FALSE);
-            glDepthFunc(GL_LEQUAL);
+    //muzzle flash
+    if (updateMuzzleFlashLightProps(render_time))
+    {
+        //additionally update the muzzle flash position
+        muzzle_flash.m_pos = camera.m_pos;
+
+        lights.push_back(muzzle_flash);
+    }
+    PROFILE_END();
+
+    // ---UI---
+    PROFILE_BEGIN("UI definition");
+    ui.clear(); // the recorded overlay of the last frame got drawn already
 
-            const size_t tagets_amount = targets.size();
-            for (size_t i = 0; i < tagets_amount; ++i)
+    //pump the input into UI
+    if (!ui.getInput(window, mouse_posF, left_mbutton, textbuffer, textbuffer_len))
+    {
+        fprintf(stderr, "[WARNING] Failed to update the input for UI!\n");
+    }
+
+    //GUI styling    
+    {
+        nk_color ui_background_color = nk_rgba(200, 200, 80, 200);
+        ui.m_ctx.style.window.background = ui_background_color;
+        ui.m_ctx.style.window.fixed_background = nk_style_item_color(ui_background_color);
+        ui.m_ctx.style.window.border_color = nk_rgb(100, 100, 80);
+        ui.m_ctx.style.window.border = 3;
+        ui.m_ctx.style.window.padding = nk_vec2(8, 4);
+        ui.m_ctx.style.text.color = nk_rgb(0, 0, 0);
+    }
+    //GUI definition+logic
+    {
+        //TODO change this probably
+        char ui_textbuff[256]{};
+        size_t ui_textbuff_capacity = sizeof(ui_textbuff) / sizeof(ui_textbuff[0]); // including term. char.
+        
+        //General info
+        if (nk_begin(&ui.m_ctx, "Target Practice", nk_rect(30, 30, 150, 240),
+            NK_WINDOW_BORDER | NK_WINDOW_TITLE | NK_WINDOW_NO_SCROLLBAR))
+        {
+            const bool use_v_sync = shared_gl_context.render_settings.use_v_sync;
+            unsigned int level = level_manager.m_level_idx,
+                         level_targets_hit = level_manager.m_level_targets_hit,
+                         level_amount = level_manager.getLevelAmount(),
+                         level_target_amount = level_manager.getCurrentLevelTargetAmount(),
+                         whole_target_amount = level_manager.getWholeTargetAmount();
+
+            nk_layout_row_dynamic(&ui.m_ctx, 0, 1);
+
+            //fps rendering, averaged over the recent frames
+            const unsigned int fps = static_cast<unsigned int>(Profiling::FrameStats::instance.getRecentFPS());
+            const char* maybe_v_sync_str = use_v_sync ? " (V-Sync)" : "";
+            snprintf(ui_textbuff, ui_textbuff_capacity, "FPS%s: %3d", maybe_v_sync_str, fps);
+            nk_label(&ui.m_ctx, ui_textbuff, NK_TEXT_LEFT);
+
+            //level counter
+            nk_layout_row_begin(&ui.m_ctx, NK_DYNAMIC, 20, 2);
             {
-                const glm::vec3 pos_offset = glm::vec3(0.f, 0.f, FLOAT_TOLERANCE);
-                targets[i].draw(Game::TargetType::target, camera, lights, gamma, frame_time, pos_offset);
-            }
+                nk_layout_row_push(&ui.m_ctx, 0.5f);
+                nk_label(&ui.m_ctx, "Level:", NK_TEXT_LEFT);
 
-            //ball targets
-            // we change the GL settings back
-            glEnable(GL_CULL_FACE);
-            glDepthMask(GL_TRUE);
-            glDepthFunc(GL_LESS);
+                nk_layout_row_push(&ui.m_ctx, 0.5f);
+                snprintf(ui_textbuff, ui_textbuff_capacity, "%d/%d",
+                         level, level_amount ? level_amount - 1 : 0); // -1 as we dont count the intro level
+                nk_label(&ui.m_ctx, ui_textbuff, NK_TEXT_RIGHT);
+            }
+            nk_layout_row_end(&ui.m_ctx);
 
-            const size_t ball_targets_amount = ball_targets.size();
-            for (size_t i = 0; i < ball_targets_amount; ++i)
+            //target counter
+            nk_layout_row_begin(&ui.m_ctx, NK_DYNAMIC, 20, 2);
             {
-                ball_targets[i].draw(Game::TargetType::ball, camera, lights, gamma, frame_time);
+                nk_layout_row_push(&ui.m_ctx, 0.5f);
+                nk_label(&ui.m_ctx, "Progress:", NK_TEXT_LEFT);
+
+                nk_layout_row_push(&ui.m_ctx, 0.5f);
+                snprintf(ui_textbuff, ui_textbuff_capacity, "%d/%d", level_targets_hit, level_target_amount);
+                nk_label(&ui.m_ctx, ui_textbuff, NK_TEXT_RIGHT);
             }
+            nk_layout_row_end(&ui.m_ctx);
 
-            //skybox
-            glDepthMask(GL_FALSE); // I guess this is not strictly necessary
-            glDepthFunc(GL_LEQUAL);
+            ui.verticalGap(8);
 
-            skybox_shader.use();
+            //level progress bar
             {
-                glm::mat3 view_mat_stripped = Utils::stripTranslationFromMatrix(view_mat);
-
-                //vs
-                skybox_shader.set("view_stripped", view_mat_stripped);
-                skybox_shader.set("projection", proj_mat);
+                ui.m_ctx.style.progress.cursor_normal = nk_style_item_color(nk_rgb(100, 100, 100));
+            }
+            nk_layout_row_dynamic(&ui.m_ctx, 30, 1);
+            {
+                nk_size level_targets_hit_copy = level_targets_hit;
+                nk_progress(&ui.m_ctx, &level_targets_hit_copy, level_target_amount, NK_FIXED); // ignoring the return value as we use NK_FIXED
+            }
 
-                //fs
-                skybox_shader.bindCubemap("skybox", skybox_cubemap);
+            //complete progress bar
+            {
+                ui.m_ctx.style.progress.cursor_normal = nk_style_item_color(nk_rgb(180, 180, 180));
+            }
+            nk_layout_row_dynamic(&ui.m_ctx, 30, 1);
+            {
+                nk_size whole_targets_hit_copy = level_manager.getPartialTargetAmount(0, level_manager.m_level_idx) + level_targets_hit;
+                nk_progress(&ui.m_ctx, &whole_targets_hit_copy, whole_target_amount, NK_FIXED); // ignoring the return value as we use NK_FIXED
             }
 
-            cube_vbo.bind();
-                glDrawArrays(GL_TRIANGLES, 0, cube_vbo.vertexCount());
-            cube_vbo.unbind();
+            //practice time
+            nk_layout_row_begin(&ui.m_ctx, NK_DYNAMIC, 20, 2);
+            {
+                double time;
+                if (practice_time_start < 0.f) time = 0.f;
+                else if (practice_time_end < 0.f) time = std::max(0.0, render_time - practice_time_start);
+                else time = practice_time_end - practice_time_start;
 
-            if (use_fbo) fbo3d.unbind();
+                nk_layout_row_push(&ui.m_ctx, 0.5f);
+                nk_label(&ui.m_ctx, "Time:", NK_TEXT_LEFT);
 
-            assert(!Utils::checkForGLErrorsAndPrintThem()); //DEBUG
+                nk_layout_row_push(&ui.m_ctx, 0.5f);
+                snprintf(ui_textbuff, ui_textbuff_capacity, "%.3fs", time);
+                nk_label(&ui.m_ctx, ui_textbuff, NK_TEXT_RIGHT);
+            }
+            nk_layout_row_end(&ui.m_ctx);
         }
+        nk_end(&ui.m_ctx);
 
-        //Stage FBO 3D scene
+        //Time window
+        const int time_window_header_height = 50, time_window_height_min = time_window_header_height + 40;
+        int time_window_height = std::max<int>(time_window_height_min,
+                                               time_window_header_height + 25 * pracice_times.size());
+        if (nk_begin(&ui.m_ctx, "Previous times:", nk_rect(30, 280, 150, time_window_height),
+            NK_WINDOW_BORDER | NK_WINDOW_TITLE | NK_WINDOW_NO_SCROLLBAR))
         {
-            const std::optional<GLuint> extenral_fbo_id = use_fbo ? std::optional<GLuint>() : std::optional<GLuint>(empty_id);
-            const bool staged = shared_gl_context.stageFbo3D(extenral_fbo_id);
-            if (!staged)
+            nk_layout_row_dynamic(&ui.m_ctx, 20, 1);
+
+            for (size_t i = 0; i < pracice_times.size(); ++i)
             {
-                fprintf(stderr, "[WARNING] Failed to stage Framebuffer for 3D scene!\n");
+                snprintf(ui_textbuff, ui_textbuff_capacity, "%.3fs", pracice_times[i]);
+                nk_label(&ui.m_ctx, ui_textbuff, NK_TEXT_RIGHT);
             }
-
-            assert(!Utils::checkForGLErrorsAndPrintThem()); //DEBUG
         }
+        nk_end(&ui.m_ctx);
 
-        //2D block
+        //Frame time statistics (toggled by F3)
+        if (show_frame_stats)
         {
-            //TODO use correct win size + check whether some functions need it as parameter
-            const glm::vec2 win_fbo_size = WindowManager::getFBOSizeF();
-            const glm::ivec2 win_fbo_size_i = WindowManager::getFBOSize();
-            glm::vec2 window_middle = win_fbo_size / 2.f;
-
-            //TODO this might be wrong on some displays?
-            //set the viewport according to window size
-            glViewport(0, 0, win_fbo_size_i.x, win_fbo_size_i.y);
-
-            //bind the default framebuffer
-            glBindFramebuffer(GL_FRAMEBUFFER, empty_id);
-            if (post_process)
+            const glm::vec2 frame_stats_size(220, 150);
+            Profiling::FrameStats::instance.drawOverlay(&ui.m_ctx, nk_rect(win_size.x - frame_stats_size.x - 30, 30,
+                                                                           frame_stats_size.x, frame_stats_size.y));
+
+            const glm::vec2 gpu_memory_size(280, 215);
+            Profiling::GpuMemory::drawOverlay(&ui.m_ctx, nk_rect(30, win_size.y - gpu_memory_size.y - 30,
+                                                                 gpu_memory_size.x, gpu_memory_size.y));
+
+            const glm::vec2 ui_frames_size(280, 70);
+            if (nk_begin(&ui.m_ctx, "UI frames", nk_rect(30, win_size.y - gpu_memory_size.y - ui_frames_size.y - 40,
+                                                        ui_frames_size.x, ui_frames_size.y),
+                         NK_WINDOW_BORDER | NK_WINDOW_TITLE | NK_WINDOW_NO_SCROLLBAR))
             {
-                Drawing::clear(clear_color_2d);
-                glClear(GL_DEPTH_BUFFER_BIT); //TODO make this nicer - probably move into Drawing
+                char textbuff[64]{};
+                snprintf(textbuff, sizeof(textbuff), "reused %u / converted %u", ui.m_reused_frames, ui.m_converted_frames);
+                nk_layout_row_dynamic(&ui.m_ctx, 16, 1);
+                nk_label(&ui.m_ctx, textbuff, NK_TEXT_LEFT);
             }
+            nk_end(&ui.m_ctx);
 
-            glDepthMask(GL_FALSE);
-            glDisable(GL_DEPTH_TEST);
-            glDisable(GL_CULL_FACE);
-            glEnable(GL_BLEND); //TODO check this
-            glBlendEquation(GL_FUNC_ADD); //TODO check this
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); //TODO check this
-
-            // enable multisampling (only for OpenGL 3.3, as OpenGL ES 2.0 and WebGL1 does not support it)
-            #ifdef BUILD_OPENGL_330_CORE
-                if (use_msaa) glEnable(GL_MULTISAMPLE);
-                else          glDisable(GL_MULTISAMPLE);
-            #endif
-            
-            //render the 3D scene as a background from it's framebuffer
-            if (post_process)
-            {
-                const Textures::Texture2D& fbo3d_conv_tex = shared_gl_context.getFbo3DTexture();
-                // Drawing::texturedRectangle2(tex_rect_shader, fbo3d_conv_tex, orb_texture, brick_texture, glm::vec2(0.f), win_fbo_size);
-                Drawing::texturedRectangle(tex_rect_shader, fbo3d_conv_tex, win_fbo_size, glm::vec2(0.f), win_fbo_size);
-            }
-            
-            //line test
-            // Drawing::screenLine(screen_line_shader, line_vbo, win_size,
-            //                     screen_middle, glm::vec2(50.f),
-            //                     50.f, ColorF(1.0f, 0.0f, 0.0f));
-
-            //crosshair
-            const ColorF crosshair_color = ColorF(1.f, 1.f, left_mbutton ? 1.f : 0.f);
-            Drawing::crosshair(screen_line_shader, line_vbo, win_fbo_size,
-                                glm::vec2(50.f, 30.f), window_middle, 1.f, crosshair_color);
-
-            //UI drawing
-            glEnable(GL_SCISSOR_TEST); // enable scissor for UI drawing only
-            if (!ui.draw(win_fbo_size))
+            const glm::vec2 latency_size(280, 110);
+            FramePacing::drawOverlay(&ui.m_ctx, nk_rect(30, win_size.y - gpu_memory_size.y - ui_frames_size.y - latency_size.y - 50,
+                                                        latency_size.x, latency_size.y));
+
+            if (Profiling::GLCallStats::isInstalled())
             {
-                fprintf(stderr, "[WARNING] Failed to draw the UI!\n");
+                const glm::vec2 gl_calls_size(240, 290);
+                Profiling::GLCallStats::drawOverlay(&ui.m_ctx, nk_rect(win_size.x - gl_calls_size.x - 340, 30,
+                                                                       gl_calls_size.x, gl_calls_size.y), 10);
             }
-            glDisable(GL_SCISSOR_TEST);
 
-            glDisable(GL_BLEND);
+            #ifdef ENABLE_PROFILER
+                const glm::vec2 cpu_scopes_size(300, 240);
+                Profiling::CpuProfiler::drawTopScopes(&ui.m_ctx, nk_rect(win_size.x - cpu_scopes_size.x - 30, 30 + frame_stats_size.y + 10,
+                                                                         cpu_scopes_size.x, cpu_scopes_size.y), 10);
 
-            assert(!Utils::checkForGLErrorsAndPrintThem()); //DEBUG
+                const glm::vec2 gpu_passes_size(300, 210);
+                Profiling::GpuProfiler::drawPasses(&ui.m_ctx, nk_rect(win_size.x - gpu_passes_size.x - 30,
+                                                                      30 + frame_stats_size.y + cpu_scopes_size.y + 20,
+                                                                      gpu_passes_size.x, gpu_passes_size.y));
+            #endif
         }
     }
-    
-    ui.clear(); // UI clear is here as we want to call it each frame regardless of drawing stage
 
-    last_mouse_posF = mouse_posF;
+    // Credits 
+    {
+        ui.m_ctx.style.window.background = nk_rgba(0, 0, 0, 0);
+        ui.m_ctx.style.window.fixed_background = nk_style_item_color(nk_rgba(0, 0, 0, 0));
+        ui.m_ctx.style.text.color = nk_rgba(0, 0, 0, 100);
+        ui.m_ctx.style.window.padding = nk_vec2(3, 3);
+    }
+    const glm::vec2 credits_size(156, 56);
+    if (nk_begin(&ui.m_ctx, "Credits", nk_rect(win_size.x - credits_size.x, win_size.y - credits_size.y,
+                                               credits_size.x, credits_size.y),
+        NK_WINDOW_NO_SCROLLBAR))
+    {
+        nk_layout_row_dynamic(&ui.m_ctx, 25, 1);
+        #ifdef VERSION_STRING
+            nk_label(&ui.m_ctx, VERSION_STRING, NK_TEXT_RIGHT);
+        #else
+            ui.verticalGap(25.f);
+        #endif
+        nk_label(&ui.m_ctx, "Ondrej Richtr, 2025", NK_TEXT_RIGHT);
+    }
+    nk_end(&ui.m_ctx);
+    PROFILE_END();
+
+    // ---Drawing---
+    {
+        PROFILE_SCOPE("drawing");
+
+        //matrices of the targets get recomputed only for the moved ones, the rest of the scene never moves
+        // flat targets are drawn slightly in front of the wall, so the z-fighting does not happen
+        const glm::vec3 flat_target_pos_offset = glm::vec3(0.f, 0.f, FLOAT_TOLERANCE);
+        const TransformBatch::Id flat_targets_amount = targets.size();
+        target_transforms.resize(flat_targets_amount + ball_targets.size());
+        for (TransformBatch::Id i = 0; i < flat_targets_amount; ++i)
+        {
+            targets[i].setTransform(Game::TargetType::target, target_transforms, i, render_time, flat_target_pos_offset);
+        }
+        for (TransformBatch::Id i = 0; i < ball_targets.size(); ++i)
+        {
+            ball_targets[i].setTransform(Game::TargetType::ball, target_transforms, flat_targets_amount + i, render_time);
+        }
+        const glm::mat4& view_proj_mat = camera.getViewProjectionMatrix();
+        scene_transforms.update(view_proj_mat);
+        target_transforms.update(view_proj_mat);
+
+        // simTick spawns and removes the targets while the commands may still wait for the execution
+        const Lighting::Light **light_ptrs = RenderCommands::allocate<const Lighting::Light*>(lights.size());
+        for (size_t i = 0; i < lights.size(); ++i) light_ptrs[i] = &lights[i].get();
+
+        TargetDraw *target_draws = RenderCommands::allocate<TargetDraw>(target_transforms.size());
+        for (TransformBatch::Id i = 0; i < flat_targets_amount; ++i)
+        {
+            target_draws[i] = TargetDraw{ &targets[i].m_model, targets[i].m_color_tint };
+        }
+        for (TransformBatch::Id i = 0; i < ball_targets.size(); ++i)
+        {
+            target_draws[flat_targets_amount + i] = TargetDraw{ &ball_targets[i].m_model, ball_targets[i].m_color_tint };
+        }
+
+        const glm::ivec2 fbo_size = WindowManager::getFBOSize();
+        RenderCommands::record(DrawSceneCommand{ this, camera, light_ptrs, static_cast<unsigned int>(lights.size()),
+                                                 target_draws, flat_targets_amount,
+                                                 static_cast<unsigned int>(ball_targets.size()), fbo_size });
+        RenderCommands::record(SharedGLContext::StageFbo3DCommand{});
+        RenderCommands::record(DrawOverlayCommand{ this, fbo_size, ColorF(1.f, 1.f, left_mbutton ? 1.f : 0.f) });
+    }
+
     last_left_mbutton = left_mbutton;
     last_right_mbutton = right_mbutton;
     last_esc_state = esc_state;
     last_c_state = c_state;
     last_v_state = v_state;
+    last_f3_state = f3_state;
+    last_f4_state = f4_state;
     last_global_tick = global_tick;
     ++tick;
 
@@ -4,70 +4,16 @@
 #include <cstring>
 
 
-bool GamePauseMainLoop::initTextures()
-{
-    const SharedGLContext& shared_gl_context = SharedGLContext::instance.value();
-    const Drawing::FrameBuffer& fbo3d_conv = shared_gl_context.getFbo3D(true);
-    const glm::ivec2 fbo3d_conv_size = shared_gl_context.getFbo3DSize(true);
-
-    //Background texture from fbo3d
-    new (&background_tex) Textures::Texture2D(fbo3d_conv_size.x, fbo3d_conv_size.y, GL_RGB);
-    if (background_tex.m_id == empty_id)
-    {
-        fprintf(stderr, "[WARNING] Failed to initialize Texture for background of pause menu!\n");
-        background_tex.~Texture2D();
-        // No return!!! We can cope with uninitialized background texture.
-    }
-    // copy contents of `fbo3d_conv_tex` into `background_tex`
-    else if (!background_tex.copyContentsFrom(fbo3d_conv, background_tex.m_width, background_tex.m_height, GL_RGB))
-    {
-        fprintf(stderr, "[WARNING] Failed to copy data of FrameBuffer into pause menu background Texture!\n");
-        background_tex.~Texture2D();
-        // No return!!! We can cope with uninitialized background texture.
-    }
-
-    return true;
-}
-
-void GamePauseMainLoop::deinitTextures()
-{
-    background_tex.~Texture2D();
-}
-
 bool GamePauseMainLoop::initShaders()
 {
-    //shader partials
     using ShaderInclude = Shaders::ShaderInclude;
-    using IncludeDefine = Shaders::IncludeDefine;
-
-    // used only during this init method, thus loaded as local unique_ptr, so we dont have to call delete/destructor
-    const char *postprocess_fs_partial_path = SHADERS_PARTIALS_DIR_PATH "postprocess.fspart";
-    std::unique_ptr<char[]> postprocess_fs_partial = Utils::getTextFileAsString(postprocess_fs_partial_path, NULL);
-    if (!postprocess_fs_partial)
-    {
-        fprintf(stderr, "Failed to load postprocessing fragment shader partial file: '%s'!\n", postprocess_fs_partial_path);
-        return false;
-    }
-
     using ShaderP = Shaders::Program;
 
     const char // *default_vs_path = SHADERS_DIR_PATH "default.vs",
             //    *default_fs_path = SHADERS_DIR_PATH "default.fs",
             //    *passthrough_pos_vs_path = SHADERS_DIR_PATH "passthrough-pos.vs",
             //    *passthrough_pos_uv_vs_path = SHADERS_DIR_PATH "passthrough-pos-uv.vs",
-               *transform_vs_path = SHADERS_DIR_PATH "transform.vs",
-               *static_color_fs_path = SHADERS_DIR_PATH "static-color.fs";
-
-    //line shader
-    const char *screen_line_vs_path = SHADERS_DIR_PATH "screen2d-line.vs";
-
-    new (&screen_line_shader) ShaderP(screen_line_vs_path, static_color_fs_path);
-    if (screen_line_shader.m_id == empty_id)
-    {
-        fprintf(stderr, "Failed to create screen line shader program!\n");
-        screen_line_shader.~Program();
-        return false;
-    }
+               *batch2d_vs_path = SHADERS_DIR_PATH "batch2d.vs";
 
     //ui shader
     const char *ui_vs_path = SHADERS_DIR_PATH "ui.vs",
@@ -79,28 +25,19 @@ bool GamePauseMainLoop::initShaders()
     if (ui_shader.m_id == empty_id)
     {
         fprintf(stderr, "Failed to create UI shader program!\n");
-        screen_line_shader.~Program();
         ui_shader.~Program();
         return false;
     }
 
-    //textured rectangle shader
+    //textured rectangle shader (the pause background gets grayed out by a PostProcessChain)
     const char *tex_rect_fs_path = SHADERS_DIR_PATH "tex-rect.fs";
-    std::vector<ShaderInclude> gray_tex_rect_vs_includes{},
-                               gray_tex_rect_fs_includes = {
-                                                            ShaderInclude(IncludeDefine("DITHER_ON_COLOR",  "(vec4(0.4, 0.4, 0.4, 1.0))")), // set the dither "on" color to darker gray
-                                                            ShaderInclude(IncludeDefine("DITHER_OFF_COLOR", "(vec4(0.0, 0.0, 0.0, 1.0))")), // rest of dither is black
-                                                            ShaderInclude(IncludeDefine("POSTPROCESS(tex, tpos)", "(_postproc_dither_gray_mix((tex), (tpos)))")),
-                                                            ShaderInclude(postprocess_fs_partial.get()),
-                                                           };
-
-    new (&gray_tex_rect_shader) ShaderP(transform_vs_path, tex_rect_fs_path, gray_tex_rect_vs_includes, gray_tex_rect_fs_includes);
-    if (gray_tex_rect_shader.m_id == empty_id)
+
+    new (&tex_rect_shader) ShaderP(batch2d_vs_path, tex_rect_fs_path);
+    if (tex_rect_shader.m_id == empty_id)
     {
         fprintf(stderr, "Failed to create textured rectangle shader program!\n");
-        screen_line_shader.~Program();
         ui_shader.~Program();
-        gray_tex_rect_shader.~Program();
+        tex_rect_shader.~Program();
         return false;
     }
 
@@ -109,9 +46,36 @@ bool GamePauseMainLoop::initShaders()
 
 void GamePauseMainLoop::deinitShaders()
 {
-    screen_line_shader.~Program();
     ui_shader.~Program();
-    gray_tex_rect_shader.~Program();
+    tex_rect_shader.~Program();
+}
+
+void GamePauseMainLoop::initBackground()
+{
+    SharedGLContext& shared_gl_context = SharedGLContext::instance.value();
+
+    // the last game frame is borrowed (no allocation nor copy) and grayed out just once, later frames only draw it
+    shared_gl_context.freezeFbo3D();
+    background_frozen = true;
+
+    PostProcessChain gray_chain{};
+    gray_chain.define("DITHER_ON_COLOR",  "(vec4(0.4, 0.4, 0.4, 1.0))"); // set the dither "on" color to darker gray
+    gray_chain.define("DITHER_OFF_COLOR", "(vec4(0.0, 0.0, 0.0, 1.0))"); // rest of dither is black
+    gray_chain.add(PostProcessChain::dither_gray_mix);
+
+    if (!gray_chain.compile() || !shared_gl_context.postprocessFrozenFbo3D(gray_chain))
+    {
+        fprintf(stderr, "[WARNING] Failed to gray out the pause menu background!\n");
+        // No return!!! We can cope with the original colors.
+    }
+}
+
+void GamePauseMainLoop::deinitBackground()
+{
+    if (!background_frozen) return;
+
+    SharedGLContext::instance.value().unfreezeFbo3D();
+    background_frozen = false;
 }
 
 bool GamePauseMainLoop::initUI()
@@ -150,25 +114,23 @@ void GamePauseMainLoop::deinitUI()
 
 int GamePauseMainLoop::init()
 {
-    //Textures
-    if (!initTextures())
-    {
-        return 1;
-    }
+    background_frozen = false;
 
     //Shaders
     if (!initShaders())
     {
-        deinitTextures();
-        return 2;
+        return 1;
     }
 
+    //Background
+    initBackground();
+
     //UI
     if (!initUI())
     {
-        deinitTextures();
+        deinitBackground();
         deinitShaders();
-        return 3;
+        return 2;
     }
 
     //Misc.
@@ -176,13 +138,14 @@ int GamePauseMainLoop::init()
     tick = 0;
     last_global_tick = 0;
     last_esc_state = GLFW_PRESS;
+    last_ui_hash = 0;
 
     return 0;
 }
 
 GamePauseMainLoop::~GamePauseMainLoop()
 {
-    // nothing for now
+    deinitBackground(); // the game may use fbo3d again
 }
 
 LoopRetVal GamePauseMainLoop::loop(unsigned int global_tick, double frame_time, float frame_delta)
@@ -203,12 +166,12 @@ LoopRetVal GamePauseMainLoop::loop(unsigned int global_tick, double frame_time,
     // const bool left_mbutton_is_clicked = left_mbutton && !last_left_mbutton, right_mbutton_is_clicked = right_mbutton && !last_right_mbutton;
 
     // ---Keyboard input---
-    if(glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) // exit on Q
+    if(InputRecorder::getKey(window, GLFW_KEY_Q) == GLFW_PRESS) // exit on Q
     {
         return LoopRetVal::exit;
     }
 
-    const int esc_state = glfwGetKey(window, GLFW_KEY_ESCAPE);
+    const int esc_state = InputRecorder::getKey(window, GLFW_KEY_ESCAPE);
     const bool esc_clicked = consecutive_tick && esc_state == GLFW_PRESS && last_esc_state == GLFW_RELEASE;
     if (esc_clicked) // go back to the game on ESC
     {
@@ -274,7 +237,7 @@ LoopRetVal GamePauseMainLoop::loop(unsigned int global_tick, double frame_time,
                     assert(game_options_main_loop != NULL);
 
                     //parameter passing
-                    game_options_main_loop->setParameters(background_tex, ui_shader, gray_tex_rect_shader, ui);
+                    game_options_main_loop->setParameters(ui_shader, tex_rect_shader, ui);
 
                     //initialization
                     int init_result = options_loop->init();
@@ -284,11 +247,11 @@ LoopRetVal GamePauseMainLoop::loop(unsigned int global_tick, double frame_time,
                     }
                 }
 
-                //return from this loop early
+                //return from this loop early, nothing got drawn
                 nk_end(&ui.m_ctx);
                 ui.convert();
                 ui.clear();
-                return LoopRetVal::ok;
+                return LoopRetVal::unchanged;
             }
 
             ui.verticalGap(20.f);
@@ -327,7 +290,14 @@ LoopRetVal GamePauseMainLoop::loop(unsigned int global_tick, double frame_time,
     }
     nk_end(&ui.m_ctx);
 
+    // ---Idle check---
+    // unchanged UI over the frozen background looks the same, such frames are neither drawn nor presented
+    const uint64_t ui_hash = ui.commandHash();
+    const bool redraw = !consecutive_tick || ui_hash != last_ui_hash || MainLoopStack::instance.redrawForced(frame_time);
+    last_ui_hash = ui_hash;
+
     // ---Drawing---
+    if (redraw)
     {
         bool use_msaa = shared_gl_context.render_settings.use_msaa;
 
@@ -358,11 +328,13 @@ LoopRetVal GamePauseMainLoop::loop(unsigned int global_tick, double frame_time,
                 else          glDisable(GL_MULTISAMPLE);
             #endif
             
-            //render the background texture with gray postprocessing (should be last fbo3d render)
-            Drawing::texturedRectangle(gray_tex_rect_shader, background_tex, win_fbo_size, glm::vec2(0.f), win_fbo_size);
+            //render the already grayed out background (last fbo3d render)
+            Drawing::texturedRectangle(tex_rect_shader, shared_gl_context.getFbo3DTexture(), win_fbo_size, glm::vec2(0.f), win_fbo_size,
+                                       shared_gl_context.getFbo3DTextureRegion());
+            Batch2D::flush();
             
             //line test
-            // Drawing::screenLine(screen_line_shader, line_vbo, win_size,
+            // Drawing::screenLine(win_size,
             //                     window_middle, glm::vec2(50.f),
             //                     50.f, ColorF(1.0f, 0.0f, 0.0f));
 
@@ -384,15 +356,13 @@ LoopRetVal GamePauseMainLoop::loop(unsigned int global_tick, double frame_time,
     last_global_tick = global_tick;
     ++tick;
 
-    return LoopRetVal::ok;
+    return redraw ? LoopRetVal::ok : LoopRetVal::unchanged;
 }
 
-void GameOptionsMainLoop::setParameters(Textures::Texture2D& background_tex, Shaders::Program& ui_shader,
-                                        Shaders::Program& tex_rect_shader, UI::Context& ui)
+void GameOptionsMainLoop::setParameters(Shaders::Program& ui_shader, Shaders::Program& tex_rect_shader, UI::Context& ui)
 {
-    ref_background_tex = &background_tex;
     ref_ui_shader = &ui_shader;
-    ref_gray_tex_rect_shader = &tex_rect_shader;
+    ref_tex_rect_shader = &tex_rect_shader;
     ref_ui = &ui;
 }
 
@@ -414,7 +384,7 @@ int GameOptionsMainLoop::init()
 {
     //Assert parameters
     assert(ref_ui_shader != NULL);
-    assert(ref_gray_tex_rect_shader != NULL);
+    assert(ref_tex_rect_shader != NULL);
     assert(ref_ui != NULL);
 
     if (!initUI())
@@ -428,6 +398,7 @@ int GameOptionsMainLoop::init()
     last_global_tick = 0;
     last_esc_state = GLFW_PRESS;
     last_enter_state = GLFW_PRESS;
+    last_ui_hash = 0;
     settings = SharedGLContext::instance.value().render_settings;
     initial_settings = settings;
 
@@ -457,8 +428,8 @@ LoopRetVal GameOptionsMainLoop::loop(unsigned int global_tick, double frame_time
     // const bool left_mbutton_is_clicked = left_mbutton && !last_left_mbutton, right_mbutton_is_clicked = right_mbutton && !last_right_mbutton;
 
     // ---Keyboard input---
-    const int esc_state = glfwGetKey(window, GLFW_KEY_ESCAPE);
-    const int enter_state = glfwGetKey(window, GLFW_KEY_ENTER);
+    const int esc_state = InputRecorder::getKey(window, GLFW_KEY_ESCAPE);
+    const int enter_state = InputRecorder::getKey(window, GLFW_KEY_ENTER);
     const bool esc_clicked = consecutive_tick && esc_state == GLFW_PRESS && last_esc_state == GLFW_RELEASE;
     const bool enter_clicked = consecutive_tick && enter_state == GLFW_PRESS && last_enter_state == GLFW_RELEASE;
 
@@ -504,7 +475,26 @@ LoopRetVal GameOptionsMainLoop::loop(unsigned int global_tick, double frame_time
         char ui_textbuff[256]{};
         size_t ui_textbuff_capacity = sizeof(ui_textbuff) / sizeof(ui_textbuff[0]); // including term. char.
 
-        const glm::vec2 menu_size(300, 530);
+        // dynamic resolution needs GPU timer queries, those are not in OpenGL ES 2.0 and WebGL1
+        bool dynamic_resolution_available = false;
+        #ifdef BUILD_OPENGL_330_CORE
+            dynamic_resolution_available = true;
+        #endif
+
+        // deferred shading needs multiple render targets and float textures
+        bool deferred_shading_available = false;
+        #ifdef USE_DEFERRED_SHADING
+            deferred_shading_available = true;
+        #endif
+
+        // automatic depth pre-pass estimates the overdraw with occlusion queries, also not in OpenGL ES 2.0 and WebGL1
+        bool depth_prepass_available = false;
+        #ifdef BUILD_OPENGL_330_CORE
+            depth_prepass_available = true;
+        #endif
+
+        const glm::vec2 menu_size(300, 530 + (dynamic_resolution_available ? 24 : 0) + (deferred_shading_available ? 24 : 0)
+                                           + (depth_prepass_available ? 24 : 0));
         
         //Menu
         if (nk_begin(&ui.m_ctx, "Options", nk_rect((win_size.x - menu_size.x) / 2.f, (win_size.y - menu_size.y) / 2.f,
@@ -541,6 +531,43 @@ LoopRetVal GameOptionsMainLoop::loop(unsigned int global_tick, double frame_time
                 settings.use_fbo3d = true;
             }
 
+            if (dynamic_resolution_available)
+            {
+                nk_layout_row_dynamic(&ui.m_ctx, 20, 1);
+                if (!settings.use_fbo3d) nk_widget_disable_begin(&ui.m_ctx);
+                if (nk_widget_is_hovered(&ui.m_ctx)) nk_tooltip(&ui.m_ctx, "   Lowers the 3D resolution when the GPU can't keep up.");
+                nk_bool dynamic_resolution_enabled = settings.use_dynamic_resolution ? nk_true : nk_false;
+                if (nk_checkbox_label_align(&ui.m_ctx, "Dynamic resolution", &dynamic_resolution_enabled, NK_WIDGET_RIGHT, NK_TEXT_LEFT))
+                {
+                    settings.use_dynamic_resolution = (dynamic_resolution_enabled == nk_true);
+                }
+                if (!settings.use_fbo3d) nk_widget_disable_end(&ui.m_ctx);
+            }
+
+            if (deferred_shading_available)
+            {
+                nk_layout_row_dynamic(&ui.m_ctx, 20, 1);
+                if (nk_widget_is_hovered(&ui.m_ctx)) nk_tooltip(&ui.m_ctx, "   Lights every pixel once, MSAA then smooths only some objects.");
+                nk_bool deferred_shading_enabled = settings.use_deferred_shading ? nk_true : nk_false;
+                if (nk_checkbox_label_align(&ui.m_ctx, "Deferred shading", &deferred_shading_enabled, NK_WIDGET_RIGHT, NK_TEXT_LEFT))
+                {
+                    settings.use_deferred_shading = (deferred_shading_enabled == nk_true);
+                }
+            }
+
+            if (depth_prepass_available)
+            {
+                nk_layout_row_dynamic(&ui.m_ctx, 20, 1);
+                if (settings.use_deferred_shading) nk_widget_disable_begin(&ui.m_ctx);
+                if (nk_widget_is_hovered(&ui.m_ctx)) nk_tooltip(&ui.m_ctx, "   Draws depth first while many hidden pixels get lit.");
+                nk_bool depth_prepass_enabled = settings.use_depth_prepass ? nk_true : nk_false;
+                if (nk_checkbox_label_align(&ui.m_ctx, "Depth pre-pass (auto)", &depth_prepass_enabled, NK_WIDGET_RIGHT, NK_TEXT_LEFT))
+                {
+                    settings.use_depth_prepass = (depth_prepass_enabled == nk_true);
+                }
+                if (settings.use_deferred_shading) nk_widget_disable_end(&ui.m_ctx);
+            }
+
             ui.verticalGap(12.f);
 
             //Anti-aliasing
@@ -618,7 +645,7 @@ LoopRetVal GameOptionsMainLoop::loop(unsigned int global_tick, double frame_time
 
             // Buttons
             nk_layout_row_dynamic(&ui.m_ctx, 40, 1);
-            const bool changes_made = (memcmp(&settings, &initial_settings, sizeof(settings)) != 0);
+            const bool changes_made = !(settings == initial_settings);
 
             if (nk_button_label(&ui.m_ctx, "Set to default"))
             {
@@ -679,7 +706,14 @@ LoopRetVal GameOptionsMainLoop::loop(unsigned int global_tick, double frame_time
     }
     nk_end(&ui.m_ctx);
 
+    // ---Idle check---
+    // unchanged UI over the frozen background looks the same, such frames are neither drawn nor presented
+    const uint64_t ui_hash = ui.commandHash();
+    const bool redraw = !consecutive_tick || ui_hash != last_ui_hash || MainLoopStack::instance.redrawForced(frame_time);
+    last_ui_hash = ui_hash;
+
     // ---Drawing---
+    if (redraw)
     {
         bool use_msaa = shared_gl_context.render_settings.use_msaa;
         
@@ -710,8 +744,10 @@ LoopRetVal GameOptionsMainLoop::loop(unsigned int global_tick, double frame_time
                 else          glDisable(GL_MULTISAMPLE);
             #endif
             
-            //render the background texture with gray postprocessing (should be last fbo3d render)
-            Drawing::texturedRectangle(*ref_gray_tex_rect_shader, *ref_background_tex, win_fbo_size, glm::vec2(0.f), win_fbo_size);
+            //render the background grayed out by the pause menu (last fbo3d render)
+            Drawing::texturedRectangle(*ref_tex_rect_shader, shared_gl_context.getFbo3DTexture(), win_fbo_size, glm::vec2(0.f), win_fbo_size,
+                                       shared_gl_context.getFbo3DTextureRegion());
+            Batch2D::flush();
 
             //UI drawing
             glEnable(GL_SCISSOR_TEST); // enable scissor for UI drawing only
@@ -732,5 +768,5 @@ LoopRetVal GameOptionsMainLoop::loop(unsigned int global_tick, double frame_time
     last_global_tick = global_tick;
     ++tick;
 
-    return LoopRetVal::ok;
+    return redraw ? LoopRetVal::ok : LoopRetVal::unchanged;
 }
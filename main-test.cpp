@@ -115,11 +115,11 @@ int TestMainLoop::init()
             //    *default_fs_path = SHADERS_DIR_PATH "default.fs",
             //    *texture_vs_path = SHADERS_DIR_PATH "texture.vs",
             //    *texture_fs_path = SHADERS_DIR_PATH "texture.fs",
-               *transform_vs_path = SHADERS_DIR_PATH "transform.vs",
+               *batch2d_vs_path = SHADERS_DIR_PATH "batch2d.vs",
                *tex_rect_fs_path = SHADERS_DIR_PATH "tex-rect.fs";
 
     //Textured rectangle shader
-    new (&tex_rect_shader) ShaderP(transform_vs_path, tex_rect_fs_path);
+    new (&tex_rect_shader) ShaderP(batch2d_vs_path, tex_rect_fs_path);
     if (tex_rect_shader.m_id == empty_id)
     {
         fprintf(stderr, "Failed to create textured rectangle shader program!\n");
@@ -219,8 +219,7 @@ int TestMainLoop::init()
     std::vector<Shaders::ShaderInclude> light_vs_includes = {},
                                         light_fs_includes =
                                             {
-                                                // TODO synchronize this value with `lights_max_amount` constexpr
-                                                Shaders::ShaderInclude(Shaders::IncludeDefine("LIGHTS_MAX_AMOUNT", "10")),
+                                                Shaders::ShaderInclude(Shaders::IncludeDefine("LIGHTS_MAX_AMOUNT", STRINGIFY(LIGHTS_MAX_AMOUNT))),
                                                 Shaders::ShaderInclude(Shaders::IncludeDefine("ALPHA_MIN_THRESHOLD", "0.35")),
                                             };
 
@@ -337,39 +336,39 @@ LoopRetVal TestMainLoop::loop(unsigned int global_tick, double frame_time, float
     }
 
     // ---Keyboard input---
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) glfwSetWindowShouldClose(window, true);
+    if (InputRecorder::getKey(window, GLFW_KEY_Q) == GLFW_PRESS) glfwSetWindowShouldClose(window, true);
 
-    if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS) show_pointl = true;
-    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) show_pointl = false;
+    if (InputRecorder::getKey(window, GLFW_KEY_O) == GLFW_PRESS) show_pointl = true;
+    if (InputRecorder::getKey(window, GLFW_KEY_P) == GLFW_PRESS) show_pointl = false;
 
-    if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS) show_flashlight = true;
-    if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS) show_flashlight = false;
+    if (InputRecorder::getKey(window, GLFW_KEY_F) == GLFW_PRESS) show_flashlight = true;
+    if (InputRecorder::getKey(window, GLFW_KEY_G) == GLFW_PRESS) show_flashlight = false;
 
     float new_gamma_coef = shared_gl_context.render_settings.gamma_coef;
-    if (glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS) new_gamma_coef -= 0.01f;
-    if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS) new_gamma_coef += 0.01f;
+    if (InputRecorder::getKey(window, GLFW_KEY_N) == GLFW_PRESS) new_gamma_coef -= 0.01f;
+    if (InputRecorder::getKey(window, GLFW_KEY_M) == GLFW_PRESS) new_gamma_coef += 0.01f;
     if (new_gamma_coef != shared_gl_context.render_settings.gamma_coef)
     {
         // printf("Gamma coeficient changed to: %f\n", new_gamma_coef);
         shared_gl_context.render_settings.gamma_coef = new_gamma_coef;
     }
 
-    /*if(glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
+    /*if(InputRecorder::getKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
     {
         camera_yaw -= 0.5f;
         camera.setTargetFromPitchYaw(camera_pitch, camera_yaw);
     }
-    if(glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+    if(InputRecorder::getKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
     {
         camera_yaw += 0.5f;
         camera.setTargetFromPitchYaw(camera_pitch, camera_yaw);
     }
-    if(glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
+    if(InputRecorder::getKey(window, GLFW_KEY_UP) == GLFW_PRESS)
     {
         camera_pitch += 0.5f;
         camera.setTargetFromPitchYaw(camera_pitch, camera_yaw);
     }
-    if(glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
+    if(InputRecorder::getKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
     {
         camera_pitch -= 0.5f;
         camera.setTargetFromPitchYaw(camera_pitch, camera_yaw);
@@ -442,8 +441,7 @@ LoopRetVal TestMainLoop::loop(unsigned int global_tick, double frame_time, float
             Drawing::clear(clear_color_3d);
             glClear(GL_DEPTH_BUFFER_BIT); //TODO make this nicer - probably move into Drawing
 
-            const glm::mat4& view_mat = camera.getViewMatrix();
-            const glm::mat4& proj_mat = camera.getProjectionMatrix();
+            const glm::mat4& view_proj_mat = camera.getViewProjectionMatrix();
 
             glEnable(GL_DEPTH_TEST);
 
@@ -462,9 +460,7 @@ LoopRetVal TestMainLoop::loop(unsigned int global_tick, double frame_time, float
                 model_mat = glm::translate(model_mat, pointl.m_pos);
                 model_mat = glm::scale(model_mat, glm::vec3(Lighting::light_src_size));
 
-                light_src_shader.set("model", model_mat);
-                light_src_shader.set("view", view_mat);
-                light_src_shader.set("projection", proj_mat);
+                light_src_shader.set("mvp", view_proj_mat * model_mat);
             }
 
             cube_vbo.bind();
@@ -480,9 +476,7 @@ LoopRetVal TestMainLoop::loop(unsigned int global_tick, double frame_time, float
                 model_mat = glm::translate(model_mat, movingl.m_pos);
                 model_mat = glm::scale(model_mat, glm::vec3(Lighting::light_src_size));
 
-                light_src_shader.set("model", model_mat);
-                light_src_shader.set("view", view_mat);
-                light_src_shader.set("projection", proj_mat);
+                light_src_shader.set("mvp", view_proj_mat * model_mat);
             }
 
             cube_vbo.bind();
@@ -493,10 +487,6 @@ LoopRetVal TestMainLoop::loop(unsigned int global_tick, double frame_time, float
             light_shader.use();
             brick_texture.bind();
             {
-                //vs
-                light_shader.set("view", view_mat);
-                light_shader.set("projection", proj_mat);
-                
                 //fs
                 light_shader.set("cameraPos", camera.m_pos);
                 light_shader.setLight(UNIFORM_LIGHT_NAME, sun, 0);
@@ -524,6 +514,7 @@ LoopRetVal TestMainLoop::loop(unsigned int global_tick, double frame_time, float
 
                 light_shader.set("model", model_mat);
                 light_shader.set("normalMat", normal_mat);
+                light_shader.set("mvp", view_proj_mat * model_mat);
 
                 //fs
                 light_shader.setMaterialProps(materials[i]);
@@ -557,8 +548,7 @@ LoopRetVal TestMainLoop::loop(unsigned int global_tick, double frame_time, float
 
                 light_shader.set("model", model_mat);
                 light_shader.set("normalMat", normal_mat);
-                light_shader.set("view", view_mat);
-                light_shader.set("projection", proj_mat);
+                light_shader.set("mvp", view_proj_mat * model_mat);
 
                 //fs
                 light_shader.set("cameraPos", camera.m_pos);
@@ -604,7 +594,8 @@ LoopRetVal TestMainLoop::loop(unsigned int global_tick, double frame_time, float
 
             //render the 3D scene as a background from it's framebuffer
             Drawing::texturedRectangle(tex_rect_shader, fbo3d_tex, win_fbo_size, glm::vec2(0.f), win_fbo_size);
-            // Drawing::texturedRectangle2(tex_rect_shader, fbo3d_tex, orb_texture, orb_texture, glm::vec2(0.f), win_fbo_size);
+            // Drawing::texturedRectangle2(tex_rect_shader, fbo3d_tex, orb_texture, orb_texture, win_fbo_size, glm::vec2(0.f), win_fbo_size);
+            Batch2D::flush();
 
             //TODO UI
 
@@ -1051,30 +1042,30 @@ LoopRetVal TestMainLoop::loop(unsigned int global_tick, double frame_time, float
         }
 
         // ---Keyboard input---
-        if(glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) glfwSetWindowShouldClose(window, true);
+        if(InputRecorder::getKey(window, GLFW_KEY_Q) == GLFW_PRESS) glfwSetWindowShouldClose(window, true);
 
-        if(glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS) show_pointl = true;
-        if(glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) show_pointl = false;
+        if(InputRecorder::getKey(window, GLFW_KEY_O) == GLFW_PRESS) show_pointl = true;
+        if(InputRecorder::getKey(window, GLFW_KEY_P) == GLFW_PRESS) show_pointl = false;
 
-        if(glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS) show_flashlight = true;
-        if(glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS) show_flashlight = false;
+        if(InputRecorder::getKey(window, GLFW_KEY_F) == GLFW_PRESS) show_flashlight = true;
+        if(InputRecorder::getKey(window, GLFW_KEY_G) == GLFW_PRESS) show_flashlight = false;
 
-        if(glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
+        if(InputRecorder::getKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
         {
             camera_yaw -= 0.5f;
             camera.setTargetFromPitchYaw(camera_pitch, camera_yaw);
         }
-        if(glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+        if(InputRecorder::getKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
         {
             camera_yaw += 0.5f;
             camera.setTargetFromPitchYaw(camera_pitch, camera_yaw);
         }
-        if(glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
+        if(InputRecorder::getKey(window, GLFW_KEY_UP) == GLFW_PRESS)
         {
             camera_pitch += 0.5f;
             camera.setTargetFromPitchYaw(camera_pitch, camera_yaw);
         }
-        if(glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
+        if(InputRecorder::getKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
         {
             camera_pitch -= 0.5f;
             camera.setTargetFromPitchYaw(camera_pitch, camera_yaw);
@@ -1144,8 +1135,7 @@ LoopRetVal TestMainLoop::loop(unsigned int global_tick, double frame_time, float
                 Drawing::clear(clear_color_3d);
                 glClear(GL_DEPTH_BUFFER_BIT); //TODO make this nicer - probably move into Drawing
 
-                const glm::mat4& view_mat = camera.getViewMatrix();
-                const glm::mat4& proj_mat = camera.getProjectionMatrix();
+                const glm::mat4& view_proj_mat = camera.getViewProjectionMatrix();
 
                 glEnable(GL_DEPTH_TEST);
 
@@ -1161,9 +1151,7 @@ LoopRetVal TestMainLoop::loop(unsigned int global_tick, double frame_time, float
                     //model_mat = glm::rotate(model_mat, time, glm::vec3(0.f, 1.f, 0.f));
                     model_mat = glm::rotate(model_mat, time, glm::vec3(0.f, 0.f, 1.f));
 
-                    default_shader.set("model", model_mat);
-                    default_shader.set("view", view_mat);
-                    default_shader.set("projection", proj_mat);
+                    default_shader.set("mvp", view_proj_mat * model_mat);
                 }
                 
                 glBindBuffer(GL_ARRAY_BUFFER, triangle_vbo);
@@ -1250,9 +1238,7 @@ LoopRetVal TestMainLoop::loop(unsigned int global_tick, double frame_time, float
                     model_mat = glm::translate(model_mat, pointl.m_pos);
                     model_mat = glm::scale(model_mat, glm::vec3(Lighting::light_src_size));
 
-                    light_src_shader.set("model", model_mat);
-                    light_src_shader.set("view", view_mat);
-                    light_src_shader.set("projection", proj_mat);
+                    light_src_shader.set("mvp", view_proj_mat * model_mat);
                 }
 
                 glBindBuffer(GL_ARRAY_BUFFER, cube_vbo);
@@ -1274,9 +1260,7 @@ LoopRetVal TestMainLoop::loop(unsigned int global_tick, double frame_time, float
                     model_mat = glm::translate(model_mat, movingl.m_pos);
                     model_mat = glm::scale(model_mat, glm::vec3(Lighting::light_src_size));
 
-                    light_src_shader.set("model", model_mat);
-                    light_src_shader.set("view", view_mat);
-                    light_src_shader.set("projection", proj_mat);
+                    light_src_shader.set("mvp", view_proj_mat * model_mat);
                 }
 
                 glBindBuffer(GL_ARRAY_BUFFER, cube_vbo);
@@ -1293,10 +1277,6 @@ LoopRetVal TestMainLoop::loop(unsigned int global_tick, double frame_time, float
                 light_shader.use();
                 brick_texture.bind();
                 {
-                    //vs
-                    light_shader.set("view", view_mat);
-                    light_shader.set("projection", proj_mat);
-                    
                     //fs
                     light_shader.set("cameraPos", camera.m_pos);
                     light_shader.setLight(UNIFORM_LIGHT_NAME, sun, 0);
@@ -1322,6 +1302,7 @@ LoopRetVal TestMainLoop::loop(unsigned int global_tick, double frame_time, float
 
                     light_shader.set("model", model_mat);
                     light_shader.set("normalMat", normal_mat);
+                    light_shader.set("mvp", view_proj_mat * model_mat);
 
                     glBindBuffer(GL_ARRAY_BUFFER, cube_vbo);
                         Shaders::setupVertexAttribute_float(0, 3, cube_verts_pos_offset, cube_vert_attrib * sizeof(GLfloat));
@@ -1352,8 +1333,7 @@ LoopRetVal TestMainLoop::loop(unsigned int global_tick, double frame_time, float
 
                     light_shader.set("model", model_mat);
                     light_shader.set("normalMat", normal_mat);
-                    light_shader.set("view", view_mat);
-                    light_shader.set("projection", proj_mat);
+                    light_shader.set("mvp", view_proj_mat * model_mat);
 
                     //fs
                     light_shader.set("cameraPos", camera.m_pos);
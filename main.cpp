@@ -1,12 +1,17 @@
 #include "game.hpp"
 #include "stb_image.h"
 
+#include <cstring> // strcmp
+#include <cstdlib> // atof, atoi
+
 #ifdef PLATFORM_WEB
     #include <emscripten/emscripten.h>
 #endif
 
-static int init(void)
+// headless mode creates hidden window without v-sync, used for benchmarking
+static int init(bool headless)
 {
+    PROFILE_SCOPE("init");
     puts("Setup begin.");
 
     //GLFW initialization
@@ -41,6 +46,8 @@ static int init(void)
     const unsigned int glfw_samples = 4;
     glfwWindowHint(GLFW_SAMPLES, glfw_samples);
 
+    if (headless) glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
     //initializing the window
     const char window_title[] = "Target Practie OpenGL Game";
     // GLFWwindow* window = glfwCreateWindow(DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT, (char*)window_title, glfwGetPrimaryMonitor(), NULL);
@@ -56,7 +63,7 @@ static int init(void)
     WindowManager::init(window);
 
     //other GLFW settings
-    bool use_v_sync = true;
+    bool use_v_sync = !headless;
     glfwSwapInterval(use_v_sync ? 1 : 0);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     // glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL); //DEBUG
@@ -83,6 +90,9 @@ static int init(void)
         }
     #endif
 
+    // always measures the GPU frame time (dynamic resolution needs it), pass timings only in profiler builds
+    Profiling::GpuProfiler::init(); // stays disabled when not supported
+
     //initializing mouse manager
     MouseManager::init(window);
 
@@ -95,6 +105,9 @@ static int init(void)
         use_msaa = true;
     #endif
     bool enable_gamma_correction = true;
+    bool use_dynamic_resolution = true; // no effect without GPU timer queries (OpenGLES 2.0)
+    bool use_deferred_shading = false; // no effect on OpenGLES 2.0
+    bool use_depth_prepass = true; // automatic, needs occlusion queries (not on OpenGLES 2.0)
 
     // glfw sample hint == 4, fbo samples == 1, enabled MSAA, disabled FBO => anti-aliasing works on every setup
     unsigned int fbo_samples = 1;
@@ -102,7 +115,8 @@ static int init(void)
         fbo_samples = glfw_samples;
     #endif
 
-    const SharedGLContext::RenderSettings default_render_settings{ use_fbo, use_msaa, enable_gamma_correction, use_v_sync };
+    const SharedGLContext::RenderSettings default_render_settings{ use_fbo, use_msaa, enable_gamma_correction, use_v_sync,
+                                                                   use_dynamic_resolution, use_deferred_shading, use_depth_prepass };
 
     assert(!SharedGLContext::instance.has_value());
     SharedGLContext& sharedGLContext = SharedGLContext::instance.emplace(window_fbo_size.x, window_fbo_size.y, fbo_samples, default_render_settings);
@@ -113,29 +127,237 @@ static int init(void)
         return 4;
     }
 
+    if (!Batch2D::init())
+    {
+        fprintf(stderr, "Failed to initialize 2D batching!\n");
+        glfwTerminate();
+        return 4;
+    }
+
+    #ifdef USE_CLUSTERED_LIGHTING
+        if (!ClusteredLighting::init())
+        {
+            fprintf(stderr, "Failed to initialize clustered lighting!\n");
+            glfwTerminate();
+            return 4;
+        }
+    #endif
+
+    DepthPrepass::init(); // without occlusion queries the pre-pass runs only when forced
+
     puts("Setup end.");
     return 0;
 }
 
 static void deinit()
 {
+    RenderCommands::stopThread();
+    FramePacing::reset();
+    InputRecorder::stop();
+    DepthPrepass::deinit();
+    PostProcessChain::clearCache();
+    #ifdef USE_CLUSTERED_LIGHTING
+        ClusteredLighting::deinit();
+    #endif
+    Batch2D::deinit();
+    Profiling::GpuProfiler::deinit();
+    Profiling::GLCallStats::uninstall();
     glfwTerminate();
 }
 
-int desktop_main(void)
+struct LaunchOptions
+{
+    const char *record_path = NULL, *replay_path = NULL;
+    double fixed_step = 0.0; // replay only, <= 0.0 means recorded frame times are used
+    const char *frame_stats_csv_path = NULL, *frame_stats_json_path = NULL; // exported on exit
+    bool gl_call_stats = false; // also enabled by giving the JSON path
+    const char *gl_call_stats_json_path = NULL; // exported on exit
+    float gpu_budget_ms = DynamicResolution::default_budget_ms; // dynamic resolution target
+    double idle_min_refresh_rate = MainLoopStack::default_idle_min_refresh_rate; // menus, 0 disables idle rendering
+    bool deferred_shading = false; // same as the option in the settings menu, no effect on OpenGLES 2.0
+    const char *depth_prepass = "auto"; // "on" forces it every frame, "off" turns the automatic one off
+    bool render_thread = false; // loops recording render commands get them executed on a thread of its own
+    bool low_latency = false; // frame pacing mode, excludes the render thread
+    const char *latency_json_path = NULL; // input latency measured in any mode, exported on exit
+    #ifdef ENABLE_PROFILER
+        const char *profile_trace_path = NULL, *gpu_profile_json_path = NULL; // GPU profile is exported on exit
+        unsigned int profile_first_frame = 100, profile_frame_amount = 60;
+    #endif
+    #ifdef BUILD_BENCHMARK
+        bool run_bench = false;
+        Bench::Settings bench_settings;
+    #endif
+};
+
+// parses `--record <file>`, `--replay <file>`, `--fixed-step <seconds>`, `--frame-stats-csv <file>`, `--frame-stats-json <file>`,
+// `--gl-stats`, `--gl-stats-json <file>`, `--gpu-budget <ms>`, `--idle-min-refresh <hz>`, `--deferred`,
+// `--depth-prepass <auto|on|off>`, `--render-thread`, `--low-latency`, `--latency-json <file>`,
+// in profiler builds also `--profile-trace <file>`, `--profile-frames <first>:<amount>`, `--gpu-profile-json <file>`
+// and in benchmark builds also `--bench <scene>`, `--bench-frames <N>`, `--bench-out <file>`
+static bool parseLaunchOptions(int argc, char *argv[], LaunchOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--record") == 0 && has_value) options.record_path = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && has_value) options.replay_path = argv[++i];
+        else if (strcmp(argv[i], "--fixed-step") == 0 && has_value) options.fixed_step = atof(argv[++i]);
+        else if (strcmp(argv[i], "--frame-stats-csv") == 0 && has_value) options.frame_stats_csv_path = argv[++i];
+        else if (strcmp(argv[i], "--frame-stats-json") == 0 && has_value) options.frame_stats_json_path = argv[++i];
+        else if (strcmp(argv[i], "--gl-stats") == 0) options.gl_call_stats = true;
+        else if (strcmp(argv[i], "--gpu-budget") == 0 && has_value)
+        {
+            options.gpu_budget_ms = static_cast<float>(atof(argv[++i]));
+            if (options.gpu_budget_ms <= 0.f)
+            {
+                fprintf(stderr, "Invalid GPU budget '%s', expected positive milliseconds!\n", argv[i]);
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--idle-min-refresh") == 0 && has_value) options.idle_min_refresh_rate = atof(argv[++i]);
+        else if (strcmp(argv[i], "--deferred") == 0) options.deferred_shading = true;
+        else if (strcmp(argv[i], "--render-thread") == 0) options.render_thread = true;
+        else if (strcmp(argv[i], "--low-latency") == 0) options.low_latency = true;
+        else if (strcmp(argv[i], "--latency-json") == 0 && has_value) options.latency_json_path = argv[++i];
+        else if (strcmp(argv[i], "--depth-prepass") == 0 && has_value)
+        {
+            options.depth_prepass = argv[++i];
+            if (strcmp(options.depth_prepass, "auto") != 0 && strcmp(options.depth_prepass, "on") != 0 &&
+                strcmp(options.depth_prepass, "off") != 0)
+            {
+                fprintf(stderr, "Invalid depth pre-pass mode '%s', expected 'auto', 'on' or 'off'!\n", argv[i]);
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--gl-stats-json") == 0 && has_value)
+        {
+            options.gl_call_stats = true;
+            options.gl_call_stats_json_path = argv[++i];
+        }
+    #ifdef ENABLE_PROFILER
+        else if (strcmp(argv[i], "--profile-trace") == 0 && has_value) options.profile_trace_path = argv[++i];
+        else if (strcmp(argv[i], "--gpu-profile-json") == 0 && has_value) options.gpu_profile_json_path = argv[++i];
+        else if (strcmp(argv[i], "--profile-frames") == 0 && has_value)
+        {
+            if (sscanf(argv[++i], "%u:%u", &options.profile_first_frame, &options.profile_frame_amount) != 2)
+            {
+                fprintf(stderr, "Invalid frame range '%s', expected <first>:<amount>!\n", argv[i]);
+                return false;
+            }
+        }
+    #endif
+    #ifdef BUILD_BENCHMARK
+        else if (strcmp(argv[i], "--bench") == 0 && has_value)
+        {
+            options.run_bench = true;
+            options.bench_settings.scene_name = argv[++i];
+        }
+        else if (strcmp(argv[i], "--bench-frames") == 0 && has_value) options.bench_settings.frame_amount = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--bench-out") == 0 && has_value) options.bench_settings.output_path = argv[++i];
+    #endif
+        else
+        {
+            fprintf(stderr, "Unknown or incomplete argument '%s'!\n", argv[i]);
+            return false;
+        }
+    }
+
+    if (options.record_path != NULL && options.replay_path != NULL)
+    {
+        fprintf(stderr, "Cannot record and replay input at the same time!\n");
+        return false;
+    }
+
+    #ifdef BUILD_BENCHMARK
+        if (options.run_bench && (options.record_path != NULL || options.replay_path != NULL))
+        {
+            fprintf(stderr, "Benchmark mode cannot be combined with input recording or replay!\n");
+            return false;
+        }
+    #endif
+
+    return true;
+}
+
+static bool setupInputRecorder(const LaunchOptions& options)
+{
+    if (options.record_path != NULL) return InputRecorder::startRecording(options.record_path);
+    if (options.replay_path != NULL) return InputRecorder::startReplay(options.replay_path, options.fixed_step);
+    return true;
+}
+
+int desktop_main(int argc, char *argv[])
 {
-    int setup_ret = init();
+    LaunchOptions options;
+    if (!parseLaunchOptions(argc, argv, options)) return 2;
+
+    bool headless = false;
+    #ifdef BUILD_BENCHMARK
+        headless = options.run_bench;
+    #endif
+
+    #ifdef ENABLE_PROFILER
+        if (options.profile_trace_path != NULL)
+        {
+            Profiling::CpuProfiler::requestTrace(options.profile_trace_path, options.profile_first_frame,
+                                                 options.profile_frame_amount);
+        }
+    #endif
+
+    int setup_ret = init(headless);
     if (setup_ret)
     {
         fprintf(stderr, "Setup failed with value: %d\n", setup_ret);
         return 1;
     }
 
+    if (options.gl_call_stats) Profiling::GLCallStats::install();
+    DynamicResolution::setBudget(options.gpu_budget_ms);
+    MainLoopStack::instance.setIdleMinRefreshRate(options.idle_min_refresh_rate);
+    if (options.deferred_shading) SharedGLContext::instance.value().render_settings.use_deferred_shading = true;
+    if (strcmp(options.depth_prepass, "on") == 0) DepthPrepass::setForced(true);
+    else if (strcmp(options.depth_prepass, "off") == 0) SharedGLContext::instance.value().render_settings.use_depth_prepass = false;
+
+    #ifdef BUILD_BENCHMARK
+        if (options.run_bench)
+        {
+            const int bench_ret = Bench::run(options.bench_settings);
+            if (options.gl_call_stats_json_path != NULL && Profiling::GLCallStats::exportJSON(options.gl_call_stats_json_path))
+            {
+                printf("GL call stats written into '%s'.\n", options.gl_call_stats_json_path);
+            }
+            #ifdef ENABLE_PROFILER
+                if (options.gpu_profile_json_path != NULL && Profiling::GpuProfiler::exportJSON(options.gpu_profile_json_path))
+                {
+                    printf("GPU profile written into '%s'.\n", options.gpu_profile_json_path);
+                }
+            #endif
+            deinit();
+            return bench_ret;
+        }
+    #endif
+
+    // has to be started before loop initialization, as the RNG seeds are recorded as well
+    if (!setupInputRecorder(options))
+    {
+        deinit();
+        return 2;
+    }
+
     puts("Begin main.");
 
     GLFWwindow *window = WindowManager::getWindow();
     assert(window != NULL);
 
+    // the render thread keeps a frame of its own in flight, that is what the low latency mode gets rid of
+    if (options.low_latency && options.render_thread)
+    {
+        fprintf(stderr, "[WARNING] Render thread can not be used in the low latency mode, frames get drawn in place.\n");
+        options.render_thread = false;
+    }
+    FramePacing::setEnabled(options.low_latency);
+    if (options.render_thread) RenderCommands::startThread(window); // failure was reported, frames get drawn in place
+
     MainLoopStack& main_loop_stack = MainLoopStack::instance;
     {
         LoopData *pushed_loop_data = main_loop_stack.pushFromTemplate<GameMainLoop>();
@@ -157,23 +379,74 @@ int desktop_main(void)
     }
 
     //main loop
+    Profiling::FrameStats& frame_stats = Profiling::FrameStats::instance;
     {
         const LoopData* loop_data = NULL;
         unsigned int global_ticks = 0;
         while(!glfwWindowShouldClose(window) && (loop_data = main_loop_stack.currentLoopData()) != NULL)
         {
-            glfwPollEvents();
+            PROFILE_FRAME_MARK();
+            PROFILE_SCOPE("frame");
+            // the other loops (menus) call GL directly, the context follows the loop on top
+            if (loop_data->m_records_render_commands) RenderCommands::handOverContext();
+            else RenderCommands::acquireContext();
+            RenderCommands::beginFrame();
+            main_loop_stack.beginFrame();
+
+            // idle capable loops (menus) are woken up only by events or by the forced redraw, replays can't wait for input
+            const bool idle_wait = main_loop_stack.idleWaitAllowed() && InputRecorder::getMode() != InputRecorder::Mode::replay;
+            if (idle_wait)
+            {
+                PROFILE_SCOPE("glfwWaitEventsTimeout");
+                glfwWaitEventsTimeout(main_loop_stack.idleWaitTimeout(glfwGetTime()));
+            }
+            else
+            {
+                FramePacing::waitForInput(SharedGLContext::instance.value().render_settings.use_v_sync);
+                PROFILE_SCOPE("glfwPollEvents");
+                glfwPollEvents();
+            }
+
+            double current_frame_time = glfwGetTime();
+            const double loop_start_time = current_frame_time;
+            FramePacing::inputSampled(current_frame_time); // before a replay overrides the frame time
+            if (!InputRecorder::beginFrame(window, current_frame_time)) break; // replay has ended
 
-            const double current_frame_time = glfwGetTime();
             const float frame_delta = main_loop_stack.getFrameDelta(current_frame_time);
+            main_loop_stack.simulate(*loop_data, current_frame_time);
+            RenderCommands::finish(); // the previous frame got drawn, the loop may touch what its commands referenced
             const LoopRetVal loop_ret_val = loop_data->loopCallback(global_ticks, current_frame_time, frame_delta);
+            const double loop_end_time = glfwGetTime();
 
-            glfwSwapBuffers(window);
+            const bool present = loop_ret_val != LoopRetVal::unchanged;
+            RenderCommands::submit(present);
+            if (present)
+            {
+                const bool loop_changed = main_loop_stack.currentLoopData() != loop_data || loop_ret_val == LoopRetVal::popTop;
+                FramePacing::frameSubmitted(glfwGetTime(), loop_changed);
+                if (!RenderCommands::isThreaded())
+                {
+                    PROFILE_SCOPE("glfwSwapBuffers");
+                    glfwSwapBuffers(window);
+                    FramePacing::framePresented();
+                }
+                main_loop_stack.framePresented(current_frame_time);
+            }
+
+            // first frame has no meaningful delta, waiting for events is not a frame time either
+            if (global_ticks > 0 && !idle_wait)
+            {
+                // GPU time lags a few frames behind, the profiler never waits for the queries
+                frame_stats.addFrame(frame_delta * 1000.f, static_cast<float>(loop_end_time - loop_start_time) * 1000.f,
+                                     Profiling::GpuProfiler::lastFrameMs());
+            }
+            main_loop_stack.endFrame(global_ticks);
 
             //resolve loop_ret_val
             switch (loop_ret_val)
             {
             case LoopRetVal::ok:
+            case LoopRetVal::unchanged:
                 // continue normally
                 break;
             case LoopRetVal::exit:
@@ -191,6 +464,33 @@ int desktop_main(void)
             ++global_ticks;
         }
     }
+    RenderCommands::stopThread(); // the exports below read what the render thread measured
+
+    if (options.latency_json_path != NULL && FramePacing::exportJSON(options.latency_json_path))
+    {
+        printf("Latency stats written into '%s'.\n", options.latency_json_path);
+    }
+    if (options.frame_stats_csv_path != NULL && frame_stats.exportCSV(options.frame_stats_csv_path))
+    {
+        printf("Frame stats written into '%s'.\n", options.frame_stats_csv_path);
+    }
+    if (options.frame_stats_json_path != NULL && frame_stats.exportJSON(options.frame_stats_json_path))
+    {
+        printf("Frame stats written into '%s'.\n", options.frame_stats_json_path);
+    }
+    if (options.gl_call_stats_json_path != NULL && Profiling::GLCallStats::exportJSON(options.gl_call_stats_json_path))
+    {
+        printf("GL call stats written into '%s'.\n", options.gl_call_stats_json_path);
+    }
+    #ifdef ENABLE_PROFILER
+        if (options.gpu_profile_json_path != NULL && Profiling::GpuProfiler::exportJSON(options.gpu_profile_json_path))
+        {
+            printf("GPU profile written into '%s'.\n", options.gpu_profile_json_path);
+        }
+    #endif
+    #ifdef ENABLE_ALLOC_TRACKER
+        Profiling::AllocTracker::printReport(stdout);
+    #endif
 
     //deinitialization
     deinit();
@@ -234,18 +534,39 @@ extern "C"
         assert(window != NULL); //TODO error?
 
         //loop routine
+        PROFILE_FRAME_MARK();
+        PROFILE_SCOPE("frame");
+        RenderCommands::beginFrame();
+        main_loop_stack.beginFrame();
+
         glfwPollEvents();
 
-        const double current_frame_time = glfwGetTime();
+        double current_frame_time = glfwGetTime();
+        FramePacing::inputSampled(current_frame_time); // only measured, the browser paces the frames
+        InputRecorder::beginFrame(window, current_frame_time); // live input only on the web
         const float frame_delta = main_loop_stack.getFrameDelta(current_frame_time);
+        main_loop_stack.simulate(*loop_data, current_frame_time);
         const LoopRetVal loop_ret_val = loop_data->loopCallback(global_ticks, current_frame_time, frame_delta);
+        RenderCommands::submit(true); // no render thread on the web, executed right here
+        const double loop_end_time = glfwGetTime();
+        const bool loop_changed = main_loop_stack.currentLoopData() != loop_data || loop_ret_val == LoopRetVal::popTop;
+        FramePacing::frameSubmitted(loop_end_time, loop_changed);
 
         glfwSwapBuffers(window);
 
+        // first frame has no meaningful delta
+        if (global_ticks > 0)
+        {
+            Profiling::FrameStats::instance.addFrame(frame_delta * 1000.f,
+                                                     static_cast<float>(loop_end_time - current_frame_time) * 1000.f);
+        }
+        main_loop_stack.endFrame(global_ticks);
+
         //resolve loop_ret_val
         switch (loop_ret_val)
         {
         case LoopRetVal::ok:
+        case LoopRetVal::unchanged: // browser keeps showing the last drawn frame
             // continue normally
             break;
         case LoopRetVal::exit:
@@ -268,7 +589,7 @@ int web_main()
 {
     puts("web_main begin");
 
-    int setup_ret = init();
+    int setup_ret = init(false);
     if (setup_ret)
     {
         fprintf(stderr, "Setup failed with value: %d\n", setup_ret);
@@ -305,7 +626,7 @@ int web_main()
 }
 #endif /* PLATFORM_WEB */
 
-int main()
+int main(int argc, char *argv[])
 {
     #ifdef BUILD_OPENGL_330_CORE
         puts("[MAIN] Build with OpenGL 3.3");
@@ -322,6 +643,6 @@ int main()
     #ifdef PLATFORM_WEB
         return web_main();
     #else
-        return desktop_main();
+        return desktop_main(argc, argv);
     #endif
 }
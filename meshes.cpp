@@ -1,8 +1,6 @@
 #include "game.hpp"
 #include "tinyobj_loader_c.h"
 
-#include "glm/gtc/matrix_transform.hpp" // IWYU pragma: keep // translate, scale
-
 
 #ifdef USE_VAO
 Meshes::VAO::~VAO()
@@ -42,7 +40,7 @@ unsigned int Meshes::AttributeConfig::sum() const
 
 Meshes::VBO::VBO() : m_id(empty_id),
                      #ifdef USE_VAO
-                        m_vao(),
+                        m_vao(), m_pos_only_vao(),
                      #endif
                      m_attr_config(),
                      m_vert_count(0), m_stride(0),
@@ -51,7 +49,7 @@ Meshes::VBO::VBO() : m_id(empty_id),
 Meshes::VBO::VBO(const GLfloat *data, size_t data_vert_count, AttributeConfig attr_config)
                     : m_id(empty_id),
                       #ifdef USE_VAO
-                         m_vao(),
+                         m_vao(), m_pos_only_vao(),
                       #endif
                      m_attr_config(attr_config),
                      m_vert_count(data_vert_count), m_stride(0),
@@ -106,17 +104,37 @@ Meshes::VBO::VBO(const GLfloat *data, size_t data_vert_count, AttributeConfig at
     }
 
     glBindBuffer(GL_ARRAY_BUFFER, empty_id); // unbind the buffer afterwards
+    Profiling::GpuMemory::track(Profiling::GpuMemory::Category::vertex_buffer, m_id, data_size);
 
     #ifdef USE_VAO
         // setup VAO
         m_vao.bind();
         bind_noVAO();
         m_vao.unbind();
+
+        // a second VAO for position-only shaders, when the VBO has only positions the first one is used instead
+        if (m_texcoord_offset >= 0 || m_normal_offset >= 0)
+        {
+            m_pos_only_vao.init();
+            if (m_pos_only_vao.m_id == empty_id)
+            {
+                // not fatal, the full VAO works with position-only shaders too
+                fprintf(stderr, "[WARNING] Error occurred when creating position-only VAO for VBO.\n");
+                return;
+            }
+
+            m_pos_only_vao.bind();
+            glBindBuffer(GL_ARRAY_BUFFER, m_id);
+            Shaders::setupVertexAttribute_float(Shaders::attribute_position_pos, m_attr_config.pos_amount, 0, m_stride);
+            m_pos_only_vao.unbind();
+            glBindBuffer(GL_ARRAY_BUFFER, empty_id);
+        }
     #endif
 }
 
 Meshes::VBO::~VBO()
 {
+    Profiling::GpuMemory::release(Profiling::GpuMemory::Category::vertex_buffer, m_id);
     glDeleteBuffers(1, &m_id);
 }
 
@@ -137,6 +155,7 @@ Meshes::VBO& Meshes::VBO::operator=(Meshes::VBO&& other)
         // this is pretty bad solution, sadly pretty much needed in C++
         // maybe we will have to define move assignment for VAOs too which would clear other.m_vao
         other.m_vao.m_id = empty_id;
+        other.m_pos_only_vao.m_id = empty_id;
     #endif
     other.m_attr_config = Meshes::AttributeConfig(); // assign the default with all zeros (maybe pointless?)
     other.m_vert_count = 0;
@@ -169,6 +188,32 @@ void Meshes::VBO::unbind() const
     #endif
 }
 
+void Meshes::VBO::bindPositionOnly() const
+{
+    assert(m_id != empty_id);
+
+    #ifdef USE_VAO
+        if (m_pos_only_vao.m_id != empty_id) m_pos_only_vao.bind();
+        else                                 m_vao.bind();
+    #else
+        glBindBuffer(GL_ARRAY_BUFFER, m_id);
+        Shaders::setupVertexAttribute_float(Shaders::attribute_position_pos, m_attr_config.pos_amount,
+                                            0, m_stride); // vertex position offset is always 0
+    #endif
+}
+
+void Meshes::VBO::unbindPositionOnly() const
+{
+    // assumes that VBO was already bound by `bindPositionOnly`!
+
+    #ifdef USE_VAO
+        m_vao.unbind(); // unbinds any VAO
+    #else
+        Shaders::disableVertexAttribute(Shaders::attribute_position_pos);
+        glBindBuffer(GL_ARRAY_BUFFER, empty_id);
+    #endif
+}
+
 void Meshes::VBO::bind_noVAO() const
 {
     assert(m_id != empty_id);
@@ -724,23 +769,20 @@ Meshes::Model::Model(const Shaders::Program& shader, const Meshes::Mesh& mesh, L
                 : m_shader(shader), m_material(material), m_mesh(mesh),
                   m_origin_offset(0.f), m_translate(0.f), m_scale(1.f) {}
 
-void Meshes::Model::draw(const Drawing::Camera3D& camera, const std::vector<std::reference_wrapper<const Lighting::Light>>& lights,
-                         float gamma, glm::vec3 pos, glm::vec3 scale) const
+void Meshes::Model::setTransform(TransformBatch& transforms, TransformBatch::Id id, glm::vec3 pos, glm::vec3 scale) const
+{
+    transforms.setPosition(id, m_translate + pos);
+    transforms.setScale(id, m_scale * scale);
+    transforms.setOriginOffset(id, m_origin_offset);
+}
+
+void Meshes::Model::draw(const Drawing::Camera3D& camera, const Lighting::LightRefs& lights,
+                         float gamma, const TransformBatch& transforms, TransformBatch::Id id) const
 {
     m_shader.use();
 
     //vs
-    glm::mat4 model_mat(1.f);
-    model_mat = glm::translate(model_mat, m_translate + pos);
-    model_mat = glm::scale(model_mat, m_scale * scale);
-    model_mat = glm::translate(model_mat, m_origin_offset);
-
-    glm::mat3 normal_mat = Utils::modelMatrixToNormalMatrix(model_mat);
-
-    m_shader.set("model", model_mat);
-    m_shader.set("normalMat", normal_mat);
-    m_shader.set("view", camera.getViewMatrix());
-    m_shader.set("projection", camera.getProjectionMatrix());
+    transforms.setUniforms(m_shader, id);
 
     //fs
     m_shader.set("cameraPos", camera.m_pos);
@@ -761,33 +803,27 @@ void Meshes::Model::draw(const Drawing::Camera3D& camera, const std::vector<std:
 }
 
 void Meshes::Model::drawWithColorTint(const Drawing::Camera3D& camera,
-                                      const std::vector<std::reference_wrapper<const Lighting::Light>>& lights,
-                                      float gamma, glm::vec3 pos, const Color3F color_tint, glm::vec3 scale) const
+                                      const Lighting::LightRefs& lights,
+                                      float gamma, const TransformBatch& transforms, TransformBatch::Id id,
+                                      const Color3F color_tint) const
 {
     m_shader.use();
 
     //vs
-    glm::mat4 model_mat(1.f);
-    model_mat = glm::translate(model_mat, m_translate + pos);
-    model_mat = glm::scale(model_mat, m_scale * scale);
-    model_mat = glm::translate(model_mat, m_origin_offset);
-
-    glm::mat3 normal_mat = Utils::modelMatrixToNormalMatrix(model_mat);
-
-    m_shader.set("model", model_mat);
-    m_shader.set("normalMat", normal_mat);
-    m_shader.set("view", camera.getViewMatrix());
-    m_shader.set("projection", camera.getProjectionMatrix());
+    transforms.setUniforms(m_shader, id);
 
     //fs
-    Lighting::Material tinted_material = m_material;
-    // tinted_material.m_props.m_ambient = Drawing::blendScreen(m_material.m_props.m_ambient, color_tint);
-    // tinted_material.m_props.m_diffuse = Drawing::blendScreen(m_material.m_props.m_diffuse, color_tint);
-    tinted_material.m_props.m_ambient = m_material.m_props.m_ambient.mult(color_tint);
-    tinted_material.m_props.m_diffuse = m_material.m_props.m_diffuse.mult(color_tint);
+    // only the props get tinted, the maps are bound straight from the model material
+    Lighting::MaterialProps tinted_props = m_material.m_props;
+    // tinted_props.m_ambient = Drawing::blendScreen(m_material.m_props.m_ambient, color_tint);
+    // tinted_props.m_diffuse = Drawing::blendScreen(m_material.m_props.m_diffuse, color_tint);
+    tinted_props.m_ambient = m_material.m_props.m_ambient.mult(color_tint);
+    tinted_props.m_diffuse = m_material.m_props.m_diffuse.mult(color_tint);
 
     m_shader.set("cameraPos", camera.m_pos);
-    m_shader.setMaterial(tinted_material);
+    m_shader.setMaterialProps(tinted_props);
+    m_shader.bindDiffuseMap(m_material.m_diffuse_map);
+    m_shader.bindSpecularMap(m_material.m_specular_map);
     
     int lights_set = m_shader.setLights(UNIFORM_LIGHT_NAME, UNIFORM_LIGHT_COUNT_NAME, lights);
     assert(lights_set >= 0);
@@ -803,6 +839,21 @@ void Meshes::Model::drawWithColorTint(const Drawing::Camera3D& camera,
     m_mesh.draw();
 }
 
+void Meshes::Model::drawToGBuffer(const Shaders::Program& gbuffer_shader,
+                                  float gamma, const TransformBatch& transforms, TransformBatch::Id id) const
+{
+    gbuffer_shader.use();
+
+    //vs
+    transforms.setUniforms(gbuffer_shader, id, false);
+
+    //fs
+    gbuffer_shader.setMaterial(m_material);
+    gbuffer_shader.set("gammaCoef", gamma);
+
+    m_mesh.draw();
+}
+
 //Loads geometry and material data out of .obj files with usage of `tinyobj_loader_c`, returns 0 when success, non-zero when error.
 //Optionally can load materials as well.
 int Meshes::loadObj(const char *obj_file_path, unsigned int *out_vert_count, unsigned int *out_triangle_count,
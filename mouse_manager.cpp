@@ -2,6 +2,13 @@
 
 
 glm::vec2 MouseManager::mouse_pos(0.f);
+MouseManager::Event MouseManager::m_pending_events[event_capacity]{};
+unsigned int MouseManager::m_pending_first = 0;
+unsigned int MouseManager::m_pending_count = 0;
+unsigned int MouseManager::m_dropped_events = 0;
+MouseManager::Event MouseManager::m_frame_events[event_capacity]{};
+unsigned int MouseManager::m_frame_event_count = 0;
+unsigned int MouseManager::m_frame_event_read = 0;
 bool MouseManager::left_button = false;
 bool MouseManager::right_button = false;
 
@@ -47,9 +54,66 @@ void MouseManager::setCursorVisible()
     }
 }
 
+void MouseManager::beginFrame()
+{
+    if (m_dropped_events > 0)
+    {
+        fprintf(stderr, "[WARNING] %u mouse events did not fit into the queue and got dropped!\n", m_dropped_events);
+        m_dropped_events = 0;
+    }
+
+    for (unsigned int i = 0; i < m_pending_count; ++i)
+    {
+        m_frame_events[i] = m_pending_events[(m_pending_first + i) % event_capacity];
+    }
+    m_frame_event_count = m_pending_count;
+    m_frame_event_read = 0;
+
+    clearPendingEvents();
+}
+
+bool MouseManager::nextEvent(double up_to_time, Event& out_event)
+{
+    if (m_frame_event_read >= m_frame_event_count) return false;
+
+    const Event& event = m_frame_events[m_frame_event_read];
+    if (event.time > up_to_time) return false;
+
+    out_event = event;
+    ++m_frame_event_read;
+    return true;
+}
+
+void MouseManager::skipEvents()
+{
+    m_frame_event_read = m_frame_event_count;
+}
+
+void MouseManager::queueEvent(const Event& event)
+{
+    if (m_pending_count == event_capacity)
+    {
+        // the oldest one goes, the newest ones matter the most for aiming
+        m_pending_first = (m_pending_first + 1) % event_capacity;
+        --m_pending_count;
+        ++m_dropped_events;
+    }
+
+    m_pending_events[(m_pending_first + m_pending_count) % event_capacity] = event;
+    ++m_pending_count;
+}
+
+void MouseManager::clearPendingEvents()
+{
+    m_pending_first = 0;
+    m_pending_count = 0;
+}
+
 void MouseManager::mousePositionCallback(GLFWwindow* window, double xpos, double ypos)
 {
     mouse_pos = glm::vec2(static_cast<float>(xpos), static_cast<float>(ypos));
+
+    queueEvent(Event{ Event::Type::move, 0, false, glfwGetTime(), mouse_pos });
 }
 
 void MouseManager::mouseButtonsCallback(GLFWwindow *window, int button, int action, int mods)
@@ -62,4 +126,7 @@ void MouseManager::mouseButtonsCallback(GLFWwindow *window, int button, int acti
     {
         MouseManager::right_button = (action == GLFW_PRESS);
     }
+    else return; // other buttons are not used anywhere
+
+    queueEvent(Event{ Event::Type::button, static_cast<uint8_t>(button), action == GLFW_PRESS, glfwGetTime(), mouse_pos });
 }
@@ -9,10 +9,10 @@ glm::vec3 Movement::getSimplePlayerDir(GLFWwindow* window)
     //TODO z == up/down 
     glm::vec3 move(0.f, 0.f, 0.f);
 
-    if(glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) move.z -= 1.f;
-    if(glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) move.z += 1.f;
-    if(glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) move.x -= 1.f;
-    if(glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) move.x += 1.f;
+    if(InputRecorder::getKey(window, GLFW_KEY_W) == GLFW_PRESS) move.z -= 1.f;
+    if(InputRecorder::getKey(window, GLFW_KEY_S) == GLFW_PRESS) move.z += 1.f;
+    if(InputRecorder::getKey(window, GLFW_KEY_A) == GLFW_PRESS) move.x -= 1.f;
+    if(InputRecorder::getKey(window, GLFW_KEY_D) == GLFW_PRESS) move.x += 1.f;
 
     return NORMALIZE_OR_0(move);
 }
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "game.hpp"
+
+#include <algorithm>
+
+
+std::vector<PostProcessChain::CachedProgram> PostProcessChain::m_cache{};
+
+const PostProcessChain::Effect PostProcessChain::grayscale{ "grayscale", PostProcessChain::Input::color,
+                                                            "return _postproc_grayscale_color(color);" };
+const PostProcessChain::Effect PostProcessChain::dither{ "dither", PostProcessChain::Input::texture,
+                                                         "return _postproc_dither(tex, tpos);" };
+const PostProcessChain::Effect PostProcessChain::dither_gray_mix{ "dither_gray_mix", PostProcessChain::Input::texture,
+                                                                  "return _postproc_dither_gray_mix(tex, tpos);" };
+
+void PostProcessChain::define(const char *name, const char *value)
+{
+    m_defines.push_back(Shaders::IncludeDefine(name, value));
+    m_pass_programs.clear();
+}
+
+void PostProcessChain::add(const Effect& effect)
+{
+    m_effects.push_back(effect);
+    m_pass_programs.clear();
+}
+
+const Shaders::Program* PostProcessChain::findProgram(const std::string& signature)
+{
+    auto it = std::find_if(m_cache.begin(), m_cache.end(),
+                           [&signature](const CachedProgram& cached) { return cached.signature == signature; });
+    return it != m_cache.end() ? it->program.get() : NULL;
+}
+
+bool PostProcessChain::compile()
+{
+    using ShaderInclude = Shaders::ShaderInclude;
+    m_pass_programs.clear();
+
+    // used only during compilation, cached programs do not need it anymore
+    const char *partial_path = SHADERS_PARTIALS_DIR_PATH "postprocess.fspart";
+    std::unique_ptr<char[]> partial{};
+
+    std::string defines_signature;
+    for (const Shaders::IncludeDefine& define : m_defines)
+    {
+        defines_signature += define.m_name;
+        defines_signature += '=';
+        defines_signature += define.m_value != NULL ? define.m_value : "";
+        defines_signature += ';';
+    }
+
+    size_t pass_begin = 0;
+    while (pass_begin < m_effects.size())
+    {
+        // texture effects start a new pass, color effects join the current one
+        size_t pass_end = pass_begin + 1;
+        while (pass_end < m_effects.size() && m_effects[pass_end].input == Input::color) ++pass_end;
+
+        std::string signature = defines_signature, code;
+        const bool sampling_first = m_effects[pass_begin].input == Input::texture;
+        std::string chain_body = sampling_first ? "    vec4 color = _chain_effect0(tex, tpos);\n"
+                                                : "    vec4 color = TEXTURE2D(tex, tpos);\n";
+        for (size_t i = pass_begin; i < pass_end; ++i)
+        {
+            const Effect& effect = m_effects[i];
+            const std::string fn_name = "_chain_effect" + std::to_string(i - pass_begin);
+
+            signature += effect.name;
+            signature += ' ';
+
+            code += "vec4 " + fn_name + (effect.input == Input::texture ? "(sampler2D tex, vec2 tpos)\n{\n    "
+                                                                        : "(vec4 color, vec2 tpos)\n{\n    ");
+            code += effect.snippet;
+            code += "\n}\n\n";
+
+            if (effect.input == Input::color) chain_body += "    color = " + fn_name + "(color, tpos);\n";
+        }
+        code += "vec4 _chain(sampler2D tex, vec2 tpos)\n{\n" + chain_body + "    return color;\n}\n";
+
+        const Shaders::Program *program = findProgram(signature);
+        if (program == NULL)
+        {
+            if (!partial) partial = Utils::getTextFileAsString(partial_path, NULL);
+            if (!partial)
+            {
+                fprintf(stderr, "Failed to load postprocessing fragment shader partial file: '%s'!\n", partial_path);
+                m_pass_programs.clear();
+                return false;
+            }
+
+            std::vector<ShaderInclude> includes{};
+            for (const Shaders::IncludeDefine& define : m_defines)
+            {
+                includes.push_back(ShaderInclude(Shaders::IncludeDefine(define.m_name, define.m_value)));
+            }
+            includes.push_back(ShaderInclude(Shaders::IncludeDefine("POSTPROCESS(tex, tpos)", "(_chain((tex), (tpos)))")));
+            includes.push_back(ShaderInclude(partial.get()));
+            includes.push_back(ShaderInclude(code.c_str()));
+
+            std::unique_ptr<Shaders::Program> new_program = std::make_unique<Shaders::Program>(SHADERS_DIR_PATH "fullscreen.vs",
+                                                                                               SHADERS_DIR_PATH "postprocess.fs",
+                                                                                               std::vector<ShaderInclude>{},
+                                                                                               includes);
+            if (new_program->m_id == empty_id)
+            {
+                fprintf(stderr, "Failed to create post-process program of pass: '%s'!\n", signature.c_str());
+                m_pass_programs.clear();
+                return false;
+            }
+
+            program = new_program.get();
+            m_cache.push_back(CachedProgram{ signature, std::move(new_program) });
+        }
+        m_pass_programs.push_back(program);
+
+        pass_begin = pass_end;
+    }
+
+    return true;
+}
+
+bool PostProcessChain::isCompiled() const
+{
+    return m_pass_programs.size() > 0 || m_effects.empty();
+}
+
+unsigned int PostProcessChain::passAmount() const
+{
+    return m_pass_programs.size();
+}
+
+const Shaders::Program& PostProcessChain::passProgram(unsigned int pass) const
+{
+    assert(pass < m_pass_programs.size());
+    return *m_pass_programs[pass];
+}
+
+void PostProcessChain::clearCache()
+{
+    m_cache.clear();
+}
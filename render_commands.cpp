@@ -0,0 +1,280 @@
+#include "game.hpp"
+
+#include <algorithm>
+#ifndef PLATFORM_WEB
+    #include <condition_variable>
+    #include <mutex>
+    #include <system_error>
+    #include <thread>
+#endif
+
+
+// every entry starts with a header, commands have their execute function there, data of the commands have NULL
+struct EntryHeader
+{
+    RenderCommands::ExecuteFnPtr *execute;
+    size_t size; // of the entry without the header
+};
+
+static constexpr size_t entry_alignment = alignof(std::max_align_t);
+static constexpr size_t header_size = (sizeof(EntryHeader) + entry_alignment - 1) & ~(entry_alignment - 1);
+
+struct StreamBlock
+{
+    std::unique_ptr<unsigned char[]> memory;
+    size_t capacity, used;
+};
+
+struct Stream
+{
+    std::vector<StreamBlock> blocks; // kept allocated, after the first frames recording allocates nothing
+    size_t current = 0; // block being recorded into, entries are never placed into the earlier ones
+};
+
+static Stream streams[2];
+static unsigned int recording_stream = 0;
+static bool frame_begun = false; // between beginFrame and submit
+static bool frame_open_inline = false; // GPU profiler frame opened on the main thread, executing the stream in place
+
+#ifndef PLATFORM_WEB
+    static std::thread render_thread;
+    static GLFWwindow *thread_window = NULL;
+    static bool thread_running = false; // main thread only
+
+    // guarded by the mutex, `context_wanted` is written only by the main thread, which may read it without locking
+    static std::mutex thread_mutex;
+    static std::condition_variable thread_cv;
+    static bool context_wanted = false, context_on_thread = false, thread_quit = false;
+    static bool stream_pending = false, stream_present = false;
+    static unsigned int pending_stream = 0;
+#endif
+
+void* RenderCommands::allocateEntry(size_t bytes, ExecuteFnPtr *execute)
+{
+    Stream& stream = streams[recording_stream];
+    const size_t entry_size = header_size + ((bytes + entry_alignment - 1) & ~(entry_alignment - 1));
+
+    while (stream.current < stream.blocks.size() &&
+           stream.blocks[stream.current].capacity - stream.blocks[stream.current].used < entry_size)
+    {
+        ++stream.current;
+    }
+    if (stream.current == stream.blocks.size())
+    {
+        const size_t capacity = std::max(block_size, entry_size);
+        stream.blocks.push_back(StreamBlock{ std::make_unique<unsigned char[]>(capacity), capacity, 0 });
+    }
+
+    StreamBlock& block = stream.blocks[stream.current];
+    unsigned char *entry = block.memory.get() + block.used;
+    block.used += entry_size;
+
+    new (entry) EntryHeader{ execute, entry_size - header_size };
+    return entry + header_size;
+}
+
+static void executeStream(Stream& stream)
+{
+    PROFILE_SCOPE("RenderCommands::execute");
+
+    for (size_t b = 0; b < stream.blocks.size() && b <= stream.current; ++b)
+    {
+        StreamBlock& block = stream.blocks[b];
+        size_t offset = 0;
+        while (offset < block.used)
+        {
+            const EntryHeader *header = reinterpret_cast<const EntryHeader*>(block.memory.get() + offset);
+            if (header->execute != NULL) header->execute(block.memory.get() + offset + header_size);
+            offset += header_size + header->size;
+        }
+        block.used = 0;
+    }
+    stream.current = 0;
+}
+
+#ifndef PLATFORM_WEB
+    static void renderThreadMain()
+    {
+        std::unique_lock<std::mutex> lock(thread_mutex);
+        while (true)
+        {
+            thread_cv.wait(lock, []() { return thread_quit || stream_pending || context_wanted != context_on_thread; });
+
+            if (context_wanted != context_on_thread)
+            {
+                glfwMakeContextCurrent(context_wanted ? thread_window : NULL);
+                context_on_thread = context_wanted;
+                thread_cv.notify_all();
+            }
+            else if (stream_pending)
+            {
+                // main thread records into the other stream meanwhile, it waits for this one before touching it again
+                Stream& stream = streams[pending_stream];
+                const bool present = stream_present;
+                lock.unlock();
+                {
+                    PROFILE_SCOPE("render thread frame");
+                    FrameArena::reset();
+                    Profiling::GLCallStats::beginFrame();
+                    GPU_PROFILE_FRAME_BEGIN();
+                    executeStream(stream);
+                    GPU_PROFILE_FRAME_END();
+                    if (present)
+                    {
+                        PROFILE_SCOPE("glfwSwapBuffers");
+                        glfwSwapBuffers(thread_window);
+                    }
+                }
+                lock.lock();
+                stream_pending = false;
+                thread_cv.notify_all();
+            }
+            else if (thread_quit) break;
+        }
+    }
+#endif
+
+void RenderCommands::beginFrame()
+{
+    assert(!frame_begun);
+    frame_begun = true;
+
+    // the render thread begins its frames by itself
+    if (isThreaded()) return;
+
+    Profiling::GLCallStats::beginFrame();
+    GPU_PROFILE_FRAME_BEGIN();
+    frame_open_inline = true;
+}
+
+void RenderCommands::submit(bool present)
+{
+    PROFILE_SCOPE("RenderCommands::submit");
+    assert(frame_begun);
+    frame_begun = false;
+
+    #ifndef PLATFORM_WEB
+        if (isThreaded())
+        {
+            std::unique_lock<std::mutex> lock(thread_mutex);
+            thread_cv.wait(lock, []() { return !stream_pending; });
+            pending_stream = recording_stream;
+            stream_present = present;
+            stream_pending = true;
+            thread_cv.notify_all();
+
+            recording_stream = 1 - recording_stream; // the other one got executed already
+            return;
+        }
+    #endif
+
+    (void)present; // the caller swaps the buffers
+    executeStream(streams[recording_stream]);
+    if (frame_open_inline)
+    {
+        GPU_PROFILE_FRAME_END();
+        frame_open_inline = false;
+    }
+}
+
+void RenderCommands::finish()
+{
+    #ifndef PLATFORM_WEB
+        if (!thread_running) return;
+
+        PROFILE_SCOPE("RenderCommands::finish");
+        std::unique_lock<std::mutex> lock(thread_mutex);
+        thread_cv.wait(lock, []() { return !stream_pending; });
+    #endif
+}
+
+bool RenderCommands::startThread(GLFWwindow *window)
+{
+    #ifdef PLATFORM_WEB
+        (void)window;
+        fprintf(stderr, "[WARNING] Render thread is not available on the web, render commands get executed in place.\n");
+        return false;
+    #else
+        assert(!thread_running);
+        assert(window != NULL);
+
+        thread_window = window;
+        context_wanted = context_on_thread = thread_quit = stream_pending = false;
+        try
+        {
+            render_thread = std::thread(renderThreadMain);
+        }
+        catch (const std::system_error& error)
+        {
+            fprintf(stderr, "[WARNING] Failed to start the render thread (%s), render commands get executed in place.\n",
+                    error.what());
+            return false;
+        }
+
+        thread_running = true;
+        return true;
+    #endif
+}
+
+void RenderCommands::stopThread()
+{
+    #ifndef PLATFORM_WEB
+        if (!thread_running) return;
+
+        acquireContext();
+        {
+            std::lock_guard<std::mutex> lock(thread_mutex);
+            thread_quit = true;
+            thread_cv.notify_all();
+        }
+        render_thread.join();
+        thread_running = false;
+    #endif
+}
+
+void RenderCommands::handOverContext()
+{
+    #ifndef PLATFORM_WEB
+        if (!thread_running || isThreaded()) return;
+        assert(!frame_begun);
+
+        glfwMakeContextCurrent(NULL);
+        std::lock_guard<std::mutex> lock(thread_mutex);
+        context_wanted = true;
+        thread_cv.notify_all();
+    #endif
+}
+
+void RenderCommands::acquireContext()
+{
+    #ifndef PLATFORM_WEB
+        if (!isThreaded()) return;
+
+        PROFILE_SCOPE("RenderCommands::acquireContext");
+        {
+            std::unique_lock<std::mutex> lock(thread_mutex);
+            thread_cv.wait(lock, []() { return !stream_pending; });
+            context_wanted = false;
+            thread_cv.notify_all();
+            thread_cv.wait(lock, []() { return !context_on_thread; });
+        }
+        glfwMakeContextCurrent(thread_window);
+
+        // the rest of the frame (e.g. a loop pushed in the middle of it) calls GL here, and submit executes the stream
+        if (frame_begun)
+        {
+            Profiling::GLCallStats::beginFrame();
+            GPU_PROFILE_FRAME_BEGIN();
+            frame_open_inline = true;
+        }
+    #endif
+}
+
+bool RenderCommands::isThreaded()
+{
+    #ifdef PLATFORM_WEB
+        return false;
+    #else
+        return context_wanted;
+    #endif
+}
@@ -0,0 +1,601 @@
+#include "game.hpp"
+
+#include <algorithm>
+#include <numeric> // iota
+
+
+std::vector<RenderGraph::PoolEntry> RenderGraph::m_pool{};
+glm::ivec2 RenderGraph::m_target_size(0);
+
+static GLenum depthAttachmentPoint(GLenum internalformat)
+{
+    switch (internalformat)
+    {
+    #ifdef USE_COMBINED_FBO_BUFFERS
+    case GL_DEPTH_STENCIL:
+    case GL_DEPTH24_STENCIL8:
+        return GL_DEPTH_STENCIL_ATTACHMENT;
+    #endif
+    case GL_STENCIL_INDEX8:
+        return GL_STENCIL_ATTACHMENT;
+    default:
+        return GL_DEPTH_ATTACHMENT;
+    }
+}
+
+static bool sameDesc(RenderGraph::TargetDesc a, RenderGraph::TargetDesc b)
+{
+    return a.internalformat == b.internalformat && a.samples == b.samples;
+}
+
+RenderGraph::RenderGraph()
+                : m_targets(), m_declared_target_amount(0), m_declared(), m_steps(), m_pass_steps(),
+                  m_used_pool_entries(), m_compiled(false), m_next_step(0), m_region(0)
+{
+}
+
+RenderGraph::~RenderGraph()
+{
+    releaseCompiled();
+    releaseUnusedEntries();
+}
+
+bool RenderGraph::allocateEntry(PoolEntry& entry)
+{
+    using GpuMemory = Profiling::GpuMemory;
+    assert(m_target_size.x > 0 && m_target_size.y > 0);
+    assert(!Utils::checkForGLError());
+
+    const unsigned int width = m_target_size.x, height = m_target_size.y;
+    if (entry.texture)
+    {
+        assert(entry.desc.samples == 1);
+        if (entry.id == empty_id) glGenTextures(1, &entry.id);
+
+        // formats and types only describe the (missing) initial data, any valid combination would do
+        GLenum format = GL_RGBA, type = GL_UNSIGNED_BYTE;
+        switch (entry.desc.internalformat)
+        {
+        case GL_DEPTH_COMPONENT16:
+            format = GL_DEPTH_COMPONENT;
+            type = GL_UNSIGNED_SHORT;
+            break;
+        case GL_DEPTH_COMPONENT24:
+            format = GL_DEPTH_COMPONENT;
+            type = GL_UNSIGNED_INT;
+            break;
+        case GL_DEPTH_STENCIL:
+        case GL_DEPTH24_STENCIL8:
+            format = GL_DEPTH_STENCIL;
+            type = GL_UNSIGNED_INT_24_8;
+            break;
+        case GL_RGB565:
+            format = GL_RGB;
+            type = GL_UNSIGNED_SHORT_5_6_5;
+            break;
+        case GL_RGB:
+        case GL_RGB8:
+            format = GL_RGB;
+            break;
+        case GL_RGBA16F:
+        case GL_RGBA32F:
+            type = GL_FLOAT;
+            break;
+        default:
+            break;
+        }
+
+        #ifdef BUILD_OPENGL_330_CORE
+            const GLenum internalformat = entry.desc.internalformat;
+        #else
+            const GLenum internalformat = format; // OpenGLES 2.0 textures have only unsized formats
+        #endif
+
+        glBindTexture(GL_TEXTURE_2D, entry.id);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalformat, width, height, 0, format, type, NULL);
+        // sampled 1:1 or with texelFetch, but the textures would be incomplete with the default mipmap filtering
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, empty_id);
+    }
+    else
+    {
+        if (entry.id == empty_id) glGenRenderbuffers(1, &entry.id);
+
+        glBindRenderbuffer(GL_RENDERBUFFER, entry.id);
+        #ifdef BUILD_OPENGL_330_CORE
+            if (entry.desc.samples > 1)
+            {
+                glRenderbufferStorageMultisample(GL_RENDERBUFFER, entry.desc.samples, entry.desc.internalformat, width, height);
+            }
+            else
+        #endif
+            {
+                glRenderbufferStorage(GL_RENDERBUFFER, entry.desc.internalformat, width, height);
+            }
+        glBindRenderbuffer(GL_RENDERBUFFER, empty_id);
+    }
+
+    if (entry.id == empty_id || Utils::checkForGLErrorsAndPrintThem())
+    {
+        fprintf(stderr, "Failed to allocate render target of format 0x%x (%u samples) and size: %ux%u\n",
+                entry.desc.internalformat, entry.desc.samples, width, height);
+        return false; // the entry is released by its owner, framebuffers may still reference it
+    }
+
+    GpuMemory::track(entry.texture ? GpuMemory::Category::render_target_texture : GpuMemory::Category::render_target_rbo,
+                     entry.id, GpuMemory::estimateBytes(entry.desc.internalformat, width, height, entry.desc.samples));
+    return true;
+}
+
+void RenderGraph::releaseEntry(PoolEntry& entry)
+{
+    using GpuMemory = Profiling::GpuMemory;
+    if (entry.id == empty_id) return;
+
+    if (entry.texture)
+    {
+        GpuMemory::release(GpuMemory::Category::render_target_texture, entry.id);
+        glDeleteTextures(1, &entry.id);
+    }
+    else
+    {
+        GpuMemory::release(GpuMemory::Category::render_target_rbo, entry.id);
+        glDeleteRenderbuffers(1, &entry.id);
+    }
+    entry.id = empty_id;
+}
+
+void RenderGraph::releaseUnusedEntries()
+{
+    for (PoolEntry& entry : m_pool)
+    {
+        if (entry.users == 0) releaseEntry(entry);
+    }
+}
+
+GLuint RenderGraph::targetId(TargetId target) const
+{
+    const Target& t = m_targets[target];
+    switch (t.kind)
+    {
+    case TargetKind::transient:
+        assert(t.pool_idx >= 0);
+        return m_pool[t.pool_idx].id;
+    case TargetKind::imported:
+        return t.imported_id;
+    default:
+        return empty_id;
+    }
+}
+
+bool RenderGraph::attachTarget(GLenum attachment, TargetId target) const
+{
+    const Target& t = m_targets[target];
+    if (t.kind == TargetKind::backbuffer)
+    {
+        fprintf(stderr, "OS framebuffer can't be attached together with other render targets!\n");
+        return false;
+    }
+
+    if (t.sampled) glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, targetId(target), 0);
+    else glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER, targetId(target));
+
+    return true;
+}
+
+bool RenderGraph::buildFramebuffers()
+{
+    for (Step& step : m_steps)
+    {
+        const bool to_backbuffer = step.type == StepType::pass && step.color_amount == 1 &&
+                                   m_targets[step.colors[0]].kind == TargetKind::backbuffer;
+        if (to_backbuffer)
+        {
+            if (step.depth != none)
+            {
+                fprintf(stderr, "Pass '%s' into the OS framebuffer can't have its own depth target!\n", step.name);
+                return false;
+            }
+            continue; // the OS framebuffer comes with its own depth and stencil
+        }
+
+        if (step.type == StepType::resolve && m_targets[step.src].kind != TargetKind::backbuffer)
+        {
+            glGenFramebuffers(1, &step.src_fbo_id);
+            glBindFramebuffer(GL_FRAMEBUFFER, step.src_fbo_id);
+            if (!attachTarget(GL_COLOR_ATTACHMENT0, step.src)) return false;
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            {
+                fprintf(stderr, "Source framebuffer of resolve '%s' is not complete!\n", step.name);
+                return false;
+            }
+        }
+
+        #ifndef BUILD_OPENGL_330_CORE
+            // without blits the resolve copies straight into the destination texture
+            if (step.type == StepType::resolve) continue;
+        #endif
+
+        glGenFramebuffers(1, &step.fbo_id);
+        glBindFramebuffer(GL_FRAMEBUFFER, step.fbo_id);
+
+        if (step.type == StepType::resolve)
+        {
+            if (!attachTarget(GL_COLOR_ATTACHMENT0, step.dst)) return false;
+        }
+        else
+        {
+            for (unsigned int i = 0; i < step.color_amount; ++i)
+            {
+                if (!attachTarget(GL_COLOR_ATTACHMENT0 + i, step.colors[i])) return false;
+            }
+            if (step.depth != none &&
+                !attachTarget(depthAttachmentPoint(m_targets[step.depth].desc.internalformat), step.depth)) return false;
+
+            #ifdef BUILD_OPENGL_330_CORE
+                // draw buffers are framebuffer state, so they are set up just once here
+                static const GLenum draw_buffers[color_attachments_max] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
+                                                                            GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+                if (step.color_amount > 0) glDrawBuffers(step.color_amount, draw_buffers);
+                else
+                {
+                    glDrawBuffer(GL_NONE);
+                    glReadBuffer(GL_NONE);
+                }
+            #endif
+        }
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            fprintf(stderr, "Framebuffer of %s '%s' is not complete!\n",
+                    step.type == StepType::pass ? "pass" : "resolve", step.name);
+            return false;
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, empty_id);
+    return true;
+}
+
+void RenderGraph::releaseCompiled()
+{
+    for (Step& step : m_steps)
+    {
+        if (step.fbo_id != empty_id) glDeleteFramebuffers(1, &step.fbo_id);
+        if (step.src_fbo_id != empty_id) glDeleteFramebuffers(1, &step.src_fbo_id);
+    }
+    m_steps.clear();
+    m_pass_steps.clear();
+
+    // storage is released later by the next compile of any graph, so a recompile gets the same targets back
+    for (int entry_idx : m_used_pool_entries)
+    {
+        assert(m_pool[entry_idx].users > 0);
+        --m_pool[entry_idx].users;
+    }
+    m_used_pool_entries.clear();
+    m_compiled = false;
+}
+
+void RenderGraph::clear()
+{
+    releaseCompiled();
+    m_targets.clear();
+    m_declared_target_amount = 0;
+    m_declared.clear();
+}
+
+RenderGraph::TargetId RenderGraph::addTarget(const char *name, TargetDesc desc)
+{
+    assert(desc.samples >= 1);
+    releaseCompiled();
+
+    m_targets.push_back(Target{ name, TargetKind::transient, desc, empty_id, false, -1, -1, -1, none });
+    m_declared_target_amount = m_targets.size();
+    return m_targets.size() - 1;
+}
+
+RenderGraph::TargetId RenderGraph::importTexture(const char *name, const Textures::Texture2D& texture)
+{
+    assert(texture.m_id != empty_id && !texture.isMultiSampled());
+    releaseCompiled();
+
+    // the format of an imported texture is never compared, it is not aliased with anything
+    m_targets.push_back(Target{ name, TargetKind::imported, TargetDesc{ GL_NONE, 1 }, texture.m_id, true, -1, -1, -1, none });
+    m_declared_target_amount = m_targets.size();
+    return m_targets.size() - 1;
+}
+
+RenderGraph::TargetId RenderGraph::importBackbuffer()
+{
+    releaseCompiled();
+
+    m_targets.push_back(Target{ "OS framebuffer", TargetKind::backbuffer, TargetDesc{ GL_NONE, 1 }, empty_id, false,
+                                -1, -1, -1, none });
+    m_declared_target_amount = m_targets.size();
+    return m_targets.size() - 1;
+}
+
+RenderGraph::PassId RenderGraph::addPass(const char *name, std::initializer_list<TargetId> colors, TargetId depth,
+                                         std::initializer_list<TargetId> reads)
+{
+    assert(colors.size() <= color_attachments_max && reads.size() <= reads_max);
+    releaseCompiled();
+
+    Step step{ StepType::pass, name, {}, 0, depth, {}, 0, none, none, empty_id, empty_id };
+    for (TargetId color : colors) step.colors[step.color_amount++] = color;
+    for (TargetId read : reads) step.reads[step.read_amount++] = read;
+
+    m_declared.push_back(step);
+    return m_declared.size() - 1;
+}
+
+void RenderGraph::addResolve(const char *name, TargetId src, TargetId dst)
+{
+    releaseCompiled();
+
+    m_declared.push_back(Step{ StepType::resolve, name, {}, 0, none, {}, 0, src, dst, empty_id, empty_id });
+}
+
+bool RenderGraph::compile()
+{
+    releaseCompiled();
+    m_targets.resize(m_declared_target_amount);
+    for (Target& target : m_targets)
+    {
+        target.sampled = target.kind == TargetKind::imported;
+        target.first_step = target.last_step = -1;
+        target.pool_idx = -1;
+        target.resolved = none;
+    }
+
+    //schedule - declared steps with the automatic resolves of sampled multisampled targets
+    std::vector<bool> resolve_current(m_targets.size(), false); // resolved copy holds the latest contents
+    for (const Step& declared : m_declared)
+    {
+        Step step = declared;
+        if (step.type == StepType::pass)
+        {
+            for (unsigned int i = 0; i < step.read_amount; ++i)
+            {
+                const TargetId read = step.reads[i];
+                if (m_targets[read].kind == TargetKind::backbuffer)
+                {
+                    fprintf(stderr, "Pass '%s' can't sample the OS framebuffer!\n", step.name);
+                    releaseCompiled();
+                    return false;
+                }
+                if (m_targets[read].desc.samples == 1) continue;
+
+                if (m_targets[read].resolved == none)
+                {
+                    const TargetDesc resolved_desc{ m_targets[read].desc.internalformat, 1 };
+                    m_targets.push_back(Target{ "resolved", TargetKind::transient, resolved_desc, empty_id, false,
+                                                -1, -1, -1, none });
+                    m_targets[read].resolved = m_targets.size() - 1;
+                    resolve_current.push_back(false);
+                }
+                if (!resolve_current[read])
+                {
+                    m_steps.push_back(Step{ StepType::resolve, "MSAA resolve", {}, 0, none, {}, 0,
+                                            read, m_targets[read].resolved, empty_id, empty_id });
+                    resolve_current[read] = true;
+                }
+                step.reads[i] = m_targets[read].resolved;
+            }
+            for (unsigned int i = 0; i < step.color_amount; ++i) resolve_current[step.colors[i]] = false;
+        }
+        else
+        {
+            const Target& src = m_targets[step.src];
+            const Target& dst = m_targets[step.dst];
+            if (dst.kind == TargetKind::backbuffer || dst.desc.samples != 1)
+            {
+                fprintf(stderr, "Resolve '%s' needs a single sample destination target!\n", step.name);
+                releaseCompiled();
+                return false;
+            }
+            #ifndef BUILD_OPENGL_330_CORE
+                if (src.kind == TargetKind::transient && src.desc.samples != 1)
+                {
+                    fprintf(stderr, "Resolve '%s' of a multisampled target is not supported on OpenGLES 2.0!\n", step.name);
+                    releaseCompiled();
+                    return false;
+                }
+            #else
+                (void)src;
+            #endif
+            resolve_current[step.dst] = false;
+        }
+
+        m_pass_steps.push_back(m_steps.size());
+        m_steps.push_back(step);
+    }
+
+    //lifetimes
+    for (size_t i = 0; i < m_steps.size(); ++i)
+    {
+        const Step& step = m_steps[i];
+        auto use = [&](TargetId target)
+        {
+            if (target == none) return;
+            Target& t = m_targets[target];
+            if (t.first_step < 0) t.first_step = i;
+            t.last_step = i;
+        };
+
+        for (unsigned int j = 0; j < step.color_amount; ++j) use(step.colors[j]);
+        use(step.depth);
+        for (unsigned int j = 0; j < step.read_amount; ++j)
+        {
+            use(step.reads[j]);
+            m_targets[step.reads[j]].sampled = true;
+        }
+        use(step.src);
+        use(step.dst);
+        #ifndef BUILD_OPENGL_330_CORE
+            // resolves copy into textures
+            if (step.dst != none) m_targets[step.dst].sampled = true;
+        #endif
+    }
+
+    //aliasing - targets in the order of their first use take the first compatible entry free by then
+    std::vector<int> order(m_targets.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [this](int a, int b) { return m_targets[a].first_step < m_targets[b].first_step; });
+
+    for (PoolEntry& entry : m_pool) entry.busy_until = -1;
+
+    std::vector<int> used_entries;
+    for (int target_idx : order)
+    {
+        Target& target = m_targets[target_idx];
+        if (target.kind != TargetKind::transient || target.first_step < 0) continue;
+
+        auto compatible = [&target](const PoolEntry& entry)
+        {
+            return entry.id != empty_id && entry.texture == target.sampled && sameDesc(entry.desc, target.desc) &&
+                   entry.busy_until < target.first_step;
+        };
+        auto it = std::find_if(m_pool.begin(), m_pool.end(), compatible);
+        if (it == m_pool.end())
+        {
+            it = std::find_if(m_pool.begin(), m_pool.end(), [](const PoolEntry& entry) { return entry.id == empty_id; });
+            if (it == m_pool.end())
+            {
+                m_pool.push_back(PoolEntry{});
+                it = m_pool.end() - 1;
+            }
+            *it = PoolEntry{ target.desc, target.sampled, empty_id, 0, -1 };
+            if (!allocateEntry(*it))
+            {
+                fprintf(stderr, "Failed to allocate render target '%s'!\n", target.name);
+                releaseCompiled();
+                releaseUnusedEntries();
+                return false;
+            }
+        }
+
+        it->busy_until = target.last_step;
+        target.pool_idx = it - m_pool.begin();
+        if (std::find(used_entries.begin(), used_entries.end(), target.pool_idx) == used_entries.end())
+        {
+            used_entries.push_back(target.pool_idx);
+        }
+    }
+
+    for (int entry_idx : used_entries) ++m_pool[entry_idx].users;
+    m_used_pool_entries = std::move(used_entries);
+    releaseUnusedEntries(); // storage left behind by previous compiles
+
+    if (!buildFramebuffers())
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, empty_id);
+        releaseCompiled();
+        releaseUnusedEntries();
+        return false;
+    }
+
+    m_compiled = true;
+    return true;
+}
+
+bool RenderGraph::isCompiled() const
+{
+    return m_compiled;
+}
+
+void RenderGraph::runResolve(const Step& step) const
+{
+    GPU_PROFILE_SCOPE(step.name);
+    assert(step.type == StepType::resolve);
+
+    #ifdef BUILD_OPENGL_330_CORE
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, step.src_fbo_id);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, step.fbo_id);
+
+        // multisampled blit can't scale, thus the same rectangle on both sides
+        glBlitFramebuffer(0, 0, m_region.x, m_region.y, 0, 0, m_region.x, m_region.y, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    #else
+        glBindFramebuffer(GL_FRAMEBUFFER, step.src_fbo_id);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, targetId(step.dst));
+
+        // sub image copy, so the texture storage is not reallocated each frame
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, m_region.x, m_region.y);
+    #endif
+}
+
+void RenderGraph::beginFrame(glm::ivec2 region)
+{
+    assert(m_compiled);
+    m_next_step = 0;
+    m_region = region;
+}
+
+void RenderGraph::beginPass(PassId pass)
+{
+    assert(m_compiled);
+    const size_t pass_step = m_pass_steps[pass];
+    assert(pass_step >= m_next_step && m_steps[pass_step].type == StepType::pass);
+
+    // passes skipped meanwhile are not run, only the resolves
+    for (size_t i = m_next_step; i < pass_step; ++i)
+    {
+        if (m_steps[i].type == StepType::resolve) runResolve(m_steps[i]);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_steps[pass_step].fbo_id);
+    m_next_step = pass_step + 1;
+}
+
+void RenderGraph::finish()
+{
+    assert(m_compiled);
+    for (size_t i = m_next_step; i < m_steps.size(); ++i)
+    {
+        if (m_steps[i].type == StepType::resolve) runResolve(m_steps[i]);
+    }
+
+    cancel();
+}
+
+void RenderGraph::cancel()
+{
+    m_next_step = m_steps.size();
+    glBindFramebuffer(GL_FRAMEBUFFER, empty_id);
+}
+
+GLuint RenderGraph::getTexture(TargetId target) const
+{
+    assert(m_compiled);
+    const Target& t = m_targets[target];
+    if (t.resolved != none) return targetId(t.resolved);
+
+    assert(t.sampled);
+    return targetId(target);
+}
+
+void RenderGraph::setTargetSize(glm::ivec2 size)
+{
+    if (size == m_target_size) return;
+    m_target_size = size;
+
+    // storage is respecified in place, the framebuffers of compiled graphs keep working
+    for (PoolEntry& entry : m_pool)
+    {
+        if (entry.id != empty_id && !allocateEntry(entry))
+        {
+            fprintf(stderr, "[WARNING] Failed to resize render target to: %dx%d\n", size.x, size.y);
+        }
+    }
+}
+
+glm::ivec2 RenderGraph::getTargetSize()
+{
+    return m_target_size;
+}
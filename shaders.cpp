@@ -205,8 +205,13 @@ bool Shaders::Program::setLight(const char *uniform_name, const Lighting::Light&
 }
 
 int Shaders::Program::setLights(const char *uniform_array_name, const char *uniform_arrray_size_name,
-                                 const std::vector<std::reference_wrapper<const Lighting::Light>>& lights) const
+                                 const Lighting::LightRefs& lights) const
 {
+    #ifdef USE_CLUSTERED_LIGHTING
+        // shaders built with CLUSTERED_LIGHTING read the lights assigned by the last ClusteredLighting::update instead
+        if (glGetUniformLocation(m_id, "clusterLights") >= 0) return ClusteredLighting::bind(*this);
+    #endif
+
     int success_count = 0;
 
     for (size_t i = 0; i < lights.size() && success_count < Lighting::lights_max_amount; ++i)
@@ -231,6 +236,12 @@ static void setDefaultAttributeLocations(GLuint program_id)
     glBindAttribLocation(program_id, Shaders::attribute_position_texcoords, ATTRIBUTE_DEFAULT_NAME_TEXCOORDS);
     glBindAttribLocation(program_id, Shaders::attribute_position_normals, ATTRIBUTE_DEFAULT_NAME_NORMALS);
     glBindAttribLocation(program_id, Shaders::attribute_position_color, ATTRIBUTE_DEFAULT_NAME_COLOR);
+    glBindAttribLocation(program_id, Shaders::attribute_position_texcoords_max, ATTRIBUTE_DEFAULT_NAME_TEXCOORDS_MAX);
+
+    #ifndef USE_VER100_SHADERS
+        // shaders with more outputs (G-buffer pass) place the other ones explicitly, the default one must be the first
+        glBindFragDataLocation(program_id, 0, "FragColor");
+    #endif
 }
 
 GLuint Shaders::fromString(GLenum type, const char *src)
@@ -1,11 +1,12 @@
 IN_ATTR vec3 aPos;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform mat4 mvp;           // projection * view * model, precomputed on the CPU
+
+// also the depth pre-pass shader, the lit pass then tests against its depth with GL_EQUAL
+invariant gl_Position;
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = mvp * vec4(aPos, 1.0);
     //vertexColor = vec4(0.5, 0.0, 0.0, 1.0);
 }
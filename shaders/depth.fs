@@ -0,0 +1,5 @@
+// depth pre-pass, only the depth buffer is written (color writes are masked off by the caller)
+
+void main()
+{
+}
@@ -0,0 +1,6 @@
+IN_ATTR vec3 aPos;         // unit quad centered at the origin (SharedGLContext::unit_quad_pos_only)
+
+void main()
+{
+    gl_Position = vec4(2.0 * aPos.xy, 0.0, 1.0); // stretched over the whole viewport
+}
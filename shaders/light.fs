@@ -6,6 +6,11 @@
     #endif
 #endif
 
+// Variants of this shader:
+//  - default           - forward shading, every fragment gets lit right away
+//  - GBUFFER_PASS      - writes the surface into the G-buffer of SharedGLContext (needs OpenGL 3.3)
+//  - DEFERRED_LIGHTING - fullscreen pass lighting the surfaces stored in the G-buffer (needs OpenGL 3.3)
+
 struct Material
 {
     vec3 ambient;
@@ -34,16 +39,53 @@ struct Light
     vec3 dir;               // only for directional and spot lights
     float cosInnerCutoff;   // only for spot lights
     float cosOuterCutoff;   // only for spot lights
+    float range;            // only for point and spot lights, light fades out completely at this distance, 0.0 -> unlimited
 };
 
-IN_ATTR vec3 FragPos;       //position in world space
-IN_ATTR vec2 TexCoord;
-IN_ATTR vec3 Normal;
+struct Surface              // material already combined with its maps
+{
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+    float shininess;
+};
+
+#ifdef DEFERRED_LIGHTING
+    // G-buffer is read texel by texel, the lighting pass covers the same viewport as the geometry pass did
+    uniform sampler2D gbufferDiffuse;   // rgb -> diffuse color
+    uniform sampler2D gbufferSpecular;  // rgb -> specular color
+    uniform sampler2D gbufferNormal;    // xy -> octahedral normal, z -> ambient scale, w -> shininess
+    uniform sampler2D gbufferDepth;
+    uniform mat4 invViewProj;
+    uniform vec2 viewportSize;
+#else
+    IN_ATTR vec3 FragPos;       //position in world space
+    IN_ATTR vec2 TexCoord;
+    IN_ATTR vec3 Normal;
+
+    uniform Material material;
+#endif
+
+#ifdef GBUFFER_PASS
+    layout(location = 1) out vec4 GBufferSpecular; // FragColor (location 0) holds the diffuse color
+    layout(location = 2) out vec4 GBufferNormal;
+#endif
 
 uniform vec3 cameraPos;     //position in world space
-uniform Material material;
-uniform Light lights[LIGHTS_MAX_AMOUNT]; //TODO this might not work everywhere!
-uniform int lightsCount;
+#ifdef CLUSTERED_LIGHTING
+    // lights packed by Lighting::Light::pack, 6 texels each:
+    // (pos, type), (dir, range), (atten_coefs, cosInnerCutoff), (ambient, cosOuterCutoff), (diffuse, -), (specular, -)
+    uniform samplerBuffer clusterLights;
+    uniform usamplerBuffer clusterGrid;         // per cluster offset and length of its list in clusterLightIndices
+    uniform usamplerBuffer clusterLightIndices; // indices into clusterLights
+    uniform mat4 clusterViewProj;
+    uniform vec3 clusterGridSize;
+    uniform vec2 clusterDepthParams;            // depth slice = log(view depth) * x + y
+    uniform int globalLightsCount;              // first lights in clusterLights, they affect every cluster
+#else
+    uniform Light lights[LIGHTS_MAX_AMOUNT]; //TODO this might not work everywhere!
+    uniform int lightsCount;
+#endif
 uniform float gammaCoef;
 
 const float Pi = 3.14159265;
@@ -53,7 +95,7 @@ const float diff_cutoff_for_spec = 0.05;
 //TODO make a uniform to enable/disable this setting
 const bool use_reinhard = true; // use reinhard tone mapping
 
-vec3 calc_dir_light(vec3 norm, vec3 cameraDir, vec3 dir)
+vec3 calc_dir_light(vec3 norm, vec3 cameraDir, vec3 dir, float shininess)
 {
     vec3 lightDir = normalize(-dir);
 
@@ -72,27 +114,37 @@ vec3 calc_dir_light(vec3 norm, vec3 cameraDir, vec3 dir)
             vec3 halfwayDir = normalize(lightDir + cameraDir);
             // energy conservation equations from:
             // https://www.rorydriscoll.com/2009/01/25/energy-conservation-in-games/
-            float energy_conserv_factor = (material.shininess + 8.0) / (8.0 * Pi);
-            spec = energy_conserv_factor * pow(max(dot(norm, halfwayDir), 0.0), material.shininess);
+            float energy_conserv_factor = (shininess + 8.0) / (8.0 * Pi);
+            spec = energy_conserv_factor * pow(max(dot(norm, halfwayDir), 0.0), shininess);
         }
     }
     else
     {
         vec3 reflectDir = reflect(-lightDir, norm);
-        float energy_conserv_factor = (material.shininess + 2.0) / (2.0 * Pi);
-        spec = energy_conserv_factor * pow(max(dot(cameraDir, reflectDir), 0.0), material.shininess);
+        float energy_conserv_factor = (shininess + 2.0) / (2.0 * Pi);
+        spec = energy_conserv_factor * pow(max(dot(cameraDir, reflectDir), 0.0), shininess);
     }
 
     return vec3(amb, diff, spec);
 }
 
-vec3 calc_point_light(vec3 norm, vec3 cameraDir, vec3 lightPos, vec3 atten_coefs)
+float range_window(float distance, float range)
+{
+    // smoothly reaches zero at the range, so the light never ends with a visible edge at cluster borders
+    if (range <= 0.0) return 1.0;
+
+    float x = distance / range;
+    float window = clamp(1.0 - x * x * x * x, 0.0, 1.0);
+    return window * window;
+}
+
+vec3 calc_point_light(vec3 fragPos, vec3 norm, vec3 cameraDir, vec3 lightPos, vec3 atten_coefs, float range, float shininess)
 {
     //ambient
     float amb = 1.0;
 
     //diffuse
-    vec3 dirToLight = normalize(lightPos - FragPos);
+    vec3 dirToLight = normalize(lightPos - fragPos);
     float diff = max(dot(norm, dirToLight), 0.0);
 
     //specular
@@ -102,31 +154,31 @@ vec3 calc_point_light(vec3 norm, vec3 cameraDir, vec3 lightPos, vec3 atten_coefs
         if (diff > diff_cutoff_for_spec) //TODO probably remove this after shadows gets implemented (causes ball to look weird)
         {
             vec3 halfwayDir = normalize(dirToLight + cameraDir);
-            float energy_conserv_factor = (material.shininess + 8.0) / (8.0 * Pi);
-            spec = energy_conserv_factor * pow(max(dot(norm, halfwayDir), 0.0), material.shininess);
+            float energy_conserv_factor = (shininess + 8.0) / (8.0 * Pi);
+            spec = energy_conserv_factor * pow(max(dot(norm, halfwayDir), 0.0), shininess);
         }
     }
     else
     {
         vec3 reflectDir = reflect(-dirToLight, norm);
-        float energy_conserv_factor = (material.shininess + 2.0) / (2.0 * Pi);
-        spec = energy_conserv_factor * pow(max(dot(cameraDir, reflectDir), 0.0), material.shininess);
+        float energy_conserv_factor = (shininess + 2.0) / (2.0 * Pi);
+        spec = energy_conserv_factor * pow(max(dot(cameraDir, reflectDir), 0.0), shininess);
     }
 
     //attenuation
-    float distance = length(lightPos - FragPos);
+    float distance = length(lightPos - fragPos);
     float attenuation = 1.0 /
                         (atten_coefs.x +                           // constant component
                          atten_coefs.y *  distance +               // linear component
                          atten_coefs.z * (distance * distance));   // quadratic component
 
-    return vec3(amb, diff, spec) * attenuation;
+    return vec3(amb, diff, spec) * attenuation * range_window(distance, range);
 }
 
-vec3 calc_spot_light(vec3 norm, vec3 cameraDir, vec3 lightDir, vec3 lightPos,
-                     float cosCutoffIn, float cosCutoffOut, vec3 atten_coefs)
+vec3 calc_spot_light(vec3 fragPos, vec3 norm, vec3 cameraDir, vec3 lightDir, vec3 lightPos,
+                     float cosCutoffIn, float cosCutoffOut, vec3 atten_coefs, float range, float shininess)
 {
-    vec3 dirToLight = normalize(lightPos - FragPos); // direction of the light source from the fragment
+    vec3 dirToLight = normalize(lightPos - fragPos); // direction of the light source from the fragment
 
     float cosTheta = dot(dirToLight, normalize(-lightDir)); // -lightDir as we have directions from the fragment
     // intensity of the light - 1.0 for inner cone (full intensity), 0.0 for fragments out of both cones (no intensity), 0.0-1.0 in the outer cone
@@ -145,74 +197,205 @@ vec3 calc_spot_light(vec3 norm, vec3 cameraDir, vec3 lightDir, vec3 lightPos,
         if (diff > diff_cutoff_for_spec) //TODO probably remove this after shadows gets implemented (causes ball to look weird)
         {
             vec3 halfwayDir = normalize(dirToLight + cameraDir);
-            float energy_conserv_factor = (material.shininess + 8.0) / (8.0 * Pi);
-            spec = energy_conserv_factor * pow(max(dot(norm, halfwayDir), 0.0), material.shininess) * intensity;  // intensity applied
+            float energy_conserv_factor = (shininess + 8.0) / (8.0 * Pi);
+            spec = energy_conserv_factor * pow(max(dot(norm, halfwayDir), 0.0), shininess) * intensity;  // intensity applied
         }
     }
     else
     {
         vec3 reflectDir = reflect(-dirToLight, norm);
-        float energy_conserv_factor = (material.shininess + 2.0) / (2.0 * Pi);
-        spec = energy_conserv_factor * pow(max(dot(cameraDir, reflectDir), 0.0), material.shininess) * intensity; // intensity applied
+        float energy_conserv_factor = (shininess + 2.0) / (2.0 * Pi);
+        spec = energy_conserv_factor * pow(max(dot(cameraDir, reflectDir), 0.0), shininess) * intensity; // intensity applied
     }
 
     //attenuation
-    float distance = length(lightPos - FragPos);
+    float distance = length(lightPos - fragPos);
     float attenuation = 1.0 /
                         (atten_coefs.x +                           // constant component
                          atten_coefs.y *  distance +               // linear component
                          atten_coefs.z * (distance * distance));   // quadratic component
 
-    return vec3(amb, diff, spec) * attenuation;
+    return vec3(amb, diff, spec) * attenuation * range_window(distance, range);
 }
 
-vec3 tone_mapping(vec3 c)
+vec3 shade_light(Light light, vec3 fragPos, vec3 norm, vec3 cameraDir, Surface surface)
 {
-    // optional reinhard tone mapping
-    return use_reinhard ? c / (c + vec3(1.0)) : c;
+    vec3 phong_light_coefs = vec3(0.0);
+    if (light.type == 0) // directional light
+    {
+        phong_light_coefs = calc_dir_light(norm, cameraDir, light.dir, surface.shininess);
+    }
+    else if (light.type == 1) // point light
+    {
+        phong_light_coefs = calc_point_light(fragPos, norm, cameraDir, light.pos, light.atten_coefs, light.range, surface.shininess);
+    }
+    else if (light.type == 2) // spot light
+    {
+        phong_light_coefs = calc_spot_light(fragPos, norm, cameraDir, light.dir, light.pos,
+                                            light.cosInnerCutoff, light.cosOuterCutoff, light.atten_coefs, light.range,
+                                            surface.shininess);
+    }
+
+    vec3 color = phong_light_coefs.x * light.props.ambient * surface.ambient;   // ambient
+    color += phong_light_coefs.y * light.props.diffuse * surface.diffuse;       // diffuse
+    color += phong_light_coefs.z * light.props.specular * surface.specular;     // specular
+    return color;
 }
 
-void main()
-{
-    vec4 diffuse_sample = TEXTURE2DGAMMA(material.diffuseMap, TexCoord);
-    // discard the fragments with too small alpha values
-    //TODO aplha blending
-    if (diffuse_sample.a < ALPHA_MIN_THRESHOLD) discard;
-
-    vec3 specular_sample = TEXTURE2D(material.specularMap, TexCoord).rgb;
-    vec3 norm = normalize(Normal);
-    vec3 cameraDir = normalize(cameraPos - FragPos);
-    
-    //light
-    vec3 color = vec3(0.0);
+#ifdef CLUSTERED_LIGHTING
+    Light fetch_light(int idx)
+    {
+        int base = idx * 6;
+        vec4 pos_type = texelFetch(clusterLights, base);
+        vec4 dir_range = texelFetch(clusterLights, base + 1);
+        vec4 atten_inner = texelFetch(clusterLights, base + 2);
+        vec4 ambient_outer = texelFetch(clusterLights, base + 3);
+
+        Light light;
+        light.type = int(pos_type.w);
+        light.pos = pos_type.xyz;
+        light.dir = dir_range.xyz;
+        light.range = dir_range.w;
+        light.atten_coefs = atten_inner.xyz;
+        light.cosInnerCutoff = atten_inner.w;
+        light.cosOuterCutoff = ambient_outer.w;
+        light.props.ambient = ambient_outer.rgb;
+        light.props.diffuse = texelFetch(clusterLights, base + 4).rgb;
+        light.props.specular = texelFetch(clusterLights, base + 5).rgb;
+        return light;
+    }
 
-    for (int i = 0; i < LIGHTS_MAX_AMOUNT; ++i)
+    int cluster_index(vec3 fragPos)
     {
-        //NOTE this might seem strange, but checking the bounds inside the for loop condition does not work with glsl version 100!
-        if (i >= lightsCount) break;
+        // must match the cluster layout of ClusteredLighting
+        vec4 clip = clusterViewProj * vec4(fragPos, 1.0);
+        vec2 tile = clamp(floor((clip.xy / clip.w * 0.5 + 0.5) * clusterGridSize.xy), vec2(0.0), clusterGridSize.xy - 1.0);
+        float slice = clamp(floor(log(clip.w) * clusterDepthParams.x + clusterDepthParams.y), 0.0, clusterGridSize.z - 1.0);
+        return int(tile.x + clusterGridSize.x * (tile.y + clusterGridSize.y * slice));
+    }
+#endif
 
-        vec3 phong_light_coefs = vec3(0.0);
-        if (lights[i].type == 0) // lights[i] is a directional light
+vec3 shade_lights(vec3 fragPos, vec3 norm, vec3 cameraDir, Surface surface)
+{
+    vec3 color = vec3(0.0);
+
+    #ifdef CLUSTERED_LIGHTING
+        for (int i = 0; i < globalLightsCount; ++i)
         {
-            phong_light_coefs = calc_dir_light(norm, cameraDir, lights[i].dir);
+            color += shade_light(fetch_light(i), fragPos, norm, cameraDir, surface);
         }
-        else if (lights[i].type == 1) // lights[i] is a point light
+
+        uvec2 cluster = texelFetch(clusterGrid, cluster_index(fragPos)).xy; // offset, length
+        for (uint i = 0u; i < cluster.y; ++i)
         {
-            phong_light_coefs = calc_point_light(norm, cameraDir, lights[i].pos, lights[i].atten_coefs);
+            int light_idx = int(texelFetch(clusterLightIndices, int(cluster.x + i)).r);
+            color += shade_light(fetch_light(light_idx), fragPos, norm, cameraDir, surface);
         }
-        else if (lights[i].type == 2) // lights[i] is a spot light
+    #else
+        for (int i = 0; i < LIGHTS_MAX_AMOUNT; ++i)
         {
-            phong_light_coefs = calc_spot_light(norm, cameraDir, lights[i].dir, lights[i].pos,
-                                                lights[i].cosInnerCutoff, lights[i].cosOuterCutoff, lights[i].atten_coefs);
+            //NOTE this might seem strange, but checking the bounds inside the for loop condition does not work with glsl version 100!
+            if (i >= lightsCount) break;
+
+            color += shade_light(lights[i], fragPos, norm, cameraDir, surface);
         }
+    #endif
+
+    return color;
+}
 
-        color += phong_light_coefs.x * lights[i].props.ambient * material.ambient * diffuse_sample.rgb; // ambient
-        color += phong_light_coefs.y * lights[i].props.diffuse * material.diffuse * diffuse_sample.rgb; // diffuse
-        color += phong_light_coefs.z * lights[i].props.specular * material.specular * specular_sample;  // specular
+#if defined(GBUFFER_PASS) || defined(DEFERRED_LIGHTING)
+    // octahedral normal encoding, two components are enough for a unit vector
+    vec2 encode_normal(vec3 n)
+    {
+        n /= abs(n.x) + abs(n.y) + abs(n.z);
+        vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        return n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * signs;
+    }
+
+    vec3 decode_normal(vec2 e)
+    {
+        vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+        float t = clamp(-n.z, 0.0, 1.0);
+        n.xy -= vec2(n.x >= 0.0 ? t : -t, n.y >= 0.0 ? t : -t);
+        return normalize(n);
     }
+#endif
 
-    //result
-    vec3 mapped = tone_mapping(color);
-    vec4 result = vec4(mapped, diffuse_sample.a);
-    OUTPUT_COLOR_GAMMA_CORRECTED(result);
+vec3 tone_mapping(vec3 c)
+{
+    // optional reinhard tone mapping
+    return use_reinhard ? c / (c + vec3(1.0)) : c;
 }
+
+#if defined(GBUFFER_PASS)
+    void main()
+    {
+        vec4 diffuse_sample = TEXTURE2DGAMMA(material.diffuseMap, TexCoord);
+        if (diffuse_sample.a < ALPHA_MIN_THRESHOLD) discard;
+
+        vec3 specular_sample = TEXTURE2D(material.specularMap, TexCoord).rgb;
+
+        // ambient color is stored relative to the diffuse one, exact for materials with proportional ambient and
+        // diffuse colors (all materials in the game, ambient usually equals diffuse)
+        float ambient_scale = dot(material.ambient, vec3(1.0)) / max(dot(material.diffuse, vec3(1.0)), 0.0001);
+
+        OUTPUT_COLOR(vec4(material.diffuse * diffuse_sample.rgb, 1.0));
+        GBufferSpecular = vec4(material.specular * specular_sample, 1.0);
+        GBufferNormal = vec4(encode_normal(normalize(Normal)), ambient_scale, material.shininess);
+    }
+#elif defined(DEFERRED_LIGHTING)
+    void main()
+    {
+        ivec2 texel = ivec2(gl_FragCoord.xy);
+        float depth = texelFetch(gbufferDepth, texel, 0).r;
+        if (depth >= 1.0) discard; // nothing got drawn here, background stays
+
+        vec4 normal_sample = texelFetch(gbufferNormal, texel, 0);
+        Surface surface;
+        surface.diffuse = texelFetch(gbufferDiffuse, texel, 0).rgb;
+        surface.ambient = surface.diffuse * normal_sample.z;
+        surface.specular = texelFetch(gbufferSpecular, texel, 0).rgb;
+        surface.shininess = normal_sample.w;
+
+        // world position reconstructed from the depth
+        vec4 ndc = vec4(gl_FragCoord.xy / viewportSize * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+        vec4 world_pos = invViewProj * ndc;
+        vec3 fragPos = world_pos.xyz / world_pos.w;
+
+        vec3 norm = decode_normal(normal_sample.xy);
+        vec3 cameraDir = normalize(cameraPos - fragPos);
+
+        vec3 color = shade_lights(fragPos, norm, cameraDir, surface);
+
+        // forward drawn objects that come later test against the scene depth
+        gl_FragDepth = depth;
+
+        //result
+        vec3 mapped = tone_mapping(color);
+        OUTPUT_COLOR_GAMMA_CORRECTED(vec4(mapped, 1.0));
+    }
+#else
+    void main()
+    {
+        vec4 diffuse_sample = TEXTURE2DGAMMA(material.diffuseMap, TexCoord);
+        // discard the fragments with too small alpha values
+        //TODO aplha blending
+        if (diffuse_sample.a < ALPHA_MIN_THRESHOLD) discard;
+
+        vec3 specular_sample = TEXTURE2D(material.specularMap, TexCoord).rgb;
+        vec3 norm = normalize(Normal);
+        vec3 cameraDir = normalize(cameraPos - FragPos);
+
+        Surface surface = Surface(material.ambient * diffuse_sample.rgb, material.diffuse * diffuse_sample.rgb,
+                                  material.specular * specular_sample, material.shininess);
+
+        //light
+        vec3 color = shade_lights(FragPos, norm, cameraDir, surface);
+
+        //result
+        vec3 mapped = tone_mapping(color);
+        vec4 result = vec4(mapped, diffuse_sample.a);
+        OUTPUT_COLOR_GAMMA_CORRECTED(result);
+    }
+#endif
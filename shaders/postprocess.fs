@@ -0,0 +1,20 @@
+#ifdef GL_ES
+    #ifdef GL_FRAGMENT_PRECISION_HIGH
+        precision highp float;
+    #else
+        precision mediump float;
+    #endif
+#endif
+
+uniform sampler2D inputTexture;
+uniform vec2 rectSize; // size of the whole input texture (postprocess.fspart SETUP)
+
+// POSTPROCESS is generated by PostProcessChain, one pass of fused effects
+
+void main()
+{
+    SETUP();
+
+    // drawn 1:1 over the same region of the input, so the fragment center is the texel center
+    OUTPUT_COLOR(POSTPROCESS(inputTexture, gl_FragCoord.xy / rectSize));
+}
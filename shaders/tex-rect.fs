@@ -6,12 +6,12 @@
     #endif
 #endif
 
-// IN_ATTR vec4 gl_FragCoord;
+IN_ATTR vec2 TexCoord;
+IN_ATTR vec2 TexCoordMax; // bilinear filtering must not reach outside of the sampled region
+IN_ATTR vec4 Color;
 
 uniform sampler2D inputTexture;
-uniform vec2 screenRes;
-uniform vec2 rectPosIn;
-uniform vec2 rectSize;
+uniform vec2 rectSize; // used only by postprocessing (postprocess.fspart SETUP)
 
 #ifndef SETUP
     #define SETUP()
@@ -25,14 +25,5 @@ void main()
 {
     SETUP();
 
-    vec2 fragScreenPos = vec2(gl_FragCoord.x, screenRes.y - gl_FragCoord.y);
-    vec2 texcoords = (fragScreenPos - rectPosIn) / rectSize;
-
-    //TODO use scissor test and remove this
-    if (texcoords.x < 0.0 || texcoords.x >= 1.0 ||
-        texcoords.y < 0.0 || texcoords.y >= 1.0) discard;
-    
-    vec2 texcoords_inverted = vec2(texcoords.x, 1.0 - texcoords.y);
-
-    OUTPUT_COLOR(POSTPROCESS(inputTexture, texcoords_inverted));
+    OUTPUT_COLOR(Color * POSTPROCESS(inputTexture, min(TexCoord, TexCoordMax)));
 }
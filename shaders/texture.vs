@@ -8,14 +8,16 @@ OUT_ATTR vec3 Normal;
 
 uniform mat4 model;
 uniform mat3 normalMat;
-uniform mat4 view;
-uniform mat4 projection;
+uniform mat4 mvp;           // projection * view * model, precomputed on the CPU
+
+// has to match the depth pre-pass (default.vs) bit for bit
+invariant gl_Position;
 
 void main()
 {
     vec4 pos = vec4(aPos, 1.0);
 
-    gl_Position = projection * view * model * pos;
+    gl_Position = mvp * pos;
     FragPos = vec3(model * pos);
 
     TexCoord = aTexCoord;
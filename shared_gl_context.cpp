@@ -1,19 +1,20 @@
 #include "game.hpp"
 
+#include <algorithm>
+
 
 std::optional<SharedGLContext> SharedGLContext::instance{};
 
 SharedGLContext::SharedGLContext(unsigned int init_width, unsigned int init_height, unsigned int fbo3d_samples, const RenderSettings render_settings)
                     : unit_quad_pos_only(), white_pixel_tex(Color3{ 255, 255, 255 }),
                       fbo3d_conv_tex(init_width, init_height, GL_RGB),
-                      fbo3d_rbo_color(empty_id),
-                      #ifdef USE_COMBINED_FBO_BUFFERS
-                        fbo3d_rbo_depth_stencil(empty_id),
-                      #else
-                        fbo3d_rbo_depth(empty_id),
-                        fbo3d_rbo_stencil(empty_id),
+                      fbo3d_samples(fbo3d_samples), fbo3d_render_scale(1.f), fbo3d_freeze_count(0),
+                      fbo3d_frozen_region(1.f), fbo3d_pending_size(),
+                      scene_graph(), scene_pass(RenderGraph::none), scene_graph_fbo3d(false), scene_graph_deferred(false),
+                      postprocess_graph(), postprocess_passes(), postprocess_inputs(),
+                      #ifdef USE_DEFERRED_SHADING
+                        gbuffer_targets{}, gbuffer_pass(RenderGraph::none),
                       #endif
-                      fbo3d_unconv(), fbo3d_conv(), fbo3d_samples(fbo3d_samples), fbo3d_unconv_size(init_width, init_height),
                       render_settings(render_settings), render_settings_default(render_settings)
 {
     //checking the constructors
@@ -40,167 +41,232 @@ SharedGLContext::SharedGLContext(unsigned int init_width, unsigned int init_heig
         return;
     }
 
-    //renderbuffers
-    //TODO render buffer object abstraction
-    {
-        assert(!Utils::checkForGLError());
-        
-        #ifdef USE_COMBINED_FBO_BUFFERS
-            GLuint rbos[2]{};
-        #else
-            GLuint rbos[3]{};
-        #endif
-        const size_t rbos_count = sizeof(rbos)/sizeof(rbos[0]);
-
-        glGenRenderbuffers(rbos_count, rbos);
-        if (Utils::checkForGLError())
-        {
-            fprintf(stderr, "Failed to create RenderBuffers(%zu) for 3D FrameBuffer!\n", rbos_count);
-            return;
-        }
+    //scene render graph, the G-buffer gets allocated only once deferred shading is used
+    // (postprocessing builds its graph on the first use, its targets are mostly aliased with the scene ones)
+    RenderGraph::setTargetSize(glm::ivec2(init_width, init_height));
 
-        #ifdef USE_COMBINED_FBO_BUFFERS
-            fbo3d_rbo_color = rbos[0];
-            fbo3d_rbo_depth_stencil = rbos[1];
-        #else
-            fbo3d_rbo_color = rbos[0];
-            fbo3d_rbo_depth = rbos[1];
-            fbo3d_rbo_stencil = rbos[2];
-        #endif
+    if (!buildSceneGraph(render_settings.use_fbo3d, false))
+    {
+        fprintf(stderr, "Failed to build render graph for 3D scene!\n");
+        return;
     }
 
-    bool fbo3d_multisampled = (fbo3d_samples > 1);
+    assert(!Utils::checkForGLErrorsAndPrintThem()); //DEBUG
+}
+
+bool SharedGLContext::buildSceneGraph(bool use_fbo3d, bool deferred)
+{
+    using TargetDesc = RenderGraph::TargetDesc;
+
+    scene_graph.clear();
+    scene_graph_fbo3d = use_fbo3d;
+    scene_graph_deferred = deferred;
 
-    //color renderbuffer with alpha
-    glBindRenderbuffer(GL_RENDERBUFFER, fbo3d_rbo_color);
-    if (fbo3d_multisampled)
+    RenderGraph::TargetId color = RenderGraph::none, depth = RenderGraph::none;
+    if (use_fbo3d)
     {
-        glRenderbufferStorageMultisample(GL_RENDERBUFFER, fbo3d_samples, fbo3d_rbo_color_internalformat, fbo3d_unconv_size.x, fbo3d_unconv_size.y);
+        color = scene_graph.addTarget("fbo3d color", TargetDesc{ fbo3d_rbo_color_internalformat, fbo3d_samples });
+        depth = scene_graph.addTarget("fbo3d depth", TargetDesc{ fbo3d_rbo_depth_internalformat, fbo3d_samples });
     }
     else
     {
-        glRenderbufferStorage(GL_RENDERBUFFER, fbo3d_rbo_color_internalformat, fbo3d_unconv_size.x, fbo3d_unconv_size.y);
+        color = scene_graph.importBackbuffer();
     }
+    const RenderGraph::TargetId conv = scene_graph.importTexture("fbo3d conv", fbo3d_conv_tex);
 
-    #ifdef USE_COMBINED_FBO_BUFFERS
-        //depth-stencil combined renderbuffer allocation
-        glBindRenderbuffer(GL_RENDERBUFFER, fbo3d_rbo_depth_stencil);
-        if (fbo3d_multisampled)
+    #ifdef USE_DEFERRED_SHADING
+        if (deferred)
         {
-            glRenderbufferStorageMultisample(GL_RENDERBUFFER, fbo3d_samples, GL_DEPTH_STENCIL, fbo3d_unconv_size.x, fbo3d_unconv_size.y);
+            static const char *gbuffer_names[gbuffer_target_amount] = { "G-buffer diffuse", "G-buffer specular",
+                                                                        "G-buffer normal", "G-buffer depth" };
+            for (unsigned int i = 0; i < gbuffer_target_amount; ++i)
+            {
+                gbuffer_targets[i] = scene_graph.addTarget(gbuffer_names[i], TargetDesc{ gbuffer_internalformats[i], 1 });
+            }
+
+            gbuffer_pass = scene_graph.addPass("G-buffer pass", { gbuffer_targets[gbuffer_diffuse],
+                                                                  gbuffer_targets[gbuffer_specular],
+                                                                  gbuffer_targets[gbuffer_normal] },
+                                               gbuffer_targets[gbuffer_depth]);
+            scene_pass = scene_graph.addPass("scene pass", { color }, depth,
+                                             { gbuffer_targets[gbuffer_diffuse], gbuffer_targets[gbuffer_specular],
+                                               gbuffer_targets[gbuffer_normal], gbuffer_targets[gbuffer_depth] });
         }
         else
-        {
-            //TODO GL_DEPTH_STENCIL or GL_DEPTH24_STENCIL8?
-            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_STENCIL, fbo3d_unconv_size.x, fbo3d_unconv_size.y);
-        }
     #else
-        //depth renderbuffer allocation
-        glBindRenderbuffer(GL_RENDERBUFFER, fbo3d_rbo_depth);
-        if (fbo3d_multisampled)
-        {
-            glRenderbufferStorageMultisample(GL_RENDERBUFFER, fbo3d_samples, GL_DEPTH_COMPONENT16, fbo3d_unconv_size.x, fbo3d_unconv_size.y);
-        }
-        else
+        assert(!deferred);
+    #endif
         {
-            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, fbo3d_unconv_size.x, fbo3d_unconv_size.y);
+            scene_pass = scene_graph.addPass("scene pass", { color }, depth);
         }
 
-        //stencil renderbuffer allocation
-        glBindRenderbuffer(GL_RENDERBUFFER, fbo3d_rbo_stencil);
-        if (fbo3d_multisampled)
-        {
-            glRenderbufferStorageMultisample(GL_RENDERBUFFER, fbo3d_samples, GL_STENCIL_INDEX8, fbo3d_unconv_size.x, fbo3d_unconv_size.y);
-        }
-        else
-        {
-            glRenderbufferStorage(GL_RENDERBUFFER, GL_STENCIL_INDEX8, fbo3d_unconv_size.x, fbo3d_unconv_size.y);
-        }
-    #endif
+    scene_graph.addResolve(fbo3d_samples > 1 && use_fbo3d ? "MSAA resolve" : "fbo3d conversion", color, conv);
 
-    glBindRenderbuffer(GL_RENDERBUFFER, empty_id);
+    return scene_graph.compile();
+}
 
-    //framebuffer 3D
-    using FrameBuffer = Drawing::FrameBuffer;
+bool SharedGLContext::buildPostprocessGraph(unsigned int pass_amount)
+{
+    using TargetDesc = RenderGraph::TargetDesc;
+    assert(pass_amount > 0);
 
-    fbo3d_unconv.init();
-    if (fbo3d_unconv.m_id == empty_id)
-    {
-        fprintf(stderr, "Failed to initialize FrameBuffer for 3D scene!\n");
-        return;
-    }
+    postprocess_graph.clear();
+    postprocess_passes.clear();
+    postprocess_inputs.clear();
 
-    #ifdef USE_COMBINED_FBO_BUFFERS
-        fbo3d_unconv.attachAllCombined(FrameBuffer::Attachment{ fbo3d_rbo_color, FrameBuffer::AttachmentType::render },
-                                       FrameBuffer::Attachment{ fbo3d_rbo_depth_stencil, FrameBuffer::AttachmentType::render });
-    #else
-        fbo3d_unconv.attachAllSeparated(FrameBuffer::Attachment{ fbo3d_rbo_color, FrameBuffer::AttachmentType::render },
-                                        FrameBuffer::Attachment{ fbo3d_rbo_depth, FrameBuffer::AttachmentType::render },
-                                        // FrameBuffer::Attachment{ fbo3d_rbo_stencil, FrameBuffer::AttachmentType::render }
-                                        FrameBuffer::Attachment{ 0, FrameBuffer::AttachmentType::none } //TODO fix stencil buffer not working on nvidia
-                                       );
-    #endif
-    
-    if (!fbo3d_unconv.isComplete())
+    const RenderGraph::TargetId conv = postprocess_graph.importTexture("fbo3d conv", fbo3d_conv_tex);
+
+    // the last target has the description of the scene color, the two never hold anything at the same time
+    RenderGraph::TargetId input = conv;
+    for (unsigned int i = 0; i < pass_amount; ++i)
     {
-        fprintf(stderr, "FrameBuffer for 3D scene is not complete!\n");
-        fbo3d_unconv.deinit();
-        return;
+        const bool last = i + 1 == pass_amount;
+        const RenderGraph::TargetId output = last ? postprocess_graph.addTarget("postprocess color",
+                                                                                TargetDesc{ fbo3d_rbo_color_internalformat,
+                                                                                            fbo3d_samples })
+                                                  : postprocess_graph.addTarget("postprocess intermediate",
+                                                                                TargetDesc{ fbo3d_rbo_color_internalformat, 1 });
+
+        postprocess_passes.push_back(postprocess_graph.addPass("postprocess pass", { output }, RenderGraph::none, { input }));
+        postprocess_inputs.push_back(input);
+        input = output;
     }
+    postprocess_graph.addResolve("postprocess resolve", input, conv);
 
-    //framebuffer 3D converted
-    fbo3d_conv.init();
-    if (fbo3d_conv.m_id == empty_id)
+    if (!postprocess_graph.compile())
     {
-        fprintf(stderr, "Failed to initialize FrameBuffer for 3D scene conversion!\n");
-        fbo3d_unconv.deinit();
-        return;
+        postprocess_passes.clear();
+        postprocess_inputs.clear();
+        return false;
     }
 
-    fbo3d_conv.attachColorBuffer(fbo3d_conv_tex.asFrameBufferAttachment());
+    return true;
+}
 
-    if (!fbo3d_conv.isComplete())
-    {
-        fprintf(stderr, "FrameBuffer for 3D scene conversion is not complete!\n");
-        fbo3d_unconv.deinit();
-        fbo3d_conv.deinit();
-        return;
-    }
+bool SharedGLContext::isInitialized() const
+{
+    return unit_quad_pos_only.m_id != empty_id &&
+           white_pixel_tex.m_id != empty_id &&
+           scene_graph.isCompiled() &&
+           fbo3d_samples >= 1;
+}
 
-    glBindFramebuffer(GL_FRAMEBUFFER, empty_id);
+glm::ivec2 SharedGLContext::getFbo3DSize() const
+{
+    return glm::ivec2(fbo3d_conv_tex.m_width, fbo3d_conv_tex.m_height);
+}
 
-    assert(!Utils::checkForGLErrorsAndPrintThem()); //DEBUG
+void SharedGLContext::setFbo3DRenderScale(float scale)
+{
+    fbo3d_render_scale = std::max(DynamicResolution::min_scale, std::min(1.f, scale));
 }
 
-SharedGLContext::~SharedGLContext()
+float SharedGLContext::getFbo3DRenderScale() const
 {
-    glDeleteBuffers(1, &fbo3d_rbo_color);
-    #ifdef USE_COMBINED_FBO_BUFFERS
-        glDeleteBuffers(1, &fbo3d_rbo_depth_stencil);
-    #else
-        glDeleteBuffers(1, &fbo3d_rbo_depth);
-        glDeleteBuffers(1, &fbo3d_rbo_stencil);
-    #endif
+    return fbo3d_render_scale;
 }
 
-bool SharedGLContext::isInitialized() const
+glm::ivec2 SharedGLContext::getFbo3DRenderSize() const
 {
-    return unit_quad_pos_only.m_id != empty_id &&
-           white_pixel_tex.m_id != empty_id &&
-           fbo3d_unconv.m_id != empty_id &&
-           fbo3d_conv.m_id != empty_id &&
-           fbo3d_samples >= 1;
+    const glm::ivec2 size = getFbo3DSize();
+    if (!render_settings.use_fbo3d) return size;
+
+    return glm::max(glm::ivec2(glm::round(glm::vec2(size) * fbo3d_render_scale)), glm::ivec2(1));
 }
 
-glm::ivec2 SharedGLContext::getFbo3DSize(bool converted) const
+glm::vec2 SharedGLContext::getFbo3DTextureRegion() const
 {
-    return converted ? glm::ivec2(fbo3d_conv_tex.m_width, fbo3d_conv_tex.m_height)
-                     : fbo3d_unconv_size;
+    if (isFbo3DFrozen()) return fbo3d_frozen_region;
+
+    return glm::vec2(getFbo3DRenderSize()) / glm::vec2(getFbo3DSize());
+}
+
+void SharedGLContext::freezeFbo3D()
+{
+    // region has to be taken before the freeze, as it is reported from then on
+    if (fbo3d_freeze_count == 0) fbo3d_frozen_region = getFbo3DTextureRegion();
+    ++fbo3d_freeze_count;
+}
+
+void SharedGLContext::unfreezeFbo3D()
+{
+    assert(fbo3d_freeze_count > 0); // unpaired unfreeze
+    if (--fbo3d_freeze_count > 0) return;
+
+    if (fbo3d_pending_size.has_value())
+    {
+        const glm::ivec2 pending_size = fbo3d_pending_size.value();
+        fbo3d_pending_size.reset();
+        changeFbo3DSize(pending_size.x, pending_size.y);
+    }
+}
+
+bool SharedGLContext::isFbo3DFrozen() const
+{
+    return fbo3d_freeze_count > 0;
+}
+
+bool SharedGLContext::postprocessFrozenFbo3D(const PostProcessChain& chain)
+{
+    assert(isFbo3DFrozen());
+    if (!chain.isCompiled()) return false;
+
+    const unsigned int pass_amount = chain.passAmount();
+    if (pass_amount == 0) return true;
+
+    if (postprocess_passes.size() != pass_amount && !buildPostprocessGraph(pass_amount))
+    {
+        fprintf(stderr, "Failed to build render graph for 3D scene postprocessing!\n");
+        return false;
+    }
+
+    const glm::ivec2 conv_size = getFbo3DSize();
+    const glm::ivec2 frozen_size = glm::ivec2(glm::round(fbo3d_frozen_region * glm::vec2(conv_size)));
+
+    Batch2D::flush(); // pending quads belong to whatever framebuffer was bound before
+    postprocess_graph.beginFrame(frozen_size);
+
+    glDepthMask(GL_FALSE);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_STENCIL_TEST);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_BLEND);
+
+    for (unsigned int i = 0; i < pass_amount; ++i)
+    {
+        // frozen region of the input is mapped 1:1 onto the same region of the target, all targets have the conv size
+        postprocess_graph.beginPass(postprocess_passes[i]);
+        glViewport(0, 0, frozen_size.x, frozen_size.y);
+
+        const Shaders::Program& program = chain.passProgram(i);
+        program.use();
+        program.set("rectSize", glm::vec2(conv_size));
+        program.set("inputTexture", 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, i == 0 ? fbo3d_conv_tex.m_id : postprocess_graph.getTexture(postprocess_inputs[i]));
+
+        unit_quad_pos_only.bind();
+            glDrawArrays(GL_TRIANGLES, 0, unit_quad_pos_only.vertexCount());
+        unit_quad_pos_only.unbind();
+    }
+
+    postprocess_graph.finish();
+
+    return !Utils::checkForGLErrorsAndPrintThem();
 }
 
 void SharedGLContext::changeFbo3DSize(unsigned int new_width, unsigned int new_height)
 {
-    const glm::ivec2 current_size = getFbo3DSize(true);
+    if (isFbo3DFrozen())
+    {
+        // reallocation would throw away the frozen frame
+        fbo3d_pending_size = glm::ivec2(new_width, new_height);
+        printf("Change of FBO 3D size to %dx%d postponed, FBO 3D is frozen\n", new_width, new_height);
+        return;
+    }
+
+    const glm::ivec2 current_size = getFbo3DSize();
 
     if (new_width == current_size.x && new_height == current_size.y)
     {
@@ -213,139 +279,127 @@ void SharedGLContext::changeFbo3DSize(unsigned int new_width, unsigned int new_h
     //TODO implement check for out of memory and other OpenGL errors
     assert(!Utils::checkForGLError());
 
-    // resize the fbo renderbuffers
-    fbo3d_unconv_size = glm::ivec2(new_width, new_height);
-
-    bool fbo3d_multisampled = (fbo3d_samples > 1);
+    // resize the fbo converted texture
+    fbo3d_conv_tex.changeTexture(new_width, new_height, GL_RGB);
+    assert(!Utils::checkForGLErrorsAndPrintThem());
 
-    glBindRenderbuffer(GL_RENDERBUFFER, fbo3d_rbo_color);
-    if (fbo3d_multisampled)
-    {
-        glRenderbufferStorageMultisample(GL_RENDERBUFFER, fbo3d_samples, fbo3d_rbo_color_internalformat, fbo3d_unconv_size.x, fbo3d_unconv_size.y);
-    }
-    else
-    {
-        glRenderbufferStorage(GL_RENDERBUFFER, fbo3d_rbo_color_internalformat, fbo3d_unconv_size.x, fbo3d_unconv_size.y);
-    }
+    // targets of all render graphs follow, their framebuffers stay as they are
+    RenderGraph::setTargetSize(glm::ivec2(new_width, new_height));
     assert(!Utils::checkForGLErrorsAndPrintThem());
+}
 
-    #ifdef USE_COMBINED_FBO_BUFFERS
-        //combined resize
-        glBindRenderbuffer(GL_RENDERBUFFER, fbo3d_rbo_depth_stencil);
-        if (fbo3d_multisampled)
-        {
-            glRenderbufferStorageMultisample(GL_RENDERBUFFER, fbo3d_samples, GL_DEPTH_STENCIL, fbo3d_unconv_size.x, fbo3d_unconv_size.y);
-        }
-        else
-        {
-            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_STENCIL, fbo3d_unconv_size.x, fbo3d_unconv_size.y);
-        }
-        assert(!Utils::checkForGLErrorsAndPrintThem());
+void SharedGLContext::beginScene()
+{
+    #ifdef USE_DEFERRED_SHADING
+        const bool deferred = render_settings.use_deferred_shading;
     #else
-        //depth resize
-        glBindRenderbuffer(GL_RENDERBUFFER, fbo3d_rbo_depth);
-        if (fbo3d_multisampled)
-        {
-            glRenderbufferStorageMultisample(GL_RENDERBUFFER, fbo3d_samples, GL_DEPTH_COMPONENT16, fbo3d_unconv_size.x, fbo3d_unconv_size.y);
-        }
-        else
-        {
-            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, fbo3d_unconv_size.x, fbo3d_unconv_size.y);
-        }
-        assert(!Utils::checkForGLErrorsAndPrintThem());
+        const bool deferred = false;
+    #endif
 
-        //stencil resize
-        glBindRenderbuffer(GL_RENDERBUFFER, fbo3d_rbo_stencil);
-        if (fbo3d_multisampled)
+    if (!scene_graph.isCompiled() || scene_graph_fbo3d != render_settings.use_fbo3d || scene_graph_deferred != deferred)
+    {
+        bool built = buildSceneGraph(render_settings.use_fbo3d, deferred);
+        if (!built && deferred)
         {
-            glRenderbufferStorageMultisample(GL_RENDERBUFFER, fbo3d_samples, GL_STENCIL_INDEX8, fbo3d_unconv_size.x, fbo3d_unconv_size.y);
+            fprintf(stderr, "[WARNING] G-buffer is not available, falling back to forward shading!\n");
+            render_settings.use_deferred_shading = false;
+            built = buildSceneGraph(render_settings.use_fbo3d, false);
         }
-        else
+        if (!built && render_settings.use_fbo3d)
         {
-            glRenderbufferStorage(GL_RENDERBUFFER, GL_STENCIL_INDEX8, fbo3d_unconv_size.x, fbo3d_unconv_size.y);
+            fprintf(stderr, "[WARNING] FBO 3D is not available, falling back to the OS framebuffer!\n");
+            render_settings.use_fbo3d = false;
+            built = buildSceneGraph(false, false);
         }
-        assert(!Utils::checkForGLErrorsAndPrintThem());
-    #endif
-
-    // resize the fbo converted texture
-    fbo3d_conv_tex.changeTexture(new_width, new_height, GL_RGB);
-    assert(!Utils::checkForGLErrorsAndPrintThem());
+        assert(built); // the OS framebuffer needs nothing but framebuffer objects
+    }
 
-    glBindRenderbuffer(GL_RENDERBUFFER, empty_id);
+    scene_graph.beginFrame(getFbo3DRenderSize());
+}
 
-    assert(fbo3d_unconv.isComplete());
-    assert(fbo3d_conv.isComplete());
+void SharedGLContext::beginScenePass()
+{
+    scene_graph.beginPass(scene_pass);
 }
 
-bool SharedGLContext::convertFbo3D() const
+bool SharedGLContext::stageFbo3D()
 {
-    if (!fbo3d_unconv.isComplete() || !fbo3d_conv.isComplete()) return false;
+    if (!scene_graph.isCompiled()) return false;
 
-    const glm::ivec2 fbo_src_size = getFbo3DSize(false);
-    bool fbo3d_multisampled = (fbo3d_samples > 1);
+    // frame borrowed by someone stays, e.g. the game still finishes the frame it got paused in
+    if (isFbo3DFrozen()) scene_graph.cancel();
+    else scene_graph.finish();
 
-    if (!fbo3d_multisampled)
-    {
-        fbo3d_unconv.bind();
-        fbo3d_conv_tex.bind();
+    return true;
+}
 
-        glCopyTexImage2D(fbo3d_conv_tex.getBindType(), 0, GL_RGB, 0, 0, fbo_src_size.x, fbo_src_size.y, 0);
+const Textures::Texture2D& SharedGLContext::getFbo3DTexture() const
+{
+    return fbo3d_conv_tex;
+}
 
-        fbo3d_unconv.unbind();
-    }
-    #ifdef BUILD_OPENGL_330_CORE
-    else
+void SharedGLContext::ResizeFbo3DCommand::execute(const ResizeFbo3DCommand& command)
+{
+    if (SharedGLContext::instance.has_value())
     {
-        const glm::ivec2 fbo_dst_size = getFbo3DSize(true);
-
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo3d_unconv.m_id);
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo3d_conv.m_id);
+        SharedGLContext::instance.value().changeFbo3DSize(command.width, command.height);
+    }
+}
 
-        glBlitFramebuffer(0, 0, fbo_src_size.x, fbo_src_size.y, 0, 0, fbo_dst_size.x, fbo_dst_size.y, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+void SharedGLContext::SwapIntervalCommand::execute(const SwapIntervalCommand& command)
+{
+    glfwSwapInterval(command.interval);
+}
 
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, empty_id);
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, empty_id);
-    }
-    #else
-    else
+void SharedGLContext::StageFbo3DCommand::execute(const StageFbo3DCommand&)
+{
+    PROFILE_SCOPE("stageFbo3D");
+    GPU_PROFILE_SCOPE("stageFbo3D");
+    const bool staged = SharedGLContext::instance.value().stageFbo3D();
+    if (!staged)
     {
-        return false;
+        fprintf(stderr, "[WARNING] Failed to stage Framebuffer for 3D scene!\n");
     }
-    #endif
 
-    return true;
+    assert(!Utils::checkForGLErrorsAndPrintThem()); //DEBUG
 }
 
-void SharedGLContext::saveToFbo3DFromExternal(GLuint external_fbo_id)
+#ifdef USE_DEFERRED_SHADING
+void SharedGLContext::beginGBufferPass()
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, external_fbo_id);
-    fbo3d_conv_tex.bind();
-
-    const glm::ivec2 src_size = getFbo3DSize(false);
-    glCopyTexImage2D(fbo3d_conv_tex.getBindType(), 0, GL_RGB, 0, 0, src_size.x, src_size.y, 0);
+    assert(scene_graph_deferred);
+    scene_graph.beginPass(gbuffer_pass);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, empty_id);
+    // color targets are read only where some geometry got drawn, clearing the depth is enough
+    glDepthMask(GL_TRUE);
+    glClear(GL_DEPTH_BUFFER_BIT);
 }
 
-bool SharedGLContext::stageFbo3D(std::optional<GLuint> external_fbo_id_used)
+void SharedGLContext::drawDeferredLighting(const Shaders::Program& shader, glm::ivec2 viewport_size) const
 {
-    if (external_fbo_id_used.has_value()) // scene got rendered into external Framebuffer, save it into shared one
-    {
-        saveToFbo3DFromExternal(external_fbo_id_used.value());
-        return true; // can't fail
-    }
-    else
+    assert(scene_graph_deferred);
+
+    static const char *sampler_names[gbuffer_target_amount] = { "gbufferDiffuse", "gbufferSpecular", "gbufferNormal",
+                                                                "gbufferDepth" };
+    for (unsigned int i = 0; i < gbuffer_target_amount; ++i)
     {
-        return convertFbo3D();
+        glActiveTexture(GL_TEXTURE0 + gbuffer_texture_unit_first + i);
+        glBindTexture(GL_TEXTURE_2D, scene_graph.getTexture(gbuffer_targets[i]));
+        shader.set(sampler_names[i], static_cast<GLint>(gbuffer_texture_unit_first + i));
     }
-}
+    glActiveTexture(GL_TEXTURE0);
+    shader.set("viewportSize", glm::vec2(viewport_size));
 
-const Textures::Texture2D& SharedGLContext::getFbo3DTexture() const
-{
-    return fbo3d_conv_tex;
-}
+    // depth of every shaded pixel overwrites whatever was in the bound framebuffer before
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_ALWAYS);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_CULL_FACE);
 
-const Drawing::FrameBuffer& SharedGLContext::getFbo3D(bool converted) const
-{
-    return converted ? fbo3d_conv : fbo3d_unconv;
+    unit_quad_pos_only.bind();
+        glDrawArrays(GL_TRIANGLES, 0, unit_quad_pos_only.vertexCount());
+    unit_quad_pos_only.unbind();
+
+    glDepthFunc(GL_LESS);
 }
+#endif /* USE_DEFERRED_SHADING */
@@ -28,6 +28,8 @@ Textures::Texture2D::Texture2D(unsigned int width, unsigned int height, GLenum c
     {
         glTexImage2D(bind_type, 0, component_type, m_width, m_height, 0, component_type, GL_UNSIGNED_BYTE, NULL);
     }
+    Profiling::GpuMemory::track(Profiling::GpuMemory::Category::texture2d, m_id,
+                                Profiling::GpuMemory::estimateBytes(component_type, m_width, m_height, m_samples));
 
     // set the default filtering, but only for single-sampled textures
     if (bind_type == GL_TEXTURE_2D)
@@ -90,6 +92,8 @@ Textures::Texture2D::Texture2D(const char *image_path, bool generate_mipmaps)
 
     // upload the image data into the texture on gpu
     glTexImage2D(bind_type, 0, GL_RGBA, m_width, m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+    Profiling::GpuMemory::track(Profiling::GpuMemory::Category::texture2d, m_id,
+                                Profiling::GpuMemory::estimateBytes(GL_RGBA, m_width, m_height, 1, generate_mipmaps));
 
     if (generate_mipmaps)
     {
@@ -130,6 +134,8 @@ Textures::Texture2D::Texture2D(const void *img_data, unsigned int width, unsigne
 
     // upload the image data into the texture on gpu
     glTexImage2D(bind_type, 0, GL_RGBA, m_width, m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, img_data);
+    Profiling::GpuMemory::track(Profiling::GpuMemory::Category::texture2d, m_id,
+                                Profiling::GpuMemory::estimateBytes(GL_RGBA, m_width, m_height, 1, generate_mipmaps));
 
     if (generate_mipmaps)
     {
@@ -160,6 +166,7 @@ Textures::Texture2D::Texture2D(Color3 color) // creates 1x1 texture from singula
 
 Textures::Texture2D::~Texture2D()
 {
+    Profiling::GpuMemory::release(Profiling::GpuMemory::Category::texture2d, m_id);
     glDeleteTextures(1, &m_id);
 }
 
@@ -200,6 +207,9 @@ void Textures::Texture2D::changeTexture(unsigned int new_width, unsigned int new
     {
         glTexImage2D(bind_type, 0, component_type, m_width, m_height, 0, component_type, GL_UNSIGNED_BYTE, new_data);
     }
+    // mip levels are dropped by the new storage
+    Profiling::GpuMemory::track(Profiling::GpuMemory::Category::texture2d, m_id,
+                                Profiling::GpuMemory::estimateBytes(component_type, m_width, m_height, m_samples));
 
     //TODO unbinding is an OpenGL anti-pattern
     glBindTexture(bind_type, empty_id); // unbind the texture just in case
@@ -225,6 +235,7 @@ void Textures::Texture2D::changeTextureToPixel(Color3 color)
     // upload the singular pixel onto gpu
     unsigned char pixel[] = { color.r, color.g, color.b };
     glTexImage2D(bind_type, 0, GL_RGB, m_width, m_height, 0, GL_RGB, GL_UNSIGNED_BYTE, (void*)pixel);
+    Profiling::GpuMemory::track(Profiling::GpuMemory::Category::texture2d, m_id, Profiling::GpuMemory::estimateBytes(GL_RGB, 1, 1));
     
     assert(!Utils::checkForGLErrorsAndPrintThem()); //DEBUG
 
@@ -248,6 +259,8 @@ bool Textures::Texture2D::copyContentsFrom(const Drawing::FrameBuffer& fbo_src,
 
     m_width = width;
     m_height = height;
+    Profiling::GpuMemory::track(Profiling::GpuMemory::Category::texture2d, m_id,
+                                Profiling::GpuMemory::estimateBytes(format, m_width, m_height));
     return true;
 }
 
@@ -260,6 +273,7 @@ Drawing::FrameBuffer::Attachment Textures::Texture2D::asFrameBufferAttachment()
 
 Textures::Cubemap::~Cubemap()
 {
+    Profiling::GpuMemory::release(Profiling::GpuMemory::Category::cubemap, m_id);
     glDeleteTextures(1, &m_id);
 }
 
@@ -274,6 +288,7 @@ void Textures::Cubemap::createEmpty(unsigned int width_height, GLenum component_
     // release the old cubemap data
     if (m_id != empty_id)
     {
+        Profiling::GpuMemory::release(Profiling::GpuMemory::Category::cubemap, m_id);
         glDeleteTextures(1, &m_id);
         m_id = empty_id;
     }
@@ -298,6 +313,8 @@ void Textures::Cubemap::createEmpty(unsigned int width_height, GLenum component_
         unsigned int size = m_size_per_face[i];
         glTexImage2D(face, 0, component_type, size, size, 0, component_type, GL_UNSIGNED_BYTE, NULL);
     }
+    Profiling::GpuMemory::track(Profiling::GpuMemory::Category::cubemap, m_id,
+                                6 * Profiling::GpuMemory::estimateBytes(component_type, width_height, width_height, 1, generate_mipmaps));
 
     // set cubemap filtering to default values, remove mipmaps if not needed
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, cubemap_default_wrapping);
@@ -324,6 +341,7 @@ void Textures::Cubemap::createFrom6Images(const std::array<const char*, 6>& imag
     // release the old cubemap data
     if (m_id != empty_id)
     {
+        Profiling::GpuMemory::release(Profiling::GpuMemory::Category::cubemap, m_id);
         glDeleteTextures(1, &m_id);
         m_id = empty_id;
     }
@@ -388,10 +406,20 @@ void Textures::Cubemap::createFrom6Images(const std::array<const char*, 6>& imag
         glDeleteTextures(1, &m_id);
         m_id = empty_id;
     }
-    else if (generate_mipmaps)
+    else
     {
-        glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-        assert(!Utils::checkForGLErrorsAndPrintThem()); //TODO make this an actual check + error
+        if (generate_mipmaps)
+        {
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+            assert(!Utils::checkForGLErrorsAndPrintThem()); //TODO make this an actual check + error
+        }
+
+        uint64_t cubemap_bytes = 0;
+        for (unsigned int face_size : m_size_per_face)
+        {
+            cubemap_bytes += Profiling::GpuMemory::estimateBytes(GL_RGB, face_size, face_size, 1, generate_mipmaps);
+        }
+        Profiling::GpuMemory::track(Profiling::GpuMemory::Category::cubemap, m_id, cubemap_bytes);
     }
 
     glBindTexture(GL_TEXTURE_CUBE_MAP, empty_id); // unbind the cubemap just in case
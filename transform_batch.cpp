@@ -0,0 +1,246 @@
+#include "game.hpp"
+
+#include "glm/gtc/matrix_transform.hpp" // IWYU pragma: keep //glm::rotate
+#include <algorithm>
+
+
+TransformBatch::TransformBatch()
+                : m_amount(0), m_components(), m_world_soa(), m_moved(), m_view_proj(0.f),
+                  m_world(), m_mvp(), m_normal() {}
+
+TransformBatch::Id TransformBatch::add()
+{
+    resize(m_amount + 1);
+    return m_amount - 1;
+}
+
+void TransformBatch::resize(unsigned int amount)
+{
+    // identity transform, also for the padding
+    static constexpr float identity[component_amount] = { 0.f, 0.f, 0.f,
+                                                          1.f, 1.f, 1.f,
+                                                          0.f, 0.f, 0.f,
+                                                          1.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 1.f };
+
+    const unsigned int old_padded = m_world.size();
+    const unsigned int padded = (amount + lanes - 1) / lanes * lanes;
+    m_amount = amount;
+
+    // removed objects turn into padding again, so later added ones start from the identity as well
+    for (Id id = amount; id < std::min(old_padded, padded); ++id)
+    {
+        for (unsigned int c = 0; c < component_amount; ++c)
+        {
+            if (m_components[c][id] != identity[c])
+            {
+                m_components[c][id] = identity[c];
+                m_moved[id] = 1;
+            }
+        }
+    }
+    if (padded == old_padded) return;
+
+    for (unsigned int c = 0; c < component_amount; ++c) m_components[c].resize(padded, identity[c]);
+    for (std::vector<float>& world_row : m_world_soa) world_row.resize(padded, 0.f);
+    m_moved.resize(padded, 1);
+    m_world.resize(padded, glm::mat4(1.f));
+    m_mvp.resize(padded, glm::mat4(1.f));
+    m_normal.resize(padded, glm::mat3(1.f));
+}
+
+void TransformBatch::reserve(unsigned int amount)
+{
+    const unsigned int padded = (amount + lanes - 1) / lanes * lanes;
+
+    for (std::vector<float>& component : m_components) component.reserve(padded);
+    for (std::vector<float>& world_row : m_world_soa) world_row.reserve(padded);
+    m_moved.reserve(padded);
+    m_world.reserve(padded);
+    m_mvp.reserve(padded);
+    m_normal.reserve(padded);
+}
+
+unsigned int TransformBatch::size() const
+{
+    return m_amount;
+}
+
+void TransformBatch::setComponent(Id id, unsigned int component, float value)
+{
+    assert(id < m_amount);
+    float& current = m_components[component][id];
+    if (current != value)
+    {
+        current = value;
+        m_moved[id] = 1;
+    }
+}
+
+void TransformBatch::setPosition(Id id, glm::vec3 pos)
+{
+    setComponent(id, pos_x, pos.x);
+    setComponent(id, pos_y, pos.y);
+    setComponent(id, pos_z, pos.z);
+}
+
+void TransformBatch::setRotation(Id id, float angle, glm::vec3 axis)
+{
+    const glm::mat3 rot = glm::mat3(glm::rotate(glm::mat4(1.f), angle, axis));
+    for (unsigned int c = 0; c < 3; ++c)
+    {
+        for (unsigned int r = 0; r < 3; ++r) setComponent(id, rot_00 + c * 3 + r, rot[c][r]);
+    }
+}
+
+void TransformBatch::setScale(Id id, glm::vec3 scale)
+{
+    setComponent(id, scale_x, scale.x);
+    setComponent(id, scale_y, scale.y);
+    setComponent(id, scale_z, scale.z);
+}
+
+void TransformBatch::setOriginOffset(Id id, glm::vec3 offset)
+{
+    setComponent(id, offset_x, offset.x);
+    setComponent(id, offset_y, offset.y);
+    setComponent(id, offset_z, offset.z);
+}
+
+void TransformBatch::updateWorldBlock(unsigned int first)
+{
+    // everything goes through local arrays, so the lane loops have no aliasing to worry about
+    float in[component_amount][lanes];
+    for (unsigned int c = 0; c < component_amount; ++c)
+    {
+        for (unsigned int l = 0; l < lanes; ++l) in[c][l] = m_components[c][first + l];
+    }
+
+    bool uniform_scale = true;
+    for (unsigned int l = 0; l < lanes; ++l)
+    {
+        uniform_scale = uniform_scale && in[scale_x][l] == in[scale_y][l] && in[scale_x][l] == in[scale_z][l];
+    }
+
+    // columns of rotation * scale, the translation column moves the origin offset along
+    float world[16][lanes];
+    for (unsigned int c = 0; c < 3; ++c)
+    {
+        for (unsigned int r = 0; r < 3; ++r)
+        {
+            for (unsigned int l = 0; l < lanes; ++l) world[c * 4 + r][l] = in[rot_00 + c * 3 + r][l] * in[scale_x + c][l];
+        }
+        for (unsigned int l = 0; l < lanes; ++l) world[c * 4 + 3][l] = 0.f;
+    }
+    for (unsigned int r = 0; r < 3; ++r)
+    {
+        for (unsigned int l = 0; l < lanes; ++l)
+        {
+            world[12 + r][l] = in[pos_x + r][l] + world[r][l] * in[offset_x][l]
+                                                + world[4 + r][l] * in[offset_y][l]
+                                                + world[8 + r][l] * in[offset_z][l];
+        }
+    }
+    for (unsigned int l = 0; l < lanes; ++l) world[15][l] = 1.f;
+
+    // inverse transpose of rotation * scale is rotation * inverse scale
+    float normal[9][lanes];
+    for (unsigned int c = 0; c < 3; ++c)
+    {
+        for (unsigned int r = 0; r < 3; ++r)
+        {
+            if (uniform_scale)
+            {
+                for (unsigned int l = 0; l < lanes; ++l) normal[c * 3 + r][l] = world[c * 4 + r][l];
+            }
+            else
+            {
+                for (unsigned int l = 0; l < lanes; ++l) normal[c * 3 + r][l] = in[rot_00 + c * 3 + r][l] / in[scale_x + c][l];
+            }
+        }
+    }
+
+    for (unsigned int i = 0; i < 16; ++i)
+    {
+        for (unsigned int l = 0; l < lanes; ++l) m_world_soa[i][first + l] = world[i][l];
+    }
+    for (unsigned int l = 0; l < lanes; ++l)
+    {
+        glm::mat4& world_mat = m_world[first + l];
+        glm::mat3& normal_mat = m_normal[first + l];
+        for (unsigned int i = 0; i < 16; ++i) world_mat[i / 4][i % 4] = world[i][l];
+        for (unsigned int i = 0; i < 9; ++i) normal_mat[i / 3][i % 3] = normal[i][l];
+        m_moved[first + l] = 0;
+    }
+}
+
+void TransformBatch::updateMvpBlock(unsigned int first)
+{
+    float world[16][lanes];
+    for (unsigned int i = 0; i < 16; ++i)
+    {
+        for (unsigned int l = 0; l < lanes; ++l) world[i][l] = m_world_soa[i][first + l];
+    }
+
+    float mvp[16][lanes];
+    for (unsigned int c = 0; c < 4; ++c)
+    {
+        for (unsigned int r = 0; r < 4; ++r)
+        {
+            for (unsigned int l = 0; l < lanes; ++l)
+            {
+                mvp[c * 4 + r][l] = m_view_proj[0][r] * world[c * 4][l] + m_view_proj[1][r] * world[c * 4 + 1][l]
+                                  + m_view_proj[2][r] * world[c * 4 + 2][l] + m_view_proj[3][r] * world[c * 4 + 3][l];
+            }
+        }
+    }
+
+    for (unsigned int l = 0; l < lanes; ++l)
+    {
+        glm::mat4& mvp_mat = m_mvp[first + l];
+        for (unsigned int i = 0; i < 16; ++i) mvp_mat[i / 4][i % 4] = mvp[i][l];
+    }
+}
+
+void TransformBatch::update(const glm::mat4& view_proj)
+{
+    const bool camera_changed = view_proj != m_view_proj;
+    m_view_proj = view_proj;
+
+    const unsigned int padded = m_world.size();
+    for (unsigned int first = 0; first < padded; first += lanes)
+    {
+        bool moved = false;
+        for (unsigned int l = 0; l < lanes; ++l) moved = moved || m_moved[first + l] != 0;
+
+        if (moved) updateWorldBlock(first);
+        if (moved || camera_changed) updateMvpBlock(first);
+    }
+}
+
+const glm::mat4& TransformBatch::worldMatrix(Id id) const
+{
+    assert(id < m_amount);
+    assert(m_moved[id] == 0); // update was not called after the object moved
+    return m_world[id];
+}
+
+const glm::mat3& TransformBatch::normalMatrix(Id id) const
+{
+    assert(id < m_amount);
+    assert(m_moved[id] == 0); // update was not called after the object moved
+    return m_normal[id];
+}
+
+const glm::mat4& TransformBatch::mvpMatrix(Id id) const
+{
+    assert(id < m_amount);
+    assert(m_moved[id] == 0); // update was not called after the object moved
+    return m_mvp[id];
+}
+
+void TransformBatch::setUniforms(const Shaders::Program& program, Id id, bool world_pos) const
+{
+    if (world_pos) program.set("model", worldMatrix(id));
+    program.set("normalMat", normalMatrix(id));
+    program.set("mvp", mvpMatrix(id));
+}
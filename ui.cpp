@@ -72,7 +72,9 @@ UI::Context::Context(const Shaders::Program& shader, const UI::Font& font)
                           #ifdef USE_VAO
                             m_vao(),
                           #endif
-                          m_vbo_id(empty_id), m_ebo_id(empty_id)
+                          m_vbo_id(empty_id), m_ebo_id(empty_id), m_ring_region(0), m_batches(),
+                          m_retained_valid(false), m_retained_hash(0), m_retained_screen_res(0.f),
+                          m_reused_frames(0), m_converted_frames(0)
 {
     assert(!Utils::checkForGLError());
 
@@ -85,9 +87,17 @@ UI::Context::Context(const Shaders::Program& shader, const UI::Font& font)
         }
     #endif
 
+    #ifdef BUILD_OPENGL_330_CORE
+        for (GLsync& fence : m_ring_fences) fence = NULL;
+    #endif
+
     const nk_user_font *font_ptr = font.getFontPtr();
 
-    if (!nk_init_default(&m_ctx, font_ptr))
+    // one allocation for the whole lifetime of the context, nothing in Nuklear grows after this
+    m_arena.reset(new unsigned char[ctx_memory_size + cmd_memory_size + max_vertex_memory + max_element_memory]);
+    unsigned char *arena_ptr = m_arena.get();
+
+    if (!nk_init_fixed(&m_ctx, arena_ptr, ctx_memory_size, font_ptr))
     {
         fprintf(stderr, "Failed to initialize nuklear context!\n");
         return;
@@ -116,11 +126,12 @@ UI::Context::Context(const Shaders::Program& shader, const UI::Font& font)
     m_cfg.global_alpha = 1.0f;
     m_cfg.tex_null = font.m_null_texture;
 
-    //TODO somehow check if error happened
-    nk_buffer_init_default(&m_cmd_buffer);
-    //IDEA maybe use fixed sized buffers
-    nk_buffer_init_default(&m_vert_buffer);
-    nk_buffer_init_default(&m_idx_buffer);
+    arena_ptr += ctx_memory_size;
+    nk_buffer_init_fixed(&m_cmd_buffer, arena_ptr, cmd_memory_size);
+    arena_ptr += cmd_memory_size;
+    nk_buffer_init_fixed(&m_vert_buffer, arena_ptr, max_vertex_memory);
+    arena_ptr += max_vertex_memory;
+    nk_buffer_init_fixed(&m_idx_buffer, arena_ptr, max_element_memory);
 
     GLuint buffer_obj[2];
     glGenBuffers(2, buffer_obj);
@@ -129,9 +140,6 @@ UI::Context::Context(const Shaders::Program& shader, const UI::Font& font)
         fprintf(stderr, "Failed to generate GL buffers for UI context!\n");
 
         nk_free(&m_ctx);
-        nk_buffer_free(&m_cmd_buffer);
-        nk_buffer_free(&m_vert_buffer);
-        nk_buffer_free(&m_idx_buffer);
 
         return;
     }
@@ -139,6 +147,17 @@ UI::Context::Context(const Shaders::Program& shader, const UI::Font& font)
     m_vbo_id = buffer_obj[0];
     m_ebo_id = buffer_obj[1];
 
+    // storage is allocated once, frames only write into it
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_id);
+    glBufferData(GL_ARRAY_BUFFER, ring_regions * max_vertex_memory, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo_id);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, ring_regions * max_element_memory, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    Profiling::GpuMemory::track(Profiling::GpuMemory::Category::ui_buffer, m_vbo_id, ring_regions * max_vertex_memory);
+    Profiling::GpuMemory::track(Profiling::GpuMemory::Category::ui_buffer, m_ebo_id, ring_regions * max_element_memory);
+
     #ifdef USE_VAO
         // setup VAO
         m_vao.bind();
@@ -154,14 +173,19 @@ UI::Context::~Context()
 {
     if (!m_ctx_initialized) return;
 
+    Profiling::GpuMemory::release(Profiling::GpuMemory::Category::ui_buffer, m_vbo_id);
+    Profiling::GpuMemory::release(Profiling::GpuMemory::Category::ui_buffer, m_ebo_id);
     glDeleteBuffers(1, &m_vbo_id);
     glDeleteBuffers(1, &m_ebo_id);
-    
-    nk_free(&m_ctx);
 
-    nk_buffer_free(&m_cmd_buffer);
-    nk_buffer_free(&m_vert_buffer);
-    nk_buffer_free(&m_idx_buffer);
+    #ifdef BUILD_OPENGL_330_CORE
+        for (GLsync fence : m_ring_fences)
+        {
+            if (fence != NULL) glDeleteSync(fence);
+        }
+    #endif
+    
+    nk_free(&m_ctx); // fixed buffers only need their arena freed
 }
 
 bool UI::Context::getInput(GLFWwindow* window, glm::vec2 mouse_pos, bool mouse_left_is_down,
@@ -206,7 +230,7 @@ bool UI::Context::getInput(GLFWwindow* window, glm::vec2 mouse_pos, bool mouse_l
         //Keys
         for (size_t i = 0; i < checked_keys_len; ++i)
         {
-            nk_bool is_down = (glfwGetKey(window, checked_keys[i].second) == GLFW_PRESS);
+            nk_bool is_down = (InputRecorder::getKey(window, checked_keys[i].second) == GLFW_PRESS);
             nk_input_key(&m_ctx, checked_keys[i].first, is_down);
         }
 
@@ -224,6 +248,7 @@ bool UI::Context::getInput(GLFWwindow* window, glm::vec2 mouse_pos, bool mouse_l
 
 bool UI::Context::convert()
 {
+    PROFILE_SCOPE("UI::Context::convert");
     assert(m_ctx_initialized); //DEBUG
     if (!m_ctx_initialized) return false;
     
@@ -258,13 +283,40 @@ bool UI::Context::convert()
     return false;
 }
 
+uint64_t UI::Context::commandHash() const
+{
+    assert(m_ctx_initialized); //DEBUG
+    if (!m_ctx_initialized) return 0;
+
+    // all window command buffers live in the context memory, hashing it whole is enough (FNV-1a)
+    const unsigned char *bytes = static_cast<const unsigned char*>(nk_buffer_memory_const(&m_ctx.memory));
+    uint64_t hash = 14695981039346656037ull;
+    for (nk_size i = 0; i < m_ctx.memory.allocated; ++i)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
 bool UI::Context::draw(glm::vec2 screen_res, unsigned int texture_unit)
 {
+    PROFILE_SCOPE("UI::Context::draw");
+    GPU_PROFILE_SCOPE("UI draw");
     assert(m_ctx_initialized); //DEBUG
     if (!m_ctx_initialized) return false;
 
-    // fills m_cmd_buffer, m_vert_buffer, m_idx_buffer with new data
-    if (!convert()) return false;
+    // same commands at the same resolution produce the same geometry, the GPU buffers from last time are reused
+    const uint64_t hash = commandHash();
+    const bool reuse = m_retained_valid && hash == m_retained_hash && screen_res == m_retained_screen_res;
+
+    if (!reuse)
+    {
+        m_retained_valid = false;
+
+        // fills m_cmd_buffer, m_vert_buffer, m_idx_buffer with new data
+        if (!convert()) return false;
+    }
 
     m_shader.use();
     glActiveTexture(GL_TEXTURE0 + texture_unit);
@@ -272,14 +324,37 @@ bool UI::Context::draw(glm::vec2 screen_res, unsigned int texture_unit)
     //bind the screen resolution uniform
     m_shader.set("screenRes", screen_res);
     
-    //copy the (converted) data from Nuklear buffers into OpenGL buffers
     assert(m_vbo_id != empty_id);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_id);
-    glBufferData(GL_ARRAY_BUFFER, m_vert_buffer.allocated, nk_buffer_memory(&m_vert_buffer), GL_STREAM_DRAW);
-
     assert(m_ebo_id != empty_id);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_id);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo_id);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_idx_buffer.allocated, nk_buffer_memory(&m_idx_buffer), GL_STREAM_DRAW);
+
+    if (reuse) ++m_reused_frames;
+    else
+    {
+        //copy the (converted) data from Nuklear buffers into OpenGL buffers
+        if (!upload())
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+            return false;
+        }
+
+        // keep the draw commands, Nuklear's own ones are gone after the next convert
+        m_batches.clear();
+        const struct nk_draw_command *cmd = NULL;
+        nk_draw_foreach(cmd, &m_ctx, &m_cmd_buffer)
+        {
+            if (!cmd->elem_count) continue;
+
+            m_batches.push_back(DrawBatch{ cmd->clip_rect, static_cast<GLuint>(cmd->texture.id), cmd->elem_count });
+        }
+
+        m_retained_hash = hash;
+        m_retained_screen_res = screen_res;
+        m_retained_valid = true;
+        ++m_converted_frames;
+    }
 
     // bind the VAO if we are using it
     #ifdef USE_VAO
@@ -288,20 +363,16 @@ bool UI::Context::draw(glm::vec2 screen_res, unsigned int texture_unit)
         setupVBOAttributes();
     #endif
 
-    size_t offset = 0;//, idx = 0;
-    const struct nk_draw_command *cmd = NULL;
-    nk_draw_foreach(cmd, &m_ctx, &m_cmd_buffer)
+    size_t offset = m_ring_region * max_element_memory;
+    #ifdef BUILD_OPENGL_330_CORE
+        // indices are relative to the start of the region
+        const GLint base_vertex = static_cast<GLint>(m_ring_region * max_vertices);
+    #endif
+    for (const DrawBatch& batch : m_batches)
     {
-        unsigned int elem_count = cmd->elem_count;
-        if (!elem_count) {
-            // ++idx;
-            continue;
-        };
-
-        struct nk_rect clip_rect = cmd->clip_rect;
-        int texture_id = cmd->texture.id;
+        const struct nk_rect& clip_rect = batch.clip_rect;
 
-        glBindTexture(GL_TEXTURE_2D, texture_id);
+        glBindTexture(GL_TEXTURE_2D, batch.texture_id);
         // we need to mirror the scissor area because OpenGL window coordinates starts at bottom left
         // and nuclear ones at the top left
         glScissor(static_cast<GLint>(clip_rect.x),
@@ -310,12 +381,23 @@ bool UI::Context::draw(glm::vec2 screen_res, unsigned int texture_unit)
                   static_cast<GLint>(clip_rect.w),
                   static_cast<GLint>(clip_rect.h));
         // draw the ui element
-        glDrawElements(GL_TRIANGLES, elem_count, GL_UNSIGNED_SHORT, reinterpret_cast<void*>(offset));
+        #ifdef BUILD_OPENGL_330_CORE
+            glDrawElementsBaseVertex(GL_TRIANGLES, batch.elem_count, GL_UNSIGNED_SHORT, reinterpret_cast<void*>(offset), base_vertex);
+        #else
+            glDrawElements(GL_TRIANGLES, batch.elem_count, GL_UNSIGNED_SHORT, reinterpret_cast<void*>(offset));
+        #endif
 
         //NOTE: this sizeof needs to be in line with type enum passed to glDrawElements (GL_UNSIGNED_SHORT)
-        offset += elem_count * sizeof(GLushort);
+        offset += batch.elem_count * sizeof(GLushort);
     }
 
+    #ifdef BUILD_OPENGL_330_CORE
+        // the region may be drawn again on reused frames, so the fence always covers the latest draw
+        GLsync& fence = m_ring_fences[m_ring_region];
+        if (fence != NULL) glDeleteSync(fence);
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    #endif
+
     //TODO unbinding in OpenGL is an anti-pattern
     //unbind the OpenGL buffers just to be sure
     #ifdef USE_VAO
@@ -331,6 +413,63 @@ bool UI::Context::draw(glm::vec2 screen_res, unsigned int texture_unit)
     return true;
 }
 
+bool UI::Context::upload()
+{
+    // exact sizes of the converted data, the Nuklear buffers may contain alignment padding
+    const size_t vertex_bytes = m_ctx.draw_list.vertex_count * sizeof(UI::Vertex);
+    const size_t element_bytes = m_ctx.draw_list.element_count * sizeof(nk_draw_index);
+    assert(vertex_bytes <= max_vertex_memory && element_bytes <= max_element_memory);
+
+    #ifdef BUILD_OPENGL_330_CORE
+        m_ring_region = (m_ring_region + 1) % ring_regions;
+
+        GLsync& fence = m_ring_fences[m_ring_region];
+        if (fence != NULL)
+        {
+            // practically always signaled already, the region was last drawn ring_regions frames ago
+            const GLenum wait_result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000); // 100 ms
+            if (wait_result == GL_TIMEOUT_EXPIRED || wait_result == GL_WAIT_FAILED)
+                fprintf(stderr, "[WARNING] UI ring buffer region is still used by the GPU, overwriting it anyway.\n");
+
+            glDeleteSync(fence);
+            fence = NULL;
+        }
+
+        // the fence guarantees the GPU is done with the region, so no implicit synchronization is needed
+        const GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+        if (vertex_bytes > 0)
+        {
+            void *dest = glMapBufferRange(GL_ARRAY_BUFFER, m_ring_region * max_vertex_memory, vertex_bytes, access);
+            if (dest == NULL)
+            {
+                fprintf(stderr, "[WARNING] Failed to map UI vertex buffer!\n");
+                return false;
+            }
+            memcpy(dest, nk_buffer_memory_const(&m_vert_buffer), vertex_bytes);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+        if (element_bytes > 0)
+        {
+            void *dest = glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, m_ring_region * max_element_memory, element_bytes, access);
+            if (dest == NULL)
+            {
+                fprintf(stderr, "[WARNING] Failed to map UI element buffer!\n");
+                return false;
+            }
+            memcpy(dest, nk_buffer_memory_const(&m_idx_buffer), element_bytes);
+            glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+        }
+    #else
+        // orphan the old storage (same size, so the driver can recycle it) and write only what was converted
+        glBufferData(GL_ARRAY_BUFFER, max_vertex_memory, NULL, GL_STREAM_DRAW);
+        if (vertex_bytes > 0) glBufferSubData(GL_ARRAY_BUFFER, 0, vertex_bytes, nk_buffer_memory_const(&m_vert_buffer));
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, max_element_memory, NULL, GL_STREAM_DRAW);
+        if (element_bytes > 0) glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, element_bytes, nk_buffer_memory_const(&m_idx_buffer));
+    #endif
+
+    return true;
+}
+
 void UI::Context::clear()
 {
     if (!m_ctx_initialized) return;
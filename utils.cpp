@@ -5,10 +5,10 @@
 
 
 Utils::RNG::RNG(int min_val, int max_val)
-                : m_generator(), m_distribution(min_val, max_val), m_distribution_circular(min_val, max_val - 1)
+                : m_generator(InputRecorder::nextSeed()), m_distribution(min_val, max_val),
+                  m_distribution_circular(min_val, max_val - 1)
 {
-    std::random_device rd;
-    m_generator = std::mt19937(rd());
+    //nothing
 }
 
 int Utils::RNG::generate()
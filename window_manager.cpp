@@ -19,7 +19,9 @@ void WindowManager::framebufferResizeCallback(GLFWwindow* window, int width, int
 
     if (SharedGLContext::instance.has_value() && m_framebuffer_size.x > 0 && m_framebuffer_size.y > 0)
     {
-        SharedGLContext::instance.value().changeFbo3DSize(width, height);
+        // the render thread may be using fbo3d right now, the resize waits for it in the stream
+        RenderCommands::recordOrExecute(SharedGLContext::ResizeFbo3DCommand{ static_cast<unsigned int>(width),
+                                                                             static_cast<unsigned int>(height) });
         printf("Framebuffer resized to: %dx%d\n", m_framebuffer_size.x, m_framebuffer_size.y);
     }
     else